@@ -0,0 +1,106 @@
+"""
+Reader for rig_calibration.bin, the single-file rig calibration written by
+htkrecorder and htkcalibrate (see tools/capture/rig_calibration.h).
+
+    from tools.calibration.rig_calibration import load_rig, camera_maps
+    cam_intr_map, cam_extr_map = camera_maps("calib_2026-10-17/rig_calibration.bin")
+
+The same file is attached to every recording as htk_rig_calibration.bin, e.g.
+    mkvextract attachments camera_0.mkv 1:rig_calibration.bin
+"""
+import sys
+
+import numpy as np
+
+MAGIC = b"HTKRIG01"
+VERSION = 1
+
+HEADER_DTYPE = np.dtype([
+    ("magic", "S8"), ("version", "<u4"), ("camera_count", "<u4"),
+    ("header_bytes", "<u4"), ("camera_bytes", "<u4"), ("rig_id", "<u8"),
+    ("file_bytes", "<u8"), ("reference", "<i4"), ("flags", "<u4"), ("reserved", "u1", 16),
+])
+CAMERA_DTYPE = np.dtype([
+    ("serial", "S32"), ("name", "S32"), ("device_index", "<i4"), ("width", "<i4"),
+    ("height", "<i4"), ("distortion_model", "<u4"), ("flags", "<u4"), ("reserved0", "<u4"),
+    ("camera_matrix", "<f8", (3, 3)), ("k4a_intrinsics", "<f8", 15),
+    ("opencv_distortion", "<f8", 8), ("camera_to_reference", "<f8", (4, 4)),
+    ("rms_px", "<f8"), ("raw_offset", "<u8"), ("raw_bytes", "<u8"), ("crop_x", "<i4"), ("crop_y", "<i4"),
+    ("reserved", "u1", 8),
+])
+assert HEADER_DTYPE.itemsize == 64 and CAMERA_DTYPE.itemsize == 512
+
+INTRINSICS_VALID = 1
+EXTRINSICS_SOLVED = 2
+# width, height and the principal point are those of a crop starting at
+# (crop_x, crop_y) in the sensor image
+COLOR_CROPPED = 4
+
+
+def rig_id(data):
+    """FNV-1a 64 of everything after the header, as the C++ side computes it."""
+    h = 0xcbf29ce484222325
+    for b in bytes(data[HEADER_DTYPE.itemsize:]):
+        h = ((h ^ b) * 0x100000001b3) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+def load_rig(path, mmap=True, verify=False):
+    """
+    Returns (header, cameras, data): a header record, a structured array with
+    one record per camera and the underlying bytes. With mmap the arrays are
+    views of the mapped file. verify recomputes the id (slow in pure Python).
+    """
+    data = np.memmap(path, dtype=np.uint8, mode="r") if mmap else np.fromfile(path, dtype=np.uint8)
+    if data.size < HEADER_DTYPE.itemsize:
+        raise ValueError(f"{path}: too short for a rig calibration")
+    header = data[:HEADER_DTYPE.itemsize].view(HEADER_DTYPE)[0]
+    if header["magic"] != MAGIC:
+        raise ValueError(f"{path}: not a rig calibration file")
+    if header["version"] > VERSION or header["file_bytes"] != data.size:
+        raise ValueError(f"{path}: rig calibration version {header['version']} is newer or the file is truncated")
+    if verify and rig_id(data) != header["rig_id"]:
+        raise ValueError(f"{path}: rig calibration is corrupt (id does not match its contents)")
+
+    start, stride, count = int(header["header_bytes"]), int(header["camera_bytes"]), int(header["camera_count"])
+    if stride == CAMERA_DTYPE.itemsize:
+        cameras = data[start:start + stride * count].view(CAMERA_DTYPE)
+    else:
+        # a later version with longer records: read the fields we know
+        cameras = np.ndarray((count,), dtype=CAMERA_DTYPE, buffer=data, offset=start, strides=(stride,))
+    return header, cameras, data
+
+
+def raw_calibration(data, camera):
+    """The camera's factory calibration JSON as the SDK returned it, or None."""
+    if camera["raw_bytes"] == 0:
+        return None
+    start = int(camera["raw_offset"])
+    return bytes(data[start:start + int(camera["raw_bytes"])]).decode("utf-8")
+
+
+def camera_maps(path):
+    """
+    {name: 3x3 camera matrix} and {name: 4x4 camera-to-reference} in the form
+    infer_hand.py builds from cam_intr/*.pkl and cam_extr/*.pkl. Cameras
+    without solved extrinsics are left out of the second map.
+    """
+    _, cameras, _ = load_rig(path, mmap=False)
+    intr, extr = {}, {}
+    for cam in cameras:
+        name = cam["name"].decode()
+        if cam["flags"] & INTRINSICS_VALID:
+            intr[name] = np.array(cam["camera_matrix"])
+        if cam["flags"] & EXTRINSICS_SOLVED:
+            extr[name] = np.array(cam["camera_to_reference"])
+    return intr, extr
+
+
+if __name__ == "__main__":
+    header, cameras, data = load_rig(sys.argv[1], verify=True)
+    print(f"rig {int(header['rig_id']):016x}, {len(cameras)} camera(s), reference {header['reference']}")
+    for cam in cameras:
+        solved = "solved" if cam["flags"] & EXTRINSICS_SOLVED else "no extrinsics"
+        crop = f" at {cam['crop_x']},{cam['crop_y']}" if cam["flags"] & COLOR_CROPPED else ""
+        print(f"  {cam['name'].decode()} {cam['serial'].decode()} {cam['width']}x{cam['height']}{crop} "
+              f"{solved}, rms {cam['rms_px']:.3f} px, raw {cam['raw_bytes']} bytes")
@@ -0,0 +1,762 @@
+// Post-processes a tree of recorded sessions on a work-stealing pool
+// (work_stealing_pool.h), resumably.
+//
+//   htkbatch [--threads N] [--io N] [--tasks index,split,verify,proxy]
+//            [--range-frames 300] [--proxy-scale 4] [--proxy-quality 80]
+//            SESSIONS_DIR OUT_DIR
+//
+// Every session_manifest.json under SESSIONS_DIR is a take, named by its
+// directory's path below SESSIONS_DIR. For each camera of each take:
+//   index   OUT_DIR/<take>/<name>/index.csv: frame number, segment, device and
+//           host timestamps and flags of every frame, from the metadata track
+//   split   OUT_DIR/<take>/<name>/frame_<NNNNNN>.jpg like tools/mkv/split.py;
+//           MJPEG frames are copied as recorded, not re-encoded
+//   proxy   OUT_DIR/<take>/<name>/proxy/frame_<NNNNNN>.jpg at 1/--proxy-scale
+//           of the size, for previews (needs libjpeg at build time)
+//   verify  the segments against the chunk checksums in the manifest, as
+//           htkverify does
+// <name> is the camera's name in the rig calibration, else camera_<index>.
+//
+// Each segment is indexed by its own task; once a camera's segments are all
+// indexed, split and proxy are queued in ranges of --range-frames frames and
+// verify in runs of chunks, so one long take keeps every thread busy. At most
+// --io tasks (default 4) read or write recordings at once. Completed tasks
+// are appended to OUT_DIR/batch_journal.txt; run the same command again after
+// an interruption and only the unfinished tasks run.
+// Exit status: 0 done, 1 bad arguments or input, 2 a task failed.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <k4a/k4a.h>
+#include <k4arecord/playback.h>
+
+#include "../chunk_hash.h"
+#include "../cli.h"
+#include "../frame_metadata.h"
+#include "../jpeg_payload.h"
+#include "../json_reader.h"
+#include "../rig_calibration.h"
+#include "../work_stealing_pool.h"
+#ifdef HTK_HAVE_JPEG_IMAGE
+#include "../undistort/jpeg_image.h"
+#endif
+
+using namespace std::chrono;
+
+static const size_t kVerifyChunks = 16; // chunks per verify task
+
+struct Frame
+{
+    uint32_t segment;
+    uint32_t flags;
+    uint64_t device_usec;
+    uint64_t system_nsec;
+};
+
+struct Camera
+{
+    std::string key; // <take>/<name>, also the output directory below OUT_DIR
+    std::vector<std::string> segments;
+    std::vector<std::vector<Frame>> segment_frames;
+    std::atomic<size_t> unindexed{ 0 };
+    std::atomic<bool> index_failed{ false };
+    std::vector<Frame> frames; // all segments, once indexed
+};
+
+struct VerifySegment
+{
+    std::string key; // <take>/<file>
+    std::string path;
+    uint64_t bytes = 0;
+    size_t chunk_size = 0;
+    std::vector<std::string> chunks;
+};
+
+// Append-only record of finished tasks. A task is one line, "ok <key>" or
+// "failed <key>", written and synced as it finishes; the last line for a key
+// wins, so failed tasks run again next time.
+class Journal
+{
+public:
+    bool open(const std::string &path, std::string *error)
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line))
+        {
+            const size_t space = line.find(' ');
+            if (space == std::string::npos)
+                continue; // torn last line
+            const std::string key = line.substr(space + 1);
+            if (line.compare(0, space, "ok") == 0)
+                m_done.insert(key);
+            else
+                m_done.erase(key);
+        }
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            *error = "Unable to open " + path + ": " + std::strerror(errno);
+            return false;
+        }
+        return true;
+    }
+    ~Journal()
+    {
+        if (m_fd >= 0)
+            ::close(m_fd);
+    }
+
+    bool done(const std::string &key) const
+    {
+        return m_done.count(key) != 0;
+    }
+    void record(const std::string &key, bool ok)
+    {
+        const std::string line = (ok ? "ok " : "failed ") + key + "\n";
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (write(m_fd, line.data(), line.size()) == static_cast<ssize_t>(line.size()))
+            fdatasync(m_fd);
+    }
+
+private:
+    std::set<std::string> m_done; // only read while tasks run
+    std::mutex m_mutex;
+    int m_fd = -1;
+};
+
+struct Counters
+{
+    std::atomic<size_t> run{ 0 };
+    std::atomic<size_t> skipped{ 0 };
+    std::atomic<size_t> failed{ 0 };
+};
+
+struct Batch
+{
+    std::string out_dir;
+    bool split = false;
+    bool proxy = false;
+    bool verify = false;
+    size_t range_frames = 300;
+    int proxy_scale = 4;
+    int proxy_quality = 80;
+
+    WorkStealingPool *pool = nullptr;
+    IoSlots *io = nullptr;
+    Journal journal;
+    std::map<std::string, Counters> counters; // by task kind, filled before the pool starts
+    std::atomic<uint64_t> bytes_read{ 0 };
+    std::mutex log_mutex;
+
+    void fail(const std::string &kind, const std::string &key, const std::string &problem)
+    {
+        counters[kind].failed++;
+        journal.record(kind + " " + key, false);
+        std::lock_guard<std::mutex> lock(log_mutex);
+        std::cerr << kind << " " << key << ": " << problem << std::endl;
+    }
+    void succeed(const std::string &kind, const std::string &key)
+    {
+        counters[kind].run++;
+        journal.record(kind + " " + key, true);
+    }
+};
+
+static std::string dirname_of(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+static void make_dirs(const std::string &path)
+{
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+        mkdir(path.substr(0, slash).c_str(), 0755);
+    mkdir(path.c_str(), 0755);
+}
+
+static void find_manifests(const std::string &dir, const std::string &relative, std::vector<std::string> *out,
+                           std::vector<std::string> *takes)
+{
+    std::vector<std::string> entries;
+    if (DIR *d = opendir(dir.c_str()))
+    {
+        while (dirent *e = readdir(d))
+            if (std::strcmp(e->d_name, ".") != 0 && std::strcmp(e->d_name, "..") != 0)
+                entries.push_back(e->d_name);
+        closedir(d);
+    }
+    std::sort(entries.begin(), entries.end());
+    struct stat st;
+    for (auto &e : entries)
+    {
+        const std::string child = dir + "/" + e;
+        if (stat(child.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            find_manifests(child, relative.empty() ? e : relative + "/" + e, out, takes);
+        }
+        else if (e == "session_manifest.json")
+        {
+            out->push_back(child);
+            takes->push_back(relative.empty() ? "." : relative);
+        }
+    }
+}
+
+static std::string frame_path(const std::string &dir, size_t frame)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/frame_%06zu.jpg", frame);
+    return dir + name;
+}
+
+// Every frame of one segment from its metadata track, or from the color
+// track of recordings made before there was one.
+static bool index_segment(const std::string &path, uint32_t segment, std::vector<Frame> *frames, std::string *error)
+{
+    k4a_playback_t playback = nullptr;
+    if (K4A_FAILED(k4a_playback_open(path.c_str(), &playback)))
+    {
+        *error = "unable to open " + path;
+        return false;
+    }
+    k4a_playback_data_block_t block = nullptr;
+    k4a_stream_result_t result;
+    while ((result = k4a_playback_get_next_data_block(playback, kFrameMetadataTrack, &block)) ==
+           K4A_STREAM_RESULT_SUCCEEDED)
+    {
+        FrameMetadata meta;
+        std::memset(&meta, 0, sizeof(meta));
+        size_t size = k4a_playback_data_block_get_buffer_size(block);
+        std::memcpy(&meta, k4a_playback_data_block_get_buffer(block), size < sizeof(meta) ? size : sizeof(meta));
+        k4a_playback_data_block_release(block);
+        frames->push_back({ segment, meta.flags, meta.device_timestamp_usec, meta.system_timestamp_nsec });
+    }
+    if (result == K4A_STREAM_RESULT_FAILED && frames->empty())
+    {
+        k4a_capture_t capture = nullptr;
+        while (k4a_playback_get_next_capture(playback, &capture) == K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            if (k4a_image_t image = k4a_capture_get_color_image(capture))
+            {
+                frames->push_back({ segment, 0, k4a_image_get_device_timestamp_usec(image), 0 });
+                k4a_image_release(image);
+            }
+            k4a_capture_release(capture);
+        }
+    }
+    k4a_playback_close(playback);
+    return true;
+}
+
+// Calls visit(frame number, payload, size) for frames [first, last) of the
+// camera, all from one segment. False if a frame is missing from the recording.
+template <typename Visit>
+static bool read_range(Batch &batch, Camera &cam, size_t first, size_t last, Visit visit, std::string *error)
+{
+    const std::string &path = cam.segments[cam.frames[first].segment];
+    k4a_playback_t playback = nullptr;
+    if (K4A_FAILED(k4a_playback_open(path.c_str(), &playback)))
+    {
+        *error = "unable to open " + path;
+        return false;
+    }
+    // the seek may land a frame or two early
+    bool ok = first == 0 || cam.frames[first - 1].segment != cam.frames[first].segment ||
+              K4A_SUCCEEDED(k4a_playback_seek_timestamp(playback, static_cast<int64_t>(cam.frames[first].device_usec),
+                                                        K4A_PLAYBACK_SEEK_DEVICE_TIME));
+    size_t next = first;
+    k4a_capture_t capture = nullptr;
+    while (ok && next < last && k4a_playback_get_next_capture(playback, &capture) == K4A_STREAM_RESULT_SUCCEEDED)
+    {
+        k4a_image_t image = k4a_capture_get_color_image(capture);
+        k4a_capture_release(capture);
+        if (image == nullptr)
+            continue;
+        const uint64_t ts = k4a_image_get_device_timestamp_usec(image);
+        if (cam.frames[next].device_usec < ts)
+            break; // in the index but not in the recording
+        if (cam.frames[next].device_usec == ts)
+        {
+            if (k4a_image_get_format(image) != K4A_IMAGE_FORMAT_COLOR_MJPG)
+            {
+                *error = path + " is not MJPEG";
+                ok = false;
+            }
+            else
+            {
+                const uint8_t *data = k4a_image_get_buffer(image);
+                size_t size = k4a_image_get_size(image);
+                const size_t length = jpeg_payload_length(data, size);
+                size = length ? length : size;
+                batch.bytes_read += size;
+                ok = visit(next, data, size, error);
+                next++;
+            }
+        }
+        k4a_image_release(image);
+    }
+    k4a_playback_close(playback);
+    if (ok && next < last)
+    {
+        *error = "frame " + std::to_string(next) + " is missing from " + path;
+        ok = false;
+    }
+    return ok;
+}
+
+static void split_range(Batch &batch, Camera &cam, size_t first, size_t last, const std::string &key)
+{
+    const std::string dir = batch.out_dir + "/" + cam.key;
+    std::string error;
+    bool ok;
+    {
+        IoSlots::Guard io(*batch.io);
+        ok = read_range(
+            batch, cam, first, last,
+            [&](size_t frame, const uint8_t *data, size_t size, std::string *err) {
+                const std::string path = frame_path(dir, frame);
+                FILE *f = std::fopen(path.c_str(), "wb");
+                bool written = f && std::fwrite(data, 1, size, f) == size;
+                if (f)
+                    written = std::fclose(f) == 0 && written;
+                if (!written)
+                    *err = "unable to write " + path;
+                return written;
+            },
+            &error);
+    }
+    if (ok)
+        batch.succeed("split", key);
+    else
+        batch.fail("split", key, error);
+}
+
+static void proxy_range(Batch &batch, Camera &cam, size_t first, size_t last, const std::string &key)
+{
+#ifdef HTK_HAVE_JPEG_IMAGE
+    // read under the I/O limit, decode and encode outside it
+    std::vector<std::vector<uint8_t>> jpegs(last - first);
+    std::string error;
+    bool ok;
+    {
+        IoSlots::Guard io(*batch.io);
+        ok = read_range(
+            batch, cam, first, last,
+            [&](size_t frame, const uint8_t *data, size_t size, std::string *) {
+                jpegs[frame - first].assign(data, data + size);
+                return true;
+            },
+            &error);
+    }
+    const std::string dir = batch.out_dir + "/" + cam.key + "/proxy";
+    std::vector<uint8_t> pixels;
+    for (size_t i = 0; ok && i < jpegs.size(); i++)
+    {
+        int width = 0, height = 0;
+        if (!decode_jpeg_memory(jpegs[i].data(), jpegs[i].size(), 3, batch.proxy_scale, &pixels, &width, &height,
+                                &error))
+        {
+            // a corrupt frame gets no proxy rather than failing the range
+            if (cam.frames[first + i].flags & kFrameCorrupt)
+                continue;
+            error = "frame " + std::to_string(first + i) + ": " + error;
+            ok = false;
+            break;
+        }
+        ok = encode_jpeg_file(frame_path(dir, first + i), pixels.data(), width, height, 3, batch.proxy_quality,
+                              &error);
+    }
+    if (ok)
+        batch.succeed("proxy", key);
+    else
+        batch.fail("proxy", key, error);
+#else
+    (void)cam;
+    (void)first;
+    (void)last;
+    batch.fail("proxy", key, "this build has no libjpeg");
+#endif
+}
+
+static bool write_index(const std::string &path, const Camera &cam, std::string *error)
+{
+    const std::string tmp = path + ".tmp";
+    std::ofstream out(tmp);
+    out << "frame,segment,device_timestamp_usec,system_timestamp_nsec,flags\n";
+    for (size_t i = 0; i < cam.frames.size(); i++)
+    {
+        const Frame &f = cam.frames[i];
+        out << i << "," << f.segment << "," << f.device_usec << "," << f.system_nsec << "," << f.flags << "\n";
+    }
+    out.close();
+    if (!out || std::rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        *error = "unable to write " + path;
+        return false;
+    }
+    return true;
+}
+
+static bool load_index(const std::string &path, Camera *cam)
+{
+    std::ifstream in(path);
+    std::string line;
+    if (!std::getline(in, line))
+        return false;
+    while (std::getline(in, line))
+    {
+        Frame f;
+        size_t frame;
+        unsigned long long device, system;
+        if (std::sscanf(line.c_str(), "%zu,%u,%llu,%llu,%u", &frame, &f.segment, &device, &system, &f.flags) != 5 ||
+            frame != cam->frames.size() || f.segment >= cam->segments.size())
+            return false;
+        f.device_usec = device;
+        f.system_nsec = system;
+        cam->frames.push_back(f);
+    }
+    return true;
+}
+
+// After indexing: split and proxy in ranges that do not cross segments.
+static void queue_ranges(Batch &batch, Camera &cam)
+{
+    if (batch.split || batch.proxy)
+    {
+        make_dirs(batch.out_dir + "/" + cam.key + (batch.proxy ? "/proxy" : ""));
+    }
+    size_t first = 0;
+    while (first < cam.frames.size())
+    {
+        size_t last = first + 1;
+        while (last < cam.frames.size() && last - first < batch.range_frames &&
+               cam.frames[last].segment == cam.frames[first].segment)
+            last++;
+        const std::string key = cam.key + " " + std::to_string(first) + "-" + std::to_string(last);
+        if (batch.split && batch.journal.done("split " + key))
+            batch.counters["split"].skipped++;
+        else if (batch.split)
+            batch.pool->submit([&batch, &cam, first, last, key] { split_range(batch, cam, first, last, key); });
+        if (batch.proxy && batch.journal.done("proxy " + key))
+            batch.counters["proxy"].skipped++;
+        else if (batch.proxy)
+            batch.pool->submit([&batch, &cam, first, last, key] { proxy_range(batch, cam, first, last, key); });
+        first = last;
+    }
+}
+
+static void index_task(Batch &batch, Camera &cam, uint32_t segment)
+{
+    std::string error;
+    bool ok;
+    {
+        IoSlots::Guard io(*batch.io);
+        ok = index_segment(cam.segments[segment], segment, &cam.segment_frames[segment], &error);
+    }
+    if (!ok)
+    {
+        cam.index_failed = true;
+        batch.fail("index", cam.key, error);
+    }
+    // the last segment in queues the ranges
+    if (--cam.unindexed != 0 || cam.index_failed)
+        return;
+    for (auto &frames : cam.segment_frames)
+        cam.frames.insert(cam.frames.end(), frames.begin(), frames.end());
+    cam.segment_frames.clear();
+    if (!write_index(batch.out_dir + "/" + cam.key + "/index.csv", cam, &error))
+    {
+        batch.fail("index", cam.key, error);
+        return;
+    }
+    batch.succeed("index", cam.key);
+    queue_ranges(batch, cam);
+}
+
+static void verify_task(Batch &batch, const VerifySegment &seg, size_t first, size_t last, const std::string &key)
+{
+    IoSlots::Guard io(*batch.io);
+    const int fd = open(seg.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        batch.fail("verify", key, "cannot open " + seg.path);
+        return;
+    }
+    std::vector<uint8_t> buf;
+    std::string bad;
+    for (size_t chunk = first; chunk < last; chunk++)
+    {
+        const uint64_t offset = static_cast<uint64_t>(chunk) * seg.chunk_size;
+        const size_t len = static_cast<size_t>(std::min<uint64_t>(seg.chunk_size, seg.bytes - offset));
+        buf.resize(len);
+        size_t done = 0;
+        while (done < len)
+        {
+            ssize_t n = pread(fd, buf.data() + done, len - done, static_cast<off_t>(offset + done));
+            if (n <= 0)
+                break;
+            done += static_cast<size_t>(n);
+        }
+        posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(len), POSIX_FADV_DONTNEED);
+        batch.bytes_read += done;
+        if (done != len || chunk_hash_hex(chunk_hash(buf.data(), len)) != seg.chunks[chunk])
+            bad += " [" + std::to_string(offset) + ", " + std::to_string(offset + len) + ")";
+    }
+    close(fd);
+    if (bad.empty())
+        batch.succeed("verify", key);
+    else
+        batch.fail("verify", key, "corrupt" + bad);
+}
+
+// The manifest's checksums for one segment; false and a reason if it cannot be checked.
+static bool plan_verify(const JsonValue &s, VerifySegment *seg, std::string *problem)
+{
+    const std::string checksum = s.get("checksum") ? s.get("checksum")->str() : "";
+    if (checksum.empty())
+    {
+        *problem = "no checksum in manifest";
+        return false;
+    }
+    if (checksum.substr(0, checksum.find(':')) != chunk_hash_name())
+    {
+        *problem = "checksums are not " + std::string(chunk_hash_name());
+        return false;
+    }
+    seg->bytes = s.get("bytes") ? s.get("bytes")->uint64() : 0;
+    seg->chunk_size = s.get("chunk_size") ? static_cast<size_t>(s.get("chunk_size")->uint64()) : 0;
+    std::vector<uint64_t> expected;
+    if (const JsonValue *chunks = s.get("chunks"))
+    {
+        for (auto &c : chunks->items)
+        {
+            seg->chunks.push_back(c.str());
+            expected.push_back(std::strtoull(c.str().c_str(), nullptr, 16));
+        }
+    }
+    if (seg->chunk_size == 0 || file_checksum(expected) != checksum ||
+        seg->chunks.size() != (seg->bytes + seg->chunk_size - 1) / seg->chunk_size)
+    {
+        *problem = "manifest entry is inconsistent";
+        return false;
+    }
+    struct stat st;
+    if (stat(seg->path.c_str(), &st) != 0)
+    {
+        *problem = "missing";
+        return false;
+    }
+    if (static_cast<uint64_t>(st.st_size) != seg->bytes)
+    {
+        *problem = "size " + std::to_string(st.st_size) + ", expected " + std::to_string(seg->bytes);
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] == '-')
+            i++; // every flag takes a value
+        else
+            args.push_back(argv[i]);
+    }
+    if (args.size() != 2)
+        die("Usage: htkbatch [--threads N] [--io N] [--tasks index,split,verify,proxy] [--range-frames N] "
+            "[--proxy-scale 1|2|4|8] [--proxy-quality Q] SESSIONS_DIR OUT_DIR");
+
+    std::string tmp;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (parse_arg_value(argc, argv, "--threads", tmp))
+        threads = static_cast<unsigned>(std::max(1, std::stoi(tmp)));
+    unsigned io_slots = 4;
+    if (parse_arg_value(argc, argv, "--io", tmp))
+        io_slots = static_cast<unsigned>(std::max(1, std::stoi(tmp)));
+
+    Batch batch;
+    batch.out_dir = args[1];
+    while (batch.out_dir.size() > 1 && batch.out_dir.back() == '/')
+        batch.out_dir.pop_back();
+    std::string tasks = "index,split,verify";
+    if (parse_arg_value(argc, argv, "--tasks", tmp))
+        tasks = tmp;
+    bool index = false;
+    std::stringstream list(tasks);
+    while (std::getline(list, tmp, ','))
+    {
+        if (tmp == "index")
+            index = true;
+        else if (tmp == "split")
+            batch.split = true;
+        else if (tmp == "proxy")
+            batch.proxy = true;
+        else if (tmp == "verify")
+            batch.verify = true;
+        else
+            die("Unknown task " + tmp);
+    }
+    index = index || batch.split || batch.proxy; // frame numbers come from the index
+#ifndef HTK_HAVE_JPEG_IMAGE
+    if (batch.proxy)
+        die("Proxies need libjpeg; this build has none.");
+#endif
+    if (parse_arg_value(argc, argv, "--range-frames", tmp))
+        batch.range_frames = static_cast<size_t>(std::max(1, std::stoi(tmp)));
+    if (parse_arg_value(argc, argv, "--proxy-scale", tmp))
+        batch.proxy_scale = std::stoi(tmp);
+    if (batch.proxy_scale != 1 && batch.proxy_scale != 2 && batch.proxy_scale != 4 && batch.proxy_scale != 8)
+        die("--proxy-scale is 1, 2, 4 or 8.");
+    if (parse_arg_value(argc, argv, "--proxy-quality", tmp))
+        batch.proxy_quality = std::stoi(tmp);
+
+    std::string sessions_dir = args[0];
+    while (sessions_dir.size() > 1 && sessions_dir.back() == '/')
+        sessions_dir.pop_back();
+    std::vector<std::string> manifests, takes;
+    find_manifests(sessions_dir, "", &manifests, &takes);
+    if (manifests.empty())
+        die("No session_manifest.json under " + sessions_dir);
+
+    std::string error;
+    make_dirs(batch.out_dir);
+    if (!batch.journal.open(batch.out_dir + "/batch_journal.txt", &error))
+        die(error);
+    for (const char *kind : { "index", "split", "proxy", "verify" })
+        batch.counters[kind];
+
+    // plan: cameras to index, segments to verify
+    std::vector<std::unique_ptr<Camera>> cameras;
+    std::vector<std::unique_ptr<VerifySegment>> verify;
+    size_t unchecked = 0;
+    for (size_t m = 0; m < manifests.size(); m++)
+    {
+        JsonValue manifest;
+        if (!load_json_file(manifests[m], &manifest, &error))
+            die(error);
+        const JsonValue *devices = manifest.get("devices");
+        if (devices == nullptr || devices->type != JsonValue::Array)
+            die(manifests[m] + " is not a session manifest.");
+        const std::string root = dirname_of(manifests[m]);
+        for (auto &d : devices->items)
+        {
+            std::unique_ptr<Camera> cam(new Camera);
+            const std::string serial = d.get("serial") ? d.get("serial")->str() : "";
+            std::string name = "camera_" + std::to_string(d.get("index") ? d.get("index")->int64() : 0);
+            const JsonValue *segments = d.get("segments");
+            for (size_t i = 0; segments && i < segments->items.size(); i++)
+            {
+                const JsonValue &s = segments->items[i];
+                const std::string file = s.get("file") ? s.get("file")->str() : "";
+                const std::string path = file.empty() || file[0] == '/' ? file : root + "/" + file;
+                cam->segments.push_back(path);
+                if (!batch.verify)
+                    continue;
+                std::unique_ptr<VerifySegment> seg(new VerifySegment);
+                seg->key = takes[m] + "/" + file;
+                seg->path = path;
+                std::string problem;
+                if (plan_verify(s, seg.get(), &problem))
+                    verify.push_back(std::move(seg));
+                else if (problem == "no checksum in manifest")
+                    unchecked++;
+                else
+                    batch.fail("verify", seg->key, problem);
+            }
+            if (cam->segments.empty() || !index)
+                continue;
+            std::string rig_data;
+            RigCalibration rig;
+            int r = -1;
+            if (read_recording_rig_calibration(cam->segments.front(), &rig_data) &&
+                rig_calibration_decode(reinterpret_cast<const uint8_t *>(rig_data.data()), rig_data.size(), &rig,
+                                       nullptr, &error) &&
+                (r = rig_find_camera(rig, serial)) >= 0)
+                name = rig.cameras[r].name;
+            cam->key = takes[m] + "/" + name;
+            cameras.push_back(std::move(cam));
+        }
+    }
+
+    const auto t0 = steady_clock::now();
+    IoSlots io(io_slots);
+    WorkStealingPool pool(threads);
+    batch.pool = &pool;
+    batch.io = &io;
+    for (auto &cam : cameras)
+    {
+        Camera *c = cam.get();
+        make_dirs(batch.out_dir + "/" + c->key);
+        if (batch.journal.done("index " + c->key) && load_index(batch.out_dir + "/" + c->key + "/index.csv", c))
+        {
+            batch.counters["index"].skipped++;
+            pool.submit([&batch, c] { queue_ranges(batch, *c); });
+            continue;
+        }
+        c->segment_frames.resize(c->segments.size());
+        c->unindexed = c->segments.size();
+        for (uint32_t s = 0; s < c->segments.size(); s++)
+            pool.submit([&batch, c, s] { index_task(batch, *c, s); });
+    }
+    for (auto &seg : verify)
+    {
+        for (size_t first = 0; first < seg->chunks.size(); first += kVerifyChunks)
+        {
+            const size_t last = std::min(first + kVerifyChunks, seg->chunks.size());
+            const std::string key = seg->key + " " + std::to_string(first) + "-" + std::to_string(last);
+            if (batch.journal.done("verify " + key))
+            {
+                batch.counters["verify"].skipped++;
+                continue;
+            }
+            const VerifySegment *s = seg.get();
+            pool.submit([&batch, s, first, last, key] { verify_task(batch, *s, first, last, key); });
+        }
+    }
+    pool.wait();
+    const double secs = duration<double>(steady_clock::now() - t0).count();
+
+    size_t failed = 0;
+    for (auto &kv : batch.counters)
+    {
+        if (kv.second.run + kv.second.skipped + kv.second.failed == 0)
+            continue;
+        std::cout << kv.first << ": " << kv.second.run << " done, " << kv.second.skipped << " already done, "
+                  << kv.second.failed << " failed" << std::endl;
+        failed += kv.second.failed;
+    }
+    if (unchecked)
+        std::cout << unchecked << " segment(s) without checksums were not verified" << std::endl;
+    std::cout << manifests.size() << " take(s); " << std::fixed << std::setprecision(1)
+              << batch.bytes_read / 1e6 << " MB read in " << secs << " s ("
+              << (secs > 0 ? batch.bytes_read / 1e6 / secs : 0) << " MB/s, " << threads << " threads, " << io_slots
+              << " I/O, " << pool.steals() << " steals)" << std::endl;
+    return failed ? 2 : 0;
+}
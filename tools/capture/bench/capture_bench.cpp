@@ -0,0 +1,341 @@
+// Microbenchmarks for the capture pipeline building blocks.
+//
+//   htkcapture_bench --fixtures=DIR --benchmark_out=run.json --benchmark_out_format=json
+//
+// DIR holds raw MJPEG payloads as pulled out of a recording by
+// extract_fixtures.py. Without it a synthetic payload of typical 1440p size is
+// used, which is fine for the queue/pool numbers but not for the JPEG ones.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "../buffer_pool.h"
+#include "../file_writer.h"
+#include "../frame_ring.h"
+#include "../jpeg_payload.h"
+
+using namespace std::chrono;
+
+static std::vector<std::vector<uint8_t>> payloads;
+static std::string fixture_source = "synthetic";
+static std::string scratch_dir = "/tmp";
+
+static std::vector<uint8_t> read_file(const std::string &path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+static void load_fixtures(const std::string &dir)
+{
+    std::vector<std::string> names;
+    if (DIR *d = opendir(dir.c_str()))
+    {
+        while (dirent *e = readdir(d))
+        {
+            std::string name = e->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".jpg") == 0)
+                names.push_back(name);
+        }
+        closedir(d);
+    }
+    std::sort(names.begin(), names.end());
+
+    for (auto &name : names)
+    {
+        auto data = read_file(dir + "/" + name);
+        if (jpeg_payload_length(data.data(), data.size()) != 0)
+            payloads.push_back(std::move(data));
+    }
+    if (!payloads.empty())
+        fixture_source = dir + " (" + std::to_string(payloads.size()) + " payloads)";
+}
+
+static const std::vector<uint8_t> &payload_at(size_t i)
+{
+    return payloads[i % payloads.size()];
+}
+
+// --- frame ring ---
+
+static void BM_FrameRingPushPop(benchmark::State &state)
+{
+    FrameRing<uint64_t> ring(static_cast<size_t>(state.range(0)));
+    uint64_t v = 0;
+    for (auto _ : state)
+    {
+        ring.try_push(v);
+        ring.try_pop(v);
+        benchmark::DoNotOptimize(v);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FrameRingPushPop)->Arg(16);
+
+// One capture thread and one writer thread hand off timestamps; the
+// counter is the average enqueue-to-dequeue latency. Range(1) is the
+// simulated per-frame write cost in microseconds, which makes the ring fill.
+static FrameRing<int64_t> *shared_ring = nullptr;
+
+static void BM_FrameRingHandoff(benchmark::State &state)
+{
+    const microseconds write_cost(state.range(1));
+    if (state.thread_index() == 0)
+    {
+        uint64_t dropped = 0;
+        for (auto _ : state)
+        {
+            int64_t now = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+            if (!shared_ring->try_push(now))
+                dropped++;
+        }
+        shared_ring->close();
+        state.counters["dropped"] = benchmark::Counter(static_cast<double>(dropped), benchmark::Counter::kAvgIterations);
+    }
+    else
+    {
+        int64_t stamp = 0;
+        double latency_ns = 0;
+        uint64_t popped = 0;
+        for (auto _ : state)
+        {
+            if (!shared_ring->pop_wait(stamp, milliseconds(10)))
+                continue;
+            latency_ns += duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count() - stamp;
+            popped++;
+            if (write_cost.count() > 0)
+                std::this_thread::sleep_for(write_cost);
+        }
+        while (shared_ring->try_pop(stamp))
+        {
+        }
+        state.counters["latency_ns"] = popped ? latency_ns / popped : 0;
+    }
+}
+
+static void handoff_setup(const benchmark::State &state)
+{
+    shared_ring = new FrameRing<int64_t>(static_cast<size_t>(state.range(0)));
+}
+
+static void handoff_teardown(const benchmark::State &)
+{
+    delete shared_ring;
+    shared_ring = nullptr;
+}
+BENCHMARK(BM_FrameRingHandoff)
+    ->Setup(handoff_setup)
+    ->Teardown(handoff_teardown)
+    ->Args({ 16, 0 })
+    ->Args({ 64, 0 })
+    ->Args({ 16, 50 })
+    ->Threads(2)
+    ->UseRealTime();
+
+// --- buffer pool ---
+
+static BufferPool *shared_pool = nullptr;
+
+static void BM_BufferPoolAcquireRelease(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        uint8_t *block = shared_pool->acquire();
+        benchmark::DoNotOptimize(block);
+        shared_pool->release(block);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void pool_setup(const benchmark::State &)
+{
+    shared_pool = new BufferPool(1 << 20, 64);
+}
+
+static void pool_teardown(const benchmark::State &)
+{
+    delete shared_pool;
+    shared_pool = nullptr;
+}
+BENCHMARK(BM_BufferPoolAcquireRelease)->Setup(pool_setup)->Teardown(pool_teardown)->ThreadRange(1, 8);
+
+// baseline for the pool: a fresh 1 MiB heap block per frame
+static void BM_MallocFree(benchmark::State &state)
+{
+    for (auto _ : state)
+    {
+        void *p = std::malloc(1 << 20);
+        benchmark::DoNotOptimize(p);
+        std::free(p);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MallocFree)->ThreadRange(1, 8);
+
+// --- file writers ---
+
+// Range(0) is the WriterMode, range(1) how many frames between syncs (0 = never).
+static void BM_FileWriter(benchmark::State &state)
+{
+    const auto mode = static_cast<WriterMode>(state.range(0));
+    const int64_t sync_every = state.range(1);
+    state.SetLabel(writer_mode_name(mode));
+
+    auto writer = make_file_writer(mode);
+    if (!writer)
+    {
+        state.SkipWithError("writer mode not available in this build");
+        return;
+    }
+    std::string path = scratch_dir + "/htkcapture_bench_" + writer_mode_name(mode) + ".bin";
+    if (!writer->open(path))
+    {
+        state.SkipWithError(("open failed: " + std::string(std::strerror(writer->last_errno()))).c_str());
+        return;
+    }
+
+    size_t i = 0;
+    int64_t bytes = 0;
+    for (auto _ : state)
+    {
+        const auto &p = payload_at(i++);
+        if (!writer->write(p.data(), p.size()))
+        {
+            state.SkipWithError(std::strerror(writer->last_errno()));
+            break;
+        }
+        if (sync_every > 0 && static_cast<int64_t>(i) % sync_every == 0 && !writer->sync())
+        {
+            state.SkipWithError(std::strerror(writer->last_errno()));
+            break;
+        }
+        bytes += static_cast<int64_t>(p.size());
+    }
+    writer->close();
+    unlink(path.c_str());
+    state.SetBytesProcessed(bytes);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FileWriter)
+    ->ArgsProduct({ { static_cast<int64_t>(WriterMode::Buffered),
+                      static_cast<int64_t>(WriterMode::Direct),
+                      static_cast<int64_t>(WriterMode::Uring) },
+                    { 0, 30 } })
+    ->UseRealTime();
+
+// --- JPEG payload handling ---
+
+// scans backwards from the end for EOI, so frames per second, not bytes
+static void BM_JpegPayloadLength(benchmark::State &state)
+{
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        const auto &p = payload_at(i++);
+        benchmark::DoNotOptimize(jpeg_payload_length(p.data(), p.size()));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_JpegPayloadLength);
+
+static void BM_JpegFrameInfo(benchmark::State &state)
+{
+    size_t i = 0;
+    JpegFrameInfo info;
+    for (auto _ : state)
+    {
+        const auto &p = payload_at(i++);
+        benchmark::DoNotOptimize(jpeg_read_frame_info(p.data(), p.size(), &info));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_JpegFrameInfo);
+
+// full structural check the writer runs on every frame
+static void BM_JpegValidate(benchmark::State &state)
+{
+    size_t i = 0;
+    int64_t bytes = 0;
+    for (auto _ : state)
+    {
+        const auto &p = payload_at(i++);
+        benchmark::DoNotOptimize(jpeg_validate(p.data(), p.size(), 0, 0));
+        bytes += static_cast<int64_t>(p.size());
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_JpegValidate);
+
+// what a sidecar sink pays per frame: find the real length, copy into a pool block
+static void BM_JpegPayloadToPool(benchmark::State &state)
+{
+    BufferPool pool(2 << 20, 4);
+    size_t i = 0;
+    int64_t bytes = 0;
+    for (auto _ : state)
+    {
+        const auto &p = payload_at(i++);
+        size_t n = std::min(jpeg_payload_length(p.data(), p.size()), pool.block_size());
+        uint8_t *block = pool.acquire();
+        std::memcpy(block, p.data(), n);
+        benchmark::ClobberMemory();
+        pool.release(block);
+        bytes += static_cast<int64_t>(n);
+    }
+    state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_JpegPayloadToPool);
+
+int main(int argc, char **argv)
+{
+    std::string fixtures_dir;
+    if (const char *env = std::getenv("HTK_BENCH_FIXTURES"))
+        fixtures_dir = env;
+    if (const char *env = std::getenv("HTK_BENCH_SCRATCH"))
+        scratch_dir = env;
+
+    // strip our own flags before google benchmark sees them
+    int out = 1;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strncmp(argv[i], "--fixtures=", 11) == 0)
+            fixtures_dir = argv[i] + 11;
+        else if (std::strncmp(argv[i], "--scratch=", 10) == 0)
+            scratch_dir = argv[i] + 10;
+        else
+            argv[out++] = argv[i];
+    }
+    argc = out;
+
+    if (!fixtures_dir.empty())
+    {
+        load_fixtures(fixtures_dir);
+        if (payloads.empty())
+        {
+            std::cerr << "No MJPEG payloads found in " << fixtures_dir << std::endl;
+            return 1;
+        }
+    }
+    if (payloads.empty())
+        payloads.push_back(jpeg_synthetic_payload(2560, 1440, 700 * 1024, 1));
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::AddCustomContext("fixtures", fixture_source);
+    benchmark::AddCustomContext("scratch_dir", scratch_dir);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,61 @@
+import argparse
+import sys
+from pathlib import Path
+
+from pyk4a import PyK4APlayback
+
+
+def die(msg: str, code: int = 1) -> None:
+    print(f"ERROR: {msg}", file=sys.stderr)
+    sys.exit(code)
+
+
+def main() -> None:
+    ap = argparse.ArgumentParser(description="Dump raw MJPEG payloads from an MKV as htkcapture_bench fixtures.")
+    ap.add_argument("mkv", type=str, help="Path to input .mkv recorded by htkrecorder")
+    ap.add_argument("out_dir", type=str, help="Directory to write payload_%%03d.jpg files into")
+    ap.add_argument("--count", type=int, default=60, help="Number of frames to dump")
+    ap.add_argument("--skip", type=int, default=30, help="Frames to skip first (auto exposure settling)")
+    args = ap.parse_args()
+
+    mkv_path = Path(args.mkv).expanduser().resolve()
+    if not mkv_path.exists():
+        die(f"Input MKV not found: {mkv_path}")
+
+    out_dir = Path(args.out_dir).expanduser().resolve()
+    out_dir.mkdir(parents=True, exist_ok=True)
+
+    pb = PyK4APlayback(str(mkv_path))
+    try:
+        pb.open()
+    except Exception as e:
+        die(f"Failed to open MKV with PyK4APlayback: {e}")
+
+    idx = 0
+    written = 0
+    try:
+        while written < args.count:
+            try:
+                cap = pb.get_next_capture()
+            except EOFError:
+                break
+
+            color = cap.color if cap is not None else None
+            if color is None:
+                continue
+            if color.ndim != 1:
+                die("Recording is not MJPEG; fixtures must be the compressed payloads")
+
+            if idx >= args.skip:
+                # the payload exactly as the camera delivered it, no re-encode
+                (out_dir / f"payload_{written:03d}.jpg").write_bytes(color.tobytes())
+                written += 1
+            idx += 1
+    finally:
+        pb.close()
+
+    print(f"Wrote {written} payloads to: {out_dir}")
+
+
+if __name__ == "__main__":
+    main()
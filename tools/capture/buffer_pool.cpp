@@ -0,0 +1,59 @@
+#include "buffer_pool.h"
+
+#include <cstdlib>
+#include <new>
+
+static size_t round_up(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+BufferPool::BufferPool(size_t block_size, size_t block_count, size_t alignment)
+    : m_block_size(round_up(block_size, alignment)), m_block_count(block_count)
+{
+    void *slab = nullptr;
+    if (posix_memalign(&slab, alignment, m_block_size * m_block_count) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    m_slab = static_cast<uint8_t *>(slab);
+
+    m_free.reserve(m_block_count);
+    for (size_t i = m_block_count; i > 0; i--)
+    {
+        m_free.push_back(m_slab + (i - 1) * m_block_size);
+    }
+}
+
+BufferPool::~BufferPool()
+{
+    std::free(m_slab);
+}
+
+uint8_t *BufferPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_free.empty())
+    {
+        return nullptr;
+    }
+    uint8_t *block = m_free.back();
+    m_free.pop_back();
+    return block;
+}
+
+void BufferPool::release(uint8_t *block)
+{
+    if (block == nullptr)
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free.push_back(block);
+}
+
+size_t BufferPool::available()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_free.size();
+}
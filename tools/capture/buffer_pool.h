@@ -0,0 +1,46 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Fixed-size, page-aligned blocks carved out of one slab allocated up front.
+// HostJpegEncoder writes its JPEGs into blocks from here instead of a fresh
+// malloc per frame, so a multi-hour session neither fragments the heap nor
+// faults in new pages for every frame. Blocks are also suitable for O_DIRECT
+// writes.
+class BufferPool
+{
+public:
+    BufferPool(size_t block_size, size_t block_count, size_t alignment = 4096);
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // nullptr when every block is in use; the caller decides whether to drop or wait
+    uint8_t *acquire();
+    void release(uint8_t *block);
+
+    size_t block_size() const
+    {
+        return m_block_size;
+    }
+    size_t block_count() const
+    {
+        return m_block_count;
+    }
+    size_t available();
+
+private:
+    uint8_t *m_slab = nullptr;
+    size_t m_block_size = 0;
+    size_t m_block_count = 0;
+
+    std::mutex m_mutex;
+    std::vector<uint8_t *> m_free;
+};
+
+#endif
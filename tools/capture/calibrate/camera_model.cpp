@@ -0,0 +1,135 @@
+#include "camera_model.h"
+
+#include <cstring>
+
+#include <Eigen/Dense>
+
+Eigen::Vector2d CameraModel::distort(const Eigen::Vector2d &normalized) const
+{
+    const double xp = normalized.x() - codx;
+    const double yp = normalized.y() - cody;
+    const double xp2 = xp * xp, yp2 = yp * yp, xyp = xp * yp;
+    const double rs = xp2 + yp2;
+    const double rss = rs * rs, rsc = rss * rs;
+    const double a = 1 + k1 * rs + k2 * rss + k3 * rsc;
+    const double b = 1 + k4 * rs + k5 * rss + k6 * rsc;
+    const double d = b != 0 ? a / b : a;
+
+    double xd = xp * d, yd = yp * d;
+    // the SDK's two models differ only in the factor on p1/p2 cross terms
+    const double cross = rational ? 1.0 : 2.0;
+    xd += (rs + 2 * xp2) * p2 + cross * xyp * p1;
+    yd += (rs + 2 * yp2) * p1 + cross * xyp * p2;
+    return Eigen::Vector2d(xd + codx, yd + cody);
+}
+
+bool CameraModel::project(const Eigen::Vector3d &point, Eigen::Vector2d *pixel) const
+{
+    if (point.z() <= 0)
+    {
+        *pixel = Eigen::Vector2d(cx, cy);
+        return false;
+    }
+    const Eigen::Vector2d n(point.x() / point.z(), point.y() / point.z());
+    const Eigen::Vector2d d = distort(n);
+    *pixel = Eigen::Vector2d(d.x() * fx + cx, d.y() * fy + cy);
+    const double rx = n.x() - codx, ry = n.y() - cody;
+    return metric_radius <= 0 || rx * rx + ry * ry <= metric_radius * metric_radius;
+}
+
+Eigen::Vector2d CameraModel::undistort(const Eigen::Vector2d &pixel) const
+{
+    const Eigen::Vector2d target((pixel.x() - cx) / fx, (pixel.y() - cy) / fy);
+    Eigen::Vector2d n = target;
+    for (int i = 0; i < 20; i++)
+    {
+        const Eigen::Vector2d err = distort(n) - target;
+        if (err.squaredNorm() < 1e-24)
+            break;
+        // the distortion is smooth and close to identity; a numeric Jacobian is plenty
+        const double h = 1e-7;
+        Eigen::Matrix2d j;
+        j.col(0) = (distort(n + Eigen::Vector2d(h, 0)) - distort(n - Eigen::Vector2d(h, 0))) / (2 * h);
+        j.col(1) = (distort(n + Eigen::Vector2d(0, h)) - distort(n - Eigen::Vector2d(0, h))) / (2 * h);
+        n -= j.inverse() * err;
+    }
+    return n;
+}
+
+Eigen::Matrix3d CameraModel::matrix() const
+{
+    Eigen::Matrix3d k;
+    k << fx, 0, cx, 0, fy, cy, 0, 0, 1;
+    return k;
+}
+
+bool camera_model_from_json(const JsonValue &device, CameraModel *model, std::string *error)
+{
+    const JsonValue *intr = device.get("intrinsics");
+    if (intr == nullptr)
+    {
+        *error = "no intrinsics for camera " + (device.get("name") ? device.get("name")->str() : std::string("?"));
+        return false;
+    }
+    auto num = [&](const char *key) { return intr->get(key) ? intr->get(key)->number() : 0.0; };
+    model->fx = num("fx");
+    model->fy = num("fy");
+    model->cx = num("cx");
+    model->cy = num("cy");
+    model->k1 = num("k1");
+    model->k2 = num("k2");
+    model->k3 = num("k3");
+    model->k4 = num("k4");
+    model->k5 = num("k5");
+    model->k6 = num("k6");
+    model->p1 = num("p1");
+    model->p2 = num("p2");
+    model->codx = num("codx");
+    model->cody = num("cody");
+    model->metric_radius = num("metric_radius");
+    model->rational = intr->get("model") && intr->get("model")->str() == "rational_6kt";
+    model->width = device.get("width") ? static_cast<int>(device.get("width")->int64()) : 0;
+    model->height = device.get("height") ? static_cast<int>(device.get("height")->int64()) : 0;
+    if (model->fx <= 0 || model->fy <= 0)
+    {
+        *error = "bad focal length in intrinsics";
+        return false;
+    }
+    return true;
+}
+
+bool camera_model_from_rig(const RigCameraRecord &camera, CameraModel *model, std::string *error)
+{
+    if (!(camera.flags & kRigIntrinsicsValid))
+    {
+        *error = "no intrinsics for camera " + std::string(camera.name);
+        return false;
+    }
+    // k4a_calibration_intrinsic_parameters_t order
+    double v[15];
+    std::memcpy(v, camera.k4a_intrinsics, sizeof(v));
+    model->cx = v[0];
+    model->cy = v[1];
+    model->fx = v[2];
+    model->fy = v[3];
+    model->k1 = v[4];
+    model->k2 = v[5];
+    model->k3 = v[6];
+    model->k4 = v[7];
+    model->k5 = v[8];
+    model->k6 = v[9];
+    model->codx = v[10];
+    model->cody = v[11];
+    model->p2 = v[12];
+    model->p1 = v[13];
+    model->metric_radius = v[14];
+    model->rational = camera.distortion_model == K4A_CALIBRATION_LENS_DISTORTION_MODEL_RATIONAL_6KT;
+    model->width = camera.width;
+    model->height = camera.height;
+    if (model->fx <= 0 || model->fy <= 0)
+    {
+        *error = "bad focal length in intrinsics";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef CAMERA_MODEL_H
+#define CAMERA_MODEL_H
+
+#include <string>
+
+#include <Eigen/Core>
+
+#include "../json_reader.h"
+#include "../rig_calibration.h"
+
+// The Azure Kinect color camera model: pinhole plus the SDK's radial/tangential
+// distortion (Brown-Conrady, or rational 6KT on some units), with the
+// distortion centred at (codx, cody). Same arithmetic as the SDK's
+// k4a_calibration_3d_to_2d(), in double precision.
+struct CameraModel
+{
+    double fx = 0, fy = 0, cx = 0, cy = 0;
+    double k1 = 0, k2 = 0, k3 = 0, k4 = 0, k5 = 0, k6 = 0;
+    double p1 = 0, p2 = 0;
+    double codx = 0, cody = 0;
+    double metric_radius = 0; // 0 when unknown; points outside it are not valid
+    bool rational = false;    // RATIONAL_6KT tangential terms instead of Brown-Conrady
+    int width = 0, height = 0;
+
+    // camera coordinates (z forward) to pixels; false behind the camera or
+    // outside the calibrated radius, with *pixel still filled in
+    bool project(const Eigen::Vector3d &point, Eigen::Vector2d *pixel) const;
+
+    // distortion only: undistorted to distorted normalized coordinates
+    Eigen::Vector2d distort(const Eigen::Vector2d &normalized) const;
+
+    // pixels to undistorted normalized coordinates, inverting distort() by
+    // Newton iteration
+    Eigen::Vector2d undistort(const Eigen::Vector2d &pixel) const;
+
+    // the 3x3 matrix calib.py pickles
+    Eigen::Matrix3d matrix() const;
+};
+
+// From a device entry of calibration.json (see calibration_capture.h): its
+// "intrinsics" object plus "width" and "height". False without intrinsics.
+bool camera_model_from_json(const JsonValue &device, CameraModel *model, std::string *error);
+
+// From a camera of rig_calibration.bin. False if it has no intrinsics.
+bool camera_model_from_rig(const RigCameraRecord &camera, CameraModel *model, std::string *error);
+
+#endif
@@ -0,0 +1,269 @@
+#include "drift_monitor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../capture_device.h"
+#include "../session_manifest.h"
+#include "../undistort/jpeg_image.h"
+#include "extrinsic_solver.h"
+#include "tag_detector.h"
+
+using namespace std::chrono;
+
+static double median(std::vector<double> v)
+{
+    if (v.empty())
+        return 0;
+    const size_t half = v.size() / 2;
+    std::nth_element(v.begin(), v.begin() + half, v.end());
+    if (v.size() % 2)
+        return v[half];
+    return (v[half] + *std::max_element(v.begin(), v.begin() + half)) / 2;
+}
+
+DriftMonitor::DriftMonitor(Session &s, const DriftOptions &options) : m_session(s), m_options(options)
+{
+}
+
+DriftMonitor::~DriftMonitor()
+{
+    stop();
+}
+
+bool DriftMonitor::start(std::string *error)
+{
+    if (!tag_detection_available())
+    {
+        *error = "Drift monitoring needs AprilTag detection, which this build does not have.";
+        return false;
+    }
+    RigCalibration rig;
+    if (m_session.rig_calibration.empty() ||
+        !rig_calibration_decode(reinterpret_cast<const uint8_t *>(m_session.rig_calibration.data()),
+                                m_session.rig_calibration.size(), &rig, nullptr, error))
+    {
+        if (m_session.rig_calibration.empty())
+            *error = "Drift monitoring needs the rig calibration.";
+        return false;
+    }
+
+    size_t usable = 0;
+    for (auto &d : m_session.devices)
+    {
+        Camera cam;
+        cam.device = &d;
+        cam.name = "device " + std::to_string(d.index);
+        const int i = rig_find_camera(rig, d.serial);
+        std::string model_error;
+        if (i >= 0)
+        {
+            const RigCameraRecord &r = rig.cameras[i];
+            cam.name = r.name;
+            cam.has_model = camera_model_from_rig(r, &cam.model, &model_error);
+            if (r.flags & kRigExtrinsicsSolved)
+            {
+                double t[16];
+                std::memcpy(t, r.camera_to_reference, sizeof(t));
+                cam.camera_to_reference.matrix() = Eigen::Map<Eigen::Matrix<double, 4, 4, Eigen::RowMajor>>(t);
+                cam.has_extrinsics = true;
+            }
+        }
+        usable += cam.has_model ? 1 : 0;
+        m_cameras.push_back(cam);
+    }
+    if (usable == 0)
+    {
+        *error = "Drift monitoring: no device has intrinsics in the rig calibration.";
+        return false;
+    }
+    if (!m_options.log_path.empty())
+    {
+        m_log.open(m_options.log_path, std::ios::trunc);
+        if (!m_log)
+        {
+            *error = "Unable to write " + m_options.log_path;
+            return false;
+        }
+    }
+    m_stop = false;
+    m_thread = std::thread(&DriftMonitor::run, this);
+    return true;
+}
+
+void DriftMonitor::stop()
+{
+    if (!m_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+    m_log.close();
+}
+
+void DriftMonitor::run()
+{
+    // only runs when a core would otherwise idle; failing that, the lowest
+    // nice level (per thread on Linux) still keeps it behind the pipeline
+    sched_param param{};
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0)
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), 19);
+
+    TagDetectorOptions detect;
+    detect.quad_decimate = 1.0f; // the decode already downscaled
+    TagDetector detector(detect);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_wake.wait_for(lock, seconds(m_options.interval_s), [this] { return m_stop; }))
+    {
+        lock.unlock();
+        check(detector);
+        lock.lock();
+    }
+}
+
+void DriftMonitor::check(TagDetector &detector)
+{
+    for (auto &cam : m_cameras)
+        if (cam.has_model)
+            session_request_sample(*cam.device);
+
+    // writers hand over their next frame, a frame period or so from now
+    std::vector<k4a_capture_t> samples(m_cameras.size(), nullptr);
+    const auto deadline = steady_clock::now() + seconds(1);
+    for (;;)
+    {
+        size_t missing = 0;
+        for (size_t c = 0; c < m_cameras.size(); c++)
+        {
+            if (m_cameras[c].has_model && samples[c] == nullptr)
+                samples[c] = session_take_sample(*m_cameras[c].device);
+            missing += m_cameras[c].has_model && samples[c] == nullptr ? 1 : 0;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (missing == 0 || m_stop || steady_clock::now() >= deadline)
+            break;
+        m_wake.wait_for(lock, milliseconds(10));
+    }
+
+    // tag centres in each camera's frame
+    std::vector<std::map<int, Eigen::Vector3d>> seen(m_cameras.size());
+    std::vector<bool> sampled(m_cameras.size(), false);
+    const double scale = m_options.scale_denom;
+    for (size_t c = 0; c < m_cameras.size(); c++)
+    {
+        if (samples[c] == nullptr)
+            continue;
+        sampled[c] = true;
+        std::vector<uint8_t> gray;
+        int width = 0, height = 0;
+        bool decoded = false;
+        if (k4a_image_t image = k4a_capture_get_color_image(samples[c]))
+        {
+            std::string error;
+            decoded = decode_jpeg_memory(k4a_image_get_buffer(image), k4a_image_get_size(image), 1,
+                                         m_options.scale_denom, &gray, &width, &height, &error);
+            k4a_image_release(image);
+        }
+        k4a_capture_release(samples[c]);
+        if (!decoded)
+            continue;
+        for (const TagDetection &t : detector.detect(gray.data(), width, height, width))
+        {
+            Eigen::Vector2d corners[4];
+            for (int i = 0; i < 4; i++)
+                corners[i] = Eigen::Vector2d((t.corners[i][0] + 0.5) * scale - 0.5, (t.corners[i][1] + 0.5) * scale - 0.5);
+            Eigen::Isometry3d pose;
+            double rms = 0;
+            if (estimate_tag_pose(m_cameras[c].model, corners, m_options.tag_size_m, &pose, &rms))
+                seen[c][t.id] = pose.translation();
+        }
+    }
+
+    // tag positions in the reference frame, from every camera with extrinsics
+    std::map<int, std::vector<Eigen::Vector3d>> in_reference;
+    for (size_t c = 0; c < m_cameras.size(); c++)
+        if (m_cameras[c].has_extrinsics)
+            for (auto &t : seen[c])
+                in_reference[t.first].push_back(m_cameras[c].camera_to_reference * t.second);
+
+    const int64_t now = monotonic_ns();
+    for (size_t c = 0; c < m_cameras.size(); c++)
+    {
+        Camera &cam = m_cameras[c];
+        if (!cam.has_model)
+            continue;
+        std::vector<double> shifts, bearings, disagreements;
+        for (auto &t : seen[c])
+        {
+            auto across = in_reference.find(t.first);
+            // two cameras that disagree cannot say which one moved
+            if (cam.has_extrinsics && across != in_reference.end() && across->second.size() >= 3)
+            {
+                Eigen::Vector3d mid;
+                for (int k = 0; k < 3; k++)
+                {
+                    std::vector<double> v;
+                    for (auto &p : across->second)
+                        v.push_back(p[k]);
+                    mid[k] = median(v);
+                }
+                disagreements.push_back((cam.camera_to_reference * t.second - mid).norm() * 1000);
+            }
+
+            auto base = cam.baseline.find(t.first);
+            if (base == cam.baseline.end())
+            {
+                cam.baseline[t.first] = t.second;
+                continue;
+            }
+            shifts.push_back((t.second - base->second).norm() * 1000);
+            const double cosine = t.second.normalized().dot(base->second.normalized());
+            bearings.push_back(std::acos(std::min(1.0, cosine)) * 180 / M_PI);
+        }
+
+        const double shift = median(shifts), bearing = median(bearings), disagreement = median(disagreements);
+        const bool over = shift > m_options.max_shift_mm || bearing > m_options.max_bearing_deg ||
+                          disagreement > m_options.max_disagreement_mm;
+        cam.over = over ? cam.over + 1 : 0;
+        if (!over)
+            cam.alerted = false;
+        const bool alert = over && !cam.alerted && cam.over >= m_options.confirm_checks;
+        if (alert)
+        {
+            cam.alerted = true;
+            m_alerts++;
+            std::ostringstream msg;
+            msg << std::fixed << std::setprecision(1) << "drift " << cam.name << " (" << cam.device->serial
+                << "): tags moved " << shift << " mm, " << std::setprecision(2) << bearing << " deg";
+            if (!disagreements.empty())
+                msg << std::setprecision(1) << ", " << disagreement << " mm off the other cameras";
+            std::cerr << "WARNING: " << msg.str() << std::endl;
+            session_mark_event(m_session, msg.str(), "drift", now);
+        }
+
+        if (m_log.is_open())
+        {
+            m_log << std::fixed << std::setprecision(3) << "{\"host_monotonic_ns\": " << now
+                  << ", \"camera\": " << json_string(cam.name) << ", \"serial\": " << json_string(cam.device->serial)
+                  << ", \"sampled\": " << (sampled[c] ? "true" : "false") << ", \"tags\": " << seen[c].size()
+                  << ", \"compared\": " << shifts.size() << ", \"shift_mm\": " << shift
+                  << ", \"bearing_deg\": " << bearing << ", \"cross_tags\": " << disagreements.size()
+                  << ", \"disagreement_mm\": " << disagreement << ", \"alert\": " << (alert ? "true" : "false") << "}\n";
+            m_log.flush();
+        }
+    }
+}
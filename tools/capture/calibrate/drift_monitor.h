@@ -0,0 +1,100 @@
+#ifndef DRIFT_MONITOR_H
+#define DRIFT_MONITOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "../capture_session.h"
+#include "../rig_calibration.h"
+#include "camera_model.h"
+
+class TagDetector;
+
+// Watches for cameras being bumped while a session records. Every few
+// seconds it borrows one written frame per camera (session_request_sample()),
+// decodes it at reduced size, finds the AprilTags fixed around the rig and
+// estimates their poses.
+//
+// Two things are compared per camera:
+//  - each tag against where the same camera saw it at the start of the
+//    session: the tag centre's shift and the change in its bearing;
+//  - with solved extrinsics, each tag's position in the reference frame
+//    against the median over the cameras that see it (three or more, or a
+//    disagreement cannot say which camera moved), i.e. whether the saved
+//    extrinsics still hold.
+// The median over a camera's tags is used, so one tag being moved does not
+// read as the camera moving. A camera past a threshold for several checks in
+// a row raises an alert: a message on stderr and a "drift" event marker. It
+// is re-armed once the camera is back within the thresholds.
+//
+// The thread runs under SCHED_IDLE and only touches the writer through the
+// sample slot, so it never competes with capture or writing.
+struct DriftOptions
+{
+    int interval_s = 5;
+    int scale_denom = 2; // decode at 1/2, 1/4 or 1/8 size
+    double tag_size_m = 0.2;
+    double max_shift_mm = 15;
+    double max_bearing_deg = 0.3;
+    double max_disagreement_mm = 30; // distance from the median across cameras
+    int confirm_checks = 2;
+    std::string log_path; // JSON lines, one per camera per check; empty for none
+};
+
+class DriftMonitor
+{
+public:
+    DriftMonitor(Session &s, const DriftOptions &options);
+    ~DriftMonitor();
+
+    DriftMonitor(const DriftMonitor &) = delete;
+    DriftMonitor &operator=(const DriftMonitor &) = delete;
+
+    // Needs tag detection and Session::rig_calibration with intrinsics for
+    // at least one device; false and fills error otherwise.
+    bool start(std::string *error);
+    void stop();
+
+    size_t alerts() const
+    {
+        return m_alerts;
+    }
+
+private:
+    struct Camera
+    {
+        DeviceCtx *device = nullptr;
+        std::string name;
+        CameraModel model;
+        bool has_model = false;
+        bool has_extrinsics = false;
+        Eigen::Isometry3d camera_to_reference = Eigen::Isometry3d::Identity();
+        std::map<int, Eigen::Vector3d> baseline; // tag id -> centre in camera frame, meters
+        int over = 0;                            // consecutive checks past a threshold
+        bool alerted = false;
+    };
+
+    void run();
+    void check(TagDetector &detector);
+
+    Session &m_session;
+    DriftOptions m_options;
+    std::vector<Camera> m_cameras;
+    std::ofstream m_log;
+    std::atomic<size_t> m_alerts{ 0 };
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,595 @@
+#include "extrinsic_solver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <thread>
+#include <utility>
+
+#include <Eigen/Dense>
+#include <Eigen/SVD>
+
+typedef Eigen::Matrix<double, 6, 1> Vector6d;
+typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+typedef Eigen::Matrix<double, 8, 1> Vector8d;
+typedef Eigen::Matrix<double, 8, 6> Matrix86d;
+
+// tag plane coordinates of the AprilTag corners, in half edge lengths
+static const double kCornerSigns[4][2] = { { -1, -1 }, { 1, -1 }, { 1, 1 }, { -1, 1 } };
+
+static void parallel_for(size_t count, unsigned threads, const std::function<void(size_t)> &fn)
+{
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < count)
+            fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads && t < count; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool)
+        t.join();
+}
+
+// small left update of a pose: rotation vector, then translation
+static Eigen::Isometry3d pose_delta(const Vector6d &d)
+{
+    Eigen::Isometry3d t = Eigen::Isometry3d::Identity();
+    const double angle = d.head<3>().norm();
+    if (angle > 1e-15)
+        t.linear() = Eigen::AngleAxisd(angle, d.head<3>() / angle).toRotationMatrix();
+    t.translation() = d.tail<3>();
+    return t;
+}
+
+static Eigen::Matrix3d nearest_rotation(const Eigen::Matrix3d &m)
+{
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(m, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d r = svd.matrixU() * svd.matrixV().transpose();
+    if (r.determinant() < 0)
+    {
+        Eigen::Matrix3d u = svd.matrixU();
+        u.col(2) *= -1;
+        r = u * svd.matrixV().transpose();
+    }
+    return r;
+}
+
+// Corner reprojection errors in pixels of a tag at tag_to_camera. False if a
+// corner ends up behind the camera.
+static bool view_residuals(const CameraModel &camera,
+                           const Eigen::Isometry3d &tag_to_camera,
+                           const Eigen::Vector2d corners[4],
+                           double half_size,
+                           Vector8d *r)
+{
+    bool ok = true;
+    for (int i = 0; i < 4; i++)
+    {
+        const Eigen::Vector3d p = tag_to_camera * Eigen::Vector3d(kCornerSigns[i][0] * half_size, kCornerSigns[i][1] * half_size, 0);
+        Eigen::Vector2d px;
+        camera.project(p, &px);
+        ok = ok && p.z() > 0;
+        r->segment<2>(2 * i) = px - corners[i];
+    }
+    return ok;
+}
+
+static double huber_cost(const Vector8d &r, double delta, Eigen::Vector4d *weights)
+{
+    double cost = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        const double s = r.segment<2>(2 * i).norm();
+        if (s <= delta)
+        {
+            cost += s * s;
+            (*weights)[i] = 1;
+        }
+        else
+        {
+            cost += 2 * delta * s - delta * delta;
+            (*weights)[i] = delta / s;
+        }
+    }
+    return cost;
+}
+
+bool estimate_tag_pose(const CameraModel &camera,
+                       const Eigen::Vector2d corners[4],
+                       double tag_size_m,
+                       Eigen::Isometry3d *tag_to_camera,
+                       double *rms_px)
+{
+    const double half = tag_size_m / 2;
+
+    // homography from the tag plane (corners at +-1) to undistorted normalized coordinates
+    Eigen::Matrix<double, 8, 8> a;
+    Vector8d b;
+    for (int i = 0; i < 4; i++)
+    {
+        const Eigen::Vector2d n = camera.undistort(corners[i]);
+        const double x = kCornerSigns[i][0], y = kCornerSigns[i][1];
+        a.row(2 * i) << x, y, 1, 0, 0, 0, -n.x() * x, -n.x() * y;
+        a.row(2 * i + 1) << 0, 0, 0, x, y, 1, -n.y() * x, -n.y() * y;
+        b[2 * i] = n.x();
+        b[2 * i + 1] = n.y();
+    }
+    Vector8d h = a.colPivHouseholderQr().solve(b);
+    Eigen::Matrix3d hm;
+    hm << h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7], 1;
+
+    // the decomposition calib.py does; with h33 = 1 the tag comes out in front of the camera
+    const double lam = 0.5 * (1 / hm.col(0).norm() + 1 / hm.col(1).norm());
+    Eigen::Matrix3d r;
+    r.col(0) = lam * hm.col(0);
+    r.col(1) = lam * hm.col(1);
+    r.col(2) = r.col(0).cross(r.col(1));
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+    pose.linear() = nearest_rotation(r);
+    pose.translation() = lam * hm.col(2) * half;
+
+    // Levenberg-Marquardt on the pixel error
+    Vector8d res;
+    if (!view_residuals(camera, pose, corners, half, &res))
+        return false;
+    double cost = res.squaredNorm();
+    double lambda = 1e-3;
+    for (int it = 0; it < 50 && lambda < 1e10; it++)
+    {
+        Matrix86d j;
+        for (int k = 0; k < 6; k++)
+        {
+            Vector6d d = Vector6d::Zero();
+            d[k] = 1e-6;
+            Vector8d plus, minus;
+            view_residuals(camera, pose_delta(d) * pose, corners, half, &plus);
+            view_residuals(camera, pose_delta(-d) * pose, corners, half, &minus);
+            j.col(k) = (plus - minus) / 2e-6;
+        }
+        Matrix6d hess = j.transpose() * j;
+        hess.diagonal() *= 1 + lambda;
+        const Vector6d step = hess.ldlt().solve(-j.transpose() * res);
+        const Eigen::Isometry3d trial = pose_delta(step) * pose;
+        Vector8d trial_res;
+        if (view_residuals(camera, trial, corners, half, &trial_res) && trial_res.squaredNorm() < cost)
+        {
+            const double gain = cost - trial_res.squaredNorm();
+            pose = trial;
+            res = trial_res;
+            cost = res.squaredNorm();
+            lambda = std::max(lambda / 10, 1e-12);
+            if (gain < 1e-12 * (1 + cost) || step.norm() < 1e-12)
+                break;
+        }
+        else
+        {
+            lambda *= 10;
+        }
+    }
+    *tag_to_camera = pose;
+    *rms_px = std::sqrt(cost / 4);
+    return std::isfinite(cost);
+}
+
+bool tag_reprojection_rms(const CameraModel &camera,
+                          const Eigen::Isometry3d &tag_to_camera,
+                          const Eigen::Vector2d corners[4],
+                          double tag_size_m,
+                          double *rms_px)
+{
+    Vector8d res;
+    if (!view_residuals(camera, tag_to_camera, corners, tag_size_m / 2, &res))
+        return false;
+    *rms_px = std::sqrt(res.squaredNorm() / 4);
+    return std::isfinite(*rms_px);
+}
+
+namespace
+{
+
+struct View
+{
+    size_t observation;
+    size_t key; // (set, tag) square
+    Eigen::Isometry3d tag_to_camera;
+    double rms_px = 0;
+    bool ok = false;
+};
+
+struct Linearized
+{
+    Vector8d r;
+    Eigen::Vector4d weights;
+    Matrix86d jt; // w.r.t. the square's pose
+    Matrix86d jc; // w.r.t. the camera's pose, zero for the reference
+    double cost = 0;
+};
+
+class Bundle
+{
+public:
+    Bundle(const std::vector<CameraModel> &cameras,
+           const std::vector<TagObservation> &observations,
+           const ExtrinsicOptions &options,
+           std::vector<Eigen::Isometry3d> &camera_to_ref,
+           std::vector<Eigen::Isometry3d> &tag_to_ref)
+        : m_cameras(cameras), m_observations(observations), m_options(options), m_camera_to_ref(camera_to_ref),
+          m_tag_to_ref(tag_to_ref)
+    {
+    }
+
+    // views: (observation, key) pairs; returns iterations run
+    int solve(const std::vector<std::pair<size_t, size_t>> &views)
+    {
+        m_views = views;
+        // variable cameras get consecutive 6-blocks in the reduced system
+        m_slot.assign(m_cameras.size(), -1);
+        int slots = 0;
+        for (auto &v : m_views)
+        {
+            size_t c = m_observations[v.first].camera;
+            if (c != m_options.reference && m_slot[c] < 0)
+                m_slot[c] = slots++;
+        }
+        m_key_views.clear();
+        for (size_t i = 0; i < m_views.size(); i++)
+            m_key_views[m_views[i].second].push_back(i);
+
+        std::vector<Linearized> lin(m_views.size());
+        double cost = linearize(lin, true);
+        double lambda = 1e-4;
+        int it = 0;
+        for (; it < m_options.max_iterations && lambda < 1e12; it++)
+        {
+            std::vector<Vector6d> tag_steps;
+            Eigen::VectorXd cam_step;
+            step(lin, lambda, slots, &tag_steps, &cam_step);
+
+            const std::vector<Eigen::Isometry3d> saved_cams = m_camera_to_ref, saved_tags = m_tag_to_ref;
+            for (size_t c = 0; c < m_cameras.size(); c++)
+                if (m_slot[c] >= 0)
+                    m_camera_to_ref[c] = pose_delta(cam_step.segment<6>(6 * m_slot[c])) * m_camera_to_ref[c];
+            size_t k = 0;
+            for (auto &kv : m_key_views)
+                m_tag_to_ref[kv.first] = pose_delta(tag_steps[k++]) * m_tag_to_ref[kv.first];
+
+            std::vector<Linearized> trial(m_views.size());
+            const double trial_cost = linearize(trial, false);
+            if (trial_cost < cost)
+            {
+                const double gain = cost - trial_cost;
+                cost = linearize(lin, true);
+                lambda = std::max(lambda / 10, 1e-12);
+                if (gain < 1e-10 * (1 + cost))
+                    break;
+            }
+            else
+            {
+                m_camera_to_ref = saved_cams;
+                m_tag_to_ref = saved_tags;
+                lambda *= 10;
+            }
+        }
+        return it + 1;
+    }
+
+private:
+    bool residuals(size_t view, const Eigen::Isometry3d &cam_to_ref, const Eigen::Isometry3d &tag_to_ref, Vector8d *r) const
+    {
+        const TagObservation &o = m_observations[m_views[view].first];
+        return view_residuals(m_cameras[o.camera], cam_to_ref.inverse() * tag_to_ref, o.corners, m_options.tag_size_m / 2, r);
+    }
+
+    double linearize(std::vector<Linearized> &lin, bool jacobians)
+    {
+        parallel_for(m_views.size(), m_options.threads, [&](size_t i) {
+            const size_t c = m_observations[m_views[i].first].camera;
+            const Eigen::Isometry3d &cam = m_camera_to_ref[c];
+            const Eigen::Isometry3d &tag = m_tag_to_ref[m_views[i].second];
+            Linearized &l = lin[i];
+            if (!residuals(i, cam, tag, &l.r))
+            {
+                l.cost = 1e30;
+                return;
+            }
+            l.cost = huber_cost(l.r, m_options.huber_px, &l.weights);
+            if (!jacobians)
+                return;
+            const double eps = 1e-6;
+            l.jc.setZero();
+            for (int k = 0; k < 6; k++)
+            {
+                Vector6d d = Vector6d::Zero();
+                d[k] = eps;
+                Vector8d plus, minus;
+                residuals(i, cam, pose_delta(d) * tag, &plus);
+                residuals(i, cam, pose_delta(-d) * tag, &minus);
+                l.jt.col(k) = (plus - minus) / (2 * eps);
+                if (m_slot[c] >= 0)
+                {
+                    residuals(i, pose_delta(d) * cam, tag, &plus);
+                    residuals(i, pose_delta(-d) * cam, tag, &minus);
+                    l.jc.col(k) = (plus - minus) / (2 * eps);
+                }
+            }
+        });
+        double cost = 0;
+        for (auto &l : lin)
+            cost += l.cost;
+        return cost;
+    }
+
+    // Schur complement: square poses are eliminated, the camera system solved
+    // densely, then the square steps back-substituted.
+    void step(const std::vector<Linearized> &lin,
+              double lambda,
+              int slots,
+              std::vector<Vector6d> *tag_steps,
+              Eigen::VectorXd *cam_step) const
+    {
+        const Eigen::Index n = 6 * slots;
+        Eigen::MatrixXd s = Eigen::MatrixXd::Zero(n, n);
+        Eigen::VectorXd rhs = Eigen::VectorXd::Zero(n);
+
+        // weighted per-view products
+        std::vector<Matrix6d> w(lin.size());
+        std::vector<Vector6d> gt(lin.size());
+        for (size_t i = 0; i < lin.size(); i++)
+        {
+            const Linearized &l = lin[i];
+            Vector8d wr;
+            Matrix86d wjc;
+            for (int c = 0; c < 4; c++)
+            {
+                wr.segment<2>(2 * c) = l.weights[c] * l.r.segment<2>(2 * c);
+                wjc.middleRows<2>(2 * c) = l.weights[c] * l.jc.middleRows<2>(2 * c);
+            }
+            gt[i] = l.jt.transpose() * wr;
+            w[i] = l.jt.transpose() * wjc;
+            const int slot = m_slot[m_observations[m_views[i].first].camera];
+            if (slot >= 0)
+            {
+                s.block<6, 6>(6 * slot, 6 * slot) += l.jc.transpose() * wjc;
+                rhs.segment<6>(6 * slot) -= l.jc.transpose() * wr;
+            }
+        }
+        for (Eigen::Index d = 0; d < n; d++)
+            s(d, d) *= 1 + lambda;
+
+        std::vector<Matrix6d> u_inv;
+        std::vector<Vector6d> gu;
+        for (auto &kv : m_key_views)
+        {
+            Matrix6d u = Matrix6d::Zero();
+            Vector6d g = Vector6d::Zero();
+            for (size_t i : kv.second)
+            {
+                const Linearized &l = lin[i];
+                for (int c = 0; c < 4; c++)
+                    u += l.weights[c] * l.jt.middleRows<2>(2 * c).transpose() * l.jt.middleRows<2>(2 * c);
+                g += gt[i];
+            }
+            u.diagonal() *= 1 + lambda;
+            u.diagonal().array() += 1e-12;
+            const Matrix6d inv = u.inverse();
+            u_inv.push_back(inv);
+            gu.push_back(g);
+
+            for (size_t a : kv.second)
+            {
+                const int sa = m_slot[m_observations[m_views[a].first].camera];
+                if (sa < 0)
+                    continue;
+                rhs.segment<6>(6 * sa) += w[a].transpose() * inv * g;
+                for (size_t b : kv.second)
+                {
+                    const int sb = m_slot[m_observations[m_views[b].first].camera];
+                    if (sb >= 0)
+                        s.block<6, 6>(6 * sa, 6 * sb) -= w[a].transpose() * inv * w[b];
+                }
+            }
+        }
+
+        *cam_step = n > 0 ? Eigen::VectorXd(s.ldlt().solve(rhs)) : Eigen::VectorXd();
+        tag_steps->clear();
+        size_t k = 0;
+        for (auto &kv : m_key_views)
+        {
+            Vector6d rhs_t = -gu[k];
+            for (size_t i : kv.second)
+            {
+                const int slot = m_slot[m_observations[m_views[i].first].camera];
+                if (slot >= 0)
+                    rhs_t -= w[i] * cam_step->segment<6>(6 * slot);
+            }
+            tag_steps->push_back(u_inv[k] * rhs_t);
+            k++;
+        }
+    }
+
+    const std::vector<CameraModel> &m_cameras;
+    const std::vector<TagObservation> &m_observations;
+    const ExtrinsicOptions &m_options;
+    std::vector<Eigen::Isometry3d> &m_camera_to_ref;
+    std::vector<Eigen::Isometry3d> &m_tag_to_ref;
+
+    std::vector<std::pair<size_t, size_t>> m_views;
+    std::vector<int> m_slot;
+    std::map<size_t, std::vector<size_t>> m_key_views;
+};
+
+} // namespace
+
+bool solve_extrinsics(const std::vector<CameraModel> &cameras,
+                      const std::vector<TagObservation> &observations,
+                      const ExtrinsicOptions &options,
+                      ExtrinsicSolution *solution,
+                      std::string *error)
+{
+    const size_t ncam = cameras.size();
+    if (options.reference >= ncam)
+    {
+        *error = "reference camera out of range";
+        return false;
+    }
+
+    // every (set, tag id) is its own square
+    std::map<std::pair<size_t, int>, size_t> key_of;
+    std::vector<View> views(observations.size());
+    for (size_t i = 0; i < observations.size(); i++)
+    {
+        auto key = std::make_pair(observations[i].set, observations[i].tag_id);
+        auto it = key_of.emplace(key, key_of.size()).first;
+        views[i].observation = i;
+        views[i].key = it->second;
+    }
+    const size_t nkeys = key_of.size();
+
+    parallel_for(views.size(), options.threads, [&](size_t i) {
+        const TagObservation &o = observations[i];
+        views[i].ok = o.camera < ncam &&
+                      estimate_tag_pose(cameras[o.camera], o.corners, options.tag_size_m, &views[i].tag_to_camera, &views[i].rms_px);
+    });
+
+    std::vector<std::vector<size_t>> by_key(nkeys);
+    for (auto &v : views)
+        if (v.ok)
+            by_key[v.key].push_back(v.observation);
+
+    // place cameras one at a time, the best-connected first
+    std::vector<Eigen::Isometry3d> camera_to_ref(ncam, Eigen::Isometry3d::Identity());
+    std::vector<bool> placed(ncam, false);
+    placed[options.reference] = true;
+    for (;;)
+    {
+        std::vector<std::vector<Eigen::Isometry3d>> estimates(ncam);
+        for (auto &list : by_key)
+        {
+            for (size_t a : list)
+            {
+                const size_t ca = observations[a].camera;
+                if (placed[ca])
+                    continue;
+                for (size_t b : list)
+                {
+                    const size_t cb = observations[b].camera;
+                    if (placed[cb])
+                        estimates[ca].push_back(camera_to_ref[cb] * views[b].tag_to_camera * views[a].tag_to_camera.inverse());
+                }
+            }
+        }
+        size_t best = ncam;
+        for (size_t c = 0; c < ncam; c++)
+            if (!estimates[c].empty() && (best == ncam || estimates[c].size() > estimates[best].size()))
+                best = c;
+        if (best == ncam)
+            break;
+
+        // chordal mean of the rotations, per-axis median of the translations
+        Eigen::Matrix3d sum = Eigen::Matrix3d::Zero();
+        std::vector<double> axis[3];
+        for (auto &e : estimates[best])
+        {
+            sum += e.linear();
+            for (int k = 0; k < 3; k++)
+                axis[k].push_back(e.translation()[k]);
+        }
+        Eigen::Isometry3d t = Eigen::Isometry3d::Identity();
+        t.linear() = nearest_rotation(sum);
+        for (int k = 0; k < 3; k++)
+        {
+            std::nth_element(axis[k].begin(), axis[k].begin() + axis[k].size() / 2, axis[k].end());
+            t.translation()[k] = axis[k][axis[k].size() / 2];
+        }
+        camera_to_ref[best] = t;
+        placed[best] = true;
+    }
+
+    // each square starts where its sharpest view of a placed camera puts it
+    std::vector<Eigen::Isometry3d> tag_to_ref(nkeys, Eigen::Isometry3d::Identity());
+    std::vector<std::pair<size_t, size_t>> active;
+    for (size_t k = 0; k < nkeys; k++)
+    {
+        std::vector<size_t> usable;
+        for (size_t o : by_key[k])
+            if (placed[observations[o].camera])
+                usable.push_back(o);
+        // a square seen by one camera says nothing about the extrinsics
+        if (usable.size() < 2)
+            continue;
+        size_t sharpest = usable[0];
+        for (size_t o : usable)
+            if (views[o].rms_px < views[sharpest].rms_px)
+                sharpest = o;
+        tag_to_ref[k] = camera_to_ref[observations[sharpest].camera] * views[sharpest].tag_to_camera;
+        for (size_t o : usable)
+            active.emplace_back(o, k);
+    }
+    if (active.empty())
+    {
+        *error = "no tag was seen by the reference camera together with another camera";
+        return false;
+    }
+
+    Bundle bundle(cameras, observations, options, camera_to_ref, tag_to_ref);
+    solution->iterations = bundle.solve(active);
+
+    auto view_rms = [&](size_t o, size_t k) {
+        Vector8d r;
+        view_residuals(cameras[observations[o].camera], camera_to_ref[observations[o].camera].inverse() * tag_to_ref[k],
+                       observations[o].corners, options.tag_size_m / 2, &r);
+        return std::sqrt(r.squaredNorm() / 4);
+    };
+
+    // drop views far off the joint solution (a misdetected tag, motion blur) and solve again
+    std::vector<double> rms;
+    for (auto &v : active)
+        rms.push_back(view_rms(v.first, v.second));
+    std::vector<double> sorted = rms;
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    const double limit = std::max(options.outlier_px, 3 * sorted[sorted.size() / 2]);
+    std::vector<std::pair<size_t, size_t>> kept;
+    std::map<size_t, size_t> key_count;
+    for (size_t i = 0; i < active.size(); i++)
+        if (rms[i] <= limit)
+            key_count[active[i].second]++;
+    for (size_t i = 0; i < active.size(); i++)
+        if (rms[i] <= limit && key_count[active[i].second] >= 2)
+            kept.push_back(active[i]);
+    solution->rejected = active.size() - kept.size();
+    if (solution->rejected > 0 && !kept.empty())
+    {
+        active = kept;
+        solution->iterations += bundle.solve(active);
+    }
+
+    solution->cameras.assign(ncam, CameraExtrinsics());
+    std::vector<double> sq(ncam, 0);
+    double total = 0;
+    std::map<size_t, bool> keys_used;
+    for (auto &v : active)
+    {
+        const size_t c = observations[v.first].camera;
+        const double r = view_rms(v.first, v.second);
+        sq[c] += r * r;
+        total += r * r;
+        solution->cameras[c].views++;
+        keys_used[v.second] = true;
+    }
+    for (size_t c = 0; c < ncam; c++)
+    {
+        CameraExtrinsics &e = solution->cameras[c];
+        e.solved = placed[c] && (e.views > 0 || c == options.reference);
+        e.camera_to_reference = camera_to_ref[c];
+        e.rms_px = e.views ? std::sqrt(sq[c] / e.views) : 0;
+    }
+    solution->views = active.size();
+    solution->tag_poses = keys_used.size();
+    solution->rms_px = std::sqrt(total / active.size());
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef EXTRINSIC_SOLVER_H
+#define EXTRINSIC_SOLVER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "camera_model.h"
+
+// Camera-to-reference extrinsics of a rig from AprilTags seen in synchronized
+// frame sets. Every (set, tag id) is a rigid square somewhere in space; every
+// camera that sees it constrains where that camera is relative to the others.
+//
+// 1. Each view's tag pose is solved on its own (homography on undistorted
+//    corners, then refined on pixel reprojection).
+// 2. Cameras are placed relative to the reference camera from the views they
+//    share with cameras already placed, so not every camera has to see the
+//    tag together with the reference.
+// 3. All camera and tag poses are refined together by Levenberg-Marquardt
+//    on corner reprojection error in pixels with a Huber loss. Tag poses are
+//    eliminated with the Schur complement, so hundreds of sets stay cheap.
+//    Views far off the solution are dropped and the solve repeated once.
+
+struct TagObservation
+{
+    size_t set = 0;
+    size_t camera = 0; // index into the camera model list
+    int tag_id = -1;
+    Eigen::Vector2d corners[4]; // AprilTag order, see tag_detector.h
+};
+
+struct ExtrinsicOptions
+{
+    double tag_size_m = 0.2; // edge length between the detected corners
+    size_t reference = 0;    // camera whose frame the extrinsics are expressed in
+    double huber_px = 2.0;
+    int max_iterations = 100;
+    // a view is dropped when its RMS exceeds this and 3x the median view
+    double outlier_px = 5.0;
+    unsigned threads = 1;
+};
+
+struct CameraExtrinsics
+{
+    // maps points in this camera's frame into the reference camera's, meters;
+    // like calib.py's cam_extr
+    Eigen::Isometry3d camera_to_reference = Eigen::Isometry3d::Identity();
+    bool solved = false;
+    size_t views = 0;    // observations used in the final solve
+    double rms_px = 0;   // of those observations
+};
+
+struct ExtrinsicSolution
+{
+    std::vector<CameraExtrinsics> cameras;
+    size_t tag_poses = 0;     // distinct (set, tag) squares in the solve
+    size_t views = 0;
+    size_t rejected = 0;      // views dropped as outliers
+    int iterations = 0;
+    double rms_px = 0;
+};
+
+// False and fills error if the reference camera saw nothing or the problem is
+// not connected at all. Cameras that share no tag with any placed camera stay
+// unsolved but do not fail the solve.
+bool solve_extrinsics(const std::vector<CameraModel> &cameras,
+                      const std::vector<TagObservation> &observations,
+                      const ExtrinsicOptions &options,
+                      ExtrinsicSolution *solution,
+                      std::string *error);
+
+// Tag pose (tag to camera) from one view, meters. False if it does not converge.
+bool estimate_tag_pose(const CameraModel &camera,
+                       const Eigen::Vector2d corners[4],
+                       double tag_size_m,
+                       Eigen::Isometry3d *tag_to_camera,
+                       double *rms_px);
+
+// RMS corner reprojection error in pixels of a tag at tag_to_camera against
+// detected corners. False if the tag is (partly) behind the camera.
+bool tag_reprojection_rms(const CameraModel &camera,
+                          const Eigen::Isometry3d &tag_to_camera,
+                          const Eigen::Vector2d corners[4],
+                          double tag_size_m,
+                          double *rms_px);
+
+#endif
@@ -0,0 +1,420 @@
+// Solves the rig's extrinsics from a calibration capture (htkrecorder --calibrate).
+//
+//   htkcalibrate [--threads N] [--tag-size-m 0.2] [--reference-index I]
+//                [--quad-decimate 2] [--names SERIAL=NAME,...]
+//                [--reuse-detections] calib_dir
+//
+// Every frame of every set is decoded and searched for tag36h11 tags in
+// parallel, one AprilTag detector per thread. Detections are cached in
+// detections.json; --reuse-detections skips straight to the solve, e.g. to
+// try another tag size or reference. The solve is extrinsic_solver.h.
+//
+// Writes, in the layout infer_hand.py loads:
+//   cam_intr/<name>.pkl   3x3 camera matrix (factory, recording resolution)
+//   cam_extr/<name>.pkl   4x4 camera-to-reference transform, meters
+//   extrinsics.json       the same transforms plus reprojection error per camera
+//   rig_calibration.bin   all of it in one file (rig_calibration.h), for
+//                         htkrecorder --rig-calibration
+// <name> is camera_<index> unless --names maps serials to other names.
+// The reference defaults to the master camera.
+// Exit status: 0 all cameras solved, 1 bad arguments or input, 2 a camera could not be placed.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "../cli.h"
+#include "../json_reader.h"
+#include "../numpy_pickle.h"
+#include "../rig_calibration.h"
+#include "../session_manifest.h"
+#include "camera_model.h"
+#include "extrinsic_solver.h"
+#include "tag_detector.h"
+
+using namespace std::chrono;
+
+struct Camera
+{
+    int index = -1; // device index
+    std::string serial;
+    std::string name;
+    CameraModel model;
+};
+
+struct FrameJob
+{
+    size_t set;
+    size_t camera; // position in the camera list
+    std::string path;
+};
+
+// The capture's own rig_calibration.bin carries the raw factory blobs; a
+// capture from before it existed gets records rebuilt from calibration.json.
+static RigCameraRecord rig_record(const RigCalibration &capture, const Camera &cam, std::string *raw)
+{
+    const int i = rig_find_camera(capture, cam.serial);
+    if (i >= 0)
+    {
+        RigCameraRecord r = capture.cameras[i];
+        *raw = capture.raw[i];
+        std::strncpy(r.name, cam.name.c_str(), sizeof(r.name) - 1);
+        return r;
+    }
+    const CameraModel &m = cam.model;
+    RigCameraRecord r = rig_camera_record(cam.serial, cam.name, cam.index);
+    r.width = m.width;
+    r.height = m.height;
+    r.distortion_model = m.rational ? K4A_CALIBRATION_LENS_DISTORTION_MODEL_RATIONAL_6KT
+                                    : K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY;
+    const double k[9] = { m.fx, 0, m.cx, 0, m.fy, m.cy, 0, 0, 1 };
+    const double v[15] = { m.cx, m.cy, m.fx, m.fy, m.k1, m.k2, m.k3, m.k4,
+                           m.k5, m.k6, m.codx, m.cody, m.p2, m.p1, m.metric_radius };
+    const double cv[8] = { m.k1, m.k2, m.p1, m.p2, m.k3, m.k4, m.k5, m.k6 };
+    std::memcpy(r.camera_matrix, k, sizeof(k));
+    std::memcpy(r.k4a_intrinsics, v, sizeof(v));
+    std::memcpy(r.opencv_distortion, cv, sizeof(cv));
+    r.flags |= kRigIntrinsicsValid;
+    raw->clear();
+    return r;
+}
+
+static std::string detections_path(const std::string &dir)
+{
+    return dir + "/detections.json";
+}
+
+static bool write_text_file(const std::string &path, const std::string &text)
+{
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        out << text;
+        out.close();
+        if (!out)
+            return false;
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+static std::string detections_json(const std::vector<Camera> &cameras, const std::vector<TagObservation> &obs)
+{
+    std::ostringstream out;
+    out << std::setprecision(10);
+    out << "{\n  \"format\": \"htk-tag-detections\",\n  \"version\": 1,\n  \"family\": \"tag36h11\",\n";
+    out << "  \"detections\": [";
+    for (size_t i = 0; i < obs.size(); i++)
+    {
+        const TagObservation &o = obs[i];
+        out << (i ? ",\n" : "\n") << "    {\"set\": " << o.set << ", \"camera\": " << cameras[o.camera].index
+            << ", \"id\": " << o.tag_id << ", \"corners\": [";
+        for (int c = 0; c < 4; c++)
+            out << (c ? ", " : "") << o.corners[c].x() << ", " << o.corners[c].y();
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+static bool load_detections(const std::string &path,
+                            const std::vector<Camera> &cameras,
+                            std::vector<TagObservation> *obs,
+                            std::string *error)
+{
+    JsonValue root;
+    if (!load_json_file(path, &root, error))
+        return false;
+    const JsonValue *list = root.get("detections");
+    if (list == nullptr)
+    {
+        *error = path + " holds no detections";
+        return false;
+    }
+    for (auto &d : list->items)
+    {
+        TagObservation o;
+        o.set = static_cast<size_t>(d.get("set") ? d.get("set")->uint64() : 0);
+        o.tag_id = d.get("id") ? static_cast<int>(d.get("id")->int64()) : -1;
+        const int index = d.get("camera") ? static_cast<int>(d.get("camera")->int64()) : -1;
+        auto cam = std::find_if(cameras.begin(), cameras.end(), [&](const Camera &c) { return c.index == index; });
+        const JsonValue *corners = d.get("corners");
+        if (cam == cameras.end() || corners == nullptr || corners->items.size() != 8)
+        {
+            *error = path + " does not match calibration.json";
+            return false;
+        }
+        o.camera = static_cast<size_t>(cam - cameras.begin());
+        for (int c = 0; c < 4; c++)
+            o.corners[c] = Eigen::Vector2d(corners->items[2 * c].number(), corners->items[2 * c + 1].number());
+        obs->push_back(o);
+    }
+    return true;
+}
+
+static std::vector<TagObservation> detect_all(const std::vector<FrameJob> &jobs,
+                                              const TagDetectorOptions &options,
+                                              unsigned threads,
+                                              size_t *failed)
+{
+    std::vector<std::vector<TagObservation>> found(jobs.size());
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> bad{ 0 };
+    std::mutex log_mutex;
+    auto worker = [&]() {
+        TagDetector detector(options);
+        std::vector<uint8_t> gray;
+        size_t j;
+        while ((j = next.fetch_add(1)) < jobs.size())
+        {
+            int width = 0, height = 0;
+            std::string error;
+            if (!decode_jpeg_gray(jobs[j].path, &gray, &width, &height, &error))
+            {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << error << std::endl;
+                bad++;
+                continue;
+            }
+            for (const TagDetection &d : detector.detect(gray.data(), width, height, width))
+            {
+                TagObservation o;
+                o.set = jobs[j].set;
+                o.camera = jobs[j].camera;
+                o.tag_id = d.id;
+                for (int c = 0; c < 4; c++)
+                    o.corners[c] = Eigen::Vector2d(d.corners[c][0], d.corners[c][1]);
+                found[j].push_back(o);
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+
+    *failed = bad;
+    std::vector<TagObservation> all;
+    for (auto &f : found)
+        all.insert(all.end(), f.begin(), f.end());
+    return all;
+}
+
+static void make_dir(const std::string &path)
+{
+    mkdir(path.c_str(), 0755);
+}
+
+static bool file_exists(const std::string &path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argv[argc - 1][0] == '-')
+        die("Usage: htkcalibrate [--threads N] [--tag-size-m M] [--reference-index I] [--quad-decimate D] "
+            "[--names SERIAL=NAME,...] [--reuse-detections] calib_dir");
+    std::string dir = argv[argc - 1];
+    while (dir.size() > 1 && dir.back() == '/')
+        dir.pop_back();
+
+    std::string tmp;
+    ExtrinsicOptions solve;
+    solve.threads = std::max(1u, std::thread::hardware_concurrency());
+    if (parse_arg_value(argc, argv, "--threads", tmp))
+        solve.threads = static_cast<unsigned>(std::max(1, std::stoi(tmp)));
+    if (parse_arg_value(argc, argv, "--tag-size-m", tmp))
+        solve.tag_size_m = std::stod(tmp);
+    if (solve.tag_size_m <= 0)
+        die("--tag-size-m must be positive.");
+    TagDetectorOptions detect;
+    if (parse_arg_value(argc, argv, "--quad-decimate", tmp))
+        detect.quad_decimate = std::stof(tmp);
+    const bool reuse = has_flag(argc, argv, "--reuse-detections");
+
+    JsonValue index;
+    std::string error;
+    if (!load_json_file(dir + "/calibration.json", &index, &error))
+        die(error);
+    const JsonValue *devices = index.get("devices");
+    const JsonValue *sets = index.get("sets");
+    if (devices == nullptr || sets == nullptr)
+        die(dir + "/calibration.json is not a calibration index.");
+
+    // serial -> name overrides, e.g. infer_hand.py's CAMERA_INFO
+    std::map<std::string, std::string> names;
+    if (parse_arg_value(argc, argv, "--names", tmp))
+    {
+        std::stringstream list(tmp);
+        std::string item;
+        while (std::getline(list, item, ','))
+        {
+            size_t eq = item.find('=');
+            if (eq == std::string::npos)
+                die("--names takes SERIAL=NAME pairs separated by commas.");
+            names[item.substr(0, eq)] = item.substr(eq + 1);
+        }
+    }
+
+    std::vector<Camera> cameras;
+    const int master_index = index.get("master_index") ? static_cast<int>(index.get("master_index")->int64()) : 0;
+    int reference_index = master_index;
+    if (parse_arg_value(argc, argv, "--reference-index", tmp))
+        reference_index = std::stoi(tmp);
+    solve.reference = devices->items.size();
+    for (auto &d : devices->items)
+    {
+        Camera cam;
+        cam.index = d.get("index") ? static_cast<int>(d.get("index")->int64()) : -1;
+        cam.serial = d.get("serial") ? d.get("serial")->str() : "";
+        cam.name = names.count(cam.serial) ? names[cam.serial] : d.get("name") ? d.get("name")->str() : "";
+        if (cam.name.empty())
+            cam.name = "camera_" + std::to_string(cam.index);
+        if (!camera_model_from_json(d, &cam.model, &error))
+            die(dir + "/calibration.json: " + error);
+        if (cam.index == reference_index)
+            solve.reference = cameras.size();
+        cameras.push_back(cam);
+    }
+    if (solve.reference >= cameras.size())
+        die("No camera with index " + std::to_string(reference_index) + " to use as the reference.");
+
+    std::vector<TagObservation> observations;
+    const auto t0 = steady_clock::now();
+    if (reuse || !tag_detection_available())
+    {
+        if (!reuse)
+            std::cout << "Built without AprilTag detection; using " << detections_path(dir) << std::endl;
+        if (!load_detections(detections_path(dir), cameras, &observations, &error))
+            die(error);
+    }
+    else
+    {
+        std::vector<FrameJob> jobs;
+        for (size_t s = 0; s < sets->items.size(); s++)
+        {
+            const JsonValue *frames = sets->items[s].get("frames");
+            if (frames == nullptr || frames->items.size() != cameras.size())
+                die("Set " + std::to_string(s) + " in calibration.json does not have one frame per camera.");
+            for (size_t c = 0; c < cameras.size(); c++)
+            {
+                const JsonValue *file = frames->items[c].get("file");
+                jobs.push_back({ s, c, dir + "/" + (file ? file->str() : "") });
+            }
+        }
+        size_t failed = 0;
+        observations = detect_all(jobs, detect, solve.threads, &failed);
+        if (failed > 0)
+            std::cerr << failed << " frame(s) could not be decoded." << std::endl;
+        if (!write_text_file(detections_path(dir), detections_json(cameras, observations)))
+            std::cerr << "Unable to write " << detections_path(dir) << std::endl;
+        std::cout << "Detected " << observations.size() << " tag(s) in " << jobs.size() << " frame(s) in " << std::fixed
+                  << std::setprecision(2) << duration<double>(steady_clock::now() - t0).count() << " s ("
+                  << solve.threads << " threads)" << std::endl;
+    }
+
+    const auto t1 = steady_clock::now();
+    std::vector<CameraModel> models;
+    for (auto &c : cameras)
+        models.push_back(c.model);
+    ExtrinsicSolution solution;
+    if (!solve_extrinsics(models, observations, solve, &solution, &error))
+        die("Extrinsic solve failed: " + error);
+    std::cout << "Solved " << solution.tag_poses << " tag pose(s) from " << solution.views << " view(s) in "
+              << std::fixed << std::setprecision(2) << duration<double>(steady_clock::now() - t1).count() << " s, "
+              << solution.iterations << " iterations, RMS " << solution.rms_px << " px, " << solution.rejected
+              << " view(s) rejected" << std::endl;
+
+    make_dir(dir + "/cam_intr");
+    make_dir(dir + "/cam_extr");
+    std::ostringstream json;
+    json << std::setprecision(10);
+    json << "{\n  \"format\": \"htk-extrinsics\",\n  \"version\": 1,\n";
+    json << "  \"created_utc\": " << json_string(utc_timestamp_now()) << ",\n";
+    json << "  \"reference\": " << json_string(cameras[solve.reference].name) << ",\n";
+    json << "  \"tag_family\": \"tag36h11\",\n  \"tag_size_m\": " << solve.tag_size_m << ",\n";
+    json << "  \"rms_px\": " << solution.rms_px << ",\n  \"views\": " << solution.views << ",\n  \"rejected_views\": "
+         << solution.rejected << ",\n";
+    json << "  \"cameras\": [";
+
+    RigCalibration capture_rig, rig;
+    const std::string rig_path = dir + "/" + kRigCalibrationFile;
+    if (file_exists(rig_path) && !load_rig_calibration(rig_path, &capture_rig, nullptr, &error))
+        std::cerr << error << "; rebuilding it from calibration.json" << std::endl;
+    rig.reference = static_cast<int32_t>(solve.reference);
+
+    size_t unsolved = 0;
+    for (size_t c = 0; c < cameras.size(); c++)
+    {
+        const Camera &cam = cameras[c];
+        const CameraExtrinsics &e = solution.cameras[c];
+        const Eigen::Matrix3d k = cam.model.matrix();
+        double k_rows[9];
+        for (int r = 0; r < 3; r++)
+            for (int col = 0; col < 3; col++)
+                k_rows[r * 3 + col] = k(r, col);
+        if (!write_numpy_pickle(dir + "/cam_intr/" + cam.name + ".pkl", k_rows, 3, 3, &error))
+            die(error);
+
+        const Eigen::Matrix4d t = e.camera_to_reference.matrix();
+        double t_rows[16];
+        for (int r = 0; r < 4; r++)
+            for (int col = 0; col < 4; col++)
+                t_rows[r * 4 + col] = t(r, col);
+        rig.raw.emplace_back();
+        rig.cameras.push_back(rig_record(capture_rig, cam, &rig.raw.back()));
+        if (e.solved)
+        {
+            if (!write_numpy_pickle(dir + "/cam_extr/" + cam.name + ".pkl", t_rows, 4, 4, &error))
+                die(error);
+            RigCameraRecord &r = rig.cameras.back();
+            std::memcpy(r.camera_to_reference, t_rows, sizeof(t_rows));
+            r.rms_px = e.rms_px;
+            r.flags |= kRigExtrinsicsSolved;
+        }
+        else
+        {
+            unsolved++;
+            std::cerr << cam.name << " (" << cam.serial << ") shares no tag view with the other cameras." << std::endl;
+        }
+
+        json << (c ? ",\n" : "\n") << "    {\"index\": " << cam.index << ", \"serial\": " << json_string(cam.serial)
+             << ", \"name\": " << json_string(cam.name) << ", \"solved\": " << (e.solved ? "true" : "false")
+             << ", \"views\": " << e.views << ", \"rms_px\": " << e.rms_px;
+        if (e.solved)
+        {
+            json << ",\n     \"camera_to_reference\": [";
+            for (int i = 0; i < 16; i++)
+                json << (i ? ", " : "") << t_rows[i];
+            json << "]";
+        }
+        json << "}";
+        std::cout << "  " << cam.name << ": " << (e.solved ? "" : "NOT SOLVED, ") << e.views << " view(s), RMS "
+                  << e.rms_px << " px" << std::endl;
+    }
+    json << "\n  ]\n}\n";
+    if (!write_text_file(dir + "/extrinsics.json", json.str()))
+        die("Unable to write " + dir + "/extrinsics.json");
+    uint64_t rig_id = 0;
+    if (!write_rig_calibration(rig_path, rig, &rig_id, &error))
+        die(error);
+
+    std::cout << "Wrote " << dir << "/cam_intr, " << dir << "/cam_extr, " << dir << "/extrinsics.json and " << rig_path
+              << " (" << rig_id_hex(rig_id) << ")" << std::endl;
+    return unsolved ? 2 : 0;
+}
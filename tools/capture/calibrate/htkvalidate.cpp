@@ -0,0 +1,748 @@
+// Checks a rig calibration against what the cameras actually recorded.
+//
+//   htkvalidate [--threads N] [--interval-s 10] [--tag-size-m 0.2]
+//               [--decode-scale 1] [--quad-decimate 2] [--max-px 3]
+//               [--rig-calibration FILE] [--json report.json]
+//               session_manifest.json|DIR ...
+//
+// Directories are searched for session_manifest.json, so a week of takes is
+// one argument. Every --interval-s seconds of each session a synchronized set
+// is sampled: a master frame and each other camera's frame nearest it in host
+// time. The sets are found from the frame metadata tracks alone, without
+// touching an image. The sampled frames of all sessions are then decoded and
+// searched for tag36h11 tags in parallel, one detector per thread, each job a
+// short run of frames from one recording so seeks stay forward.
+//
+// Two reprojection errors per camera, RMS over a tag's four corners in pixels:
+//   single  the tag pose fitted to this view alone; high means poor
+//           intrinsics or poor detections
+//   cross   the tag pose from every other camera that saw the tag in the same
+//           set, carried over by the extrinsics and projected into this
+//           camera; the (lower) median over those cameras is taken, so one
+//           bad camera does not make the others look bad. Needs solved
+//           extrinsics.
+// The calibration is the one attached to the recordings (rig_calibration.h),
+// else rig_calibration.bin next to the manifest. --rig-calibration uses one
+// file for every session instead, e.g. to try a new calibration on old takes.
+// Exit status: 0 all good, 1 bad arguments or no usable session, 2 a camera's
+// median cross error is above --max-px.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <k4arecord/playback.h>
+
+#include "../cli.h"
+#include "../frame_metadata.h"
+#include "../json_reader.h"
+#include "../rig_calibration.h"
+#include "../session_manifest.h"
+#include "../undistort/jpeg_image.h"
+#include "camera_model.h"
+#include "extrinsic_solver.h"
+#include "tag_detector.h"
+
+using namespace std::chrono;
+
+// frames per detection job; all from one recording
+static const size_t kRunFrames = 8;
+
+struct Recording // one segment file
+{
+    size_t session = 0;
+    size_t camera = 0;
+    std::string path;
+    std::vector<FrameMetadata> frames;
+    std::string problem;
+};
+
+struct ValidationCamera
+{
+    int index = -1;
+    std::string serial;
+    std::string name;
+    CameraModel model;
+    bool has_model = false;
+    bool has_extrinsics = false;
+    Eigen::Isometry3d camera_to_reference = Eigen::Isometry3d::Identity();
+    std::vector<size_t> recordings;
+    size_t frames = 0;    // sampled
+    size_t undecoded = 0; // sampled but not found or not decodable
+    size_t views = 0;     // tags seen
+    std::vector<double> single_px, cross_px;
+};
+
+struct SessionEntry
+{
+    std::string manifest;
+    std::string dir;
+    std::string rig_id;
+    std::string rig_source; // "attachment", "file" or "override"
+    std::vector<ValidationCamera> cameras;
+    size_t master = 0;
+    size_t sets = 0;
+    std::string problem; // not validated when set
+};
+
+struct Sample
+{
+    size_t session = 0;
+    size_t set = 0;
+    size_t camera = 0;
+    size_t recording = 0;
+    uint64_t device_usec = 0;
+    bool decoded = false;
+    std::vector<TagDetection> tags; // corners at full resolution
+};
+
+struct DetectJob
+{
+    size_t first, count; // into the sorted sample order
+};
+
+static void parallel_for(size_t count, unsigned threads, const std::function<void(size_t)> &fn)
+{
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < count)
+            fn(i);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads && t < count; t++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &t : pool)
+        t.join();
+}
+
+static std::string dirname_of(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+static void find_manifests(const std::string &path, std::vector<std::string> *out)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        die(path + " does not exist.");
+    if (!S_ISDIR(st.st_mode))
+    {
+        out->push_back(path);
+        return;
+    }
+    std::vector<std::string> entries;
+    if (DIR *d = opendir(path.c_str()))
+    {
+        while (dirent *e = readdir(d))
+            if (std::strcmp(e->d_name, ".") != 0 && std::strcmp(e->d_name, "..") != 0)
+                entries.push_back(e->d_name);
+        closedir(d);
+    }
+    std::sort(entries.begin(), entries.end());
+    for (auto &e : entries)
+    {
+        const std::string child = path + "/" + e;
+        if (stat(child.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            find_manifests(child, out);
+        else if (e == "session_manifest.json")
+            out->push_back(child);
+    }
+}
+
+// Devices, recordings and calibration of one session. Problems that make the
+// session unusable go into entry->problem.
+static void load_session(const std::string &manifest_path,
+                         const RigCalibration *override_rig,
+                         uint64_t override_id,
+                         size_t session,
+                         SessionEntry *entry,
+                         std::vector<Recording> *recordings)
+{
+    entry->manifest = manifest_path;
+    entry->dir = dirname_of(manifest_path);
+    JsonValue manifest;
+    std::string error;
+    if (!load_json_file(manifest_path, &manifest, &error))
+    {
+        entry->problem = error;
+        return;
+    }
+    const JsonValue *devices = manifest.get("devices");
+    if (devices == nullptr || devices->type != JsonValue::Array)
+    {
+        entry->problem = "not a session manifest";
+        return;
+    }
+    const JsonValue *master = manifest.get("master");
+    const int master_index = master && master->get("index") ? static_cast<int>(master->get("index")->int64()) : 0;
+
+    for (auto &d : devices->items)
+    {
+        ValidationCamera cam;
+        cam.index = d.get("index") ? static_cast<int>(d.get("index")->int64()) : -1;
+        cam.serial = d.get("serial") ? d.get("serial")->str() : "";
+        cam.name = "camera_" + std::to_string(cam.index);
+        if (cam.index == master_index)
+            entry->master = entry->cameras.size();
+        if (const JsonValue *segments = d.get("segments"))
+        {
+            for (auto &s : segments->items)
+            {
+                Recording r;
+                r.session = session;
+                r.camera = entry->cameras.size();
+                const std::string file = s.get("file") ? s.get("file")->str() : "";
+                r.path = file.empty() || file[0] == '/' ? file : entry->dir + "/" + file;
+                cam.recordings.push_back(recordings->size());
+                recordings->push_back(r);
+            }
+        }
+        entry->cameras.push_back(cam);
+    }
+
+    RigCalibration rig;
+    uint64_t rig_id = 0;
+    if (override_rig)
+    {
+        rig = *override_rig;
+        rig_id = override_id;
+        entry->rig_source = "override";
+    }
+    else
+    {
+        // the recordings carry the calibration they were made with
+        std::string attached;
+        for (auto &cam : entry->cameras)
+        {
+            if (!cam.recordings.empty() &&
+                read_recording_rig_calibration((*recordings)[cam.recordings.front()].path, &attached))
+                break;
+            attached.clear();
+        }
+        if (!attached.empty() && rig_calibration_decode(reinterpret_cast<const uint8_t *>(attached.data()),
+                                                        attached.size(), &rig, &rig_id, &error))
+        {
+            entry->rig_source = "attachment";
+        }
+        else
+        {
+            const JsonValue *listed = manifest.get("rig_calibration");
+            const std::string file =
+                listed && listed->get("file") ? listed->get("file")->str() : std::string(kRigCalibrationFile);
+            if (!load_rig_calibration(entry->dir + "/" + file, &rig, &rig_id, &error))
+            {
+                entry->problem = "no rig calibration attached or next to the manifest";
+                return;
+            }
+            entry->rig_source = "file";
+        }
+    }
+    entry->rig_id = rig_id_hex(rig_id);
+
+    size_t usable = 0;
+    for (auto &cam : entry->cameras)
+    {
+        const int i = rig_find_camera(rig, cam.serial);
+        if (i < 0)
+            continue;
+        const RigCameraRecord &r = rig.cameras[i];
+        cam.name = r.name;
+        cam.has_model = camera_model_from_rig(r, &cam.model, &error);
+        if (cam.has_model && (r.flags & kRigExtrinsicsSolved))
+        {
+            double t[16];
+            std::memcpy(t, r.camera_to_reference, sizeof(t));
+            cam.camera_to_reference.matrix() = Eigen::Map<Eigen::Matrix<double, 4, 4, Eigen::RowMajor>>(t);
+            cam.has_extrinsics = true;
+        }
+        usable += cam.has_model ? 1 : 0;
+    }
+    if (usable == 0)
+        entry->problem = "no camera of the session is in the rig calibration";
+}
+
+// Picks synchronized sets from the host timestamps in the frame metadata.
+static void sample_sets(const std::vector<Recording> &recordings,
+                        double interval_s,
+                        size_t session,
+                        SessionEntry *entry,
+                        std::vector<Sample> *samples)
+{
+    struct Frame
+    {
+        uint64_t system_ns;
+        uint64_t device_usec;
+        size_t recording;
+        bool operator<(const Frame &o) const
+        {
+            return system_ns < o.system_ns;
+        }
+    };
+    std::vector<std::vector<Frame>> frames(entry->cameras.size());
+    for (size_t c = 0; c < entry->cameras.size(); c++)
+    {
+        if (!entry->cameras[c].has_model)
+            continue;
+        for (size_t r : entry->cameras[c].recordings)
+            for (const FrameMetadata &m : recordings[r].frames)
+                if (m.system_timestamp_nsec != 0 && !(m.flags & kFrameCorrupt))
+                    frames[c].push_back({ m.system_timestamp_nsec, m.device_timestamp_usec, r });
+        std::sort(frames[c].begin(), frames[c].end());
+    }
+
+    const std::vector<Frame> &master = frames[entry->master];
+    if (master.size() < 2)
+    {
+        entry->problem = "the master has no usable frame metadata";
+        return;
+    }
+    std::vector<uint64_t> gaps;
+    for (size_t i = 1; i < master.size(); i++)
+        gaps.push_back(master[i].system_ns - master[i - 1].system_ns);
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+    const uint64_t tolerance_ns = gaps[gaps.size() / 2] / 2;
+    const uint64_t interval_ns = static_cast<uint64_t>(interval_s * 1e9);
+
+    uint64_t next_ns = 0;
+    for (const Frame &m : master)
+    {
+        if (m.system_ns < next_ns)
+            continue;
+        std::vector<Sample> set;
+        for (size_t c = 0; c < frames.size(); c++)
+        {
+            const Frame *match = nullptr;
+            if (c == entry->master)
+            {
+                match = &m;
+            }
+            else if (!frames[c].empty())
+            {
+                auto it = std::lower_bound(frames[c].begin(), frames[c].end(), m);
+                const Frame *best = nullptr;
+                uint64_t best_gap = UINT64_MAX;
+                for (auto k : { it, it == frames[c].begin() ? it : it - 1 })
+                {
+                    if (k == frames[c].end())
+                        continue;
+                    const uint64_t gap = k->system_ns > m.system_ns ? k->system_ns - m.system_ns : m.system_ns - k->system_ns;
+                    if (gap < best_gap)
+                    {
+                        best_gap = gap;
+                        best = &*k;
+                    }
+                }
+                if (best && best_gap <= tolerance_ns)
+                    match = best;
+            }
+            if (match == nullptr)
+                continue;
+            Sample s;
+            s.session = session;
+            s.set = entry->sets;
+            s.camera = c;
+            s.recording = match->recording;
+            s.device_usec = match->device_usec;
+            set.push_back(s);
+        }
+        if (set.size() < 2)
+            continue; // nothing to compare across
+        samples->insert(samples->end(), set.begin(), set.end());
+        entry->sets++;
+        next_ns = m.system_ns + interval_ns;
+    }
+}
+
+// Decodes and searches one run of frames from a recording.
+static void detect_run(const std::vector<Recording> &recordings,
+                       const std::vector<size_t> &order,
+                       const DetectJob &job,
+                       int decode_scale,
+                       TagDetector &detector,
+                       std::vector<Sample> *samples)
+{
+    const std::string &path = recordings[(*samples)[order[job.first]].recording].path;
+    k4a_playback_t playback = nullptr;
+    if (K4A_FAILED(k4a_playback_open(path.c_str(), &playback)))
+        return;
+    std::vector<uint8_t> gray;
+    for (size_t i = job.first; i < job.first + job.count; i++)
+    {
+        Sample &s = (*samples)[order[i]];
+        if (K4A_FAILED(k4a_playback_seek_timestamp(playback, static_cast<int64_t>(s.device_usec),
+                                                   K4A_PLAYBACK_SEEK_DEVICE_TIME)))
+            continue;
+        // the seek lands on or just before the frame
+        k4a_image_t color = nullptr;
+        for (int tries = 0; tries < 3 && color == nullptr; tries++)
+        {
+            k4a_capture_t cap = nullptr;
+            if (k4a_playback_get_next_capture(playback, &cap) != K4A_STREAM_RESULT_SUCCEEDED)
+                break;
+            k4a_image_t image = k4a_capture_get_color_image(cap);
+            k4a_capture_release(cap);
+            if (image == nullptr)
+                continue;
+            const uint64_t ts = k4a_image_get_device_timestamp_usec(image);
+            if (ts >= s.device_usec)
+            {
+                if (ts == s.device_usec && k4a_image_get_format(image) == K4A_IMAGE_FORMAT_COLOR_MJPG)
+                    color = image;
+                else
+                    k4a_image_release(image);
+                break;
+            }
+            k4a_image_release(image);
+        }
+        if (color == nullptr)
+            continue;
+
+        int width = 0, height = 0;
+        std::string error;
+        s.decoded = decode_jpeg_memory(k4a_image_get_buffer(color), k4a_image_get_size(color), 1, decode_scale, &gray,
+                                       &width, &height, &error);
+        k4a_image_release(color);
+        if (!s.decoded)
+            continue;
+        for (TagDetection t : detector.detect(gray.data(), width, height, width))
+        {
+            for (int c = 0; c < 4; c++)
+                for (int k = 0; k < 2; k++)
+                    t.corners[c][k] = (t.corners[c][k] + 0.5) * decode_scale - 0.5;
+            s.tags.push_back(t);
+        }
+    }
+    k4a_playback_close(playback);
+}
+
+// Single and cross errors of one set's views.
+static void score_set(const std::vector<Sample> &samples,
+                      size_t first,
+                      size_t count,
+                      double tag_size_m,
+                      SessionEntry *entry)
+{
+    struct View
+    {
+        size_t camera;
+        Eigen::Vector2d corners[4];
+        Eigen::Isometry3d tag_to_camera;
+        bool posed = false;
+    };
+    std::map<int, std::vector<View>> tags;
+    for (size_t i = first; i < first + count; i++)
+    {
+        for (const TagDetection &t : samples[i].tags)
+        {
+            View v;
+            v.camera = samples[i].camera;
+            for (int c = 0; c < 4; c++)
+                v.corners[c] = Eigen::Vector2d(t.corners[c][0], t.corners[c][1]);
+            tags[t.id].push_back(v);
+        }
+    }
+
+    for (auto &tag : tags)
+    {
+        for (View &v : tag.second)
+        {
+            ValidationCamera &cam = entry->cameras[v.camera];
+            double rms = 0;
+            cam.views++;
+            v.posed = estimate_tag_pose(cam.model, v.corners, tag_size_m, &v.tag_to_camera, &rms);
+            if (v.posed)
+                cam.single_px.push_back(rms);
+        }
+        for (const View &dst : tag.second)
+        {
+            ValidationCamera &cam = entry->cameras[dst.camera];
+            if (!cam.has_extrinsics)
+                continue;
+            const Eigen::Isometry3d reference_to_dst = cam.camera_to_reference.inverse();
+            std::vector<double> errors;
+            for (const View &src : tag.second)
+            {
+                const ValidationCamera &from = entry->cameras[src.camera];
+                if (src.camera == dst.camera || !src.posed || !from.has_extrinsics)
+                    continue;
+                double rms = 0;
+                if (tag_reprojection_rms(cam.model, reference_to_dst * from.camera_to_reference * src.tag_to_camera,
+                                         dst.corners, tag_size_m, &rms))
+                    errors.push_back(rms);
+            }
+            if (errors.empty())
+                continue;
+            // the lower median: with two other cameras, one that agrees is enough
+            const size_t mid = (errors.size() - 1) / 2;
+            std::nth_element(errors.begin(), errors.begin() + mid, errors.end());
+            cam.cross_px.push_back(errors[mid]);
+        }
+    }
+}
+
+struct Distribution
+{
+    size_t count = 0;
+    double p50 = 0, p90 = 0, p99 = 0, max = 0;
+};
+
+static Distribution distribution(std::vector<double> v)
+{
+    Distribution d;
+    d.count = v.size();
+    if (v.empty())
+        return d;
+    std::sort(v.begin(), v.end());
+    auto at = [&](double q) { return v[std::min(v.size() - 1, static_cast<size_t>(q * v.size()))]; };
+    d.p50 = at(0.5);
+    d.p90 = at(0.9);
+    d.p99 = at(0.99);
+    d.max = v.back();
+    return d;
+}
+
+static std::string distribution_json(const Distribution &d)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3) << "{\"count\": " << d.count << ", \"p50\": " << d.p50
+        << ", \"p90\": " << d.p90 << ", \"p99\": " << d.p99 << ", \"max\": " << d.max << "}";
+    return out.str();
+}
+
+static bool write_text_file(const std::string &path, const std::string &text)
+{
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::trunc);
+        out << text;
+        out.close();
+        if (!out)
+            return false;
+    }
+    return std::rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const value_flags[] = { "--threads",       "--interval-s",    "--tag-size-m", "--decode-scale",
+                                               "--quad-decimate", "--max-px",        "--json",       "--rig-calibration" };
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            inputs.push_back(argv[i]);
+            continue;
+        }
+        for (const char *flag : value_flags)
+            if (std::strcmp(argv[i], flag) == 0)
+                i++;
+    }
+    if (inputs.empty())
+        die("Usage: htkvalidate [--threads N] [--interval-s S] [--tag-size-m M] [--decode-scale 1|2|4|8] "
+            "[--quad-decimate D] [--max-px P] [--rig-calibration FILE] [--json report.json] "
+            "session_manifest.json|DIR ...");
+    if (!tag_detection_available())
+        die("htkvalidate needs AprilTag detection, which this build does not have.");
+
+    std::string tmp;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (parse_arg_value(argc, argv, "--threads", tmp))
+        threads = static_cast<unsigned>(std::max(1, std::stoi(tmp)));
+    double interval_s = 10;
+    if (parse_arg_value(argc, argv, "--interval-s", tmp))
+        interval_s = std::stod(tmp);
+    double tag_size_m = 0.2;
+    if (parse_arg_value(argc, argv, "--tag-size-m", tmp))
+        tag_size_m = std::stod(tmp);
+    if (interval_s <= 0 || tag_size_m <= 0)
+        die("--interval-s and --tag-size-m must be positive.");
+    int decode_scale = 1;
+    if (parse_arg_value(argc, argv, "--decode-scale", tmp))
+        decode_scale = std::stoi(tmp);
+    if (decode_scale != 1 && decode_scale != 2 && decode_scale != 4 && decode_scale != 8)
+        die("--decode-scale is 1, 2, 4 or 8.");
+    TagDetectorOptions detect;
+    if (parse_arg_value(argc, argv, "--quad-decimate", tmp))
+        detect.quad_decimate = std::stof(tmp);
+    if (decode_scale > 1)
+        detect.quad_decimate = std::max(1.0f, detect.quad_decimate / decode_scale);
+    double max_px = 3;
+    if (parse_arg_value(argc, argv, "--max-px", tmp))
+        max_px = std::stod(tmp);
+
+    std::string error;
+    RigCalibration override_rig;
+    uint64_t override_id = 0;
+    const bool have_override = parse_arg_value(argc, argv, "--rig-calibration", tmp);
+    if (have_override && !load_rig_calibration(tmp, &override_rig, &override_id, &error))
+        die(error);
+
+    std::vector<std::string> manifests;
+    for (auto &in : inputs)
+        find_manifests(in, &manifests);
+    if (manifests.empty())
+        die("No session_manifest.json found.");
+
+    const auto t0 = steady_clock::now();
+    std::vector<SessionEntry> sessions(manifests.size());
+    std::vector<Recording> recordings;
+    for (size_t i = 0; i < manifests.size(); i++)
+        load_session(manifests[i], have_override ? &override_rig : nullptr, override_id, i, &sessions[i], &recordings);
+
+    parallel_for(recordings.size(), threads, [&](size_t i) {
+        Recording &r = recordings[i];
+        if (!sessions[r.session].problem.empty() || !sessions[r.session].cameras[r.camera].has_model)
+            return;
+        std::string e;
+        if (!read_frame_metadata(r.path, &r.frames, &e))
+            r.problem = e;
+    });
+    for (auto &r : recordings)
+        if (!r.problem.empty())
+            std::cerr << r.problem << std::endl;
+
+    std::vector<Sample> samples;
+    for (size_t i = 0; i < sessions.size(); i++)
+        if (sessions[i].problem.empty())
+            sample_sets(recordings, interval_s, i, &sessions[i], &samples);
+
+    // runs of frames in recording order, so each job seeks forward through one file
+    std::vector<size_t> order(samples.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return samples[a].recording != samples[b].recording ? samples[a].recording < samples[b].recording
+                                                            : samples[a].device_usec < samples[b].device_usec;
+    });
+    std::vector<DetectJob> jobs;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        if (jobs.empty() || jobs.back().count == kRunFrames ||
+            samples[order[jobs.back().first]].recording != samples[order[i]].recording)
+            jobs.push_back({ i, 0 });
+        jobs.back().count++;
+    }
+    const auto t1 = steady_clock::now();
+
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        TagDetector detector(detect);
+        size_t j;
+        while ((j = next.fetch_add(1)) < jobs.size())
+            detect_run(recordings, order, jobs[j], decode_scale, detector, &samples);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads && i < jobs.size(); i++)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+    const auto t2 = steady_clock::now();
+
+    // samples of a set are contiguous
+    for (size_t i = 0; i < samples.size();)
+    {
+        size_t end = i;
+        while (end < samples.size() && samples[end].session == samples[i].session && samples[end].set == samples[i].set)
+            end++;
+        SessionEntry &entry = sessions[samples[i].session];
+        for (size_t k = i; k < end; k++)
+        {
+            ValidationCamera &cam = entry.cameras[samples[k].camera];
+            cam.frames++;
+            cam.undecoded += samples[k].decoded ? 0 : 1;
+        }
+        score_set(samples, i, end - i, tag_size_m, &entry);
+        i = end;
+    }
+
+    size_t validated = 0, bad_cameras = 0;
+    std::ostringstream json;
+    json << "{\n  \"format\": \"htk-validation\",\n  \"version\": 1,\n";
+    json << "  \"created_utc\": " << json_string(utc_timestamp_now()) << ",\n";
+    json << "  \"tag_size_m\": " << tag_size_m << ",\n  \"interval_s\": " << interval_s << ",\n  \"max_px\": " << max_px
+         << ",\n";
+    json << "  \"sessions\": [";
+    for (size_t i = 0; i < sessions.size(); i++)
+    {
+        const SessionEntry &entry = sessions[i];
+        json << (i ? ",\n" : "\n") << "    {\"manifest\": " << json_string(entry.manifest);
+        if (!entry.problem.empty())
+        {
+            std::cout << entry.manifest << ": skipped, " << entry.problem << std::endl;
+            json << ", \"problem\": " << json_string(entry.problem) << "}";
+            continue;
+        }
+        validated++;
+        std::cout << entry.manifest << ": rig " << entry.rig_id << " (" << entry.rig_source << "), " << entry.sets
+                  << " set(s)" << std::endl;
+        json << ", \"rig_calibration_id\": " << json_string(entry.rig_id)
+             << ", \"rig_calibration_source\": " << json_string(entry.rig_source) << ", \"sets\": " << entry.sets
+             << ", \"cameras\": [";
+        for (size_t c = 0; c < entry.cameras.size(); c++)
+        {
+            const ValidationCamera &cam = entry.cameras[c];
+            const Distribution single = distribution(cam.single_px);
+            const Distribution cross = distribution(cam.cross_px);
+            const bool bad = cross.count > 0 && cross.p50 > max_px;
+            bad_cameras += bad ? 1 : 0;
+            std::cout << "  " << std::left << std::setw(12) << cam.name << std::right << " (" << cam.serial << ") ";
+            if (!cam.has_model)
+                std::cout << "not in the rig calibration" << std::endl;
+            else
+                std::cout << std::fixed << std::setprecision(2) << cam.frames << " frame(s), " << cam.views
+                          << " tag view(s), single p50 " << single.p50 << " p90 " << single.p90 << " px, cross p50 "
+                          << cross.p50 << " p90 " << cross.p90 << " p99 " << cross.p99 << " max " << cross.max
+                          << " px (" << cross.count << ")" << (bad ? "  BAD" : "") << std::endl;
+            json << (c ? ",\n" : "\n") << "      {\"index\": " << cam.index << ", \"serial\": " << json_string(cam.serial)
+                 << ", \"name\": " << json_string(cam.name) << ", \"calibrated\": " << (cam.has_model ? "true" : "false")
+                 << ", \"extrinsics\": " << (cam.has_extrinsics ? "true" : "false") << ", \"frames\": " << cam.frames
+                 << ", \"undecoded\": " << cam.undecoded << ", \"tag_views\": " << cam.views
+                 << ", \"single_px\": " << distribution_json(single) << ", \"cross_px\": " << distribution_json(cross)
+                 << ", \"ok\": " << (bad ? "false" : "true") << "}";
+        }
+        json << "\n    ]}";
+    }
+    json << "\n  ]\n}\n";
+
+    size_t frames = 0;
+    for (auto &s : samples)
+        frames += s.decoded ? 1 : 0;
+    std::cout << "Validated " << validated << " of " << sessions.size() << " session(s): " << frames
+              << " frame(s) decoded and searched in " << std::fixed << std::setprecision(2)
+              << duration<double>(t2 - t1).count() << " s, " << duration<double>(t2 - t0).count() << " s in all ("
+              << threads << " threads)" << std::endl;
+
+    if (parse_arg_value(argc, argv, "--json", tmp) && !write_text_file(tmp, json.str()))
+        die("Unable to write " + tmp);
+    if (validated == 0)
+        return 1;
+    if (bad_cameras > 0)
+    {
+        std::cerr << bad_cameras << " camera(s) have a median cross-camera error above " << max_px << " px."
+                  << std::endl;
+        return 2;
+    }
+    return 0;
+}
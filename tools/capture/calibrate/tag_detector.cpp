@@ -0,0 +1,148 @@
+#include "tag_detector.h"
+
+#include <csetjmp>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include <jpeglib.h>
+
+#ifdef HTK_HAVE_APRILTAG
+#include <apriltag/apriltag.h>
+#include <apriltag/tag36h11.h>
+#endif
+
+bool tag_detection_available()
+{
+#ifdef HTK_HAVE_APRILTAG
+    return true;
+#else
+    return false;
+#endif
+}
+
+TagDetector::TagDetector(const TagDetectorOptions &options) : m_options(options)
+{
+#ifdef HTK_HAVE_APRILTAG
+    apriltag_family_t *family = tag36h11_create();
+    apriltag_detector_t *detector = apriltag_detector_create();
+    apriltag_detector_add_family_bits(detector, family, options.max_hamming);
+    detector->quad_decimate = options.quad_decimate;
+    detector->quad_sigma = options.quad_sigma;
+    detector->refine_edges = options.refine_edges;
+    detector->decode_sharpening = options.decode_sharpening;
+    // frames are spread over threads instead
+    detector->nthreads = 1;
+    m_family = family;
+    m_detector = detector;
+#endif
+}
+
+TagDetector::~TagDetector()
+{
+#ifdef HTK_HAVE_APRILTAG
+    if (m_detector != nullptr)
+        apriltag_detector_destroy(static_cast<apriltag_detector_t *>(m_detector));
+    if (m_family != nullptr)
+        tag36h11_destroy(static_cast<apriltag_family_t *>(m_family));
+#endif
+}
+
+std::vector<TagDetection> TagDetector::detect(const uint8_t *gray, int width, int height, int stride)
+{
+    std::vector<TagDetection> out;
+#ifdef HTK_HAVE_APRILTAG
+    image_u8_t image = { width, height, stride, const_cast<uint8_t *>(gray) };
+    zarray_t *found = apriltag_detector_detect(static_cast<apriltag_detector_t *>(m_detector), &image);
+    for (int i = 0; i < zarray_size(found); i++)
+    {
+        apriltag_detection_t *det = nullptr;
+        zarray_get(found, i, &det);
+        if (det->hamming > m_options.max_hamming)
+            continue;
+        TagDetection d;
+        d.id = det->id;
+        for (int c = 0; c < 4; c++)
+        {
+            d.corners[c][0] = det->p[c][0];
+            d.corners[c][1] = det->p[c][1];
+        }
+        d.decision_margin = det->decision_margin;
+        d.hamming = det->hamming;
+        out.push_back(d);
+    }
+    apriltag_detections_destroy(found);
+#else
+    (void)gray;
+    (void)width;
+    (void)height;
+    (void)stride;
+#endif
+    return out;
+}
+
+namespace
+{
+
+struct JpegError
+{
+    jpeg_error_mgr mgr;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+} // namespace
+
+// libjpeg's default handler exits the process
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    JpegError *err = reinterpret_cast<JpegError *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    std::longjmp(err->jump, 1);
+}
+
+bool decode_jpeg_gray(const std::string &path, std::vector<uint8_t> *pixels, int *width, int *height, std::string *error)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in.good() && !in.eof())
+    {
+        *error = "Unable to read " + path;
+        return false;
+    }
+    if (data.empty())
+    {
+        *error = "Empty or missing file " + path;
+        return false;
+    }
+
+    jpeg_decompress_struct cinfo;
+    JpegError err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        *error = path + ": " + err.message;
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data.data(), static_cast<unsigned long>(data.size()));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_GRAYSCALE;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(&cinfo);
+
+    *width = static_cast<int>(cinfo.output_width);
+    *height = static_cast<int>(cinfo.output_height);
+    pixels->resize(static_cast<size_t>(*width) * static_cast<size_t>(*height));
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row = pixels->data() + static_cast<size_t>(cinfo.output_scanline) * static_cast<size_t>(*width);
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef TAG_DETECTOR_H
+#define TAG_DETECTOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// tag36h11 detection on calibration frames. Needs the AprilTag library
+// (HTK_HAVE_APRILTAG); without it tag_detection_available() is false and
+// htkcalibrate can only re-solve from cached detections.
+
+struct TagDetectorOptions
+{
+    // detection on a downsampled image; corners are still refined at full
+    // resolution, so 2 costs little accuracy and saves most of the time
+    float quad_decimate = 2.0f;
+    float quad_sigma = 0.0f;
+    bool refine_edges = true;
+    double decode_sharpening = 0.25;
+    int max_hamming = 1; // bit errors accepted when decoding
+};
+
+struct TagDetection
+{
+    int id = -1;
+    // pixel corners in AprilTag order: tag coordinates (-1,-1), (1,-1),
+    // (1,1), (-1,1) of the tag's homography
+    double corners[4][2] = {};
+    double decision_margin = 0;
+    int hamming = 0;
+};
+
+bool tag_detection_available();
+
+// One detector per thread; AprilTag detectors are not safe to share.
+class TagDetector
+{
+public:
+    explicit TagDetector(const TagDetectorOptions &options);
+    ~TagDetector();
+
+    TagDetector(const TagDetector &) = delete;
+    TagDetector &operator=(const TagDetector &) = delete;
+
+    // 8-bit grayscale
+    std::vector<TagDetection> detect(const uint8_t *gray, int width, int height, int stride);
+
+private:
+    TagDetectorOptions m_options;
+    void *m_family = nullptr;
+    void *m_detector = nullptr;
+};
+
+// Decodes a JPEG file straight to grayscale (the decoder skips the chroma
+// planes). False and fills error on a bad or missing file.
+bool decode_jpeg_gray(const std::string &path, std::vector<uint8_t> *pixels, int *width, int *height, std::string *error);
+
+#endif
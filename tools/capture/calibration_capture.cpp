@@ -0,0 +1,477 @@
+#include "calibration_capture.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+
+#include "file_writer.h"
+#include "jpeg_payload.h"
+#include "numpy_pickle.h"
+#include "session_manifest.h"
+
+using namespace std::chrono;
+
+namespace
+{
+
+struct Grabbed
+{
+    k4a_capture_t cap = nullptr;
+    int64_t system_ns = 0;
+    uint64_t device_usec = 0;
+};
+
+// The newest few frames of one device, refreshed by its grab thread so a set
+// is always built from current frames rather than from the SDK's backlog.
+struct Grabber
+{
+    std::mutex mutex;
+    std::deque<Grabbed> frames; // oldest first
+    std::thread thread;
+};
+
+const size_t kKeptFrames = 8;
+const int kMaxRetakes = 10; // corrupt frames in a row before giving up on a set
+
+} // namespace
+
+static void grab_loop(Session *s, DeviceCtx *d, Grabber *g, int64_t settle_until_ns)
+{
+    while (!s->stop)
+    {
+        k4a_capture_t cap = nullptr;
+        k4a_wait_result_t wr = d->device->get_capture(&cap, 100);
+        if (wr == K4A_WAIT_RESULT_FAILED)
+        {
+            session_fail(*s, "k4a_device_get_capture() failed on device " + std::to_string(d->index));
+            break;
+        }
+        if (wr != K4A_WAIT_RESULT_SUCCEEDED)
+            continue;
+
+        k4a_image_t image = k4a_capture_get_color_image(cap);
+        if (image == nullptr || monotonic_ns() < settle_until_ns)
+        {
+            if (image != nullptr)
+                k4a_image_release(image);
+            k4a_capture_release(cap);
+            continue;
+        }
+        Grabbed frame;
+        frame.cap = cap;
+        frame.system_ns = static_cast<int64_t>(k4a_image_get_system_timestamp_nsec(image));
+        frame.device_usec = k4a_image_get_device_timestamp_usec(image);
+        k4a_image_release(image);
+
+        std::lock_guard<std::mutex> lock(g->mutex);
+        g->frames.push_back(frame);
+        if (g->frames.size() > kKeptFrames)
+        {
+            k4a_capture_release(g->frames.front().cap);
+            g->frames.pop_front();
+        }
+    }
+}
+
+// The oldest master frame at or after not_before_ns for which every other
+// device has a frame within half a period. The picked captures are referenced
+// for the caller.
+static bool match_set(Session &s,
+                      std::deque<Grabber> &grabbers,
+                      int64_t not_before_ns,
+                      int64_t half_period_ns,
+                      std::vector<Grabbed> *picked)
+{
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (auto &g : grabbers)
+        locks.emplace_back(g.mutex);
+
+    const size_t master = static_cast<size_t>(s.master_index);
+    for (const Grabbed &mf : grabbers[master].frames)
+    {
+        if (mf.system_ns < not_before_ns)
+            continue;
+
+        picked->assign(grabbers.size(), Grabbed());
+        bool complete = true;
+        for (size_t i = 0; i < grabbers.size() && complete; i++)
+        {
+            if (i == master)
+            {
+                (*picked)[i] = mf;
+                continue;
+            }
+            int64_t best = half_period_ns + 1;
+            for (const Grabbed &f : grabbers[i].frames)
+            {
+                int64_t diff = f.system_ns > mf.system_ns ? f.system_ns - mf.system_ns : mf.system_ns - f.system_ns;
+                if (diff < best)
+                {
+                    best = diff;
+                    (*picked)[i] = f;
+                }
+            }
+            complete = best <= half_period_ns;
+        }
+        if (complete)
+        {
+            for (auto &f : *picked)
+                k4a_capture_reference(f.cap);
+            return true;
+        }
+    }
+    picked->clear();
+    return false;
+}
+
+static std::string camera_name(const DeviceCtx &d)
+{
+    return "camera_" + std::to_string(d.index);
+}
+
+static bool make_dir(const std::string &path, std::string *error)
+{
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        *error = "Unable to create directory " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+// Validates every frame of the set, then saves them; nothing is written for a
+// set that has to be retaken.
+static bool save_set(Session &s,
+                     const std::vector<Grabbed> &picked,
+                     const std::string &dir,
+                     size_t number,
+                     CalibrationSet *set,
+                     bool *retake)
+{
+    *retake = false;
+    std::vector<std::pair<const uint8_t *, size_t>> payloads;
+    std::vector<k4a_image_t> images;
+    for (size_t i = 0; i < picked.size() && !*retake; i++)
+    {
+        const DeviceCtx &d = s.devices[i];
+        k4a_image_t image = k4a_capture_get_color_image(picked[i].cap);
+        images.push_back(image);
+        int width, height;
+        color_resolution_size(d.config.color_resolution, &width, &height);
+        const uint8_t *data = k4a_image_get_buffer(image);
+        size_t size = k4a_image_get_size(image);
+        JpegDefect defect = jpeg_validate(data, size, width, height);
+        if (defect != JpegDefect::None)
+        {
+            std::cout << "Device " << d.index << " sent a corrupt frame (" << jpeg_defect_name(defect)
+                      << "), retaking the set." << std::endl;
+            *retake = true;
+            break;
+        }
+        // USB transfers can leave padding after EOI
+        payloads.emplace_back(data, jpeg_payload_length(data, size));
+    }
+
+    bool ok = true;
+    if (!*retake)
+    {
+        std::ostringstream name;
+        name << "frames/set_" << std::setw(3) << std::setfill('0') << number;
+        std::string error;
+        ok = make_dir(dir + "/" + name.str(), &error);
+
+        std::unique_ptr<FileWriter> out = make_file_writer(WriterMode::Buffered);
+        for (size_t i = 0; i < picked.size() && ok; i++)
+        {
+            CalibrationFrame frame;
+            frame.file = name.str() + "/" + camera_name(s.devices[i]) + ".jpg";
+            frame.device_timestamp_usec = picked[i].device_usec;
+            frame.system_ns = picked[i].system_ns;
+            const std::string path = dir + "/" + frame.file;
+            if (!out->open(path) || !out->write(payloads[i].first, payloads[i].second) || !out->close())
+            {
+                error = "Unable to write " + path + ": " + std::strerror(out->last_errno());
+                ok = false;
+                break;
+            }
+            int64_t skew = picked[i].system_ns - picked[static_cast<size_t>(s.master_index)].system_ns;
+            set->skew_ns = std::max(set->skew_ns, skew < 0 ? -skew : skew);
+            set->frames.push_back(frame);
+        }
+        if (!ok)
+            session_fail(s, error);
+    }
+
+    for (auto image : images)
+    {
+        if (image != nullptr)
+            k4a_image_release(image);
+    }
+    return ok;
+}
+
+bool calibration_capture_sets(Session &s, const CalibrationOptions &options, std::vector<CalibrationSet> *sets)
+{
+    const DeviceCtx &master = s.devices[static_cast<size_t>(s.master_index)];
+    const int64_t half_period_ns = 500000000LL / fps_to_uint(master.config.camera_fps);
+
+    std::string error;
+    if (!make_dir(options.dir, &error) || !make_dir(options.dir + "/frames", &error))
+    {
+        session_fail(s, error);
+        return false;
+    }
+
+    const int64_t settle_until_ns = monotonic_ns() + static_cast<int64_t>(options.settle_ms) * 1000000;
+    std::deque<Grabber> grabbers(s.devices.size());
+    for (size_t i = 0; i < s.devices.size(); i++)
+        grabbers[i].thread = std::thread(grab_loop, &s, &s.devices[i], &grabbers[i], settle_until_ns);
+
+    int retakes = 0;
+    while (static_cast<int>(sets->size()) < options.sets && !s.stop)
+    {
+        const size_t number = sets->size() + 1;
+        if (options.interval_ms <= 0 && retakes == 0)
+        {
+            std::cout << "Position the target and press Enter for set " << number << "/" << options.sets << "..."
+                      << std::endl;
+            std::string line;
+            if (!std::getline(std::cin, line))
+                break;
+        }
+        else if (number > 1 && retakes == 0)
+        {
+            const auto until = steady_clock::now() + milliseconds(options.interval_ms);
+            while (!s.stop && steady_clock::now() < until)
+                std::this_thread::sleep_for(milliseconds(10));
+        }
+
+        // only frames exposed after the request, so the target has stopped moving
+        const int64_t requested_ns = std::max(monotonic_ns(), settle_until_ns);
+        const int64_t deadline_ns = requested_ns + static_cast<int64_t>(options.set_timeout_ms) * 1000000;
+        std::vector<Grabbed> picked;
+        while (!s.stop && !match_set(s, grabbers, requested_ns, half_period_ns, &picked))
+        {
+            if (monotonic_ns() > deadline_ns)
+            {
+                session_fail(s, "No frames from all cameras lined up within " + std::to_string(options.set_timeout_ms) +
+                                    " ms; check the sync cables.");
+                break;
+            }
+            std::this_thread::sleep_for(milliseconds(5));
+        }
+        if (picked.empty())
+            break;
+
+        CalibrationSet set;
+        bool retake = false;
+        bool ok = save_set(s, picked, options.dir, number, &set, &retake);
+        for (auto &f : picked)
+            k4a_capture_release(f.cap);
+        if (!ok)
+            break;
+        if (retake)
+        {
+            if (++retakes > kMaxRetakes)
+            {
+                session_fail(s, "Too many corrupt frames while taking calibration set " + std::to_string(number) + ".");
+                break;
+            }
+            continue;
+        }
+        retakes = 0;
+        std::cout << "Set " << number << "/" << options.sets << " captured (skew " << set.skew_ns / 1000 << " us)"
+                  << std::endl;
+        sets->push_back(set);
+    }
+
+    s.stop = true;
+    for (auto &g : grabbers)
+    {
+        g.thread.join();
+        for (auto &f : g.frames)
+            k4a_capture_release(f.cap);
+    }
+    return s.error.empty();
+}
+
+static bool device_calibration(const DeviceCtx &d, k4a_calibration_t *cal)
+{
+    return d.device->handle() != nullptr &&
+           K4A_SUCCEEDED(k4a_device_get_calibration(d.device->handle(), d.config.depth_mode,
+                                                    d.config.color_resolution, cal));
+}
+
+bool read_rig_calibration(Session &s, RigCalibration *rig, std::string *error)
+{
+    rig->reference = -1;
+    rig->cameras.clear();
+    rig->raw.clear();
+    for (auto &d : s.devices)
+    {
+        k4a_calibration_t cal;
+        if (!device_calibration(d, &cal))
+        {
+            *error = "Unable to read the factory calibration of device " + std::to_string(d.index);
+            return false;
+        }
+        RigCameraRecord record = rig_camera_record(d.serial, camera_name(d), d.index);
+        rig_camera_set_intrinsics(&record, cal.color_camera_calibration);
+
+        // the blob is JSON text, null-terminated
+        size_t size = 0;
+        if (k4a_device_get_raw_calibration(d.device->handle(), nullptr, &size) != K4A_BUFFER_RESULT_TOO_SMALL)
+        {
+            *error = "Unable to read the raw calibration of device " + std::to_string(d.index);
+            return false;
+        }
+        std::vector<uint8_t> raw(size);
+        if (k4a_device_get_raw_calibration(d.device->handle(), raw.data(), &size) != K4A_BUFFER_RESULT_SUCCEEDED)
+        {
+            *error = "Unable to read the raw calibration of device " + std::to_string(d.index);
+            return false;
+        }
+        while (size > 0 && raw[size - 1] == 0)
+            size--;
+        if (d.index == s.master_index)
+            rig->reference = static_cast<int32_t>(rig->cameras.size());
+        rig->cameras.push_back(record);
+        rig->raw.emplace_back(reinterpret_cast<const char *>(raw.data()), size);
+    }
+    return true;
+}
+
+bool write_calibration_intrinsics(Session &s, const std::string &dir, std::string *error)
+{
+    if (!make_dir(dir, error) || !make_dir(dir + "/cam_intr", error) || !make_dir(dir + "/raw", error))
+        return false;
+
+    RigCalibration rig;
+    if (!read_rig_calibration(s, &rig, error))
+        return false;
+    for (size_t i = 0; i < rig.cameras.size(); i++)
+    {
+        // what pyk4a's get_camera_matrix() returns, for this color resolution
+        const RigCameraRecord &r = rig.cameras[i];
+        double k[9];
+        std::memcpy(k, r.camera_matrix, sizeof(k)); // the record is packed
+        if (!write_numpy_pickle(dir + "/cam_intr/" + r.name + ".pkl", k, 3, 3, error))
+            return false;
+
+        const std::string path = dir + "/raw/" + r.name + ".json";
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << rig.raw[i];
+        out.close();
+        if (!out)
+        {
+            *error = "Unable to write " + path;
+            return false;
+        }
+    }
+    // intrinsics only; htkcalibrate rewrites it with the extrinsics
+    uint64_t id = 0;
+    return write_rig_calibration(dir + "/" + kRigCalibrationFile, rig, &id, error);
+}
+
+static const char *distortion_model_name(k4a_calibration_model_type_t type)
+{
+    switch (type)
+    {
+    case K4A_CALIBRATION_LENS_DISTORTION_MODEL_THETA:
+        return "theta";
+    case K4A_CALIBRATION_LENS_DISTORTION_MODEL_POLYNOMIAL_3K:
+        return "polynomial_3k";
+    case K4A_CALIBRATION_LENS_DISTORTION_MODEL_RATIONAL_6KT:
+        return "rational_6kt";
+    case K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY:
+        return "brown_conrady";
+    default:
+        return "unknown";
+    }
+}
+
+bool write_calibration_index(Session &s, const std::vector<CalibrationSet> &sets, const std::string &dir, std::string *error)
+{
+    std::ostringstream out;
+    out << std::setprecision(9);
+    out << "{\n  \"format\": \"htk-calibration\",\n  \"version\": 1,\n";
+    out << "  \"created_utc\": " << json_string(utc_timestamp_now()) << ",\n";
+    out << "  \"master_index\": " << s.master_index << ",\n";
+
+    out << "  \"devices\": [";
+    for (size_t i = 0; i < s.devices.size(); i++)
+    {
+        const DeviceCtx &d = s.devices[i];
+        int width, height;
+        color_resolution_size(d.config.color_resolution, &width, &height);
+        out << (i ? ",\n" : "\n") << "    {\"index\": " << d.index << ", \"serial\": " << json_string(d.serial)
+            << ", \"name\": " << json_string(camera_name(d)) << ", \"master\": " << (d.index == s.master_index ? "true" : "false")
+            << ", \"color_resolution\": \"" << color_resolution_name(d.config.color_resolution) << "\""
+            << ", \"width\": " << width << ", \"height\": " << height
+            << ", \"fps\": " << fps_to_uint(d.config.camera_fps)
+            << ", \"subordinate_delay_usec\": " << d.config.subordinate_delay_off_master_usec;
+
+        k4a_calibration_t cal;
+        if (device_calibration(d, &cal))
+        {
+            const auto &intr = cal.color_camera_calibration.intrinsics;
+            const auto &p = intr.parameters.param;
+            out << ",\n     \"camera_matrix\": \"cam_intr/" << camera_name(d) << ".pkl\", \"raw_calibration\": \"raw/"
+                << camera_name(d) << ".json\",\n     \"intrinsics\": {\"model\": \"" << distortion_model_name(intr.type)
+                << "\", \"fx\": " << p.fx << ", \"fy\": " << p.fy << ", \"cx\": " << p.cx << ", \"cy\": " << p.cy
+                << ", \"k1\": " << p.k1 << ", \"k2\": " << p.k2 << ", \"k3\": " << p.k3 << ", \"k4\": " << p.k4
+                << ", \"k5\": " << p.k5 << ", \"k6\": " << p.k6 << ", \"p1\": " << p.p1 << ", \"p2\": " << p.p2
+                << ", \"codx\": " << p.codx << ", \"cody\": " << p.cody << ", \"metric_radius\": " << p.metric_radius
+                // cv2.undistort() order
+                << ",\n                    \"opencv_distortion\": [" << p.k1 << ", " << p.k2 << ", " << p.p1 << ", "
+                << p.p2 << ", " << p.k3 << ", " << p.k4 << ", " << p.k5 << ", " << p.k6 << "]}";
+        }
+        out << "}";
+    }
+    out << "\n  ],\n";
+
+    out << "  \"sets\": [";
+    for (size_t i = 0; i < sets.size(); i++)
+    {
+        out << (i ? ",\n" : "\n") << "    {\"skew_usec\": " << sets[i].skew_ns / 1000 << ", \"frames\": [";
+        for (size_t f = 0; f < sets[i].frames.size(); f++)
+        {
+            const CalibrationFrame &frame = sets[i].frames[f];
+            out << (f ? ", " : "") << "{\"file\": " << json_string(frame.file)
+                << ", \"device_timestamp_usec\": " << frame.device_timestamp_usec
+                << ", \"system_ns\": " << frame.system_ns << "}";
+        }
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+
+    const std::string path = dir + "/calibration.json";
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::trunc);
+        file << out.str();
+        file.close();
+        if (!file)
+        {
+            *error = "Unable to write " + tmp_path + ": " + std::strerror(errno);
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        *error = "Unable to rename " + tmp_path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#ifndef CALIBRATION_CAPTURE_H
+#define CALIBRATION_CAPTURE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "capture_session.h"
+#include "rig_calibration.h"
+
+// htkrecorder --calibrate: instead of recording, grab sets of simultaneous
+// frames from every camera of the synchronized rig, in the configured
+// recording mode, and export each camera's factory intrinsics for that mode.
+//
+// Layout of the output directory (calib_<date> by default), matching
+// tools/calibration/calib.py where the two overlap:
+//
+//   cam_intr/camera_<i>.pkl         3x3 float64 camera matrix (numpy pickle)
+//   raw/camera_<i>.json             the device's raw factory calibration
+//   frames/set_<NNN>/camera_<i>.jpg one MJPEG frame per camera and set
+//   calibration.json                serials, modes, full intrinsics with
+//                                   distortion, and the frame sets with timestamps
+//
+// <i> is the device index, as in the recordings' file names.
+
+struct CalibrationOptions
+{
+    std::string dir;
+    int sets = 20;
+    // between sets, to move the target; 0 waits for Enter on stdin instead
+    int interval_ms = 1000;
+    // frames after start are thrown away until the cameras settle
+    int settle_ms = 1000;
+    // a set is given up if no frame of every camera lines up this long
+    int set_timeout_ms = 2000;
+};
+
+struct CalibrationFrame
+{
+    std::string file; // relative to the output directory
+    uint64_t device_timestamp_usec = 0;
+    int64_t system_ns = 0;
+};
+
+struct CalibrationSet
+{
+    // one frame per device, in Session::devices order
+    std::vector<CalibrationFrame> frames;
+    // largest system timestamp difference to the master's frame
+    int64_t skew_ns = 0;
+};
+
+// Runs with the cameras started by session_start_cameras() and without the
+// recording threads. Frames are matched across cameras by system timestamp,
+// within half a frame period of the master's; the device clocks themselves
+// are independent. Sets with a frame that fails jpeg_validate() are retaken.
+// Returns false and fills s.error on failure; sets taken so far are kept.
+bool calibration_capture_sets(Session &s, const CalibrationOptions &options, std::vector<CalibrationSet> *sets);
+
+// Factory intrinsics and raw calibration of every device for its configured
+// color resolution, extrinsics left unsolved. Needs real hardware handles.
+bool read_rig_calibration(Session &s, RigCalibration *rig, std::string *error);
+
+// Factory intrinsics of every device for its configured color resolution:
+// cam_intr/*.pkl, raw/*.json and an intrinsics-only rig_calibration.bin.
+// Needs real hardware handles.
+bool write_calibration_intrinsics(Session &s, const std::string &dir, std::string *error);
+
+// calibration.json, see above. Devices without a hardware handle are listed
+// without intrinsics.
+bool write_calibration_index(Session &s,
+                             const std::vector<CalibrationSet> &sets,
+                             const std::string &dir,
+                             std::string *error);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef CAPTURE_DEVICE_H
+#define CAPTURE_DEVICE_H
+
+#include <k4a/k4a.h>
+
+#include <cstdint>
+#include <string>
+
+#include <time.h>
+
+// k4a system timestamps (k4a_image_get_system_timestamp_nsec) are taken from
+// CLOCK_MONOTONIC on the host, so latencies are measured against it too.
+inline int64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// What the capture pipeline needs from a camera. The real implementation
+// forwards to the k4a device API; simulated and fault-injecting devices let
+// the same pipeline run without hardware.
+class CaptureDevice
+{
+public:
+    virtual ~CaptureDevice() = default;
+
+    virtual const std::string &serial() const = 0;
+
+    // passed to k4a_record_create(); nullptr when no hardware backs the device
+    virtual k4a_device_t handle() const = 0;
+
+    virtual k4a_result_t start_cameras(const k4a_device_configuration_t *config) = 0;
+    virtual void stop_cameras() = 0;
+    virtual k4a_wait_result_t get_capture(k4a_capture_t *capture, int32_t timeout_ms) = 0;
+};
+
+// Non-owning wrapper; whoever opened the k4a_device_t closes it.
+class K4aDevice : public CaptureDevice
+{
+public:
+    K4aDevice(k4a_device_t dev, const std::string &serial) : m_dev(dev), m_serial(serial)
+    {
+    }
+
+    const std::string &serial() const override
+    {
+        return m_serial;
+    }
+    k4a_device_t handle() const override
+    {
+        return m_dev;
+    }
+
+    k4a_result_t start_cameras(const k4a_device_configuration_t *config) override
+    {
+        return k4a_device_start_cameras(m_dev, config);
+    }
+    void stop_cameras() override
+    {
+        k4a_device_stop_cameras(m_dev);
+    }
+    k4a_wait_result_t get_capture(k4a_capture_t *capture, int32_t timeout_ms) override
+    {
+        return k4a_device_get_capture(m_dev, capture, timeout_ms);
+    }
+
+private:
+    k4a_device_t m_dev;
+    std::string m_serial;
+};
+
+#endif
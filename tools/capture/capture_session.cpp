@@ -0,0 +1,887 @@
+#include "capture_session.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "file_writer.h"
+#include "rig_calibration.h"
+
+using namespace std::chrono;
+
+uint32_t fps_to_uint(k4a_fps_t fps)
+{
+    switch (fps)
+    {
+    case K4A_FRAMES_PER_SECOND_5:
+        return 5;
+    case K4A_FRAMES_PER_SECOND_15:
+        return 15;
+    case K4A_FRAMES_PER_SECOND_30:
+        return 30;
+    default:
+        return 0;
+    }
+}
+
+void color_resolution_size(k4a_color_resolution_t res, int *width, int *height)
+{
+    switch (res)
+    {
+    case K4A_COLOR_RESOLUTION_720P:
+        *width = 1280, *height = 720;
+        return;
+    case K4A_COLOR_RESOLUTION_1080P:
+        *width = 1920, *height = 1080;
+        return;
+    case K4A_COLOR_RESOLUTION_1440P:
+        *width = 2560, *height = 1440;
+        return;
+    case K4A_COLOR_RESOLUTION_1536P:
+        *width = 2048, *height = 1536;
+        return;
+    case K4A_COLOR_RESOLUTION_2160P:
+        *width = 3840, *height = 2160;
+        return;
+    case K4A_COLOR_RESOLUTION_3072P:
+        *width = 4096, *height = 3072;
+        return;
+    default:
+        *width = 0, *height = 0;
+        return;
+    }
+}
+
+bool parse_jpeg_check(const std::string &name, JpegCheck *out)
+{
+    if (name == "off")
+        *out = JpegCheck::Off;
+    else if (name == "count")
+        *out = JpegCheck::Count;
+    else if (name == "quarantine")
+        *out = JpegCheck::Quarantine;
+    else
+        return false;
+    return true;
+}
+
+struct FrameStamps
+{
+    uint64_t device_usec = 0;
+    int64_t system_ns = 0;
+};
+
+static FrameStamps color_stamps(k4a_capture_t cap)
+{
+    FrameStamps stamps;
+    k4a_image_t image = k4a_capture_get_color_image(cap);
+    if (image == nullptr)
+    {
+        return stamps;
+    }
+    stamps.device_usec = k4a_image_get_device_timestamp_usec(image);
+    stamps.system_ns = static_cast<int64_t>(k4a_image_get_system_timestamp_nsec(image));
+    k4a_image_release(image);
+    return stamps;
+}
+
+const char *latency_stage_name(LatencyStage stage)
+{
+    switch (stage)
+    {
+    case LatencyStage::Captured:
+        return "captured";
+    case LatencyStage::Enqueued:
+        return "enqueued";
+    case LatencyStage::Written:
+        return "written";
+    case LatencyStage::Durable:
+        return "durable";
+    }
+    return "unknown";
+}
+
+const LatencyHistogram &stage_latency(const DeviceCtx &d, LatencyStage stage)
+{
+    switch (stage)
+    {
+    case LatencyStage::Captured:
+        return d.captured_latency;
+    case LatencyStage::Enqueued:
+        return d.enqueued_latency;
+    case LatencyStage::Written:
+        return d.written_latency;
+    case LatencyStage::Durable:
+        break;
+    }
+    return d.durable_latency;
+}
+
+static const LatencyStage all_stages[] = { LatencyStage::Captured,
+                                           LatencyStage::Enqueued,
+                                           LatencyStage::Written,
+                                           LatencyStage::Durable };
+
+std::string segment_filename(const Session &s, const DeviceCtx &d, size_t segment)
+{
+    std::ostringstream oss;
+    if (!s.output_dir.empty())
+        oss << s.output_dir << "/";
+    oss << "k4a_" << d.index << "_" << d.serial;
+    if (s.segment_seconds > 0)
+        oss << "_" << std::setw(4) << std::setfill('0') << segment;
+    oss << ".mkv";
+    return oss.str();
+}
+
+void session_fail(Session &s, const std::string &msg)
+{
+    {
+        std::lock_guard<std::mutex> lock(s.error_mutex);
+        if (s.error.empty())
+            s.error = msg;
+    }
+    s.stop = true;
+}
+
+// the configuration the recordings describe: host-encoded color is MJPEG
+static k4a_device_configuration_t recorded_config(const DeviceCtx &d)
+{
+    k4a_device_configuration_t config = d.config;
+    if (d.encoder)
+        config.color_format = K4A_IMAGE_FORMAT_COLOR_MJPG;
+    return config;
+}
+
+// color frame size in the recordings: the crop if there is one
+static void recorded_color_size(const DeviceCtx &d, int *width, int *height)
+{
+    color_resolution_size(d.config.color_resolution, width, height);
+    if (d.encoder && d.encoder->options().crop.width > 0)
+    {
+        *width = d.encoder->options().crop.width;
+        *height = d.encoder->options().crop.height;
+    }
+}
+
+static bool open_segment(Session &s, DeviceCtx &d)
+{
+    SegmentInfo seg;
+    seg.path = segment_filename(s, d, d.segments.size());
+    if (K4A_FAILED(d.sink->create(seg.path, d.device->handle(), recorded_config(d))))
+    {
+        session_fail(s, "Unable to create recording file: " + seg.path);
+        return false;
+    }
+    d.sink_open = true;
+    d.segments.push_back(seg);
+    if (s.checksum_chunk_bytes > 0)
+        d.hasher.open(seg.path, s.checksum_chunk_bytes);
+    if (s.frame_metadata && K4A_FAILED(d.sink->add_metadata_track()))
+    {
+        session_fail(s, "Unable to add the metadata track to: " + seg.path);
+        return false;
+    }
+    // the k4a track still gives the sensor's resolution
+    if (d.encoder && d.encoder->options().crop.width > 0 &&
+        K4A_FAILED(d.sink->add_tag(kColorCropTag, color_crop_string(d.encoder->options().crop))))
+    {
+        session_fail(s, "Unable to tag the crop of: " + seg.path);
+        return false;
+    }
+    if (s.event_track && K4A_FAILED(d.sink->add_event_track()))
+    {
+        session_fail(s, "Unable to add the event track to: " + seg.path);
+        return false;
+    }
+    if (!s.rig_calibration.empty() &&
+        (K4A_FAILED(d.sink->add_attachment(kRigCalibrationAttachment, s.rig_calibration)) ||
+         K4A_FAILED(d.sink->add_tag(kRigCalibrationTag, rig_id_hex(s.rig_calibration_id)))))
+    {
+        session_fail(s, "Unable to attach the rig calibration to: " + seg.path);
+        return false;
+    }
+    if (K4A_FAILED(d.sink->write_header()))
+    {
+        session_fail(s, "Unable to write header for: " + seg.path);
+        return false;
+    }
+    return true;
+}
+
+static void close_segment(Session &s, DeviceCtx &d)
+{
+    if (!d.sink_open)
+    {
+        return;
+    }
+    if (K4A_FAILED(d.sink->flush()))
+    {
+        session_fail(s, "Failed to flush recording: " + d.segments.back().path);
+    }
+    d.sink->close();
+    d.sink_open = false;
+
+    SegmentInfo &seg = d.segments.back();
+    if (d.hasher.is_open() && d.hasher.finish())
+    {
+        seg.chunk_size = d.hasher.chunk_size();
+        seg.chunks = d.hasher.chunks();
+        seg.checksum = file_checksum(seg.chunks);
+    }
+    d.hasher.close();
+
+    struct stat st;
+    if (stat(seg.path.c_str(), &st) == 0)
+        seg.bytes = static_cast<uint64_t>(st.st_size);
+    if (s.on_segment_closed)
+    {
+        s.on_segment_closed(d, d.segments.back());
+    }
+}
+
+bool session_open_recordings(Session &s)
+{
+    for (auto &d : s.devices)
+    {
+        if (!d.sink)
+            d.sink.reset(new K4aRecordSink());
+        if (!open_segment(s, d))
+            return false;
+    }
+    return true;
+}
+
+bool session_open_rig_file(Session &s, const std::string &path, const RigSinkOptions &options)
+{
+    std::vector<RigContainerCamera> cameras;
+    int master = -1;
+    for (auto &d : s.devices)
+    {
+        if (d.index == s.master_index)
+            master = static_cast<int>(cameras.size());
+        RigContainerCamera c;
+        rig_camera_init(&c, d.serial, d.index);
+        int width, height;
+        recorded_color_size(d, &width, &height);
+        c.color_format = static_cast<uint32_t>(recorded_config(d).color_format);
+        if (d.encoder)
+        {
+            c.color_x = d.encoder->options().crop.x;
+            c.color_y = d.encoder->options().crop.y;
+        }
+        c.color_width = static_cast<uint32_t>(width);
+        c.color_height = static_cast<uint32_t>(height);
+        cameras.push_back(c);
+    }
+    const uint32_t fps = fps_to_uint(s.devices.front().config.camera_fps);
+    std::unique_ptr<RigSink> rig(new RigSink(options));
+    std::string error;
+    if (!rig->open(path, cameras, master, fps ? 1000000 / fps : 0, &error))
+    {
+        session_fail(s, error);
+        return false;
+    }
+    rig->set_error_handler([&s](const std::string &msg) { session_fail(s, msg); });
+    s.rig = std::move(rig);
+    return true;
+}
+
+bool session_start_cameras(Session &s)
+{
+    // start the cameras in the order described: subs then master
+    for (auto &d : s.devices)
+    {
+        if (d.index == s.master_index)
+            continue;
+
+        std::cout << "Starting SUBORDINATE device " << d.index << "..." << std::endl;
+        if (K4A_FAILED(d.device->start_cameras(&d.config)))
+        {
+            session_fail(s, "Failed to start cameras on subordinate device " + std::to_string(d.index));
+            return false;
+        }
+    }
+
+    std::this_thread::sleep_for(milliseconds(200));
+
+    auto &m = s.devices[static_cast<size_t>(s.master_index)];
+    std::cout << "Starting MASTER device " << m.index << "..." << std::endl;
+    if (K4A_FAILED(m.device->start_cameras(&m.config)))
+    {
+        session_fail(s, "Failed to start cameras on master device " + std::to_string(m.index));
+        return false;
+    }
+    return true;
+}
+
+// Hands a frame to the writer, from the capture thread or, for host-encoded
+// color, from the encoder pool.
+static void enqueue_capture(DeviceCtx *d, k4a_capture_t cap, int64_t system_ns)
+{
+    if (!d->ring->try_push(cap))
+    {
+        // writer is behind; drop here rather than stall the SDK's queue
+        k4a_capture_release(cap);
+        d->dropped++;
+    }
+    else if (system_ns != 0)
+    {
+        d->enqueued_latency.record(monotonic_ns() - system_ns);
+    }
+}
+
+static void capture_loop(Session *s, DeviceCtx *d)
+{
+    const int timeout_ms = 100;
+    const uint64_t period_usec = 1000000 / fps_to_uint(d->config.camera_fps);
+    const int64_t period_ns = static_cast<int64_t>(period_usec) * 1000;
+    const DeviceCtx *master = d->index == s->master_index ? nullptr : &s->devices[static_cast<size_t>(s->master_index)];
+    uint64_t last_ts = 0;
+
+    while (!s->stop)
+    {
+        k4a_capture_t cap = nullptr;
+        k4a_wait_result_t wr = d->device->get_capture(&cap, timeout_ms);
+
+        if (wr == K4A_WAIT_RESULT_SUCCEEDED)
+        {
+            FrameStamps stamps = color_stamps(cap);
+            if (stamps.system_ns != 0)
+            {
+                d->captured_latency.record(monotonic_ns() - stamps.system_ns);
+                d->last_system_ns.store(stamps.system_ns, std::memory_order_relaxed);
+
+                // the matching master frame may not have arrived yet, so fold the
+                // offset from its latest one into half a frame period either side
+                int64_t master_ns = master ? master->last_system_ns.load(std::memory_order_relaxed) : 0;
+                if (master_ns != 0)
+                {
+                    int64_t offset = (stamps.system_ns - master_ns) % period_ns;
+                    if (offset > period_ns / 2)
+                        offset -= period_ns;
+                    else if (offset < -period_ns / 2)
+                        offset += period_ns;
+                    d->sync_skew.record(offset < 0 ? -offset : offset);
+                }
+            }
+
+            uint64_t ts = stamps.device_usec;
+            if (last_ts != 0 && ts > last_ts + period_usec * 3 / 2)
+            {
+                d->missed += (ts - last_ts + period_usec / 2) / period_usec - 1;
+            }
+            last_ts = ts;
+
+            if (!d->encoder)
+            {
+                enqueue_capture(d, cap, stamps.system_ns);
+            }
+            else if (!d->encoder->submit(cap))
+            {
+                // every encoder thread is busy and the backlog is full
+                k4a_capture_release(cap);
+                d->dropped++;
+            }
+        }
+        else if (wr == K4A_WAIT_RESULT_FAILED)
+        {
+            session_fail(*s, "k4a_device_get_capture() failed on device " + std::to_string(d->index));
+        }
+    }
+    if (d->encoder)
+        d->encoder->finish();
+    d->ring->close();
+}
+
+// Validates the color payload; a bad one is listed and, when quarantining,
+// saved (up to max_quarantine per device). Returns false if the frame should
+// stay out of the recording.
+static bool check_color_payload(Session *s,
+                                DeviceCtx *d,
+                                k4a_capture_t cap,
+                                uint64_t ts,
+                                std::unique_ptr<FileWriter> &quarantine,
+                                JpegDefect *defect_out)
+{
+    k4a_image_t image = k4a_capture_get_color_image(cap);
+    if (image == nullptr)
+        return true;
+    if (k4a_image_get_format(image) != K4A_IMAGE_FORMAT_COLOR_MJPG)
+    {
+        k4a_image_release(image);
+        return true;
+    }
+
+    int width, height;
+    recorded_color_size(*d, &width, &height);
+    const uint8_t *data = k4a_image_get_buffer(image);
+    const size_t size = k4a_image_get_size(image);
+    JpegDefect defect = jpeg_validate(data, size, width, height);
+    *defect_out = defect;
+    if (defect == JpegDefect::None)
+    {
+        k4a_image_release(image);
+        return true;
+    }
+
+    d->corrupt++;
+    CorruptFrame bad;
+    bad.timestamp_usec = ts;
+    bad.segment = d->segments.size() - 1;
+    bad.defect = defect;
+
+    const bool keep_out = s->jpeg_check == JpegCheck::Quarantine;
+    // the list is capped, and a frame left off it must not leave a file nobody references
+    const bool listed = d->corrupt_frames.size() < kMaxCorruptFrames;
+    if (keep_out && listed && d->quarantined < s->max_quarantine)
+    {
+        std::string dir = (s->output_dir.empty() ? std::string(".") : s->output_dir) + "/quarantine";
+        mkdir(dir.c_str(), 0755);
+        std::string path = dir + "/k4a_" + std::to_string(d->index) + "_" + d->serial + "_" + std::to_string(ts) + ".jpg";
+        if (!quarantine)
+            quarantine = make_file_writer(WriterMode::Buffered);
+        if (quarantine->open(path) && quarantine->write(data, size) && quarantine->close())
+        {
+            bad.quarantine_path = path;
+            d->quarantined++;
+        }
+    }
+    // the counter keeps going, the list stops growing on a camera that only sends garbage
+    if (listed)
+        d->corrupt_frames.push_back(bad);
+    k4a_image_release(image);
+    return !keep_out;
+}
+
+// Maps host CLOCK_MONOTONIC onto a device's timestamp clock from recent
+// frames. A frame's system timestamp lags its device timestamp by transfer
+// time plus jitter, so the smallest offset in the window is the best estimate.
+class DeviceClockMap
+{
+public:
+    void add(int64_t system_ns, uint64_t device_usec)
+    {
+        m_offsets[m_next++ % kWindow] = system_ns - static_cast<int64_t>(device_usec) * 1000;
+        m_filled = std::min(m_filled + 1, kWindow);
+    }
+
+    bool valid() const
+    {
+        return m_filled > 0;
+    }
+
+    uint64_t to_device_usec(int64_t host_ns) const
+    {
+        int64_t offset = *std::min_element(m_offsets, m_offsets + m_filled);
+        int64_t usec = (host_ns - offset) / 1000;
+        return usec > 0 ? static_cast<uint64_t>(usec) : 0;
+    }
+
+    int64_t to_host_ns(uint64_t device_usec) const
+    {
+        return static_cast<int64_t>(device_usec) * 1000 + *std::min_element(m_offsets, m_offsets + m_filled);
+    }
+
+private:
+    static constexpr size_t kWindow = 64;
+    int64_t m_offsets[kWindow] = {};
+    size_t m_next = 0;
+    size_t m_filled = 0;
+};
+
+void session_mark_event(Session &s, const std::string &label, const std::string &source, int64_t host_ns)
+{
+    timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    std::lock_guard<std::mutex> lock(s.event_mutex);
+    EventMarker e;
+    e.label = label;
+    e.source = source;
+    e.host_ns = host_ns;
+    e.wall_ns = static_cast<int64_t>(wall.tv_sec) * 1000000000 + wall.tv_nsec - (monotonic_ns() - host_ns);
+    s.events.push_back(e);
+    s.event_count.store(s.events.size(), std::memory_order_release);
+}
+
+// Writes the events this device has not placed yet. They land no earlier
+// than the newest written frame: libk4arecord refuses data for clusters it
+// has already flushed, so a marker stamped a few seconds late is moved up to
+// now on this device's track. The manifest keeps the original stamp. An
+// event the track still refuses is counted and skipped; a stray marker is
+// not worth the recording.
+static void write_pending_events(Session *s, DeviceCtx *d, const DeviceClockMap &clock)
+{
+    std::vector<EventMarker> pending;
+    {
+        std::lock_guard<std::mutex> lock(s->event_mutex);
+        pending.assign(s->events.begin() + static_cast<std::ptrdiff_t>(d->events.size()), s->events.end());
+    }
+    const SegmentInfo &seg = d->segments.back();
+    for (auto &e : pending)
+    {
+        EventPlacement p;
+        p.device_timestamp_usec = std::max(clock.to_device_usec(e.host_ns), seg.last_timestamp_usec);
+        p.segment = d->segments.size() - 1;
+        if (s->event_track && K4A_FAILED(d->sink->write_event(p.device_timestamp_usec, e.label)))
+        {
+            p.written = false;
+            d->event_failures++;
+        }
+        d->events.push_back(p);
+    }
+}
+
+static void fill_frame_metadata(k4a_capture_t cap, const FrameStamps &stamps, FrameMetadata *meta)
+{
+    std::memset(meta, 0, sizeof(*meta));
+    meta->version = kFrameMetadataVersion;
+    meta->device_timestamp_usec = stamps.device_usec;
+    meta->system_timestamp_nsec = static_cast<uint64_t>(stamps.system_ns);
+    meta->temperature_c = k4a_capture_get_temperature_c(cap);
+
+    k4a_image_t image = k4a_capture_get_color_image(cap);
+    if (image == nullptr)
+        return;
+    meta->exposure_usec = k4a_image_get_exposure_usec(image);
+    meta->white_balance = k4a_image_get_white_balance(image);
+    meta->iso_speed = k4a_image_get_iso_speed(image);
+    meta->payload_bytes = static_cast<uint32_t>(k4a_image_get_size(image));
+    k4a_image_release(image);
+}
+
+// lends the capture to a background analyzer that asked for one
+static void offer_sample(DeviceCtx *d, k4a_capture_t cap)
+{
+    std::unique_lock<std::mutex> lock(d->sample_mutex, std::try_to_lock);
+    if (!lock.owns_lock() || d->sample != nullptr)
+        return;
+    k4a_capture_reference(cap);
+    d->sample = cap;
+    d->sample_wanted = false;
+}
+
+static void writer_loop(Session *s, DeviceCtx *d)
+{
+    const uint64_t segment_usec = static_cast<uint64_t>(s->segment_seconds) * 1000000;
+    const int64_t sync_ns = static_cast<int64_t>(s->sync_ms) * 1000000;
+    int64_t last_sync = monotonic_ns();
+
+    // system timestamps of frames written since the last sync
+    std::vector<int64_t> unsynced;
+    unsynced.reserve(256);
+
+    auto sync_now = [&]() -> bool {
+        if (K4A_FAILED(d->sink->sync()))
+        {
+            session_fail(*s, "Failed to sync recording: " + d->segments.back().path);
+            return false;
+        }
+        int64_t now = monotonic_ns();
+        for (int64_t t : unsynced)
+            d->durable_latency.record(now - t);
+        unsynced.clear();
+        last_sync = now;
+        return true;
+    };
+
+    std::unique_ptr<FileWriter> quarantine;
+    DeviceClockMap clock;
+    // position in s->devices, the device's camera number in the rig file
+    size_t rig_camera = 0;
+    while (&s->devices[rig_camera] != d)
+        rig_camera++;
+
+    k4a_capture_t cap = nullptr;
+    while (!d->ring->closed() || d->ring->size() != 0)
+    {
+        if (!d->ring->pop_wait(cap, milliseconds(100)))
+            continue;
+
+        FrameStamps stamps = color_stamps(cap);
+        uint64_t ts = stamps.device_usec;
+
+        if (segment_usec > 0 && d->segments.back().frames > 0 &&
+            ts >= d->segments.back().first_timestamp_usec + segment_usec)
+        {
+            if (sync_ns > 0 && !sync_now())
+            {
+                k4a_capture_release(cap);
+                break;
+            }
+            close_segment(*s, *d);
+            if (!open_segment(*s, *d))
+            {
+                k4a_capture_release(cap);
+                break;
+            }
+        }
+
+        JpegDefect defect = JpegDefect::None;
+        if (s->jpeg_check != JpegCheck::Off && !check_color_payload(s, d, cap, ts, quarantine, &defect))
+        {
+            k4a_capture_release(cap);
+            continue;
+        }
+
+        // filled before the write so the latency and queue depth describe this frame
+        FrameMetadata meta;
+        if (s->frame_metadata)
+        {
+            fill_frame_metadata(cap, stamps, &meta);
+            meta.sequence = d->written;
+            meta.queue_depth = static_cast<uint16_t>(std::min<size_t>(d->ring->size(), UINT16_MAX));
+            if (stamps.system_ns != 0)
+                meta.latency_usec = static_cast<uint32_t>((monotonic_ns() - stamps.system_ns) / 1000);
+            if (defect != JpegDefect::None)
+                meta.flags |= kFrameCorrupt;
+            meta.jpeg_defect = static_cast<uint8_t>(defect);
+        }
+
+        auto t0 = steady_clock::now();
+        if (K4A_FAILED(d->sink->write_capture(cap)))
+        {
+            k4a_capture_release(cap);
+            session_fail(*s, "Failed to write capture for device " + std::to_string(d->index));
+            break;
+        }
+        d->write_latency.record(duration_cast<nanoseconds>(steady_clock::now() - t0).count());
+        if (d->sample_wanted.load(std::memory_order_relaxed))
+            offer_sample(d, cap);
+        // the rig file orders every device's frames on the host clock; the
+        // mapping covers the frames before this one, which is close enough
+        if (s->rig && stamps.system_ns != 0)
+        {
+            const int64_t host_ns = clock.valid() ? clock.to_host_ns(ts) : stamps.system_ns;
+            s->rig->push(rig_camera, cap, host_ns, defect != JpegDefect::None ? kFrameCorrupt : 0);
+        }
+        k4a_capture_release(cap);
+
+        if (s->frame_metadata && K4A_FAILED(d->sink->write_metadata(meta)))
+        {
+            session_fail(*s, "Failed to write frame metadata for device " + std::to_string(d->index));
+            break;
+        }
+
+        // hash what the recorder has appended while it is still in the page cache;
+        // on a read error the manifest writer hashes the file instead
+        if (d->hasher.is_open() && !d->hasher.update())
+            d->hasher.close();
+
+        if (stamps.system_ns != 0)
+        {
+            int64_t now = monotonic_ns();
+            d->written_latency.record(now - stamps.system_ns);
+            if (sync_ns > 0)
+            {
+                unsynced.push_back(stamps.system_ns);
+                if (now - last_sync >= sync_ns && !sync_now())
+                    break;
+            }
+        }
+
+        SegmentInfo &seg = d->segments.back();
+        if (seg.frames == 0)
+            seg.first_timestamp_usec = ts;
+        seg.last_timestamp_usec = ts;
+        seg.frames++;
+        d->written++;
+
+        if (stamps.system_ns != 0)
+            clock.add(stamps.system_ns, ts);
+        if (clock.valid() && s->event_count.load(std::memory_order_acquire) > d->events.size())
+            write_pending_events(s, d, clock);
+    }
+
+    if (sync_ns > 0 && !unsynced.empty() && d->sink_open)
+    {
+        sync_now();
+    }
+
+    // release anything left behind after a write failure
+    while (d->ring->try_pop(cap))
+    {
+        k4a_capture_release(cap);
+    }
+    if (s->rig)
+        s->rig->close_camera(rig_camera);
+}
+
+void session_request_sample(DeviceCtx &d)
+{
+    d.sample_wanted = true;
+}
+
+k4a_capture_t session_take_sample(DeviceCtx &d)
+{
+    std::lock_guard<std::mutex> lock(d.sample_mutex);
+    k4a_capture_t cap = d.sample;
+    d.sample = nullptr;
+    return cap;
+}
+
+bool session_start_threads(Session &s)
+{
+    // the capture loop times frames by the device's frame period
+    for (auto &d : s.devices)
+    {
+        if (fps_to_uint(d.config.camera_fps) == 0)
+        {
+            session_fail(s, "Device " + std::to_string(d.index) + " has no valid camera_fps");
+            return false;
+        }
+    }
+
+    if (s.rig)
+        s.rig->start();
+    for (auto &d : s.devices)
+    {
+        d.ring.reset(new FrameRing<k4a_capture_t>(static_cast<size_t>(s.queue_frames)));
+        if (d.encoder)
+        {
+            int width, height;
+            color_resolution_size(d.config.color_resolution, &width, &height);
+            DeviceCtx *dp = &d;
+            std::string error;
+            if (!d.encoder->start(d.config.color_format,
+                                  width,
+                                  height,
+                                  [dp](k4a_capture_t cap) { enqueue_capture(dp, cap, color_stamps(cap).system_ns); },
+                                  &error))
+                session_fail(s, "Device " + std::to_string(d.index) + ": " + error);
+        }
+        d.writer_thread = std::thread(writer_loop, &s, &d);
+        d.capture_thread = std::thread(capture_loop, &s, &d);
+    }
+    return true;
+}
+
+void session_stop(Session &s)
+{
+    s.stop = true;
+    for (auto &d : s.devices)
+    {
+        if (d.capture_thread.joinable())
+            d.capture_thread.join();
+    }
+    for (auto &d : s.devices)
+    {
+        if (d.writer_thread.joinable())
+            d.writer_thread.join();
+    }
+    if (s.rig)
+    {
+        std::string error;
+        if (!s.rig->stop(&error))
+            session_fail(s, error);
+    }
+
+    for (auto &d : s.devices)
+    {
+        d.device->stop_cameras();
+        d.sample_wanted = false;
+        if (k4a_capture_t cap = session_take_sample(d))
+            k4a_capture_release(cap);
+    }
+
+    for (auto &d : s.devices)
+    {
+        close_segment(s, d);
+    }
+}
+
+static double to_ms(uint64_t ns)
+{
+    return static_cast<double>(ns) / 1e6;
+}
+
+std::string session_stats_json(Session &s)
+{
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"devices\": [";
+    bool first = true;
+    for (auto &d : s.devices)
+    {
+        out << (first ? "" : ", ") << "{\"index\": " << d.index << ", \"serial\": \"" << d.serial << "\""
+            << ", \"written\": " << d.written << ", \"dropped\": " << d.dropped << ", \"missed\": " << d.missed
+            << ", \"corrupt\": " << d.corrupt << ", \"event_failures\": " << d.event_failures
+            << ", \"latency_ms\": {";
+        first = false;
+        bool first_stage = true;
+        for (LatencyStage stage : all_stages)
+        {
+            LatencySnapshot snap = stage_latency(d, stage).snapshot();
+            out << (first_stage ? "" : ", ") << "\"" << latency_stage_name(stage) << "\": {\"count\": " << snap.count()
+                << ", \"p50\": " << to_ms(snap.percentile(50)) << ", \"p99\": " << to_ms(snap.percentile(99))
+                << ", \"p999\": " << to_ms(snap.percentile(99.9)) << ", \"max\": " << to_ms(snap.max()) << "}";
+            first_stage = false;
+        }
+        out << "}";
+        if (d.encoder)
+        {
+            const HostJpegEncoder &e = *d.encoder;
+            LatencySnapshot snap = e.encode_latency().snapshot();
+            out << ", \"host_jpeg\": {\"encoded\": " << e.encoded() << ", \"failed\": " << e.failed()
+                << ", \"unpooled\": " << e.unpooled()
+                << ", \"utilization\": " << e.utilization() << ", \"encode_ms\": {\"p50\": "
+                << to_ms(snap.percentile(50)) << ", \"p99\": " << to_ms(snap.percentile(99))
+                << ", \"max\": " << to_ms(snap.max()) << "}}";
+        }
+        out << "}";
+    }
+    out << "]}";
+    return out.str();
+}
+
+void print_latency_report(Session &s, std::ostream &out)
+{
+    out << "Latency from frame system timestamp, ms (p50 / p99 / p99.9 / max):" << std::endl;
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(2);
+    for (auto &d : s.devices)
+    {
+        out << "  device " << d.index << " (" << d.serial << ")" << std::endl;
+        for (LatencyStage stage : all_stages)
+        {
+            LatencySnapshot snap = stage_latency(d, stage).snapshot();
+            if (snap.count() == 0)
+                continue;
+            out << "    " << std::left << std::setw(9) << latency_stage_name(stage) << std::right
+                << to_ms(snap.percentile(50)) << " / " << to_ms(snap.percentile(99)) << " / "
+                << to_ms(snap.percentile(99.9)) << " / " << to_ms(snap.max()) << std::endl;
+        }
+    }
+    out.flags(flags);
+}
+
+void print_host_jpeg_report(Session &s, std::ostream &out)
+{
+    std::ios::fmtflags flags = out.flags();
+    out << std::fixed << std::setprecision(2);
+    for (auto &d : s.devices)
+    {
+        if (!d.encoder)
+            continue;
+        const HostJpegEncoder &e = *d.encoder;
+        LatencySnapshot snap = e.encode_latency().snapshot();
+        out << "Device " << d.index
+            << (d.config.color_format == K4A_IMAGE_FORMAT_COLOR_MJPG ? " JPEG cropping: " : " JPEG encoding: ")
+            << e.encoded() << " frames";
+        if (e.failed())
+            out << ", " << e.failed() << " failed";
+        if (e.unpooled())
+            out << ", " << e.unpooled() << " outside the buffer pool";
+        out << ", " << to_ms(snap.percentile(50)) << " / " << to_ms(snap.percentile(99)) << " ms p50 / p99, "
+            << e.options().threads << " threads " << std::setprecision(0) << e.utilization() * 100 << "% busy";
+        if (e.jpeg_bytes())
+            out << std::setprecision(1) << ", " << static_cast<double>(e.raw_bytes()) / e.jpeg_bytes() << ":1";
+        out << std::setprecision(2) << std::endl;
+    }
+    out.flags(flags);
+}
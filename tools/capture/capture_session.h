@@ -0,0 +1,230 @@
+#ifndef CAPTURE_SESSION_H
+#define CAPTURE_SESSION_H
+
+#include <k4a/k4a.h>
+#include <k4arecord/record.h>
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "capture_device.h"
+#include "chunk_hash.h"
+#include "frame_ring.h"
+#include "host_jpeg_encoder.h"
+#include "jpeg_payload.h"
+#include "latency_histogram.h"
+#include "recording_sink.h"
+#include "rig_sink.h"
+
+// The multi-device recording pipeline shared by htkrecorder and the soak
+// harness: one capture thread and one writer thread per device with a
+// FrameRing in between, writing k4a MKVs, optionally split into segments.
+
+struct SegmentInfo
+{
+    std::string path;
+    uint64_t first_timestamp_usec = 0; // color device timestamps
+    uint64_t last_timestamp_usec = 0;
+    uint64_t frames = 0;
+    uint64_t bytes = 0; // file size once closed
+    // content checksum, see chunk_hash.h; computed while writing, or by the
+    // manifest writer when that was not possible
+    std::string checksum; // "<algorithm>:<hex>"
+    size_t chunk_size = 0;
+    std::vector<uint64_t> chunks;
+};
+
+// What the writer does with MJPEG frames that fail jpeg_validate().
+enum class JpegCheck
+{
+    Off,
+    Count,      // record them anyway, but count and list them
+    Quarantine, // keep them out of the MKV; the first few are saved as .jpg
+};
+
+bool parse_jpeg_check(const std::string &name, JpegCheck *out);
+
+// DeviceCtx::corrupt counts every bad frame; only this many are listed.
+static const size_t kMaxCorruptFrames = 10000;
+
+struct CorruptFrame
+{
+    uint64_t timestamp_usec = 0; // color device timestamp
+    size_t segment = 0;
+    JpegDefect defect = JpegDefect::None;
+    std::string quarantine_path; // empty unless saved
+};
+
+// An annotation from the operator (or a program) during recording, see
+// event_markers.h. host_ns is CLOCK_MONOTONIC like the frames' system timestamps.
+struct EventMarker
+{
+    std::string label;
+    std::string source; // "stdin", "key", "socket", ...
+    int64_t host_ns = 0;
+    int64_t wall_ns = 0; // CLOCK_REALTIME, for the manifest
+};
+
+// Where a device's writer put an event on that device's clock.
+struct EventPlacement
+{
+    uint64_t device_timestamp_usec = 0;
+    size_t segment = 0;
+    bool written = true; // false when the event track refused it
+};
+
+struct DeviceCtx
+{
+    int index = -1;
+    std::string serial;
+    std::unique_ptr<CaptureDevice> device;
+
+    k4a_device_configuration_t config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+
+    // defaults to a K4aRecordSink when left empty
+    std::unique_ptr<RecordingSink> sink;
+    bool sink_open = false;
+    // owned by the writer thread while the session runs
+    std::vector<SegmentInfo> segments;
+    ChunkHasher hasher; // current segment
+    std::vector<CorruptFrame> corrupt_frames; // the first kMaxCorruptFrames
+    size_t quarantined = 0;                   // of them saved as .jpg
+    // one entry per Session::events item this writer has placed so far
+    std::vector<EventPlacement> events;
+
+    // set before session_start_threads() when color is captured as NV12 or
+    // YUY2; frames then pass through it on their way to the ring, and from
+    // the ring on everything sees MJPEG
+    std::unique_ptr<HostJpegEncoder> encoder;
+
+    // capture thread -> writer thread
+    std::unique_ptr<FrameRing<k4a_capture_t>> ring;
+    std::thread capture_thread;
+    std::thread writer_thread;
+
+    // safe to read while running
+    std::atomic<uint64_t> written{ 0 };
+    std::atomic<uint64_t> dropped{ 0 }; // queue full, released before the writer saw it
+    std::atomic<uint64_t> missed{ 0 };  // gaps in device timestamps, lost before reaching us
+    std::atomic<uint64_t> corrupt{ 0 }; // failed MJPEG validation
+    std::atomic<uint64_t> event_failures{ 0 }; // event markers the event track refused
+    LatencyHistogram write_latency;     // RecordingSink::write_capture() duration
+
+    // sensor-to-disk latency, from the frame's system timestamp to each stage
+    LatencyHistogram captured_latency; // k4a_device_get_capture() returned it
+    LatencyHistogram enqueued_latency; // in the ring for the writer
+    LatencyHistogram written_latency;  // write_capture() returned
+    LatencyHistogram durable_latency;  // covered by a completed sync, when enabled
+
+    // system timestamp of the newest frame; subordinates compare against the master's
+    std::atomic<int64_t> last_system_ns{ 0 };
+    // |arrival offset| from the nearest master frame, subordinates only;
+    // includes the configured subordinate_delay_off_master_usec
+    LatencyHistogram sync_skew;
+
+    // frames lent to background analyzers, see session_request_sample()
+    std::atomic_bool sample_wanted{ false };
+    std::mutex sample_mutex;
+    k4a_capture_t sample = nullptr;
+};
+
+enum class LatencyStage
+{
+    Captured,
+    Enqueued,
+    Written,
+    Durable,
+};
+
+const char *latency_stage_name(LatencyStage stage);
+const LatencyHistogram &stage_latency(const DeviceCtx &d, LatencyStage stage);
+
+struct Session
+{
+    // a deque so contexts never move once the threads hold pointers to them
+    std::deque<DeviceCtx> devices;
+    int master_index = -1;
+
+    int queue_frames = 16;
+    int segment_seconds = 0; // 0 records one file per device
+    int sync_ms = 0;         // fdatasync the recordings this often, 0 never
+    size_t checksum_chunk_bytes = kDefaultChunkBytes; // 0 leaves checksums to the manifest writer
+    JpegCheck jpeg_check = JpegCheck::Count;
+    bool frame_metadata = true;  // FrameMetadata track in every recording
+    bool event_track = false;    // HTK_EVENTS track in every recording
+    size_t max_quarantine = 100; // saved .jpg files per device
+    std::string output_dir;      // empty for the working directory
+    // encoded rig_calibration.h file attached to every recording, empty for none
+    std::string rig_calibration;
+    uint64_t rig_calibration_id = 0;
+
+    // every device's frames interleaved into one file as well, see rig_sink.h;
+    // set up by session_open_rig_file()
+    std::unique_ptr<RigSink> rig;
+
+    // runs on the writer thread once a segment's file has been closed
+    std::function<void(DeviceCtx &, const SegmentInfo &)> on_segment_closed;
+
+    // append through session_mark_event()
+    std::mutex event_mutex;
+    std::vector<EventMarker> events;
+    std::atomic<size_t> event_count{ 0 };
+
+    std::atomic_bool stop{ false };
+    std::mutex error_mutex;
+    std::string error; // first failure, empty if none
+};
+
+std::string segment_filename(const Session &s, const DeviceCtx &d, size_t segment);
+
+// 5, 15 or 30; 0 for an unknown value
+uint32_t fps_to_uint(k4a_fps_t fps);
+// pixel size of a color mode, 0x0 for an unknown one
+void color_resolution_size(k4a_color_resolution_t res, int *width, int *height);
+
+// Each returns false and fills s.error on failure.
+bool session_open_recordings(Session &s);
+// After the devices are configured: the rig file next to the recordings.
+bool session_open_rig_file(Session &s, const std::string &path, const RigSinkOptions &options);
+bool session_start_cameras(Session &s);
+// Starts no thread when a device's configuration cannot be captured, e.g.
+// an unset camera_fps; session_stop() still cleans up after that.
+bool session_start_threads(Session &s);
+
+// Stops and joins the threads, stops the cameras and finalizes every
+// recording. Safe to call after a worker failed.
+void session_stop(Session &s);
+
+// worker threads report here so the owner can still shut down cleanly
+void session_fail(Session &s, const std::string &msg);
+
+// Thread-safe; every device's writer places the event on its own clock and
+// writes it to its event track.
+void session_mark_event(Session &s, const std::string &label, const std::string &source, int64_t host_ns);
+
+// Asks the device's writer for a reference to the next capture it writes.
+// The writer only pays for this when asked, and gives up rather than wait if
+// the slot is busy. Collect with session_take_sample(): a capture to release,
+// or null if none has arrived yet. session_stop() releases leftovers.
+void session_request_sample(DeviceCtx &d);
+k4a_capture_t session_take_sample(DeviceCtx &d);
+
+// Per-device counters and latency percentiles as JSON; callable while the
+// session runs.
+std::string session_stats_json(Session &s);
+
+// Human-readable latency table for the end of a run.
+void print_latency_report(Session &s, std::ostream &out);
+// Encode (or crop) time, load and compression of the devices with a host
+// JPEG encoder; prints nothing when there are none.
+void print_host_jpeg_report(Session &s, std::ostream &out);
+
+#endif
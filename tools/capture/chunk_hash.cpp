@@ -0,0 +1,161 @@
+#include "chunk_hash.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HTK_HAVE_XXHASH
+#include <xxhash.h>
+#else
+#include <zlib.h>
+#endif
+
+const char *chunk_hash_name()
+{
+#ifdef HTK_HAVE_XXHASH
+    return "xxh3";
+#else
+    return "crc32";
+#endif
+}
+
+uint64_t chunk_hash(const void *data, size_t len)
+{
+#ifdef HTK_HAVE_XXHASH
+    return XXH3_64bits(data, len);
+#else
+    // zlib takes uInt lengths
+    uLong crc = crc32(0L, Z_NULL, 0);
+    const Bytef *p = static_cast<const Bytef *>(data);
+    while (len > 0)
+    {
+        uInt n = len > (1u << 30) ? (1u << 30) : static_cast<uInt>(len);
+        crc = crc32(crc, p, n);
+        p += n;
+        len -= n;
+    }
+    return crc;
+#endif
+}
+
+std::string chunk_hash_hex(uint64_t hash)
+{
+    char buf[17];
+#ifdef HTK_HAVE_XXHASH
+    std::snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash));
+#else
+    std::snprintf(buf, sizeof(buf), "%08llx", static_cast<unsigned long long>(hash));
+#endif
+    return buf;
+}
+
+std::string file_checksum(const std::vector<uint64_t> &chunks)
+{
+    // fixed little-endian layout so the value does not depend on the host
+    std::vector<uint8_t> raw;
+    raw.reserve(chunks.size() * 8);
+    for (uint64_t c : chunks)
+        for (int i = 0; i < 8; i++)
+            raw.push_back(static_cast<uint8_t>(c >> (8 * i)));
+    return std::string(chunk_hash_name()) + ":" + chunk_hash_hex(chunk_hash(raw.data(), raw.size()));
+}
+
+ChunkHasher::~ChunkHasher()
+{
+    close();
+}
+
+bool ChunkHasher::open(const std::string &path, size_t chunk_size)
+{
+    close();
+    m_chunk_size = chunk_size;
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+        return false;
+    if (m_buf.size() != m_chunk_size)
+        m_buf.resize(m_chunk_size);
+    return true;
+}
+
+void ChunkHasher::close()
+{
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_size = 0;
+    m_chunks.clear();
+}
+
+bool ChunkHasher::hash_chunk(size_t index, uint64_t size)
+{
+    const uint64_t offset = static_cast<uint64_t>(index) * m_chunk_size;
+    const size_t len = static_cast<size_t>(std::min<uint64_t>(m_chunk_size, size - offset));
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pread(m_fd, m_buf.data() + done, len - done, static_cast<off_t>(offset + done));
+        if (n <= 0)
+            return false;
+        done += static_cast<size_t>(n);
+    }
+    uint64_t h = chunk_hash(m_buf.data(), len);
+    if (index < m_chunks.size())
+        m_chunks[index] = h;
+    else
+        m_chunks.push_back(h);
+    return true;
+}
+
+bool ChunkHasher::update()
+{
+    if (m_fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+        return false;
+
+    // stay one chunk behind whatever is being appended
+    const uint64_t size = static_cast<uint64_t>(st.st_size);
+    while ((m_chunks.size() + 2) * m_chunk_size <= size)
+    {
+        if (!hash_chunk(m_chunks.size(), size))
+            return false;
+    }
+    m_size = size;
+    return true;
+}
+
+bool ChunkHasher::finish()
+{
+    if (m_fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+        return false;
+    const uint64_t size = static_cast<uint64_t>(st.st_size);
+
+    // a shorter file than what was hashed means something truncated it
+    if (size < m_chunks.size() * m_chunk_size)
+        m_chunks.clear();
+    if (!m_chunks.empty() && !hash_chunk(0, size))
+        return false;
+    while (m_chunks.size() * m_chunk_size < size)
+    {
+        if (!hash_chunk(m_chunks.size(), size))
+            return false;
+    }
+    m_size = size;
+    return true;
+}
+
+bool hash_file_chunks(const std::string &path, size_t chunk_size, std::vector<uint64_t> *chunks, uint64_t *bytes)
+{
+    ChunkHasher hasher;
+    if (!hasher.open(path, chunk_size) || !hasher.finish())
+        return false;
+    *chunks = hasher.chunks();
+    *bytes = hasher.bytes();
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef CHUNK_HASH_H
+#define CHUNK_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Content checksums for recordings, kept per fixed-size chunk so copies can
+// be verified in parallel and a corrupt region pinned down to one chunk.
+// Builds with libxxhash use XXH3-64, anything else falls back to zlib's
+// CRC32; the algorithm name is stored next to every checksum.
+const char *chunk_hash_name();
+uint64_t chunk_hash(const void *data, size_t len);
+std::string chunk_hash_hex(uint64_t hash);
+
+// Whole-file checksum derived from the chunk checksums, "<name>:<hex>".
+std::string file_checksum(const std::vector<uint64_t> &chunks);
+
+// Hashes a file while someone else is still appending to it, reading the
+// new bytes back through the page cache. libk4arecord writes clusters
+// sequentially and only rewrites the header region (segment size, seek head,
+// duration) on close, so chunks are hashed one chunk behind the end of the
+// file and finish() rehashes the first chunk and whatever is left.
+class ChunkHasher
+{
+public:
+    ChunkHasher() = default;
+    ~ChunkHasher();
+
+    ChunkHasher(const ChunkHasher &) = delete;
+    ChunkHasher &operator=(const ChunkHasher &) = delete;
+
+    bool open(const std::string &path, size_t chunk_size);
+    bool is_open() const
+    {
+        return m_fd >= 0;
+    }
+    // cheap when nothing new is complete: one fstat
+    bool update();
+    // call once the writer has closed the file
+    bool finish();
+    void close();
+
+    size_t chunk_size() const
+    {
+        return m_chunk_size;
+    }
+    const std::vector<uint64_t> &chunks() const
+    {
+        return m_chunks;
+    }
+    uint64_t bytes() const
+    {
+        return m_size;
+    }
+
+private:
+    bool hash_chunk(size_t index, uint64_t size);
+
+    size_t m_chunk_size = 0;
+    int m_fd = -1;
+    uint64_t m_size = 0;
+    std::vector<uint64_t> m_chunks;
+    std::vector<uint8_t> m_buf;
+};
+
+const size_t kDefaultChunkBytes = 4 << 20;
+
+// One-shot: chunk checksums of a complete file. Returns false if it cannot be read.
+bool hash_file_chunks(const std::string &path, size_t chunk_size, std::vector<uint64_t> *chunks, uint64_t *bytes);
+
+#endif
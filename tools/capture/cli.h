@@ -0,0 +1,53 @@
+#ifndef CLI_H
+#define CLI_H
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Command line helpers shared by the htk capture tools.
+
+static inline void die(const std::string &msg, int code = 1)
+{
+    std::cerr << msg << std::endl;
+    std::exit(code);
+}
+
+static inline bool parse_arg_value(int argc, char **argv, const char *key, std::string &out)
+{
+    for (int i = 1; i < argc - 1; i++)
+    {
+        if (std::strcmp(argv[i], key) == 0)
+        {
+            out = argv[i + 1];
+            return true;
+        }
+    }
+    return false;
+}
+
+// every value of an option that may be given more than once
+static inline std::vector<std::string> parse_arg_values(int argc, char **argv, const char *key)
+{
+    std::vector<std::string> values;
+    for (int i = 1; i < argc - 1; i++)
+    {
+        if (std::strcmp(argv[i], key) == 0)
+            values.push_back(argv[++i]);
+    }
+    return values;
+}
+
+static inline bool has_flag(int argc, char **argv, const char *key)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], key) == 0)
+            return true;
+    }
+    return false;
+}
+
+#endif
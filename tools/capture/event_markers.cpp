@@ -0,0 +1,232 @@
+#include "event_markers.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+EventServer::EventServer(Session &s) : m_session(s) {}
+
+EventServer::~EventServer()
+{
+    stop();
+}
+
+bool EventServer::listen_stdin(bool keys, std::string *error)
+{
+    m_stdin_fd = STDIN_FILENO;
+    m_keys = keys;
+    if (!keys)
+        return true;
+
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &m_saved_terminal) != 0)
+    {
+        *error = "key events need stdin to be a terminal";
+        return false;
+    }
+    // deliver each keypress as it happens instead of after Enter
+    termios raw = m_saved_terminal;
+    raw.c_lflag &= static_cast<tcflag_t>(~(ICANON | ECHO));
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSANOW, &raw) != 0)
+    {
+        *error = std::string("tcsetattr: ") + std::strerror(errno);
+        return false;
+    }
+    m_restore_terminal = true;
+    return true;
+}
+
+bool EventServer::listen_socket(const std::string &path, std::string *error)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        *error = "socket path too long: " + path;
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    m_socket_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (m_socket_fd < 0)
+    {
+        *error = std::string("socket: ") + std::strerror(errno);
+        return false;
+    }
+    unlink(path.c_str());
+    if (bind(m_socket_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        *error = "bind " + path + ": " + std::strerror(errno);
+        ::close(m_socket_fd);
+        m_socket_fd = -1;
+        return false;
+    }
+    m_socket_path = path;
+    return true;
+}
+
+void EventServer::start()
+{
+    if (pipe2(m_wake, O_CLOEXEC) != 0)
+    {
+        m_wake[0] = m_wake[1] = -1;
+    }
+    m_thread = std::thread(&EventServer::run, this);
+}
+
+void EventServer::stop()
+{
+    if (m_thread.joinable())
+    {
+        if (m_wake[1] >= 0)
+        {
+            char c = 0;
+            ssize_t n = write(m_wake[1], &c, 1);
+            (void)n;
+        }
+        m_thread.join();
+    }
+    for (int &fd : m_wake)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+    if (m_restore_terminal)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &m_saved_terminal);
+        m_restore_terminal = false;
+    }
+    if (m_socket_fd >= 0)
+    {
+        ::close(m_socket_fd);
+        unlink(m_socket_path.c_str());
+        m_socket_fd = -1;
+    }
+}
+
+void EventServer::handle_line(std::string line, const char *source, int64_t now)
+{
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r' || line.back() == ' '))
+        line.pop_back();
+    size_t start = line.find_first_not_of(' ');
+    line = start == std::string::npos ? "" : line.substr(start);
+
+    int64_t host_ns = now;
+    if (!line.empty() && line[0] == '@')
+    {
+        char *end = nullptr;
+        long long stamped = std::strtoll(line.c_str() + 1, &end, 10);
+        // a stamp from the future or far in the past is a sender bug; use arrival time
+        if (end != line.c_str() + 1 && stamped <= now && now - stamped < 10000000000LL)
+            host_ns = stamped;
+        size_t label = line.find_first_not_of(' ', line.find(' '));
+        line = label == std::string::npos ? "" : line.substr(label);
+    }
+    session_mark_event(m_session, line.empty() ? "mark" : line, source, host_ns);
+    std::cout << "Event '" << (line.empty() ? "mark" : line) << "' (" << source << ")" << std::endl;
+}
+
+void EventServer::run()
+{
+    char buf[4096];
+    while (!m_session.stop)
+    {
+        pollfd fds[3];
+        int n = 0;
+        int stdin_slot = -1, socket_slot = -1;
+        if (m_stdin_fd >= 0)
+        {
+            stdin_slot = n;
+            fds[n++] = { m_stdin_fd, POLLIN, 0 };
+        }
+        if (m_socket_fd >= 0)
+        {
+            socket_slot = n;
+            fds[n++] = { m_socket_fd, POLLIN, 0 };
+        }
+        int wake_slot = n;
+        fds[n++] = { m_wake[0], POLLIN, 0 };
+
+        // the timeout only matters for noticing session.stop
+        if (poll(fds, static_cast<nfds_t>(n), 100) <= 0)
+            continue;
+        const int64_t now = monotonic_ns();
+
+        if (fds[wake_slot].revents != 0)
+            break;
+
+        if (stdin_slot >= 0 && (fds[stdin_slot].revents & (POLLIN | POLLHUP)))
+        {
+            ssize_t got = read(m_stdin_fd, buf, sizeof(buf));
+            if (got <= 0)
+            {
+                m_stdin_fd = -1; // EOF, e.g. a script piped in
+            }
+            else if (m_keys)
+            {
+                for (ssize_t i = 0; i < got; i++)
+                {
+                    switch (buf[i])
+                    {
+                    case 's':
+                        handle_line("handover_start", "key", now);
+                        break;
+                    case 'e':
+                        handle_line("handover_end", "key", now);
+                        break;
+                    case ' ':
+                    case 'm':
+                        handle_line("mark", "key", now);
+                        break;
+                    case 'q':
+                        std::cout << "Stop requested from the keyboard." << std::endl;
+                        m_session.stop = true;
+                        break;
+                    default:
+                        break;
+                    }
+                }
+            }
+            else
+            {
+                // the arrival time of the chunk stands for every line completed in it
+                m_partial.append(buf, static_cast<size_t>(got));
+                size_t nl;
+                while ((nl = m_partial.find('\n')) != std::string::npos)
+                {
+                    handle_line(m_partial.substr(0, nl), "stdin", now);
+                    m_partial.erase(0, nl + 1);
+                }
+            }
+        }
+
+        if (socket_slot >= 0 && (fds[socket_slot].revents & POLLIN))
+        {
+            ssize_t got = recv(m_socket_fd, buf, sizeof(buf), 0);
+            if (got >= 0)
+            {
+                std::string text(buf, static_cast<size_t>(got));
+                size_t pos = 0;
+                while (pos <= text.size())
+                {
+                    size_t nl = text.find('\n', pos);
+                    std::string line = text.substr(pos, nl == std::string::npos ? std::string::npos : nl - pos);
+                    if (!line.empty() || pos == 0)
+                        handle_line(line, "socket", now);
+                    if (nl == std::string::npos)
+                        break;
+                    pos = nl + 1;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef EVENT_MARKERS_H
+#define EVENT_MARKERS_H
+
+#include <string>
+#include <termios.h>
+#include <thread>
+
+#include "capture_session.h"
+
+// Feeds session_mark_event() from the operator's terminal and from other
+// programs while a session records. Each input is stamped on arrival with
+// CLOCK_MONOTONIC, the clock of the frames' system timestamps, so an event
+// lands between frames rather than on the next one.
+//
+// Line protocol (stdin and socket datagrams), one event per line:
+//
+//   <label>              e.g. handover_start
+//   @<ns> <label>        stamped by the sender with CLOCK_MONOTONIC ns
+//   (empty line)         "mark"
+//
+// Key mode reads single keypresses from a terminal instead:
+//   s handover_start, e handover_end, space/m mark, q stop recording.
+class EventServer
+{
+public:
+    explicit EventServer(Session &s);
+    ~EventServer();
+
+    EventServer(const EventServer &) = delete;
+    EventServer &operator=(const EventServer &) = delete;
+
+    // keys needs stdin to be a terminal; returns false and fills error otherwise
+    bool listen_stdin(bool keys, std::string *error);
+    // unix datagram socket; an existing socket file at path is replaced
+    bool listen_socket(const std::string &path, std::string *error);
+
+    void start();
+    // also restores the terminal and removes the socket
+    void stop();
+
+private:
+    void run();
+    void handle_line(std::string line, const char *source, int64_t now);
+
+    Session &m_session;
+    int m_stdin_fd = -1;
+    bool m_keys = false;
+    bool m_restore_terminal = false;
+    termios m_saved_terminal{};
+    int m_socket_fd = -1;
+    std::string m_socket_path;
+    int m_wake[2] = { -1, -1 };
+    std::string m_partial; // stdin line being typed
+    std::thread m_thread;
+};
+
+#endif
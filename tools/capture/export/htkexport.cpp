@@ -0,0 +1,511 @@
+// Exports a take as constant-rate, frame-aligned recordings, one per camera.
+//
+//   htkexport [--names SERIAL=NAME,...] [--root DIR] session_manifest.json out_dir
+//
+// Frame i of every output is the same instant: slot i of the master's frame
+// grid, which runs at the configured rate from the master's first frame to
+// its last. A camera's frames are placed on the grid by device timestamp,
+// counting whole frame periods from its previous frame, so a drop leaves one
+// empty slot instead of shifting everything after it. The slot of each
+// camera's first frame comes from the host timestamps of the first frames in
+// the metadata tracks (frame_metadata.h), the same matching the recorder
+// uses for sync skew. An empty slot gets the camera's previous frame again
+// (the next one at the very start), flagged kFrameFilled in the metadata
+// track.
+//
+// One thread per camera streams its segments in order straight into
+// <out_dir>/<name>.mkv; MJPEG frames are copied, not re-encoded. Then
+// <out_dir>/alignment.csv gets one row per slot: its index and timestamp, and
+// per camera the source frame's device timestamp and 0 (recorded) or 1
+// (filled). <name> is the camera's name in the recording's rig calibration,
+// else camera_<index>; --names overrides it by serial. The outputs are what
+// infer_hand.py's process_seq expects in a sequence directory.
+// Exit status: 0 done, 1 bad arguments or input, 2 a camera failed.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <k4arecord/playback.h>
+
+#include "../capture_session.h"
+#include "../cli.h"
+#include "../frame_metadata.h"
+#include "../json_reader.h"
+#include "../recording_sink.h"
+#include "../rig_calibration.h"
+
+using namespace std::chrono;
+
+// metadata records per camera used to find where it starts on the grid
+static const size_t kAnchorFrames = 64;
+
+enum SlotStatus : uint8_t
+{
+    kSlotRecorded = 0,
+    kSlotFilled = 1,
+};
+
+struct ExportCamera
+{
+    int index = -1;
+    std::string serial;
+    std::string name;
+    std::vector<std::string> segments;
+    std::string rig_calibration; // attachment of the first segment, copied into the output
+    int64_t first_slot = 0;      // grid slot of the first frame
+    // per slot
+    std::vector<uint64_t> source_usec;
+    std::vector<uint8_t> status;
+    size_t recorded = 0, filled = 0;
+    size_t doubled = 0;  // frames that fell into an already used slot
+    size_t outside = 0;  // frames before or after the grid
+    std::string error;
+};
+
+struct Grid
+{
+    uint64_t start_usec = 0; // master device time of slot 0
+    uint32_t fps = 0;
+    size_t slots = 0;
+
+    uint64_t slot_usec(size_t slot) const
+    {
+        return start_usec + slot * 1000000ull / fps;
+    }
+};
+
+static std::string dirname_of(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Whole frame periods between two device timestamps of one camera.
+static int64_t periods_between(uint64_t from_usec, uint64_t to_usec, uint32_t fps)
+{
+    const double periods = (static_cast<double>(to_usec) - static_cast<double>(from_usec)) * fps / 1e6;
+    return static_cast<int64_t>(std::llround(periods));
+}
+
+static bool read_first_metadata(const std::string &path, size_t count, std::vector<FrameMetadata> *records)
+{
+    k4a_playback_t playback = nullptr;
+    if (K4A_FAILED(k4a_playback_open(path.c_str(), &playback)))
+        return false;
+    k4a_playback_data_block_t block = nullptr;
+    while (records->size() < count &&
+           k4a_playback_get_next_data_block(playback, kFrameMetadataTrack, &block) == K4A_STREAM_RESULT_SUCCEEDED)
+    {
+        FrameMetadata meta;
+        std::memset(&meta, 0, sizeof(meta));
+        size_t size = k4a_playback_data_block_get_buffer_size(block);
+        std::memcpy(&meta, k4a_playback_data_block_get_buffer(block), size < sizeof(meta) ? size : sizeof(meta));
+        records->push_back(meta);
+        k4a_playback_data_block_release(block);
+    }
+    k4a_playback_close(playback);
+    return true;
+}
+
+// Slot of a camera's first frame: each of its first frames is matched to the
+// master frame nearest in host time, and the median of the implied slots wins.
+static bool anchor_camera(const std::vector<FrameMetadata> &master,
+                          int64_t master_first_slot,
+                          const std::vector<FrameMetadata> &camera,
+                          uint32_t fps,
+                          int64_t *first_slot)
+{
+    const double period_ns = 1e9 / fps;
+    std::vector<int64_t> master_slots(master.size(), master_first_slot);
+    for (size_t j = 1; j < master.size(); j++)
+        master_slots[j] = master_slots[j - 1] +
+                          periods_between(master[j - 1].device_timestamp_usec, master[j].device_timestamp_usec, fps);
+
+    std::vector<int64_t> votes;
+    int64_t own = 0; // periods since the camera's first frame
+    for (size_t i = 0; i < camera.size(); i++)
+    {
+        if (i > 0)
+            own += periods_between(camera[i - 1].device_timestamp_usec, camera[i].device_timestamp_usec, fps);
+        if (camera[i].system_timestamp_nsec == 0)
+            continue;
+        size_t best = master.size();
+        double best_gap = 0;
+        for (size_t j = 0; j < master.size(); j++)
+        {
+            if (master[j].system_timestamp_nsec == 0)
+                continue;
+            const double gap = static_cast<double>(camera[i].system_timestamp_nsec) -
+                               static_cast<double>(master[j].system_timestamp_nsec);
+            if (best == master.size() || std::abs(gap) < std::abs(best_gap))
+            {
+                best = j;
+                best_gap = gap;
+            }
+        }
+        if (best < master.size())
+            votes.push_back(master_slots[best] + std::llround(best_gap / period_ns) - own);
+    }
+    if (votes.empty())
+        return false;
+    std::nth_element(votes.begin(), votes.begin() + votes.size() / 2, votes.end());
+    *first_slot = votes[votes.size() / 2];
+    return true;
+}
+
+// Writes source's color image as the grid slot's frame.
+static bool write_slot(RecordingSink &sink,
+                       const Grid &grid,
+                       k4a_image_t source,
+                       const FrameMetadata &source_meta,
+                       size_t slot,
+                       bool filled)
+{
+    const uint64_t ts = grid.slot_usec(slot);
+    k4a_image_t image = nullptr;
+    if (K4A_FAILED(k4a_image_create_from_buffer(k4a_image_get_format(source),
+                                                k4a_image_get_width_pixels(source),
+                                                k4a_image_get_height_pixels(source),
+                                                k4a_image_get_stride_bytes(source),
+                                                k4a_image_get_buffer(source),
+                                                k4a_image_get_size(source),
+                                                nullptr,
+                                                nullptr,
+                                                &image)))
+        return false;
+    k4a_image_set_device_timestamp_usec(image, ts);
+    k4a_image_set_system_timestamp_nsec(image, k4a_image_get_system_timestamp_nsec(source));
+    k4a_capture_t capture = nullptr;
+    if (K4A_FAILED(k4a_capture_create(&capture)))
+    {
+        k4a_image_release(image);
+        return false;
+    }
+    k4a_capture_set_color_image(capture, image);
+    k4a_image_release(image);
+    bool ok = K4A_SUCCEEDED(sink.write_capture(capture));
+    k4a_capture_release(capture);
+
+    FrameMetadata meta = source_meta;
+    meta.device_timestamp_usec = ts;
+    meta.sequence = slot;
+    meta.version = kFrameMetadataVersion;
+    if (filled)
+        meta.flags |= kFrameFilled;
+    return ok && K4A_SUCCEEDED(sink.write_metadata(meta));
+}
+
+static void export_camera(ExportCamera *cam, const Grid &grid, const std::string &out_path)
+{
+    cam->source_usec.assign(grid.slots, 0);
+    cam->status.assign(grid.slots, kSlotFilled);
+
+    K4aRecordSink sink;
+    bool created = false;
+    // the last frame written, repeated into empty slots
+    k4a_image_t held = nullptr;
+    FrameMetadata held_meta;
+    std::memset(&held_meta, 0, sizeof(held_meta));
+    size_t next_slot = 0;
+    bool first = true;
+    uint64_t prev_usec = 0;
+    int64_t prev_slot = 0;
+
+    auto put = [&](k4a_image_t image, const FrameMetadata &meta, size_t slot, bool filled) {
+        if (!cam->error.empty())
+            return;
+        if (!write_slot(sink, grid, image, meta, slot, filled))
+        {
+            cam->error = "Writing " + out_path + " failed.";
+            return;
+        }
+        cam->source_usec[slot] = k4a_image_get_device_timestamp_usec(image);
+        cam->status[slot] = filled ? kSlotFilled : kSlotRecorded;
+        (filled ? cam->filled : cam->recorded)++;
+    };
+
+    for (size_t s = 0; s < cam->segments.size() && cam->error.empty(); s++)
+    {
+        k4a_playback_t playback = nullptr;
+        if (K4A_FAILED(k4a_playback_open(cam->segments[s].c_str(), &playback)))
+        {
+            cam->error = "Unable to open " + cam->segments[s];
+            break;
+        }
+        if (!created)
+        {
+            k4a_record_configuration_t rc;
+            if (K4A_FAILED(k4a_playback_get_record_configuration(playback, &rc)))
+            {
+                cam->error = "Unable to read the configuration of " + cam->segments[s];
+                k4a_playback_close(playback);
+                break;
+            }
+            k4a_device_configuration_t config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+            config.color_format = rc.color_format;
+            config.color_resolution = rc.color_resolution;
+            config.camera_fps = rc.camera_fps;
+            config.wired_sync_mode = K4A_WIRED_SYNC_MODE_STANDALONE;
+            if (K4A_FAILED(sink.create(out_path, nullptr, config)) || K4A_FAILED(sink.add_metadata_track()) ||
+                (!cam->rig_calibration.empty() &&
+                 K4A_FAILED(sink.add_attachment(kRigCalibrationAttachment, cam->rig_calibration))) ||
+                K4A_FAILED(sink.add_tag("HTK_SOURCE_SERIAL", cam->serial)) || K4A_FAILED(sink.write_header()))
+            {
+                cam->error = "Unable to create " + out_path;
+                k4a_playback_close(playback);
+                break;
+            }
+            created = true;
+        }
+
+        bool more_metadata = true;
+        bool have_record = false; // record holds one read ahead, not yet matched
+        FrameMetadata meta, record;
+        k4a_capture_t capture = nullptr;
+        while (cam->error.empty() && k4a_playback_get_next_capture(playback, &capture) == K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            k4a_image_t image = k4a_capture_get_color_image(capture);
+            k4a_capture_release(capture);
+            if (image == nullptr)
+                continue;
+            const uint64_t ts = k4a_image_get_device_timestamp_usec(image);
+
+            // records follow their frames, and a frame whose record is missing
+            // gets an empty one; a record read ahead for a later frame waits
+            // for that frame. A recording without the track gets empty ones.
+            while (more_metadata && (!have_record || record.device_timestamp_usec < ts))
+            {
+                k4a_playback_data_block_t block = nullptr;
+                more_metadata = k4a_playback_get_next_data_block(playback, kFrameMetadataTrack, &block) ==
+                                K4A_STREAM_RESULT_SUCCEEDED;
+                have_record = more_metadata;
+                if (!more_metadata)
+                    break;
+                size_t size = k4a_playback_data_block_get_buffer_size(block);
+                std::memset(&record, 0, sizeof(record));
+                std::memcpy(&record, k4a_playback_data_block_get_buffer(block),
+                            size < sizeof(record) ? size : sizeof(record));
+                k4a_playback_data_block_release(block);
+            }
+            std::memset(&meta, 0, sizeof(meta));
+            if (have_record && record.device_timestamp_usec == ts)
+            {
+                meta = record;
+                have_record = false;
+            }
+
+            const int64_t slot = first ? cam->first_slot : prev_slot + periods_between(prev_usec, ts, grid.fps);
+            if (!first && slot <= prev_slot)
+            {
+                cam->doubled++;
+                k4a_image_release(image);
+                continue;
+            }
+            first = false;
+            prev_usec = ts;
+            prev_slot = slot;
+            if (slot < 0 || slot >= static_cast<int64_t>(grid.slots))
+            {
+                cam->outside++;
+                k4a_image_release(image);
+                continue;
+            }
+            for (; next_slot < static_cast<size_t>(slot); next_slot++)
+                put(held ? held : image, held ? held_meta : meta, next_slot, true);
+            put(image, meta, next_slot++, false);
+            if (held)
+                k4a_image_release(held);
+            held = image;
+            held_meta = meta;
+        }
+        k4a_playback_close(playback);
+    }
+
+    if (held)
+    {
+        for (; next_slot < grid.slots; next_slot++)
+            put(held, held_meta, next_slot, true);
+        k4a_image_release(held);
+    }
+    else if (cam->error.empty())
+    {
+        cam->error = "No frame of camera " + std::to_string(cam->index) + " falls on the master's grid.";
+    }
+    if (created)
+    {
+        sink.flush();
+        sink.close();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argv[argc - 2][0] == '-' || argv[argc - 1][0] == '-')
+        die("Usage: htkexport [--names SERIAL=NAME,...] [--root DIR] session_manifest.json out_dir");
+    const std::string manifest_path = argv[argc - 2];
+    std::string out_dir = argv[argc - 1];
+    while (out_dir.size() > 1 && out_dir.back() == '/')
+        out_dir.pop_back();
+
+    std::string tmp;
+    std::string root = dirname_of(manifest_path);
+    parse_arg_value(argc, argv, "--root", root);
+    std::map<std::string, std::string> names;
+    if (parse_arg_value(argc, argv, "--names", tmp))
+    {
+        std::stringstream list(tmp);
+        std::string item;
+        while (std::getline(list, item, ','))
+        {
+            size_t eq = item.find('=');
+            if (eq == std::string::npos)
+                die("--names takes SERIAL=NAME pairs separated by commas.");
+            names[item.substr(0, eq)] = item.substr(eq + 1);
+        }
+    }
+
+    JsonValue manifest;
+    std::string error;
+    if (!load_json_file(manifest_path, &manifest, &error))
+        die(error);
+    const JsonValue *devices = manifest.get("devices");
+    if (devices == nullptr || devices->type != JsonValue::Array || devices->items.empty())
+        die(manifest_path + " is not a session manifest.");
+    const JsonValue *master_entry = manifest.get("master");
+    const int master_index =
+        master_entry && master_entry->get("index") ? static_cast<int>(master_entry->get("index")->int64()) : 0;
+
+    std::vector<ExportCamera> cameras;
+    size_t master = devices->items.size();
+    Grid grid;
+    uint64_t master_last_usec = 0;
+    for (auto &d : devices->items)
+    {
+        ExportCamera cam;
+        cam.index = d.get("index") ? static_cast<int>(d.get("index")->int64()) : -1;
+        cam.serial = d.get("serial") ? d.get("serial")->str() : "";
+        cam.name = "camera_" + std::to_string(cam.index);
+        const JsonValue *segments = d.get("segments");
+        for (size_t s = 0; segments && s < segments->items.size(); s++)
+        {
+            const JsonValue &seg = segments->items[s];
+            const std::string file = seg.get("file") ? seg.get("file")->str() : "";
+            cam.segments.push_back(file.empty() || file[0] == '/' ? file : root + "/" + file);
+            if (cam.index == master_index)
+            {
+                if (s == 0 && seg.get("first_timestamp_usec"))
+                    grid.start_usec = seg.get("first_timestamp_usec")->uint64();
+                if (seg.get("last_timestamp_usec"))
+                    master_last_usec = seg.get("last_timestamp_usec")->uint64();
+            }
+        }
+        if (cam.segments.empty())
+            die("Camera " + std::to_string(cam.index) + " has no recordings in " + manifest_path);
+        if (cam.index == master_index)
+        {
+            master = cameras.size();
+            const JsonValue *config = d.get("config");
+            if (config && config->get("camera_fps"))
+                grid.fps = static_cast<uint32_t>(config->get("camera_fps")->uint64());
+        }
+        cameras.push_back(cam);
+    }
+    if (master == cameras.size())
+        die(manifest_path + " does not list the master's recordings.");
+    if (grid.fps == 0 || master_last_usec <= grid.start_usec)
+        die(manifest_path + " does not give the master's frame rate and timestamp range.");
+    grid.slots = static_cast<size_t>(periods_between(grid.start_usec, master_last_usec, grid.fps)) + 1;
+
+    // names and calibration come with the recordings
+    std::vector<FrameMetadata> master_meta;
+    if (!read_first_metadata(cameras[master].segments.front(), kAnchorFrames, &master_meta) || master_meta.empty())
+        die(cameras[master].segments.front() + " has no frame metadata to align by.");
+    cameras[master].first_slot = periods_between(grid.start_usec, master_meta.front().device_timestamp_usec, grid.fps);
+    for (auto &cam : cameras)
+    {
+        if (read_recording_rig_calibration(cam.segments.front(), &cam.rig_calibration))
+        {
+            RigCalibration rig;
+            int i = -1;
+            if (rig_calibration_decode(reinterpret_cast<const uint8_t *>(cam.rig_calibration.data()),
+                                       cam.rig_calibration.size(), &rig, nullptr, &error) &&
+                (i = rig_find_camera(rig, cam.serial)) >= 0)
+                cam.name = rig.cameras[i].name;
+        }
+        if (names.count(cam.serial))
+            cam.name = names[cam.serial];
+        if (&cam == &cameras[master])
+            continue;
+        std::vector<FrameMetadata> meta;
+        if (!read_first_metadata(cam.segments.front(), kAnchorFrames, &meta) ||
+            !anchor_camera(master_meta, cameras[master].first_slot, meta, grid.fps, &cam.first_slot))
+            die(cam.segments.front() + " has no host timestamps to align by.");
+    }
+
+    mkdir(out_dir.c_str(), 0755);
+    const auto t0 = steady_clock::now();
+    std::vector<std::thread> threads;
+    for (auto &cam : cameras)
+        threads.emplace_back(export_camera, &cam, std::cref(grid), out_dir + "/" + cam.name + ".mkv");
+    for (auto &t : threads)
+        t.join();
+    const double seconds = duration<double>(steady_clock::now() - t0).count();
+
+    std::ostringstream csv;
+    csv << "frame,timestamp_usec";
+    for (auto &cam : cameras)
+        csv << "," << cam.name << "_source_usec," << cam.name << "_status";
+    csv << "\n";
+    for (size_t slot = 0; slot < grid.slots; slot++)
+    {
+        csv << slot << "," << grid.slot_usec(slot);
+        for (auto &cam : cameras)
+            csv << "," << cam.source_usec[slot] << "," << static_cast<int>(cam.status[slot]);
+        csv << "\n";
+    }
+    const std::string csv_path = out_dir + "/alignment.csv";
+    {
+        std::ofstream out(csv_path + ".tmp", std::ios::trunc);
+        out << csv.str();
+        out.close();
+        if (!out || std::rename((csv_path + ".tmp").c_str(), csv_path.c_str()) != 0)
+            die("Unable to write " + csv_path);
+    }
+
+    size_t failed = 0;
+    std::cout << grid.slots << " frame(s) at " << grid.fps << " fps per camera, exported in " << std::fixed
+              << std::setprecision(2) << seconds << " s" << std::endl;
+    for (auto &cam : cameras)
+    {
+        std::cout << "  " << std::left << std::setw(12) << cam.name << std::right << " (" << cam.serial << ") ";
+        if (!cam.error.empty())
+        {
+            failed++;
+            std::cout << "FAILED: " << cam.error << std::endl;
+            continue;
+        }
+        std::cout << "starts at frame " << cam.first_slot << ", " << cam.recorded << " recorded, " << cam.filled
+                  << " filled";
+        if (cam.doubled)
+            std::cout << ", " << cam.doubled << " sharing a slot dropped";
+        if (cam.outside)
+            std::cout << ", " << cam.outside << " outside the master's range dropped";
+        std::cout << std::endl;
+    }
+    return failed ? 2 : 0;
+}
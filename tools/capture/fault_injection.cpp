@@ -0,0 +1,431 @@
+#include "fault_injection.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace std::chrono;
+
+// "10s", "2500ms", "1.5s", "2m" -> ns
+static bool parse_duration_ns(const std::string &text, int64_t *ns)
+{
+    size_t end = 0;
+    double value = 0;
+    try
+    {
+        value = std::stod(text, &end);
+    }
+    catch (...)
+    {
+        return false;
+    }
+    std::string unit = text.substr(end);
+    double scale;
+    if (unit == "ms")
+        scale = 1e6;
+    else if (unit == "s" || unit.empty())
+        scale = 1e9;
+    else if (unit == "m")
+        scale = 60e9;
+    else
+        return false;
+    *ns = static_cast<int64_t>(value * scale);
+    return value >= 0;
+}
+
+static bool parse_int(const std::string &text, int64_t *out)
+{
+    try
+    {
+        size_t end = 0;
+        *out = std::stoll(text, &end);
+        return end == text.size() && *out >= 0;
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+static bool parse_rule(const std::string &line, FaultRule *rule, std::string *error)
+{
+    std::istringstream in(line);
+    std::string target, kind, token;
+    in >> target >> kind;
+
+    size_t colon = target.find(':');
+    std::string what = target.substr(0, colon);
+    std::string which = colon == std::string::npos ? "*" : target.substr(colon + 1);
+    if (what == "device")
+        rule->device = true;
+    else if (what == "sink")
+        rule->device = false;
+    else
+    {
+        *error = "unknown target '" + target + "'";
+        return false;
+    }
+    int64_t index = 0;
+    if (which == "*")
+        rule->index = -1;
+    else if (parse_int(which, &index))
+        rule->index = static_cast<int>(index);
+    else
+    {
+        *error = "bad index in '" + target + "'";
+        return false;
+    }
+
+    if (rule->device && kind == "timeout")
+        rule->kind = FaultKind::Timeout;
+    else if (rule->device && kind == "usb_error")
+        rule->kind = FaultKind::UsbError;
+    else if (rule->device && kind == "latency")
+        rule->kind = FaultKind::Latency;
+    else if (rule->device && kind == "corrupt")
+        rule->kind = FaultKind::Corrupt;
+    else if (!rule->device && kind == "slow")
+        rule->kind = FaultKind::Slow;
+    else if (!rule->device && kind == "full")
+        rule->kind = FaultKind::Full;
+    else if (!rule->device && kind == "eio")
+        rule->kind = FaultKind::Eio;
+    else
+    {
+        *error = "fault '" + kind + "' does not apply to " + what;
+        return false;
+    }
+
+    bool have_trigger = false, have_window = false, window_by_frame = false;
+    while (in >> token)
+    {
+        size_t eq = token.find('=');
+        std::string key = token.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : token.substr(eq + 1);
+        bool ok;
+        if (key == "at")
+        {
+            rule->by_frame = false;
+            ok = parse_duration_ns(value, &rule->start);
+            have_trigger = true;
+        }
+        else if (key == "frame")
+        {
+            rule->by_frame = true;
+            ok = parse_int(value, &rule->start);
+            have_trigger = true;
+        }
+        else if (key == "for" || key == "frames")
+        {
+            window_by_frame = key == "frames";
+            ok = window_by_frame ? parse_int(value, &rule->length) : parse_duration_ns(value, &rule->length);
+            have_window = true;
+        }
+        else if (key == "ms")
+            ok = parse_int(value, &rule->delay_ms);
+        else if (key == "every")
+            ok = parse_int(value, &rule->every) && rule->every > 0;
+        else
+            ok = false;
+
+        if (!ok)
+        {
+            *error = "bad option '" + token + "'";
+            return false;
+        }
+    }
+
+    if (!have_trigger)
+    {
+        *error = "missing at=<time> or frame=<n>";
+        return false;
+    }
+    if (have_window && rule->by_frame != window_by_frame)
+    {
+        *error = "use for=<duration> with at= and frames=<n> with frame=";
+        return false;
+    }
+    if (rule->kind == FaultKind::Full && rule->length == 0)
+    {
+        rule->length = -1; // a full disk stays full
+    }
+    return true;
+}
+
+bool parse_fault_script(const std::string &text, std::vector<FaultRule> *rules, std::string *error)
+{
+    std::istringstream in(text);
+    std::string line;
+    int line_number = 0;
+    while (std::getline(in, line))
+    {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        FaultRule rule;
+        std::string why;
+        if (!parse_rule(line, &rule, &why))
+        {
+            *error = "line " + std::to_string(line_number) + ": " + why;
+            return false;
+        }
+        rules->push_back(rule);
+    }
+    return true;
+}
+
+bool load_fault_script(const std::string &path, std::vector<FaultRule> *rules, std::string *error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        *error = "unable to open " + path;
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    if (!parse_fault_script(text.str(), rules, error))
+    {
+        *error = path + ": " + *error;
+        return false;
+    }
+    return true;
+}
+
+void install_faults(Session &s, const std::vector<FaultRule> &rules)
+{
+    for (auto &d : s.devices)
+    {
+        FaultSchedule device_faults(rules, true, d.index);
+        if (!device_faults.empty())
+        {
+            d.device.reset(new FaultDevice(std::move(d.device), std::move(device_faults)));
+        }
+
+        FaultSchedule sink_faults(rules, false, d.index);
+        if (!sink_faults.empty())
+        {
+            std::unique_ptr<RecordingSink> inner = std::move(d.sink);
+            if (!inner)
+                inner.reset(new K4aRecordSink());
+            d.sink.reset(new FaultSink(std::move(inner), std::move(sink_faults)));
+        }
+    }
+}
+
+FaultSchedule::FaultSchedule(const std::vector<FaultRule> &rules, bool device, int index)
+    : m_epoch(steady_clock::now())
+{
+    for (auto &r : rules)
+    {
+        if (r.device == device && (r.index == -1 || r.index == index))
+        {
+            Armed a;
+            a.rule = r;
+            m_rules.push_back(a);
+        }
+    }
+}
+
+// Rank of a fault when several rules fire on one frame.
+static int severity(const FaultRule &r)
+{
+    switch (r.kind)
+    {
+    case FaultKind::Full:
+        return 5;
+    case FaultKind::Eio:
+    case FaultKind::UsbError:
+        return 4;
+    case FaultKind::Timeout:
+        return 3;
+    case FaultKind::Corrupt:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+const FaultRule *FaultSchedule::next_frame()
+{
+    const int64_t frame = m_frame++;
+    if (m_rules.empty())
+    {
+        return nullptr;
+    }
+    const int64_t elapsed = duration_cast<nanoseconds>(steady_clock::now() - m_epoch).count();
+
+    // every rule sees every frame, so one rule cannot shadow another's window
+    const FaultRule *active = nullptr;
+    for (auto &a : m_rules)
+    {
+        const FaultRule &r = a.rule;
+        const int64_t pos = r.by_frame ? frame : elapsed;
+        if (pos < r.start)
+            continue;
+
+        bool fires;
+        if (r.length == 0)
+        {
+            fires = !a.fired;
+            a.fired = true;
+        }
+        else if (r.length > 0 && pos >= r.start + r.length)
+            continue;
+        else
+        {
+            // frames seen inside the window, for 'every'
+            fires = a.hits++ % r.every == 0 || r.kind == FaultKind::Full;
+        }
+
+        if (fires && (active == nullptr || severity(r) > severity(*active) ||
+                      (severity(r) == severity(*active) && r.delay_ms > active->delay_ms)))
+            active = &r;
+    }
+    return active;
+}
+
+FaultDevice::FaultDevice(std::unique_ptr<CaptureDevice> inner, FaultSchedule schedule)
+    : m_inner(std::move(inner)), m_schedule(std::move(schedule))
+{
+}
+
+static void free_buffer(void *buffer, void *)
+{
+    std::free(buffer);
+}
+
+// New capture whose color image holds the first half of the original payload.
+static k4a_capture_t truncated_copy(k4a_capture_t capture)
+{
+    k4a_image_t color = k4a_capture_get_color_image(capture);
+    if (color == nullptr)
+        return capture;
+
+    size_t size = k4a_image_get_size(color) / 2;
+    uint8_t *buffer = static_cast<uint8_t *>(std::malloc(size ? size : 1));
+    std::memcpy(buffer, k4a_image_get_buffer(color), size);
+
+    k4a_image_t image = nullptr;
+    k4a_capture_t copy = nullptr;
+    if (K4A_FAILED(k4a_image_create_from_buffer(k4a_image_get_format(color),
+                                                k4a_image_get_width_pixels(color),
+                                                k4a_image_get_height_pixels(color),
+                                                0,
+                                                buffer,
+                                                size,
+                                                free_buffer,
+                                                nullptr,
+                                                &image)) ||
+        K4A_FAILED(k4a_capture_create(&copy)))
+    {
+        if (image != nullptr)
+            k4a_image_release(image);
+        else
+            std::free(buffer);
+        k4a_image_release(color);
+        return capture;
+    }
+    k4a_image_set_device_timestamp_usec(image, k4a_image_get_device_timestamp_usec(color));
+    k4a_image_set_system_timestamp_nsec(image, k4a_image_get_system_timestamp_nsec(color));
+    k4a_capture_set_color_image(copy, image);
+    k4a_image_release(image);
+    k4a_image_release(color);
+    k4a_capture_release(capture);
+    return copy;
+}
+
+k4a_wait_result_t FaultDevice::get_capture(k4a_capture_t *capture, int32_t timeout_ms)
+{
+    k4a_wait_result_t result = m_inner->get_capture(capture, timeout_ms);
+    if (result != K4A_WAIT_RESULT_SUCCEEDED)
+    {
+        return result;
+    }
+
+    const FaultRule *fault = m_schedule.next_frame();
+    if (fault == nullptr)
+    {
+        return result;
+    }
+    switch (fault->kind)
+    {
+    case FaultKind::Timeout:
+        // the frame never arrives, as with a stalled USB transfer
+        k4a_capture_release(*capture);
+        *capture = nullptr;
+        return K4A_WAIT_RESULT_TIMEOUT;
+    case FaultKind::UsbError:
+        k4a_capture_release(*capture);
+        *capture = nullptr;
+        return K4A_WAIT_RESULT_FAILED;
+    case FaultKind::Latency:
+        std::this_thread::sleep_for(milliseconds(fault->delay_ms));
+        return result;
+    case FaultKind::Corrupt:
+        *capture = truncated_copy(*capture);
+        return result;
+    default:
+        return result;
+    }
+}
+
+FaultSink::FaultSink(std::unique_ptr<RecordingSink> inner, FaultSchedule schedule)
+    : m_inner(std::move(inner)), m_schedule(std::move(schedule))
+{
+}
+
+k4a_result_t FaultSink::create(const std::string &path, k4a_device_t device, const k4a_device_configuration_t &config)
+{
+    // a full disk cannot take new segments either
+    if (m_full)
+    {
+        return K4A_RESULT_FAILED;
+    }
+    return m_inner->create(path, device, config);
+}
+
+k4a_result_t FaultSink::write_capture(k4a_capture_t capture)
+{
+    // a 'full' rule fires on every frame of its window and outranks the
+    // rest, so the disk stays full until the window ends (or for good)
+    const FaultRule *fault = m_schedule.next_frame();
+    m_full = fault != nullptr && fault->kind == FaultKind::Full;
+    if (fault != nullptr)
+    {
+        switch (fault->kind)
+        {
+        case FaultKind::Slow:
+            std::this_thread::sleep_for(milliseconds(fault->delay_ms));
+            break;
+        case FaultKind::Full:
+        case FaultKind::Eio:
+            return K4A_RESULT_FAILED;
+        default:
+            break;
+        }
+    }
+    return m_inner->write_capture(capture);
+}
+
+k4a_result_t FaultSink::flush()
+{
+    if (m_full)
+    {
+        return K4A_RESULT_FAILED;
+    }
+    return m_inner->flush();
+}
+
+k4a_result_t FaultSink::sync()
+{
+    if (m_full)
+    {
+        return K4A_RESULT_FAILED;
+    }
+    return m_inner->sync();
+}
@@ -0,0 +1,176 @@
+#ifndef FAULT_INJECTION_H
+#define FAULT_INJECTION_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "capture_device.h"
+#include "capture_session.h"
+#include "recording_sink.h"
+
+// Scriptable faults for exercising the pipeline's error paths without
+// pulling cables. A script has one rule per line ('#' starts a comment):
+//
+//   <target> <kind> <trigger> [for=<duration>|frames=<n>] [ms=<n>] [every=<n>]
+//
+//   target   device:<index>, sink:<index>, or device:* / sink:* for all
+//   kind     device: timeout, usb_error, latency, corrupt
+//            sink:   slow, full, eio
+//   trigger  at=<time> (10s, 2500ms, seconds since start) or frame=<n>
+//
+// Without a window a rule fires once, except 'full' which stays full. 'ms'
+// is the added delay for latency/slow, 'every' applies it to every n-th
+// frame of the window to make bursts; a full disk ignores it and fails
+// every write of its window. 'corrupt' delivers the frame with its MJPEG
+// payload cut in half, like a short USB transfer. When several rules fire on
+// the same frame the most severe one wins, whatever their order in the
+// script: full, eio, usb_error, timeout, corrupt, then the longest delay.
+//
+//   device:2 timeout at=10s for=2s
+//   device:* latency at=30s for=10s ms=80 every=5
+//   device:1 corrupt frame=300 frames=10 every=3
+//   sink:1 slow frame=600 frames=300 ms=200
+//   sink:0 eio frame=1200
+//   sink:* full at=120s
+
+enum class FaultKind
+{
+    Timeout,
+    UsbError,
+    Latency,
+    Corrupt,
+    Slow,
+    Full,
+    Eio,
+};
+
+struct FaultRule
+{
+    bool device = true; // false for sink rules
+    int index = -1;     // -1 for every device/sink
+    FaultKind kind = FaultKind::Timeout;
+
+    bool by_frame = false;
+    int64_t start = 0;   // ns since start, or frame number
+    int64_t length = 0;  // ns or frames; 0 fires once, -1 never ends
+    int64_t delay_ms = 0;
+    int64_t every = 1;
+};
+
+bool parse_fault_script(const std::string &text, std::vector<FaultRule> *rules, std::string *error);
+bool load_fault_script(const std::string &path, std::vector<FaultRule> *rules, std::string *error);
+
+// Wraps the devices and sinks of a session that have rules. Call after the
+// devices are set up and before session_open_recordings(); time triggers
+// count from here.
+void install_faults(Session &s, const std::vector<FaultRule> &rules);
+
+// The rules of a script that apply to one device or sink, evaluated against
+// time since construction and the number of frames seen so far.
+class FaultSchedule
+{
+public:
+    FaultSchedule(const std::vector<FaultRule> &rules, bool device, int index);
+
+    bool empty() const
+    {
+        return m_rules.empty();
+    }
+
+    // the rule active for the next frame, or nullptr; advances the frame
+    // count and every rule's window, including the rules that lose out
+    const FaultRule *next_frame();
+
+private:
+    struct Armed
+    {
+        FaultRule rule;
+        bool fired = false;
+        int64_t hits = 0;
+    };
+    std::vector<Armed> m_rules;
+    std::chrono::steady_clock::time_point m_epoch;
+    int64_t m_frame = 0;
+};
+
+class FaultDevice : public CaptureDevice
+{
+public:
+    FaultDevice(std::unique_ptr<CaptureDevice> inner, FaultSchedule schedule);
+
+    const std::string &serial() const override
+    {
+        return m_inner->serial();
+    }
+    k4a_device_t handle() const override
+    {
+        return m_inner->handle();
+    }
+    k4a_result_t start_cameras(const k4a_device_configuration_t *config) override
+    {
+        return m_inner->start_cameras(config);
+    }
+    void stop_cameras() override
+    {
+        m_inner->stop_cameras();
+    }
+    k4a_wait_result_t get_capture(k4a_capture_t *capture, int32_t timeout_ms) override;
+
+private:
+    std::unique_ptr<CaptureDevice> m_inner;
+    FaultSchedule m_schedule;
+};
+
+class FaultSink : public RecordingSink
+{
+public:
+    FaultSink(std::unique_ptr<RecordingSink> inner, FaultSchedule schedule);
+
+    k4a_result_t create(const std::string &path, k4a_device_t device, const k4a_device_configuration_t &config) override;
+    k4a_result_t add_metadata_track() override
+    {
+        return m_inner->add_metadata_track();
+    }
+    k4a_result_t add_event_track() override
+    {
+        return m_inner->add_event_track();
+    }
+    k4a_result_t add_attachment(const std::string &name, const std::string &data) override
+    {
+        return m_inner->add_attachment(name, data);
+    }
+    k4a_result_t add_tag(const std::string &name, const std::string &value) override
+    {
+        return m_inner->add_tag(name, value);
+    }
+    k4a_result_t write_header() override
+    {
+        return m_inner->write_header();
+    }
+    k4a_result_t write_capture(k4a_capture_t capture) override;
+    k4a_result_t write_metadata(const FrameMetadata &meta) override
+    {
+        // rules count captures only; a full disk takes nothing at all
+        return m_full ? K4A_RESULT_FAILED : m_inner->write_metadata(meta);
+    }
+    k4a_result_t write_event(uint64_t device_timestamp_usec, const std::string &label) override
+    {
+        return m_full ? K4A_RESULT_FAILED : m_inner->write_event(device_timestamp_usec, label);
+    }
+    k4a_result_t flush() override;
+    k4a_result_t sync() override;
+    void close() override
+    {
+        m_inner->close();
+    }
+
+private:
+    std::unique_ptr<RecordingSink> m_inner;
+    FaultSchedule m_schedule;
+    bool m_full = false;
+};
+
+#endif
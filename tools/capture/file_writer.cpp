@@ -0,0 +1,484 @@
+#include "file_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HTK_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+static const size_t kDirectAlignment = 4096;
+
+const char *writer_mode_name(WriterMode mode)
+{
+    switch (mode)
+    {
+    case WriterMode::Buffered:
+        return "buffered";
+    case WriterMode::Direct:
+        return "direct";
+    case WriterMode::Uring:
+        return "uring";
+    }
+    return "unknown";
+}
+
+bool parse_writer_mode(const std::string &name, WriterMode *mode)
+{
+    if (name == "buffered")
+        *mode = WriterMode::Buffered;
+    else if (name == "direct")
+        *mode = WriterMode::Direct;
+    else if (name == "uring")
+        *mode = WriterMode::Uring;
+    else
+        return false;
+    return true;
+}
+
+static bool pwrite_all(int fd, const uint8_t *data, size_t size, off_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, data, size, offset);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+        offset += n;
+    }
+    return true;
+}
+
+class BufferedWriter : public FileWriter
+{
+public:
+    explicit BufferedWriter(size_t buffer_size)
+    {
+        m_staging.reserve(buffer_size);
+    }
+
+    ~BufferedWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            m_errno = errno;
+            return false;
+        }
+        return true;
+    }
+
+    bool write(const uint8_t *data, size_t size) override
+    {
+        if (m_staging.size() + size > m_staging.capacity() && !drain())
+        {
+            return false;
+        }
+        if (size >= m_staging.capacity())
+        {
+            if (!pwrite_all(m_fd, data, size, static_cast<off_t>(m_bytes)))
+            {
+                m_errno = errno;
+                return false;
+            }
+            m_bytes += size;
+            return true;
+        }
+        m_staging.insert(m_staging.end(), data, data + size);
+        return true;
+    }
+
+    bool sync() override
+    {
+        if (!drain())
+        {
+            return false;
+        }
+        if (fdatasync(m_fd) != 0)
+        {
+            m_errno = errno;
+            return false;
+        }
+        return true;
+    }
+
+    bool close() override
+    {
+        if (m_fd < 0)
+        {
+            return m_errno == 0;
+        }
+        bool ok = drain();
+        if (::close(m_fd) != 0 && ok)
+        {
+            m_errno = errno;
+            ok = false;
+        }
+        m_fd = -1;
+        return ok;
+    }
+
+private:
+    bool drain()
+    {
+        if (m_staging.empty())
+        {
+            return true;
+        }
+        if (!pwrite_all(m_fd, m_staging.data(), m_staging.size(), static_cast<off_t>(m_bytes)))
+        {
+            m_errno = errno;
+            return false;
+        }
+        m_bytes += m_staging.size();
+        m_staging.clear();
+        return true;
+    }
+
+    int m_fd = -1;
+    std::vector<uint8_t> m_staging;
+};
+
+// O_DIRECT only accepts aligned offsets and lengths, so whole blocks are
+// written as they fill and the partial tail is written zero-padded on
+// sync/close, then trimmed back with ftruncate().
+class DirectWriter : public FileWriter
+{
+public:
+    explicit DirectWriter(size_t buffer_size)
+    {
+        m_capacity = std::max(buffer_size, 2 * kDirectAlignment) / kDirectAlignment * kDirectAlignment;
+        void *p = nullptr;
+        if (posix_memalign(&p, kDirectAlignment, m_capacity) == 0)
+        {
+            m_staging = static_cast<uint8_t *>(p);
+        }
+    }
+
+    ~DirectWriter() override
+    {
+        close();
+        std::free(m_staging);
+    }
+
+    bool open(const std::string &path) override
+    {
+        if (m_staging == nullptr)
+        {
+            m_errno = ENOMEM;
+            return false;
+        }
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+        if (m_fd < 0)
+        {
+            m_errno = errno;
+            return false;
+        }
+        return true;
+    }
+
+    bool write(const uint8_t *data, size_t size) override
+    {
+        while (size > 0)
+        {
+            size_t n = std::min(size, m_capacity - m_staged);
+            std::memcpy(m_staging + m_staged, data, n);
+            m_staged += n;
+            m_bytes += n;
+            data += n;
+            size -= n;
+            if (m_staged == m_capacity && !flush_blocks())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool sync() override
+    {
+        if (!flush_blocks() || !write_tail())
+        {
+            return false;
+        }
+        if (fdatasync(m_fd) != 0)
+        {
+            m_errno = errno;
+            return false;
+        }
+        return true;
+    }
+
+    bool close() override
+    {
+        if (m_fd < 0)
+        {
+            return m_errno == 0;
+        }
+        bool ok = flush_blocks() && write_tail();
+        if (ok && ftruncate(m_fd, static_cast<off_t>(m_bytes)) != 0)
+        {
+            m_errno = errno;
+            ok = false;
+        }
+        if (::close(m_fd) != 0 && ok)
+        {
+            m_errno = errno;
+            ok = false;
+        }
+        m_fd = -1;
+        return ok;
+    }
+
+private:
+    bool flush_blocks()
+    {
+        size_t whole = m_staged / kDirectAlignment * kDirectAlignment;
+        if (whole == 0)
+        {
+            return true;
+        }
+        if (!pwrite_all(m_fd, m_staging, whole, m_offset))
+        {
+            m_errno = errno;
+            return false;
+        }
+        m_offset += static_cast<off_t>(whole);
+        m_staged -= whole;
+        std::memmove(m_staging, m_staging + whole, m_staged);
+        return true;
+    }
+
+    // the tail stays staged; the next flush rewrites the same block in place
+    bool write_tail()
+    {
+        if (m_staged == 0)
+        {
+            return true;
+        }
+        std::memset(m_staging + m_staged, 0, kDirectAlignment - m_staged);
+        if (!pwrite_all(m_fd, m_staging, kDirectAlignment, m_offset))
+        {
+            m_errno = errno;
+            return false;
+        }
+        return true;
+    }
+
+    int m_fd = -1;
+    uint8_t *m_staging = nullptr;
+    size_t m_capacity = 0;
+    size_t m_staged = 0;
+    off_t m_offset = 0;
+};
+
+#ifdef HTK_HAVE_LIBURING
+// Rotates through a few staging buffers so filling one overlaps with the
+// kernel writing the others.
+class UringWriter : public FileWriter
+{
+public:
+    explicit UringWriter(size_t buffer_size) : m_buffer_size(buffer_size)
+    {
+        for (auto &b : m_buffers)
+        {
+            b.data.resize(m_buffer_size);
+        }
+    }
+
+    ~UringWriter() override
+    {
+        close();
+    }
+
+    bool open(const std::string &path) override
+    {
+        m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            m_errno = errno;
+            return false;
+        }
+        int rc = io_uring_queue_init(kDepth, &m_ring, 0);
+        if (rc < 0)
+        {
+            m_errno = -rc;
+            ::close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        return true;
+    }
+
+    bool write(const uint8_t *data, size_t size) override
+    {
+        while (size > 0)
+        {
+            Buffer &b = m_buffers[m_current];
+            while (b.in_flight)
+            {
+                if (!reap(true))
+                    return false;
+            }
+            size_t n = std::min(size, m_buffer_size - b.used);
+            std::memcpy(b.data.data() + b.used, data, n);
+            b.used += n;
+            data += n;
+            size -= n;
+            if (b.used == m_buffer_size && !submit_current())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool sync() override
+    {
+        if (!submit_current() || !reap_all())
+        {
+            return false;
+        }
+        if (fdatasync(m_fd) != 0)
+        {
+            m_errno = errno;
+            return false;
+        }
+        return true;
+    }
+
+    bool close() override
+    {
+        if (m_fd < 0)
+        {
+            return m_errno == 0;
+        }
+        bool ok = submit_current() && reap_all();
+        io_uring_queue_exit(&m_ring);
+        if (::close(m_fd) != 0 && ok)
+        {
+            m_errno = errno;
+            ok = false;
+        }
+        m_fd = -1;
+        return ok;
+    }
+
+private:
+    static const unsigned kDepth = 4;
+
+    struct Buffer
+    {
+        std::vector<uint8_t> data;
+        size_t used = 0;
+        bool in_flight = false;
+    };
+
+    bool submit_current()
+    {
+        Buffer &b = m_buffers[m_current];
+        if (b.used == 0)
+        {
+            return true;
+        }
+        io_uring_sqe *sqe = io_uring_get_sqe(&m_ring);
+        if (sqe == nullptr)
+        {
+            m_errno = EBUSY;
+            return false;
+        }
+        io_uring_prep_write(sqe, m_fd, b.data.data(), static_cast<unsigned>(b.used), m_offset);
+        io_uring_sqe_set_data(sqe, &b);
+        b.in_flight = true;
+        m_offset += b.used;
+        m_pending++;
+        int rc = io_uring_submit(&m_ring);
+        if (rc < 0)
+        {
+            m_errno = -rc;
+            return false;
+        }
+        m_current = (m_current + 1) % kDepth;
+        return true;
+    }
+
+    bool reap(bool wait)
+    {
+        io_uring_cqe *cqe = nullptr;
+        int rc = wait ? io_uring_wait_cqe(&m_ring, &cqe) : io_uring_peek_cqe(&m_ring, &cqe);
+        if (rc < 0)
+        {
+            if (!wait && rc == -EAGAIN)
+                return true;
+            m_errno = -rc;
+            return false;
+        }
+        auto *b = static_cast<Buffer *>(io_uring_cqe_get_data(cqe));
+        int res = cqe->res;
+        io_uring_cqe_seen(&m_ring, cqe);
+        m_pending--;
+        // regular files only return short writes when the disk is full
+        if (res < 0 || static_cast<size_t>(res) != b->used)
+        {
+            m_errno = res < 0 ? -res : ENOSPC;
+            return false;
+        }
+        m_bytes += b->used;
+        b->used = 0;
+        b->in_flight = false;
+        return true;
+    }
+
+    bool reap_all()
+    {
+        while (m_pending > 0)
+        {
+            if (!reap(true))
+                return false;
+        }
+        return true;
+    }
+
+    int m_fd = -1;
+    io_uring m_ring;
+    size_t m_buffer_size;
+    Buffer m_buffers[kDepth];
+    unsigned m_current = 0;
+    unsigned m_pending = 0;
+    off_t m_offset = 0;
+};
+#endif
+
+std::unique_ptr<FileWriter> make_file_writer(WriterMode mode, size_t buffer_size)
+{
+    switch (mode)
+    {
+    case WriterMode::Buffered:
+        return std::unique_ptr<FileWriter>(new BufferedWriter(buffer_size));
+    case WriterMode::Direct:
+        return std::unique_ptr<FileWriter>(new DirectWriter(buffer_size));
+    case WriterMode::Uring:
+#ifdef HTK_HAVE_LIBURING
+        return std::unique_ptr<FileWriter>(new UringWriter(buffer_size));
+#else
+        return nullptr;
+#endif
+    }
+    return nullptr;
+}
@@ -0,0 +1,51 @@
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Byte-level sinks for the files the recorder writes itself (the MKVs go
+// through libk4arecord). All three share one interface so the capture
+// pipeline and htkcapture_bench can swap them freely.
+enum class WriterMode
+{
+    Buffered, // staged in user space, plain write(2)
+    Direct,   // O_DIRECT with page-aligned staging, bypasses the page cache
+    Uring,    // io_uring with several writes in flight (needs liburing)
+};
+
+const char *writer_mode_name(WriterMode mode);
+bool parse_writer_mode(const std::string &name, WriterMode *mode);
+
+class FileWriter
+{
+public:
+    virtual ~FileWriter() = default;
+
+    virtual bool open(const std::string &path) = 0;
+    virtual bool write(const uint8_t *data, size_t size) = 0;
+    // pushes everything staged so far to the device (fdatasync)
+    virtual bool sync() = 0;
+    virtual bool close() = 0;
+
+    uint64_t bytes_written() const
+    {
+        return m_bytes;
+    }
+    // errno of the first failure, 0 if none
+    int last_errno() const
+    {
+        return m_errno;
+    }
+
+protected:
+    uint64_t m_bytes = 0;
+    int m_errno = 0;
+};
+
+// nullptr if the mode is not available in this build (io_uring without liburing)
+std::unique_ptr<FileWriter> make_file_writer(WriterMode mode, size_t buffer_size = 1 << 20);
+
+#endif
@@ -0,0 +1,36 @@
+#include "frame_metadata.h"
+
+#include <cstring>
+
+#include <k4arecord/playback.h>
+
+std::string frame_metadata_codec_context()
+{
+    return "htk frame metadata v" + std::to_string(kFrameMetadataVersion) + ", " +
+           std::to_string(sizeof(FrameMetadata)) + "-byte little-endian records";
+}
+
+bool read_frame_metadata(const std::string &path, std::vector<FrameMetadata> *records, std::string *error)
+{
+    k4a_playback_t playback = nullptr;
+    if (K4A_FAILED(k4a_playback_open(path.c_str(), &playback)))
+    {
+        *error = "Unable to open " + path;
+        return false;
+    }
+
+    records->clear();
+    k4a_playback_data_block_t block = nullptr;
+    while (k4a_playback_get_next_data_block(playback, kFrameMetadataTrack, &block) == K4A_STREAM_RESULT_SUCCEEDED)
+    {
+        // shorter records come from an older writer; missing fields read as zero
+        FrameMetadata meta;
+        std::memset(&meta, 0, sizeof(meta));
+        size_t size = k4a_playback_data_block_get_buffer_size(block);
+        std::memcpy(&meta, k4a_playback_data_block_get_buffer(block), size < sizeof(meta) ? size : sizeof(meta));
+        records->push_back(meta);
+        k4a_playback_data_block_release(block);
+    }
+    k4a_playback_close(playback);
+    return true;
+}
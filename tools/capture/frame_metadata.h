@@ -0,0 +1,59 @@
+#ifndef FRAME_METADATA_H
+#define FRAME_METADATA_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// One fixed-size record per written frame, stored in a custom subtitle track
+// of the device's MKV next to the color track. Readers get exposure, white
+// balance, host timing and our own per-frame stats without touching the
+// images. Records are little-endian and exactly 64 bytes; new fields go into
+// the reserved space and bump kFrameMetadataVersion.
+//
+//   numpy: np.dtype([('device_timestamp_usec', '<u8'), ('system_timestamp_nsec', '<u8'),
+//                    ('exposure_usec', '<u8'), ('sequence', '<u8'), ('white_balance', '<u4'),
+//                    ('iso_speed', '<u4'), ('payload_bytes', '<u4'), ('temperature_c', '<f4'),
+//                    ('latency_usec', '<u4'), ('queue_depth', '<u2'), ('flags', '<u2'),
+//                    ('jpeg_defect', 'u1'), ('version', 'u1'), ('reserved', 'u1', 6)])
+
+static const char kFrameMetadataTrack[] = "HTK_FRAME_META";
+static const char kFrameMetadataCodec[] = "S_HTK/FRAME_META";
+static const uint8_t kFrameMetadataVersion = 1;
+
+enum FrameMetadataFlags : uint16_t
+{
+    kFrameCorrupt = 1 << 0, // failed jpeg_validate(), recorded anyway
+    kFrameFilled = 1 << 1,  // htkexport stand-in for a missing frame: an earlier (or the next) frame repeated
+};
+
+#pragma pack(push, 1)
+struct FrameMetadata
+{
+    uint64_t device_timestamp_usec;
+    uint64_t system_timestamp_nsec; // CLOCK_MONOTONIC when the SDK got the frame
+    uint64_t exposure_usec;
+    uint64_t sequence;       // frames written by this device since the session started
+    uint32_t white_balance;  // kelvin
+    uint32_t iso_speed;      // the SDK's stand-in for gain
+    uint32_t payload_bytes;  // compressed color image size
+    float temperature_c;     // NaN when the capture has no reading
+    uint32_t latency_usec;   // system timestamp to the start of the write
+    uint16_t queue_depth;    // captures still waiting behind this one
+    uint16_t flags;          // FrameMetadataFlags
+    uint8_t jpeg_defect;     // JpegDefect
+    uint8_t version;
+    uint8_t reserved[6];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FrameMetadata) == 64, "FrameMetadata is an on-disk format");
+
+// Codec private data for the track: a short human-readable description.
+std::string frame_metadata_codec_context();
+
+// Every record of a recording's metadata track, in order. False if the file
+// cannot be opened; a recording without the track yields no records.
+bool read_frame_metadata(const std::string &path, std::vector<FrameMetadata> *records, std::string *error);
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring used to hand captures from a
+// device's capture thread to its writer thread. Push never blocks: when the
+// ring is full the producer gets false back and decides what to drop, so a
+// slow disk can never stall k4a_device_get_capture().
+template <typename T> class FrameRing
+{
+public:
+    explicit FrameRing(size_t capacity)
+    {
+        size_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        m_slots.resize(n);
+        m_mask = n - 1;
+    }
+
+    FrameRing(const FrameRing &) = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+
+    size_t capacity() const
+    {
+        return m_slots.size();
+    }
+
+    size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    // producer side
+    bool try_push(const T &item)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == m_slots.size())
+        {
+            return false;
+        }
+        m_slots[tail & m_mask] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+
+        // pairs with the fence in pop_wait() so either the consumer sees the
+        // new tail or we see that it is about to sleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiting.load(std::memory_order_relaxed))
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cv.notify_one();
+        }
+        return true;
+    }
+
+    // consumer side
+    bool try_pop(T &item)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        item = m_slots[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side; returns false on timeout or once the ring is closed and drained
+    bool pop_wait(T &item, std::chrono::milliseconds timeout)
+    {
+        if (try_pop(item))
+        {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_waiting.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool ok = try_pop(item);
+        if (!ok && !m_closed.load(std::memory_order_acquire))
+        {
+            m_cv.wait_for(lock, timeout, [&] { return size() != 0 || m_closed.load(std::memory_order_acquire); });
+            ok = try_pop(item);
+        }
+        m_waiting.store(false, std::memory_order_relaxed);
+        return ok;
+    }
+
+    // producer side; wakes the consumer so it can drain and exit
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed.store(true, std::memory_order_release);
+        m_cv.notify_all();
+    }
+
+    bool closed() const
+    {
+        return m_closed.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> m_slots;
+    size_t m_mask = 0;
+
+    alignas(64) std::atomic<size_t> m_head{ 0 };
+    alignas(64) std::atomic<size_t> m_tail{ 0 };
+
+    alignas(64) std::atomic_bool m_waiting{ false };
+    std::atomic_bool m_closed{ false };
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+#endif
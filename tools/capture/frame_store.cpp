@@ -0,0 +1,408 @@
+#include "frame_store.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string frame_store_shard_path(const std::string &dir, uint32_t shard)
+{
+    char name[32];
+    std::snprintf(name, sizeof(name), "/shard_%05u.bin", shard);
+    return dir + name;
+}
+
+static void copy_padded(char *dst, size_t size, const std::string &src)
+{
+    std::memset(dst, 0, size);
+    std::memcpy(dst, src.data(), std::min(src.size(), size - 1));
+}
+
+FrameStoreWriter::FrameStoreWriter(const std::string &dir, const FrameStoreOptions &options)
+    : m_dir(dir), m_options(options)
+{
+}
+
+FrameStoreWriter::~FrameStoreWriter()
+{
+    // an unfinished store is left without an index
+    for (auto &s : m_streams)
+        if (s->shard)
+            s->shard->file->close();
+    for (auto &s : m_idle)
+        s->file->close();
+}
+
+bool FrameStoreWriter::open(std::string *error)
+{
+    if (mkdir(m_dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        *error = "Unable to create " + m_dir + ": " + std::strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (stat((m_dir + "/" + kFrameStoreIndex).c_str(), &st) == 0)
+    {
+        *error = m_dir + " already holds a frame store.";
+        return false;
+    }
+    if (!make_file_writer(m_options.writer, m_options.buffer_size))
+    {
+        *error = std::string("The ") + writer_mode_name(m_options.writer) + " writer is not available in this build.";
+        return false;
+    }
+    return true;
+}
+
+bool FrameStoreWriter::new_shard(std::unique_ptr<Shard> *shard, std::string *error)
+{
+    std::unique_ptr<Shard> s(new Shard);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        s->id = m_shard_count++;
+    }
+    const std::string path = frame_store_shard_path(m_dir, s->id);
+    s->file = make_file_writer(m_options.writer, m_options.buffer_size);
+    FrameShardHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kFrameShardMagic, sizeof(header.magic));
+    header.version = kFrameStoreVersion;
+    header.shard = s->id;
+    if (!s->file->open(path) || !s->file->write(reinterpret_cast<const uint8_t *>(&header), sizeof(header)))
+    {
+        *error = "Unable to write " + path + ": " + std::strerror(s->file->last_errno());
+        return false;
+    }
+    s->bytes = sizeof(header);
+    *shard = std::move(s);
+    return true;
+}
+
+bool FrameStoreWriter::close_shard(std::unique_ptr<Shard> shard, std::string *error)
+{
+    const uint64_t bytes = shard->bytes;
+    if (!shard->file->close())
+    {
+        *error = "Unable to write " + frame_store_shard_path(m_dir, shard->id) + ": " +
+                 std::strerror(shard->file->last_errno());
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed_bytes += bytes;
+    return true;
+}
+
+bool FrameStoreWriter::begin_stream(const std::string &take,
+                                    const std::string &serial,
+                                    int device_index,
+                                    size_t *stream,
+                                    std::string *error)
+{
+    std::unique_ptr<Stream> s(new Stream);
+    std::memset(&s->record, 0, sizeof(s->record));
+    copy_padded(s->record.take, sizeof(s->record.take), take);
+    copy_padded(s->record.serial, sizeof(s->record.serial), serial);
+    s->record.device_index = device_index;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &other : m_streams)
+        {
+            if (std::strcmp(other->record.take, s->record.take) == 0 &&
+                std::strcmp(other->record.serial, s->record.serial) == 0)
+            {
+                *error = "Take " + take + " camera " + serial + " is already in the store.";
+                return false;
+            }
+        }
+        if (!m_idle.empty())
+        {
+            s->shard = std::move(m_idle.back());
+            m_idle.pop_back();
+        }
+        *stream = m_streams.size();
+        m_streams.push_back(nullptr);
+    }
+    if (!s->shard && !new_shard(&s->shard, error))
+        return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_streams[*stream] = std::move(s);
+    return true;
+}
+
+bool FrameStoreWriter::append(size_t stream,
+                              uint64_t device_timestamp_usec,
+                              uint32_t flags,
+                              const uint8_t *data,
+                              size_t size,
+                              std::string *error)
+{
+    Stream *s;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        s = m_streams[stream].get();
+    }
+    if (size > UINT32_MAX)
+    {
+        *error = "Frame too large for a frame store";
+        return false;
+    }
+    // roll over, but never leave a shard empty
+    if (s->shard->bytes > sizeof(FrameShardHeader) && s->shard->bytes + size > m_options.shard_bytes)
+    {
+        if (!close_shard(std::move(s->shard), error) || !new_shard(&s->shard, error))
+            return false;
+    }
+    FrameStoreEntry e;
+    std::memset(&e, 0, sizeof(e));
+    e.device_timestamp_usec = device_timestamp_usec;
+    e.offset = s->shard->bytes;
+    e.size = static_cast<uint32_t>(size);
+    e.shard = s->shard->id;
+    e.flags = flags;
+    if (!s->shard->file->write(data, size))
+    {
+        *error = "Unable to write " + frame_store_shard_path(m_dir, s->shard->id) + ": " +
+                 std::strerror(s->shard->file->last_errno());
+        return false;
+    }
+    s->shard->bytes += size;
+    s->entries.push_back(e);
+    s->record.bytes += size;
+    return true;
+}
+
+bool FrameStoreWriter::end_stream(size_t stream, std::string *error)
+{
+    std::unique_ptr<Shard> shard;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Stream *s = m_streams[stream].get();
+        s->ended = true;
+        shard = std::move(s->shard);
+        // the next stream carries on in the same shard while it has room
+        if (shard && shard->bytes < m_options.shard_bytes)
+        {
+            m_idle.push_back(std::move(shard));
+            return true;
+        }
+    }
+    return !shard || close_shard(std::move(shard), error);
+}
+
+uint64_t FrameStoreWriter::bytes_written() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint64_t bytes = m_closed_bytes;
+    for (auto &s : m_streams)
+        if (s && s->shard)
+            bytes += s->shard->bytes;
+    for (auto &s : m_idle)
+        bytes += s->bytes;
+    return bytes;
+}
+
+bool FrameStoreWriter::finish(std::string *error)
+{
+    std::vector<std::unique_ptr<Shard>> idle;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &s : m_streams)
+        {
+            if (!s || !s->ended)
+            {
+                *error = "A stream was not ended.";
+                return false;
+            }
+        }
+        idle.swap(m_idle);
+    }
+    for (auto &s : idle)
+        if (!close_shard(std::move(s), error))
+            return false;
+
+    std::sort(m_streams.begin(), m_streams.end(), [](const std::unique_ptr<Stream> &a, const std::unique_ptr<Stream> &b) {
+        int c = std::strcmp(a->record.take, b->record.take);
+        return c != 0 ? c < 0 : std::strcmp(a->record.serial, b->record.serial) < 0;
+    });
+
+    FrameStoreHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kFrameStoreMagic, sizeof(header.magic));
+    header.version = kFrameStoreVersion;
+    header.header_bytes = sizeof(FrameStoreHeader);
+    header.stream_bytes = sizeof(FrameStoreStream);
+    header.entry_bytes = sizeof(FrameStoreEntry);
+    header.shard_count = m_shard_count;
+    header.stream_count = m_streams.size();
+    header.streams_offset = sizeof(FrameStoreHeader);
+    header.entries_offset = header.streams_offset + m_streams.size() * sizeof(FrameStoreStream);
+    for (auto &s : m_streams)
+    {
+        s->record.first_entry = header.entry_count;
+        s->record.entry_count = s->entries.size();
+        header.entry_count += s->entries.size();
+    }
+
+    const std::string path = m_dir + "/" + kFrameStoreIndex;
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        for (auto &s : m_streams)
+            out.write(reinterpret_cast<const char *>(&s->record), sizeof(s->record));
+        for (auto &s : m_streams)
+            out.write(reinterpret_cast<const char *>(s->entries.data()),
+                      static_cast<std::streamsize>(s->entries.size() * sizeof(FrameStoreEntry)));
+        out.close();
+        if (!out)
+        {
+            *error = "Unable to write " + tmp_path + ": " + std::strerror(errno);
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        *error = "Unable to rename " + tmp_path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+static void *map_file(const std::string &path, size_t *size, std::string *error)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        *error = "Unable to open " + path;
+        if (fd >= 0)
+            ::close(fd);
+        return nullptr;
+    }
+    *size = static_cast<size_t>(st.st_size);
+    void *p = mmap(nullptr, *size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        *error = "Unable to map " + path + ": " + std::strerror(errno);
+        return nullptr;
+    }
+    return p;
+}
+
+FrameStore::~FrameStore()
+{
+    close();
+}
+
+void FrameStore::close()
+{
+    for (auto &s : m_shards)
+        munmap(s.first, s.second);
+    m_shards.clear();
+    if (m_index)
+        munmap(m_index, m_index_bytes);
+    m_index = nullptr;
+    m_header = nullptr;
+    m_streams = nullptr;
+    m_entries = nullptr;
+}
+
+bool FrameStore::open(const std::string &dir, std::string *error)
+{
+    close();
+    m_dir = dir;
+    const std::string path = dir + "/" + kFrameStoreIndex;
+    m_index = map_file(path, &m_index_bytes, error);
+    if (!m_index)
+        return false;
+    const FrameStoreHeader *h = static_cast<const FrameStoreHeader *>(m_index);
+    if (m_index_bytes < sizeof(*h) || std::memcmp(h->magic, kFrameStoreMagic, sizeof(h->magic)) != 0 ||
+        h->version > kFrameStoreVersion || h->stream_bytes != sizeof(FrameStoreStream) ||
+        h->entry_bytes != sizeof(FrameStoreEntry) ||
+        h->streams_offset + h->stream_count * sizeof(FrameStoreStream) > m_index_bytes ||
+        h->entries_offset + h->entry_count * sizeof(FrameStoreEntry) > m_index_bytes)
+    {
+        *error = path + " is not a frame store index this build can read.";
+        close();
+        return false;
+    }
+    m_header = h;
+    m_streams = reinterpret_cast<const FrameStoreStream *>(static_cast<const uint8_t *>(m_index) + h->streams_offset);
+    m_entries = reinterpret_cast<const FrameStoreEntry *>(static_cast<const uint8_t *>(m_index) + h->entries_offset);
+
+    for (uint32_t i = 0; i < h->shard_count; i++)
+    {
+        size_t size = 0;
+        void *p = map_file(frame_store_shard_path(dir, i), &size, error);
+        if (!p)
+        {
+            close();
+            return false;
+        }
+        m_shards.emplace_back(p, size);
+        if (size < sizeof(FrameShardHeader) ||
+            std::memcmp(static_cast<const FrameShardHeader *>(p)->magic, kFrameShardMagic, sizeof(kFrameShardMagic)) != 0)
+        {
+            *error = frame_store_shard_path(dir, i) + " is not a frame store shard.";
+            close();
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < h->stream_count; i++)
+    {
+        if (m_streams[i].first_entry + m_streams[i].entry_count > h->entry_count)
+        {
+            *error = path + " is corrupt.";
+            close();
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < h->entry_count; i++)
+    {
+        const FrameStoreEntry &e = m_entries[i];
+        if (e.shard >= m_shards.size() || e.offset + e.size > m_shards[e.shard].second)
+        {
+            *error = frame_store_shard_path(dir, e.shard) + " is shorter than the index says.";
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+long FrameStore::find_stream(const std::string &take, const std::string &serial) const
+{
+    const FrameStoreStream *end = m_streams + stream_count();
+    const FrameStoreStream *it = std::lower_bound(m_streams, end, std::make_pair(take, serial),
+                                                  [](const FrameStoreStream &s, const std::pair<std::string, std::string> &key) {
+                                                      int c = std::strncmp(s.take, key.first.c_str(), sizeof(s.take));
+                                                      return c != 0 ? c < 0
+                                                                    : std::strncmp(s.serial, key.second.c_str(),
+                                                                                   sizeof(s.serial)) < 0;
+                                                  });
+    if (it == end || std::strncmp(it->take, take.c_str(), sizeof(it->take)) != 0 ||
+        std::strncmp(it->serial, serial.c_str(), sizeof(it->serial)) != 0)
+        return -1;
+    return static_cast<long>(it - m_streams);
+}
+
+size_t FrameStore::find_frame(size_t stream, uint64_t device_timestamp_usec) const
+{
+    const FrameStoreEntry *first = entries(stream);
+    const FrameStoreEntry *last = first + m_streams[stream].entry_count;
+    return static_cast<size_t>(
+        std::lower_bound(first, last, device_timestamp_usec,
+                         [](const FrameStoreEntry &e, uint64_t ts) { return e.device_timestamp_usec < ts; }) -
+        first);
+}
+
+const uint8_t *FrameStore::payload(const FrameStoreEntry &entry) const
+{
+    return static_cast<const uint8_t *>(m_shards[entry.shard].first) + entry.offset;
+}
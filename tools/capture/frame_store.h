@@ -0,0 +1,218 @@
+#ifndef FRAME_STORE_H
+#define FRAME_STORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "file_writer.h"
+
+// Packed storage for extracted frames: instead of one JPG file per frame, a
+// store directory holds a few large shard files with the JPEG payloads back
+// to back, and one index.bin saying where each frame is. Frames are keyed by
+// take, camera serial and frame number or device timestamp.
+//
+// A stream is one camera of one take. Its frames sit contiguously in one
+// shard, or a run of shards if it outgrows one, in timestamp order. A data
+// loader walking a stream therefore reads sequentially.
+//
+// index.bin is little-endian and used in place (mmap): a 64-byte header,
+// the stream records sorted by take then serial, then every frame entry,
+// grouped by stream. Shards are shard_<NNNNN>.bin, each a 64-byte header then
+// payloads.
+//
+//   hdr    = np.dtype([('magic', 'S8'), ('version', '<u4'), ('header_bytes', '<u4'),
+//                      ('stream_bytes', '<u4'), ('entry_bytes', '<u4'), ('shard_count', '<u4'),
+//                      ('reserved0', '<u4'), ('stream_count', '<u8'), ('entry_count', '<u8'),
+//                      ('streams_offset', '<u8'), ('entries_offset', '<u8')])
+//   stream = np.dtype([('take', 'S64'), ('serial', 'S32'), ('device_index', '<i4'),
+//                      ('reserved0', '<u4'), ('first_entry', '<u8'), ('entry_count', '<u8'),
+//                      ('bytes', '<u8')])
+//   entry  = np.dtype([('device_timestamp_usec', '<u8'), ('offset', '<u8'), ('size', '<u4'),
+//                      ('shard', '<u4'), ('flags', '<u4'), ('reserved', '<u4')])
+//
+// The index is written last, so a store without index.bin is an unfinished
+// one. tools/mkv/frame_store.py reads stores from Python.
+
+static const char kFrameStoreMagic[8] = { 'H', 'T', 'K', 'S', 'T', 'O', 'R', 'E' };
+static const char kFrameShardMagic[8] = { 'H', 'T', 'K', 'S', 'H', 'A', 'R', 'D' };
+static const uint32_t kFrameStoreVersion = 1;
+static const char kFrameStoreIndex[] = "index.bin";
+
+#pragma pack(push, 1)
+struct FrameStoreHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint32_t stream_bytes;
+    uint32_t entry_bytes;
+    uint32_t shard_count;
+    uint32_t reserved0;
+    uint64_t stream_count;
+    uint64_t entry_count;
+    uint64_t streams_offset;
+    uint64_t entries_offset;
+};
+
+struct FrameStoreStream
+{
+    char take[64];   // NUL-padded
+    char serial[32]; // NUL-padded
+    int32_t device_index;
+    uint32_t reserved0;
+    uint64_t first_entry;
+    uint64_t entry_count;
+    uint64_t bytes; // payload bytes of all frames
+};
+
+struct FrameStoreEntry
+{
+    uint64_t device_timestamp_usec;
+    uint64_t offset; // in the shard file
+    uint32_t size;
+    uint32_t shard;
+    uint32_t flags; // FrameMetadataFlags of the recorded frame
+    uint32_t reserved;
+};
+
+struct FrameShardHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t shard;
+    uint8_t reserved[48];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FrameStoreHeader) == 64, "FrameStoreHeader is an on-disk format");
+static_assert(sizeof(FrameStoreStream) == 128, "FrameStoreStream is an on-disk format");
+static_assert(sizeof(FrameStoreEntry) == 32, "FrameStoreEntry is an on-disk format");
+static_assert(sizeof(FrameShardHeader) == 64, "FrameShardHeader is an on-disk format");
+
+// shard_<NNNNN>.bin
+std::string frame_store_shard_path(const std::string &dir, uint32_t shard);
+
+struct FrameStoreOptions
+{
+    uint64_t shard_bytes = 4ull << 30; // a stream moves on to a new shard past this
+    WriterMode writer = WriterMode::Buffered;
+    size_t buffer_size = 8 << 20;
+};
+
+// Builds a store. Streams are written from any number of threads at once,
+// each stream by one thread: begin_stream() hands the stream a shard of its
+// own until end_stream(), so writers never share a file and need no lock per
+// frame.
+class FrameStoreWriter
+{
+public:
+    FrameStoreWriter(const std::string &dir, const FrameStoreOptions &options);
+    ~FrameStoreWriter();
+
+    FrameStoreWriter(const FrameStoreWriter &) = delete;
+    FrameStoreWriter &operator=(const FrameStoreWriter &) = delete;
+
+    // Creates the directory; false if it already holds a store.
+    bool open(std::string *error);
+
+    bool begin_stream(const std::string &take,
+                      const std::string &serial,
+                      int device_index,
+                      size_t *stream,
+                      std::string *error);
+    // frames in timestamp order
+    bool append(size_t stream,
+                uint64_t device_timestamp_usec,
+                uint32_t flags,
+                const uint8_t *data,
+                size_t size,
+                std::string *error);
+    bool end_stream(size_t stream, std::string *error);
+
+    // After every stream has ended: closes the shards and writes index.bin.
+    bool finish(std::string *error);
+
+    uint64_t bytes_written() const;
+
+private:
+    struct Shard
+    {
+        uint32_t id = 0;
+        std::unique_ptr<FileWriter> file;
+        // the next frame's offset; FileWriter::bytes_written() lags behind
+        // what it has staged
+        std::atomic<uint64_t> bytes{ 0 };
+    };
+    struct Stream
+    {
+        FrameStoreStream record;
+        std::vector<FrameStoreEntry> entries;
+        std::unique_ptr<Shard> shard; // while open
+        bool ended = false;
+    };
+
+    bool new_shard(std::unique_ptr<Shard> *shard, std::string *error);
+    bool close_shard(std::unique_ptr<Shard> shard, std::string *error);
+
+    std::string m_dir;
+    FrameStoreOptions m_options;
+    mutable std::mutex m_mutex;
+    std::vector<std::unique_ptr<Stream>> m_streams;
+    std::vector<std::unique_ptr<Shard>> m_idle; // shards with room, between streams
+    uint32_t m_shard_count = 0;
+    uint64_t m_closed_bytes = 0;
+};
+
+// Reads a finished store. The index and the shards are mapped read-only, so
+// lookups cost nothing and payload() is a pointer into the page cache; every
+// method is safe from any number of threads.
+class FrameStore
+{
+public:
+    FrameStore() = default;
+    ~FrameStore();
+
+    FrameStore(const FrameStore &) = delete;
+    FrameStore &operator=(const FrameStore &) = delete;
+
+    bool open(const std::string &dir, std::string *error);
+    void close();
+
+    size_t stream_count() const
+    {
+        return m_header ? static_cast<size_t>(m_header->stream_count) : 0;
+    }
+    const FrameStoreStream &stream(size_t i) const
+    {
+        return m_streams[i];
+    }
+    // -1 if the store has no such stream
+    long find_stream(const std::string &take, const std::string &serial) const;
+
+    // stream(i).entry_count entries, frame 0 first
+    const FrameStoreEntry *entries(size_t stream) const
+    {
+        return m_entries + m_streams[stream].first_entry;
+    }
+    // first frame at or after the timestamp; entry_count if there is none
+    size_t find_frame(size_t stream, uint64_t device_timestamp_usec) const;
+
+    // Valid until close().
+    const uint8_t *payload(const FrameStoreEntry &entry) const;
+
+private:
+    std::string m_dir;
+    void *m_index = nullptr;
+    size_t m_index_bytes = 0;
+    const FrameStoreHeader *m_header = nullptr;
+    const FrameStoreStream *m_streams = nullptr;
+    const FrameStoreEntry *m_entries = nullptr;
+    std::vector<std::pair<void *, size_t>> m_shards;
+};
+
+#endif
@@ -0,0 +1,922 @@
+#include "host_jpeg_encoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+#include "capture_device.h"
+
+#ifdef HTK_HAVE_HOST_JPEG
+#include <csetjmp>
+
+#include <jpeglib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#endif
+
+// First output buffer for a JPEG of width x height: room for any frame
+// short of noise, libjpeg grows it otherwise.
+static size_t host_jpeg_buffer_size(int width, int height)
+{
+    return static_cast<size_t>(width) * height * 2 + 65536;
+}
+
+bool parse_jpeg_quality(const std::string &value, HostJpegOptions *options)
+{
+    char *end = nullptr;
+    const long q = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || q < 1 || q > 100)
+        return false;
+    options->quality = static_cast<int>(q);
+    return true;
+}
+
+bool parse_color_crop(const std::string &value, ColorCrop *crop)
+{
+    ColorCrop c;
+    char tail = 0;
+    if (std::sscanf(value.c_str(), "%d,%d,%dx%d%c", &c.x, &c.y, &c.width, &c.height, &tail) != 4 || c.x < 0 ||
+        c.y < 0 || c.width < 1 || c.height < 1)
+        return false;
+    *crop = c;
+    return true;
+}
+
+std::string color_crop_string(const ColorCrop &crop)
+{
+    return std::to_string(crop.x) + "," + std::to_string(crop.y) + "," + std::to_string(crop.width) + "x" +
+           std::to_string(crop.height);
+}
+
+bool align_color_crop(ColorCrop *crop, int width, int height)
+{
+    const int block = 16;
+    const int x0 = crop->x / block * block;
+    const int y0 = crop->y / block * block;
+    const int x1 = std::min((crop->x + crop->width + block - 1) / block * block, width);
+    const int y1 = std::min((crop->y + crop->height + block - 1) / block * block, height);
+    if (x0 >= x1 || y0 >= y1)
+        return false;
+    crop->x = x0;
+    crop->y = y0;
+    crop->width = x1 - x0;
+    crop->height = y1 - y0;
+    return true;
+}
+
+#ifdef HTK_HAVE_HOST_JPEG
+
+namespace
+{
+
+struct JpegError
+{
+    jpeg_error_mgr mgr;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+// libjpeg's default handler exits the process
+void jpeg_error_exit(j_common_ptr cinfo)
+{
+    JpegError *err = reinterpret_cast<JpegError *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    std::longjmp(err->jump, 1);
+}
+
+// warnings are kept for the caller instead of going to stderr
+void jpeg_keep_message(j_common_ptr cinfo)
+{
+    JpegError *err = reinterpret_cast<JpegError *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+}
+
+// The camera's YCbCr is video range (BT.601, as the Sensor SDK's own
+// conversion assumes), JFIF's is full range. 8.8 fixed point, identical in
+// the SSE2 and scalar paths so a frame encodes the same on any machine.
+inline uint8_t full_range_luma(uint8_t y)
+{
+    const int x = std::min(std::max(static_cast<int>(y) - 16, 0), 219);
+    return static_cast<uint8_t>((x * 298 + 128) >> 8);
+}
+
+inline uint8_t full_range_chroma(uint8_t c)
+{
+    const int d = std::min(std::max(static_cast<int>(c), 16), 240) - 128;
+    return static_cast<uint8_t>(std::min(std::max(128 + ((d * 291 + 128) >> 8), 0), 255));
+}
+
+#if defined(__SSE2__)
+// the same on 16-bit lanes holding 0-255
+inline __m128i full_range_luma16(__m128i y)
+{
+    __m128i x = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    x = _mm_min_epi16(_mm_max_epi16(x, _mm_setzero_si128()), _mm_set1_epi16(219));
+    x = _mm_add_epi16(_mm_mullo_epi16(x, _mm_set1_epi16(298)), _mm_set1_epi16(128));
+    return _mm_srli_epi16(x, 8); // up to 65390, unsigned
+}
+
+inline __m128i full_range_chroma16(__m128i c)
+{
+    __m128i d = _mm_min_epi16(_mm_max_epi16(c, _mm_set1_epi16(16)), _mm_set1_epi16(240));
+    d = _mm_sub_epi16(d, _mm_set1_epi16(128));
+    d = _mm_add_epi16(_mm_mullo_epi16(d, _mm_set1_epi16(291)), _mm_set1_epi16(128));
+    return _mm_add_epi16(_mm_srai_epi16(d, 8), _mm_set1_epi16(128));
+}
+#endif
+
+void luma_row(const uint8_t *in, uint8_t *out, int width)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + x));
+        const __m128i lo = full_range_luma16(_mm_unpacklo_epi8(v, zero));
+        const __m128i hi = full_range_luma16(_mm_unpackhi_epi8(v, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; x < width; x++)
+        out[x] = full_range_luma(in[x]);
+}
+
+// interleaved CbCr (NV12's second plane, or split from YUY2) to two planes
+void chroma_row(const uint8_t *cbcr, uint8_t *cb, uint8_t *cr, int pairs)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    for (; x + 16 <= pairs; x += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cbcr + 2 * x));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(cbcr + 2 * x + 16));
+        const __m128i cb_out = _mm_packus_epi16(full_range_chroma16(_mm_and_si128(a, low_bytes)),
+                                                full_range_chroma16(_mm_and_si128(b, low_bytes)));
+        const __m128i cr_out = _mm_packus_epi16(full_range_chroma16(_mm_srli_epi16(a, 8)),
+                                                full_range_chroma16(_mm_srli_epi16(b, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cb + x), cb_out);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cr + x), cr_out);
+    }
+#endif
+    for (; x < pairs; x++)
+    {
+        cb[x] = full_range_chroma(cbcr[2 * x]);
+        cr[x] = full_range_chroma(cbcr[2 * x + 1]);
+    }
+}
+
+// YUY2 (Y0 Cb Y1 Cr) to full-range luma and still interleaved, unconverted CbCr
+void yuy2_row(const uint8_t *yuyv, uint8_t *y, uint8_t *cbcr, int width)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    for (; x + 16 <= width; x += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(yuyv + 2 * x));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(yuyv + 2 * x + 16));
+        const __m128i y_out = _mm_packus_epi16(full_range_luma16(_mm_and_si128(a, low_bytes)),
+                                               full_range_luma16(_mm_and_si128(b, low_bytes)));
+        const __m128i c_out = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y + x), y_out);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(cbcr + x), c_out);
+    }
+#endif
+    for (; x < width; x++)
+    {
+        y[x] = full_range_luma(yuyv[2 * x]);
+        cbcr[x] = yuyv[2 * x + 1];
+    }
+}
+
+// libjpeg reads whole blocks; the padding repeats the last sample
+void pad_row(uint8_t *row, int width, int padded)
+{
+    std::memset(row + width, row[width - 1], static_cast<size_t>(padded - width));
+}
+
+int round_up(int v, int m)
+{
+    return (v + m - 1) / m * m;
+}
+
+// Rows of one frame converted for libjpeg, kept per thread between frames.
+struct RowScratch
+{
+    std::vector<uint8_t> y, cb, cr, cbcr;
+};
+
+} // namespace
+
+bool host_jpeg_available(const HostJpegOptions &, std::string *)
+{
+    return true;
+}
+
+// host_jpeg_encode() into buffer; a JPEG that does not fit goes to a
+// malloc'd buffer of libjpeg's instead, which *jpeg then points to.
+static bool encode_into(k4a_image_format_t format,
+                        const uint8_t *data,
+                        int width,
+                        int height,
+                        int stride,
+                        const HostJpegOptions &options,
+                        uint8_t *buffer,
+                        size_t buffer_size,
+                        uint8_t **jpeg,
+                        size_t *jpeg_size,
+                        std::string *error)
+{
+    const bool nv12 = format == K4A_IMAGE_FORMAT_COLOR_NV12;
+    if (!nv12 && format != K4A_IMAGE_FORMAT_COLOR_YUY2)
+    {
+        *error = "Only NV12 and YUY2 are encoded on the host";
+        return false;
+    }
+    // the region to encode; a crop starts on even pixels so chroma lines up
+    const ColorCrop &crop = options.crop;
+    const bool cropped = crop.width > 0 && crop.height > 0;
+    const int x0 = cropped ? crop.x : 0;
+    const int y0 = cropped ? crop.y : 0;
+    const int out_width = cropped ? crop.width : width;
+    const int out_height = cropped ? crop.height : height;
+    if (cropped && (x0 % 2 != 0 || y0 % 2 != 0 || x0 + out_width > width || y0 + out_height > height))
+    {
+        *error = "The crop must start on even pixels inside the frame";
+        return false;
+    }
+    if (!nv12 && (width % 2 != 0 || out_width % 2 != 0))
+    {
+        *error = "YUY2 needs an even width";
+        return false;
+    }
+
+    // 4:2:0 or 4:2:2 as sent
+    const int chroma_width = (out_width + 1) / 2;
+    const int v_samp = nv12 ? 2 : 1;
+    const int rows = 8 * v_samp; // luma rows per libjpeg call
+    const int luma_padded = round_up(out_width, 16);
+    const int chroma_padded = luma_padded / 2;
+    thread_local RowScratch scratch;
+    scratch.y.resize(static_cast<size_t>(luma_padded) * 16);
+    scratch.cb.resize(static_cast<size_t>(chroma_padded) * 16);
+    scratch.cr.resize(static_cast<size_t>(chroma_padded) * 16);
+    scratch.cbcr.resize(static_cast<size_t>(luma_padded));
+
+    // raw data rows: luma row r, and chroma row r of this call
+    auto fill_row = [&](int frame_row, int r) {
+        const int src = y0 + std::min(frame_row, out_height - 1);
+        uint8_t *y = scratch.y.data() + static_cast<size_t>(r) * luma_padded;
+        uint8_t *cb = scratch.cb.data() + static_cast<size_t>(r / v_samp) * chroma_padded;
+        uint8_t *cr = scratch.cr.data() + static_cast<size_t>(r / v_samp) * chroma_padded;
+        if (nv12)
+        {
+            luma_row(data + static_cast<size_t>(src) * stride + x0, y, out_width);
+            if (r % v_samp == 0)
+            {
+                const uint8_t *plane = data + static_cast<size_t>(stride) * height;
+                chroma_row(plane + static_cast<size_t>(src / 2) * stride + x0, cb, cr, chroma_width);
+            }
+        }
+        else
+        {
+            yuy2_row(data + static_cast<size_t>(src) * stride + 2 * x0, y, scratch.cbcr.data(), out_width);
+            chroma_row(scratch.cbcr.data(), cb, cr, chroma_width);
+        }
+        pad_row(y, out_width, luma_padded);
+        if (r % v_samp == 0)
+        {
+            pad_row(cb, chroma_width, chroma_padded);
+            pad_row(cr, chroma_width, chroma_padded);
+        }
+    };
+
+    jpeg_compress_struct cinfo;
+    JpegError err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    err.mgr.output_message = jpeg_keep_message;
+    unsigned char *const initial = buffer;
+    unsigned char *out = initial;
+    unsigned long size = static_cast<unsigned long>(buffer_size);
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_compress(&cinfo);
+        if (out != initial)
+            std::free(out);
+        *error = err.message;
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, &size);
+    cinfo.image_width = static_cast<JDIMENSION>(out_width);
+    cinfo.image_height = static_cast<JDIMENSION>(out_height);
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = v_samp;
+    for (int c = 1; c < 3; c++)
+        cinfo.comp_info[c].h_samp_factor = cinfo.comp_info[c].v_samp_factor = 1;
+    cinfo.restart_in_rows = options.restart_rows;
+
+    jpeg_set_quality(&cinfo, options.quality, TRUE);
+    cinfo.raw_data_in = TRUE;
+    cinfo.dct_method = JDCT_ISLOW;
+    jpeg_start_compress(&cinfo, TRUE);
+    JSAMPROW y_rows[16], cb_rows[8], cr_rows[8];
+    for (int r = 0; r < rows; r++)
+        y_rows[r] = scratch.y.data() + static_cast<size_t>(r) * luma_padded;
+    for (int r = 0; r < 8; r++)
+    {
+        cb_rows[r] = scratch.cb.data() + static_cast<size_t>(r) * chroma_padded;
+        cr_rows[r] = scratch.cr.data() + static_cast<size_t>(r) * chroma_padded;
+    }
+    JSAMPARRAY planes[3] = { y_rows, cb_rows, cr_rows };
+    for (int row0 = 0; row0 < out_height; row0 += rows)
+    {
+        for (int r = 0; r < rows; r++)
+            fill_row(row0 + r, r);
+        jpeg_write_raw_data(&cinfo, planes, static_cast<JDIMENSION>(rows));
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    *jpeg = out;
+    *jpeg_size = size;
+    return true;
+}
+
+// The one-shot results are malloc'd: written into a generous malloc'd first
+// buffer, which is then trimmed, or dropped if libjpeg outgrew it.
+static bool into_malloc(size_t capacity,
+                        const std::function<bool(uint8_t *, size_t, uint8_t **, size_t *)> &write,
+                        uint8_t **jpeg,
+                        size_t *jpeg_size,
+                        std::string *error)
+{
+    uint8_t *buffer = static_cast<uint8_t *>(std::malloc(capacity));
+    if (buffer == nullptr)
+    {
+        *error = "Out of memory";
+        return false;
+    }
+    if (!write(buffer, capacity, jpeg, jpeg_size))
+    {
+        std::free(buffer);
+        return false;
+    }
+    if (*jpeg != buffer)
+        std::free(buffer);
+    // give back the unused tail
+    if (uint8_t *shrunk = static_cast<uint8_t *>(std::realloc(*jpeg, *jpeg_size)))
+        *jpeg = shrunk;
+    return true;
+}
+
+bool host_jpeg_encode(k4a_image_format_t format,
+                      const uint8_t *data,
+                      int width,
+                      int height,
+                      int stride,
+                      const HostJpegOptions &options,
+                      uint8_t **jpeg,
+                      size_t *jpeg_size,
+                      std::string *error)
+{
+    const bool cropped = options.crop.width > 0 && options.crop.height > 0;
+    const size_t capacity = host_jpeg_buffer_size(cropped ? options.crop.width : width,
+                                                  cropped ? options.crop.height : height);
+    return into_malloc(
+        capacity,
+        [&](uint8_t *buffer, size_t buffer_size, uint8_t **out, size_t *out_size) {
+            return encode_into(format, data, width, height, stride, options, buffer, buffer_size, out, out_size,
+                               error);
+        },
+        jpeg, jpeg_size, error);
+}
+
+// The MCU rows of the crop as a JPEG of their own, cut out of the compressed
+// stream without decoding: possible when restart intervals start each MCU row
+// afresh, since every interval then decodes on its own. The rows are renumbered
+// to start at 0 and crop moved with them. False when the frame does not allow
+// it (no restart markers, intervals across rows, progressive), and the whole
+// frame has to be read.
+static bool restart_band(const uint8_t *data, size_t size, ColorCrop *crop, std::vector<uint8_t> *band)
+{
+    size_t pos = 2, sof = 0, scan = 0;
+    int restart_interval = 0, width = 0, height = 0, max_h = 1, max_v = 1, components = 0, scan_components = 0;
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+    while (scan == 0)
+    {
+        if (pos + 4 > size || data[pos] != 0xFF)
+            return false;
+        const uint8_t marker = data[pos + 1];
+        const size_t length = (static_cast<size_t>(data[pos + 2]) << 8) | data[pos + 3];
+        if (length < 2 || pos + 2 + length > size)
+            return false;
+        const uint8_t *seg = data + pos + 4;
+        if (marker == 0xC0 || marker == 0xC1)
+        {
+            if (length < 8)
+                return false;
+            sof = pos;
+            height = (seg[1] << 8) | seg[2];
+            width = (seg[3] << 8) | seg[4];
+            components = seg[5];
+            if (length < 8 + 3 * static_cast<size_t>(components))
+                return false;
+            for (int c = 0; c < components; c++)
+            {
+                max_h = std::max(max_h, seg[7 + 3 * c] >> 4);
+                max_v = std::max(max_v, seg[7 + 3 * c] & 15);
+            }
+        }
+        else if ((marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC))
+            return false; // progressive, lossless or arithmetic
+        else if (marker == 0xDD && length == 4)
+            restart_interval = (seg[0] << 8) | seg[1];
+        else if (marker == 0xDA)
+        {
+            scan_components = seg[0];
+            scan = pos + 2 + length;
+        }
+        pos += 2 + length;
+    }
+    const int mcu_width = max_h * 8, mcu_height = max_v * 8;
+    const int mcus_per_row = (width + mcu_width - 1) / mcu_width;
+    const int mcu_rows = (height + mcu_height - 1) / mcu_height;
+    if (sof == 0 || restart_interval == 0 || scan_components != components || mcus_per_row % restart_interval != 0 ||
+        crop->y % mcu_height != 0 || crop->y + crop->height > height)
+        return false;
+    const int first_row = crop->y / mcu_height;
+    const int end_row = std::min((crop->y + crop->height + mcu_height - 1) / mcu_height, mcu_rows);
+    const int per_row = mcus_per_row / restart_interval;
+    const long first = static_cast<long>(first_row) * per_row;
+    const long end = static_cast<long>(end_row) * per_row; // one past the last interval
+    if (first == 0 && end_row == mcu_rows)
+        return false; // nothing to cut
+
+    // intervals [first, end), found by their RST markers
+    long interval = 0;
+    size_t band_start = first == 0 ? scan : 0, band_end = 0;
+    thread_local std::vector<size_t> markers; // RSTs inside the band
+    markers.clear();
+    for (const uint8_t *p = data + scan, *stop = data + size - 1; band_end == 0;)
+    {
+        p = static_cast<const uint8_t *>(std::memchr(p, 0xFF, static_cast<size_t>(stop - p)));
+        if (p == nullptr)
+            return false;
+        const uint8_t m = p[1];
+        if (m >= 0xD0 && m <= 0xD7)
+        {
+            if ((m & 7) != (interval & 7))
+                return false; // damaged; libjpeg can say how
+            interval++;
+            if (interval == first)
+                band_start = static_cast<size_t>(p + 2 - data);
+            else if (interval == end)
+                band_end = static_cast<size_t>(p - data);
+            else if (interval > first)
+                markers.push_back(static_cast<size_t>(p + 1 - data));
+            p += 2;
+        }
+        else if (m == 0xD9)
+        {
+            if (interval + 1 != end)
+                return false;
+            band_end = static_cast<size_t>(p - data);
+        }
+        else
+            p += m == 0xFF ? 1 : 2; // fill byte, or stuffed 0xFF00
+        if (p >= stop && band_end == 0)
+            return false;
+    }
+    if (band_start == 0)
+        return false;
+
+    band->assign(data, data + scan);
+    const int band_height = std::min(end_row * mcu_height, height) - first_row * mcu_height;
+    (*band)[sof + 5] = static_cast<uint8_t>(band_height >> 8);
+    (*band)[sof + 6] = static_cast<uint8_t>(band_height);
+    band->insert(band->end(), data + band_start, data + band_end);
+    // the band's own restart numbering starts over at RST0
+    for (size_t i = 0; i < markers.size(); i++)
+        (*band)[scan + markers[i] - band_start] = static_cast<uint8_t>(0xD0 | (i & 7));
+    band->push_back(0xFF);
+    band->push_back(0xD9);
+    crop->y -= first_row * mcu_height;
+    return true;
+}
+
+// jpeg_crop_lossless() on whichever stream it settled on, into buffer like
+// encode_into(). Kept apart so that nothing the setjmp() below can return to
+// is reassigned before it.
+static bool crop_coefficients(const uint8_t *data,
+                              size_t size,
+                              const ColorCrop &region,
+                              uint8_t *buffer,
+                              size_t buffer_size,
+                              uint8_t **jpeg,
+                              size_t *jpeg_size,
+                              std::string *error)
+{
+    // one error manager for both sides
+    jpeg_decompress_struct src;
+    jpeg_compress_struct dst;
+    JpegError err;
+    src.err = dst.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    err.mgr.output_message = jpeg_keep_message;
+    unsigned char *const initial = buffer;
+    unsigned char *out = initial;
+    unsigned long out_size = static_cast<unsigned long>(buffer_size);
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        if (out != initial)
+            std::free(out);
+        *error = err.message;
+        return false;
+    }
+
+    jpeg_mem_src(&src, data, static_cast<unsigned long>(size));
+    jpeg_read_header(&src, TRUE);
+    const int max_h = src.max_h_samp_factor;
+    const int max_v = src.max_v_samp_factor;
+    const int mcu_width = max_h * DCTSIZE;
+    const int mcu_height = max_v * DCTSIZE;
+    if (region.width < 1 || region.height < 1 || region.x % mcu_width != 0 || region.y % mcu_height != 0 ||
+        region.x + region.width > static_cast<int>(src.image_width) ||
+        region.y + region.height > static_cast<int>(src.image_height))
+    {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        *error = "The crop is not on this frame's " + std::to_string(mcu_width) + "x" + std::to_string(mcu_height) +
+                 " MCU grid or leaves the frame";
+        return false;
+    }
+
+    // The cropped coefficients, per component in whole MCUs like libjpeg's
+    // own arrays. They must be requested before jpeg_read_coefficients()
+    // realizes the source's.
+    jvirt_barray_ptr cropped[MAX_COMPONENTS];
+    JDIMENSION x_blocks[MAX_COMPONENTS], y_blocks[MAX_COMPONENTS];
+    JDIMENSION width_blocks[MAX_COMPONENTS], height_blocks[MAX_COMPONENTS];
+    for (int c = 0; c < src.num_components; c++)
+    {
+        const jpeg_component_info &comp = src.comp_info[c];
+        x_blocks[c] = static_cast<JDIMENSION>(region.x / mcu_width * comp.h_samp_factor);
+        y_blocks[c] = static_cast<JDIMENSION>(region.y / mcu_height * comp.v_samp_factor);
+        width_blocks[c] = static_cast<JDIMENSION>(
+            round_up((region.width * comp.h_samp_factor + mcu_width - 1) / mcu_width, comp.h_samp_factor));
+        height_blocks[c] = static_cast<JDIMENSION>(
+            round_up((region.height * comp.v_samp_factor + mcu_height - 1) / mcu_height, comp.v_samp_factor));
+        cropped[c] = (*src.mem->request_virt_barray)(reinterpret_cast<j_common_ptr>(&src), JPOOL_IMAGE, TRUE,
+                                                     width_blocks[c], height_blocks[c],
+                                                     static_cast<JDIMENSION>(comp.v_samp_factor));
+    }
+    jvirt_barray_ptr *coefficients = jpeg_read_coefficients(&src);
+    // libjpeg fills in what a damaged frame lacks; that must not pass for
+    // the frame
+    if (err.mgr.num_warnings > 0)
+    {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        *error = err.message;
+        return false;
+    }
+
+    for (int c = 0; c < src.num_components; c++)
+    {
+        const jpeg_component_info &comp = src.comp_info[c];
+        // the source arrays are padded to whole MCUs too
+        const JDIMENSION src_width = static_cast<JDIMENSION>(
+            round_up(static_cast<int>(comp.width_in_blocks), comp.h_samp_factor));
+        const JDIMENSION src_height = static_cast<JDIMENSION>(
+            round_up(static_cast<int>(comp.height_in_blocks), comp.v_samp_factor));
+        const JDIMENSION copy_width = std::min(width_blocks[c], src_width - x_blocks[c]);
+        const JDIMENSION copy_height = std::min(height_blocks[c], src_height - y_blocks[c]);
+        for (JDIMENSION row = 0; row < copy_height; row++)
+        {
+            JBLOCKARRAY from = (*src.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&src), coefficients[c],
+                                                              y_blocks[c] + row, 1, FALSE);
+            JBLOCKARRAY to = (*src.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&src), cropped[c], row,
+                                                            1, TRUE);
+            std::memcpy(to[0], from[0] + x_blocks[c], copy_width * sizeof(JBLOCK));
+        }
+    }
+
+    jpeg_copy_critical_parameters(&src, &dst);
+    dst.image_width = static_cast<JDIMENSION>(region.width);
+    dst.image_height = static_cast<JDIMENSION>(region.height);
+    // corrupt-frame detection relies on the restart markers
+    dst.restart_interval = src.restart_interval;
+    jpeg_mem_dest(&dst, &out, &out_size);
+    jpeg_write_coefficients(&dst, cropped);
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    *jpeg = out;
+    *jpeg_size = out_size;
+    return true;
+}
+
+static bool crop_into(const uint8_t *data,
+                      size_t size,
+                      const ColorCrop &crop,
+                      uint8_t *buffer,
+                      size_t buffer_size,
+                      uint8_t **jpeg,
+                      size_t *jpeg_size,
+                      std::string *error)
+{
+    // only the crop's rows need entropy-decoding when they can be cut out
+    thread_local std::vector<uint8_t> band;
+    ColorCrop region = crop;
+    if (restart_band(data, size, &region, &band))
+        return crop_coefficients(band.data(), band.size(), region, buffer, buffer_size, jpeg, jpeg_size, error);
+    return crop_coefficients(data, size, crop, buffer, buffer_size, jpeg, jpeg_size, error);
+}
+
+bool jpeg_crop_lossless(const uint8_t *data,
+                        size_t size,
+                        const ColorCrop &crop,
+                        uint8_t **jpeg,
+                        size_t *jpeg_size,
+                        std::string *error)
+{
+    // a crop is smaller than the frame it came from
+    return into_malloc(
+        size + 4096,
+        [&](uint8_t *buffer, size_t buffer_size, uint8_t **out, size_t *out_size) {
+            return crop_into(data, size, crop, buffer, buffer_size, out, out_size, error);
+        },
+        jpeg, jpeg_size, error);
+}
+
+#else
+
+bool host_jpeg_available(const HostJpegOptions &, std::string *error)
+{
+    *error = "This build has no libjpeg; only the camera's MJPEG can be recorded.";
+    return false;
+}
+
+bool host_jpeg_encode(k4a_image_format_t,
+                      const uint8_t *,
+                      int,
+                      int,
+                      int,
+                      const HostJpegOptions &options,
+                      uint8_t **,
+                      size_t *,
+                      std::string *error)
+{
+    return host_jpeg_available(options, error);
+}
+
+bool jpeg_crop_lossless(const uint8_t *, size_t, const ColorCrop &, uint8_t **, size_t *, std::string *error)
+{
+    return host_jpeg_available(HostJpegOptions(), error);
+}
+
+static bool encode_into(k4a_image_format_t,
+                        const uint8_t *,
+                        int,
+                        int,
+                        int,
+                        const HostJpegOptions &options,
+                        uint8_t *,
+                        size_t,
+                        uint8_t **,
+                        size_t *,
+                        std::string *error)
+{
+    return host_jpeg_available(options, error);
+}
+
+static bool
+crop_into(const uint8_t *, size_t, const ColorCrop &, uint8_t *, size_t, uint8_t **, size_t *, std::string *error)
+{
+    return host_jpeg_available(HostJpegOptions(), error);
+}
+
+#endif
+
+static void free_jpeg_buffer(void *buffer, void *)
+{
+    std::free(buffer);
+}
+
+// context is a reference to the pool, held until the image is released
+static void release_pooled_jpeg(void *buffer, void *context)
+{
+    std::shared_ptr<BufferPool> *pool = static_cast<std::shared_ptr<BufferPool> *>(context);
+    (*pool)->release(static_cast<uint8_t *>(buffer));
+    delete pool;
+}
+
+HostJpegEncoder::HostJpegEncoder(const HostJpegOptions &options) : m_options(options)
+{
+    m_options.threads = std::max(1, m_options.threads);
+    m_options.queue_frames = std::max<size_t>(1, m_options.queue_frames);
+}
+
+HostJpegEncoder::~HostJpegEncoder()
+{
+    finish();
+}
+
+bool HostJpegEncoder::start(k4a_image_format_t format, int width, int height, Deliver deliver, std::string *error)
+{
+    const ColorCrop &crop = m_options.crop;
+    const bool cropped = crop.width > 0 && crop.height > 0;
+    if (format != K4A_IMAGE_FORMAT_COLOR_NV12 && format != K4A_IMAGE_FORMAT_COLOR_YUY2 &&
+        !(format == K4A_IMAGE_FORMAT_COLOR_MJPG && cropped))
+    {
+        *error = "Only NV12 and YUY2 are encoded on the host, and MJPEG only cropped";
+        return false;
+    }
+    if (cropped && (crop.x < 0 || crop.y < 0 || crop.x + crop.width > width || crop.y + crop.height > height))
+    {
+        *error = "The crop leaves the " + std::to_string(width) + "x" + std::to_string(height) + " frame";
+        return false;
+    }
+    if (!host_jpeg_available(m_options, error))
+        return false;
+    m_format = format;
+    m_width = width;
+    m_height = height;
+    m_deliver = deliver;
+    if (m_options.output_buffers > 0)
+    {
+        const int out_width = cropped ? crop.width : width;
+        const int out_height = cropped ? crop.height : height;
+        m_buffers = std::make_shared<BufferPool>(host_jpeg_buffer_size(out_width, out_height),
+                                                 m_options.output_buffers);
+    }
+    m_start_ns = monotonic_ns();
+    for (int i = 0; i < m_options.threads; i++)
+        m_threads.emplace_back(&HostJpegEncoder::run, this);
+    return true;
+}
+
+bool HostJpegEncoder::submit(k4a_capture_t capture)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.size() >= m_options.queue_frames)
+            return false;
+        Job job;
+        job.sequence = m_submitted++;
+        job.capture = capture;
+        m_queue.push_back(job);
+    }
+    m_cv.notify_one();
+    return true;
+}
+
+void HostJpegEncoder::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finishing = true;
+    }
+    m_cv.notify_all();
+    for (auto &t : m_threads)
+        if (t.joinable())
+            t.join();
+    m_threads.clear();
+}
+
+double HostJpegEncoder::utilization() const
+{
+    const int64_t elapsed = monotonic_ns() - m_start_ns;
+    if (m_start_ns == 0 || elapsed <= 0)
+        return 0;
+    return static_cast<double>(m_busy_ns.load()) / (static_cast<double>(elapsed) * m_options.threads);
+}
+
+void HostJpegEncoder::run()
+{
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&] { return !m_queue.empty() || m_finishing; });
+            if (m_queue.empty())
+                return;
+            job = m_queue.front();
+            m_queue.pop_front();
+        }
+        const int64_t t0 = monotonic_ns();
+        const bool ok = encode(job.capture);
+        const int64_t elapsed = monotonic_ns() - t0;
+        m_busy_ns += elapsed;
+        m_encode_latency.record(elapsed);
+        if (!ok)
+        {
+            m_failed++;
+            // a damaged camera frame goes on whole, for the payload check
+            if (m_format != K4A_IMAGE_FORMAT_COLOR_MJPG)
+            {
+                k4a_capture_release(job.capture);
+                job.capture = nullptr;
+            }
+        }
+        deliver(job.sequence, job.capture);
+    }
+}
+
+bool HostJpegEncoder::encode(k4a_capture_t capture)
+{
+    k4a_image_t raw = k4a_capture_get_color_image(capture);
+    if (raw == nullptr)
+        return false;
+    const int stride = k4a_image_get_stride_bytes(raw);
+    const size_t raw_size = k4a_image_get_size(raw);
+    const bool cropped = m_options.crop.width > 0 && m_options.crop.height > 0;
+    const int out_width = cropped ? m_options.crop.width : m_width;
+    const int out_height = cropped ? m_options.crop.height : m_height;
+    // into a block of the pool when one is free and the JPEG fits, else malloc'd
+    uint8_t *const block = m_buffers ? m_buffers->acquire() : nullptr;
+    const size_t block_size = block ? m_buffers->block_size() : 0;
+    uint8_t *jpeg = nullptr;
+    size_t jpeg_size = 0;
+    std::string error;
+    k4a_image_t image = nullptr;
+    bool ok = k4a_image_get_format(raw) == m_format;
+    if (ok && m_format == K4A_IMAGE_FORMAT_COLOR_MJPG)
+    {
+        ok = crop_into(k4a_image_get_buffer(raw), raw_size, m_options.crop, block, block_size, &jpeg, &jpeg_size,
+                       &error);
+    }
+    else if (ok)
+    {
+        const size_t needed = m_format == K4A_IMAGE_FORMAT_COLOR_NV12
+                                  ? static_cast<size_t>(stride) * m_height * 3 / 2
+                                  : static_cast<size_t>(stride) * m_height;
+        const int min_stride = m_format == K4A_IMAGE_FORMAT_COLOR_NV12 ? m_width : m_width * 2;
+        ok = k4a_image_get_width_pixels(raw) == m_width && k4a_image_get_height_pixels(raw) == m_height &&
+             stride >= min_stride && raw_size >= needed &&
+             encode_into(m_format, k4a_image_get_buffer(raw), m_width, m_height, stride, m_options, block,
+                         block_size, &jpeg, &jpeg_size, &error);
+    }
+    const bool pooled = ok && block != nullptr && jpeg == block;
+    if (block != nullptr && !pooled)
+        m_buffers->release(block);
+    if (!pooled && ok)
+        m_unpooled++;
+    std::shared_ptr<BufferPool> *lease = pooled ? new std::shared_ptr<BufferPool>(m_buffers) : nullptr;
+    if (ok && K4A_FAILED(k4a_image_create_from_buffer(K4A_IMAGE_FORMAT_COLOR_MJPG, out_width, out_height, 0, jpeg,
+                                                      jpeg_size, pooled ? release_pooled_jpeg : free_jpeg_buffer,
+                                                      lease, &image)))
+    {
+        if (pooled)
+            release_pooled_jpeg(jpeg, lease);
+        else
+            std::free(jpeg);
+        ok = false;
+    }
+    if (ok)
+    {
+        k4a_image_set_device_timestamp_usec(image, k4a_image_get_device_timestamp_usec(raw));
+        k4a_image_set_system_timestamp_nsec(image, k4a_image_get_system_timestamp_nsec(raw));
+        k4a_image_set_exposure_usec(image, k4a_image_get_exposure_usec(raw));
+        k4a_image_set_white_balance(image, k4a_image_get_white_balance(raw));
+        k4a_image_set_iso_speed(image, k4a_image_get_iso_speed(raw));
+        // the capture lets go of the raw frame here
+        k4a_capture_set_color_image(capture, image);
+        k4a_image_release(image);
+        m_raw_bytes += raw_size;
+        m_jpeg_bytes += jpeg_size;
+        m_encoded++;
+    }
+    k4a_image_release(raw);
+    return ok;
+}
+
+void HostJpegEncoder::deliver(uint64_t sequence, k4a_capture_t capture)
+{
+    std::lock_guard<std::mutex> lock(m_done_mutex);
+    m_done[sequence] = capture;
+    for (auto it = m_done.begin(); it != m_done.end() && it->first == m_next_delivery; it = m_done.erase(it))
+    {
+        m_next_delivery++;
+        if (it->second != nullptr)
+            m_deliver(it->second);
+    }
+}
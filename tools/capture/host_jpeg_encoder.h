@@ -0,0 +1,209 @@
+#ifndef HOST_JPEG_ENCODER_H
+#define HOST_JPEG_ENCODER_H
+
+#include <k4a/k4a.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "latency_histogram.h"
+
+// JPEG work on the host between capture and recording: encoding cameras that
+// record uncompressed color (htkrecorder --color-format nv12|yuy2), so the
+// quality is ours to choose instead of the camera's fixed MJPEG setting, and
+// cropping frames to a workspace region (--crop).
+//
+// Each device gets a pool of encoder threads between its capture thread and
+// its writer. Every frame's color image is swapped for a JPEG of it (or of
+// its crop), with the same timestamps and exposure settings, so everything
+// downstream (recordings, rig file, checks, metadata) sees MJPEG as usual.
+// Frames leave the pool in the order they came in.
+//
+// NV12 and YUY2 are already YCbCr, so the encoder hands the planes to
+// libjpeg as raw data at the camera's chroma subsampling (4:2:0 and 4:2:2)
+// and skips libjpeg's color conversion and downsampling altogether. The only
+// per-pixel work on our side is splitting interleaved chroma and stretching
+// the camera's video range (16-235) to the full range JFIF decoders expect,
+// done 16 pixels at a time with SSE2.
+//
+// The camera's own MJPEG is cropped losslessly in the DCT domain, like
+// jpegtran -crop: the quantized coefficients of the blocks inside the region
+// are copied into a new JPEG and only re-entropy-coded, so the crop costs a
+// fraction of a decode and changes no pixel. That needs the region to start
+// on an MCU boundary, which align_color_crop() takes care of. When the
+// frame's restart intervals start on MCU rows, the rows above and below the
+// crop are cut out of the compressed stream first and never decoded. A frame
+// that cannot be cropped (a damaged payload) is passed on whole, for the
+// writer's payload check to count.
+
+// A region of the sensor's color image, in pixels.
+struct ColorCrop
+{
+    int x = 0;
+    int y = 0;
+    int width = 0; // 0: no crop
+    int height = 0;
+};
+
+struct HostJpegOptions
+{
+    int quality = 95;        // libjpeg quality, 1-100
+    int threads = 2;         // per device
+    size_t queue_frames = 8; // raw frames waiting for an encoder, per device
+    ColorCrop crop;          // aligned, see align_color_crop()
+    int restart_rows = 0;    // restart marker every this many MCU rows, 0 for none
+    // JPEGs are written into this many preallocated blocks per device, held
+    // until the writer releases the frame; 0 mallocs every frame
+    size_t output_buffers = 24;
+};
+
+// 1-100, e.g. "95"
+bool parse_jpeg_quality(const std::string &value, HostJpegOptions *options);
+// MKV tag with the crop of a cropped recording, as color_crop_string()
+static const char kColorCropTag[] = "HTK_COLOR_CROP";
+
+// "X,Y,WxH", e.g. "848,400,864x640"
+bool parse_color_crop(const std::string &value, ColorCrop *crop);
+std::string color_crop_string(const ColorCrop &crop);
+// Grows the crop outwards to 16-pixel boundaries, the largest MCU a camera
+// sends, and clips it to the frame. False if nothing of it is in the frame.
+bool align_color_crop(ColorCrop *crop, int width, int height);
+// false and fills error when this build cannot encode as asked
+bool host_jpeg_available(const HostJpegOptions &options, std::string *error);
+
+// One-shot encode of an NV12 or YUY2 buffer (of options.crop, if set), for
+// tools and benchmarks. The result is a malloc'd buffer the caller frees.
+bool host_jpeg_encode(k4a_image_format_t format,
+                      const uint8_t *data,
+                      int width,
+                      int height,
+                      int stride,
+                      const HostJpegOptions &options,
+                      uint8_t **jpeg,
+                      size_t *jpeg_size,
+                      std::string *error);
+
+// Lossless crop of a baseline or progressive JPEG to an MCU-aligned region,
+// see above. The result is a malloc'd buffer the caller frees. Fails on a
+// payload libjpeg warns about rather than crop a damaged frame.
+bool jpeg_crop_lossless(const uint8_t *data,
+                        size_t size,
+                        const ColorCrop &crop,
+                        uint8_t **jpeg,
+                        size_t *jpeg_size,
+                        std::string *error);
+
+class HostJpegEncoder
+{
+public:
+    // Takes the capture (its reference) once its color image is a JPEG of
+    // the crop, in submission order; called from the encoder threads, one at
+    // a time.
+    using Deliver = std::function<void(k4a_capture_t)>;
+
+    explicit HostJpegEncoder(const HostJpegOptions &options);
+    ~HostJpegEncoder();
+
+    HostJpegEncoder(const HostJpegEncoder &) = delete;
+    HostJpegEncoder &operator=(const HostJpegEncoder &) = delete;
+
+    // format is what the camera sends: NV12 or YUY2 to encode, or MJPG to
+    // crop; width and height are the sensor's.
+    bool start(k4a_image_format_t format, int width, int height, Deliver deliver, std::string *error);
+
+    // Capture thread. Takes the reference on success; false if the queue is
+    // full, and the caller drops the frame.
+    bool submit(k4a_capture_t capture);
+    // Capture thread, after the last submit(): delivers what is queued and
+    // stops the threads.
+    void finish();
+
+    const HostJpegOptions &options() const
+    {
+        return m_options;
+    }
+    uint64_t encoded() const
+    {
+        return m_encoded;
+    }
+    // The image was not what the camera was configured for, or libjpeg
+    // failed. Raw frames are dropped, MJPEG ones passed on uncropped.
+    uint64_t failed() const
+    {
+        return m_failed;
+    }
+    uint64_t raw_bytes() const
+    {
+        return m_raw_bytes;
+    }
+    uint64_t jpeg_bytes() const
+    {
+        return m_jpeg_bytes;
+    }
+    // frames that found no free output block, or outgrew it, and were malloc'd
+    uint64_t unpooled() const
+    {
+        return m_unpooled;
+    }
+    // per frame, on one encoder thread
+    const LatencyHistogram &encode_latency() const
+    {
+        return m_encode_latency;
+    }
+    // Share of the pool's thread time spent encoding since start(); 1 means
+    // frames arrive as fast as the pool can encode them.
+    double utilization() const;
+
+private:
+    struct Job
+    {
+        uint64_t sequence = 0;
+        k4a_capture_t capture = nullptr;
+    };
+
+    void run();
+    bool encode(k4a_capture_t capture);
+    void deliver(uint64_t sequence, k4a_capture_t capture);
+
+    HostJpegOptions m_options;
+    k4a_image_format_t m_format = K4A_IMAGE_FORMAT_COLOR_MJPG;
+    int m_width = 0;
+    int m_height = 0;
+    Deliver m_deliver;
+    // shared with the images that hold blocks, which can outlive the encoder
+    std::shared_ptr<BufferPool> m_buffers;
+    std::vector<std::thread> m_threads;
+    int64_t m_start_ns = 0;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Job> m_queue;
+    uint64_t m_submitted = 0;
+    bool m_finishing = false;
+
+    // finished out of order, waiting for their predecessors; null if the
+    // frame failed
+    std::mutex m_done_mutex;
+    std::map<uint64_t, k4a_capture_t> m_done;
+    uint64_t m_next_delivery = 0;
+
+    std::atomic<uint64_t> m_encoded{ 0 };
+    std::atomic<uint64_t> m_failed{ 0 };
+    std::atomic<uint64_t> m_raw_bytes{ 0 };
+    std::atomic<uint64_t> m_jpeg_bytes{ 0 };
+    std::atomic<uint64_t> m_unpooled{ 0 };
+    std::atomic<int64_t> m_busy_ns{ 0 };
+    LatencyHistogram m_encode_latency;
+};
+
+#endif
@@ -0,0 +1,339 @@
+// Reports what is in k4a recordings without decoding them.
+//
+//   htkinspect [--gap-factor 1.5] [--window-s 1] [--max-gaps 20] [--bitrate]
+//              [--json report.json] recording.mkv ...
+//
+// The file is memory-mapped and its Matroska structure walked directly
+// (matroska.h): track layout, attachments, tags, and per track the number of
+// frames, their timestamps and sizes, read from the block headers. Frame
+// payloads are never read. A video frame more than --gap-factor median frame
+// periods after the previous one is a gap. Bitrate is summed over
+// --window-s windows of recording time; --bitrate prints every window.
+// Exit status: 0 all intact, 1 bad arguments or not a recording, 2 a
+// recording is truncated or damaged.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../cli.h"
+#include "../matroska.h"
+#include "../session_manifest.h"
+
+using namespace std::chrono;
+
+struct Gap
+{
+    size_t frame; // the frame after the gap
+    int64_t timestamp_ns;
+    int64_t length_ns;
+};
+
+struct TrackStats
+{
+    uint64_t blocks = 0;
+    uint64_t bytes = 0;
+    int64_t first_ns = 0;
+    int64_t last_ns = 0;
+    int64_t period_ns = 0; // median
+    uint64_t backwards = 0; // timestamps that did not increase
+    std::vector<int64_t> timestamps;
+    std::vector<Gap> gaps;
+    uint64_t missing = 0; // frames estimated to be in the gaps
+};
+
+struct Options
+{
+    double gap_factor = 1.5;
+    double window_s = 1;
+    size_t max_gaps = 20;
+    bool bitrate = false;
+};
+
+static std::string megabytes(uint64_t bytes)
+{
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(1) << bytes / 1e6 << " MB";
+    return s.str();
+}
+
+static int64_t median(std::vector<int64_t> v)
+{
+    if (v.empty())
+        return 0;
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+static void find_gaps(const MatroskaTrack &track, const Options &options, TrackStats *s)
+{
+    if (s->timestamps.size() < 3)
+        return;
+    std::vector<int64_t> deltas;
+    deltas.reserve(s->timestamps.size() - 1);
+    for (size_t i = 1; i < s->timestamps.size(); i++)
+        deltas.push_back(s->timestamps[i] - s->timestamps[i - 1]);
+    s->period_ns = median(deltas);
+    if (track.type != 1 || s->period_ns <= 0)
+        return;
+    for (size_t i = 0; i < deltas.size(); i++)
+    {
+        if (deltas[i] <= 0)
+        {
+            s->backwards++;
+            continue;
+        }
+        if (deltas[i] <= options.gap_factor * s->period_ns)
+            continue;
+        s->gaps.push_back({ i + 1, s->timestamps[i + 1], deltas[i] });
+        s->missing += static_cast<uint64_t>(std::llround(static_cast<double>(deltas[i]) / s->period_ns)) - 1;
+    }
+}
+
+static bool map_file(const std::string &path, const uint8_t **data, size_t *size, std::string *error)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        *error = "Unable to open " + path + ": " + std::strerror(errno);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    *size = static_cast<size_t>(st.st_size);
+    void *p = *size ? mmap(nullptr, *size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        *error = "Unable to map " + path;
+        return false;
+    }
+    // only block headers are read: no readahead into the payloads between them
+    madvise(p, *size, MADV_RANDOM);
+    *data = static_cast<const uint8_t *>(p);
+    return true;
+}
+
+// Returns false if the file is not a recording at all; damage is reported in
+// the output and counted in *damaged.
+static bool inspect(const std::string &path, const Options &options, std::ostringstream &json, size_t *damaged)
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    std::string error;
+    if (!map_file(path, &data, &size, &error))
+    {
+        std::cerr << error << std::endl;
+        return false;
+    }
+
+    const auto t0 = steady_clock::now();
+    MatroskaLayout layout;
+    std::map<uint64_t, TrackStats> stats;
+    std::vector<uint64_t> windows; // bytes per window
+    const double window_ns = options.window_s * 1e9;
+    const bool ok = matroska_scan(
+        data, size, &layout,
+        [&](const MatroskaBlock &b) {
+            TrackStats &s = stats[b.track];
+            if (s.blocks == 0)
+                s.first_ns = b.timestamp_ns;
+            s.blocks += b.frames;
+            s.bytes += b.size;
+            s.last_ns = b.timestamp_ns;
+            s.timestamps.push_back(b.timestamp_ns);
+            const size_t w = b.timestamp_ns > 0 ? static_cast<size_t>(b.timestamp_ns / window_ns) : 0;
+            if (w >= windows.size())
+                windows.resize(w + 1, 0);
+            windows[w] += b.size;
+        },
+        &error);
+    const double seconds = duration<double>(steady_clock::now() - t0).count();
+    if (!ok)
+    {
+        munmap(const_cast<uint8_t *>(data), size);
+        std::cerr << path << ": " << error << std::endl;
+        return false;
+    }
+    for (auto &t : layout.tracks)
+        find_gaps(t, options, &stats[t.number]);
+
+    const int64_t start_offset_ns = std::atoll(layout.tag("K4A_START_OFFSET_NS", 0, "0").c_str());
+    const bool intact = layout.problem.empty() && layout.segment_complete;
+    if (!intact)
+        (*damaged)++;
+
+    std::cout << path << ": " << megabytes(size) << ", " << layout.clusters << " clusters, "
+              << (layout.has_cues ? "cues" : "no cues") << ", "
+              << (intact                     ? "intact"
+                  : layout.segment_complete  ? "damaged"
+                  : layout.problem.empty()   ? "not finalized"
+                                             : "truncated")
+              << std::endl;
+    if (!layout.problem.empty())
+        std::cout << "  stopped at " << layout.scanned_bytes << " of " << size << " bytes: " << layout.problem
+                  << std::endl;
+    for (auto &t : layout.tracks)
+    {
+        const TrackStats &s = stats[t.number];
+        const double span_s = (s.last_ns - s.first_ns) / 1e9;
+        std::cout << "  track " << t.number << " " << (t.name.empty() ? "-" : t.name) << " " << t.codec;
+        if (t.width)
+            std::cout << " " << t.width << "x" << t.height;
+        std::cout << ": " << s.blocks << " frame(s), " << megabytes(s.bytes);
+        if (s.blocks > 1)
+        {
+            std::cout << std::fixed << std::setprecision(2) << ", " << span_s << " s";
+            if (s.period_ns > 0)
+                std::cout << ", " << 1e9 / s.period_ns << " fps";
+            if (span_s > 0)
+                std::cout << ", " << std::setprecision(1) << s.bytes * 8 / 1e6 / span_s << " Mbit/s";
+        }
+        if (t.type == 1)
+            std::cout << ", " << s.gaps.size() << " gap(s), ~" << s.missing << " missing";
+        if (s.backwards)
+            std::cout << ", " << s.backwards << " out of order";
+        std::cout << std::endl;
+        for (size_t g = 0; g < s.gaps.size() && g < options.max_gaps; g++)
+        {
+            const Gap &gap = s.gaps[g];
+            std::cout << "    gap before frame " << gap.frame << " at " << std::fixed << std::setprecision(3)
+                      << gap.timestamp_ns / 1e9 << " s (device " << (gap.timestamp_ns + start_offset_ns) / 1000
+                      << " us): " << std::setprecision(1) << gap.length_ns / 1e6 << " ms" << std::endl;
+        }
+        if (s.gaps.size() > options.max_gaps)
+            std::cout << "    ... " << s.gaps.size() - options.max_gaps << " more" << std::endl;
+    }
+
+    if (!windows.empty())
+    {
+        std::vector<double> mbit;
+        for (uint64_t b : windows)
+            mbit.push_back(b * 8 / 1e6 / options.window_s);
+        std::vector<double> sorted = mbit;
+        std::sort(sorted.begin(), sorted.end());
+        std::cout << "  bitrate over " << options.window_s << " s windows: min " << std::fixed << std::setprecision(1)
+                  << sorted.front() << ", median " << sorted[sorted.size() / 2] << ", max " << sorted.back()
+                  << " Mbit/s" << std::endl;
+        if (options.bitrate)
+            for (size_t w = 0; w < mbit.size(); w++)
+                std::cout << "    " << std::setprecision(1) << w * options.window_s << " s  " << mbit[w]
+                          << std::endl;
+    }
+    for (auto &a : layout.attachments)
+        std::cout << "  attachment " << a.name << " (" << a.mime << ", " << a.size << " bytes)" << std::endl;
+    for (auto &t : layout.tags)
+        std::cout << "  tag " << t.name << (t.track_uid ? " (track)" : "") << " = " << t.value << std::endl;
+    std::cout << "  scanned in " << std::fixed << std::setprecision(3) << seconds << " s" << std::endl;
+
+    // report entry
+    if (json.tellp() > 1)
+        json << ",";
+    json << "\n  {\"file\": " << json_string(path) << ", \"bytes\": " << size << ", \"intact\": "
+         << (intact ? "true" : "false") << ", \"problem\": " << json_string(layout.problem)
+         << ", \"clusters\": " << layout.clusters << ", \"start_offset_ns\": " << start_offset_ns
+         << ", \"tracks\": [";
+    for (size_t i = 0; i < layout.tracks.size(); i++)
+    {
+        const MatroskaTrack &t = layout.tracks[i];
+        const TrackStats &s = stats[t.number];
+        json << (i ? ", " : "") << "{\"number\": " << t.number << ", \"name\": " << json_string(t.name)
+             << ", \"codec\": " << json_string(t.codec) << ", \"type\": " << t.type << ", \"width\": " << t.width
+             << ", \"height\": " << t.height << ", \"frames\": " << s.blocks << ", \"bytes\": " << s.bytes
+             << ", \"first_ns\": " << s.first_ns << ", \"last_ns\": " << s.last_ns
+             << ", \"period_ns\": " << s.period_ns << ", \"missing\": " << s.missing << ", \"gaps\": [";
+        for (size_t g = 0; g < s.gaps.size(); g++)
+            json << (g ? ", " : "") << "[" << s.gaps[g].frame << ", " << s.gaps[g].timestamp_ns << ", "
+                 << s.gaps[g].length_ns << "]";
+        json << "]}";
+    }
+    json << "], \"attachments\": [";
+    for (size_t i = 0; i < layout.attachments.size(); i++)
+        json << (i ? ", " : "") << "{\"name\": " << json_string(layout.attachments[i].name)
+             << ", \"mime\": " << json_string(layout.attachments[i].mime)
+             << ", \"bytes\": " << layout.attachments[i].size << "}";
+    json << "], \"tags\": {";
+    bool first_tag = true;
+    for (auto &t : layout.tags)
+    {
+        if (t.track_uid)
+            continue;
+        json << (first_tag ? "" : ", ") << json_string(t.name) << ": " << json_string(t.value);
+        first_tag = false;
+    }
+    json << "}, \"window_s\": " << options.window_s << ", \"window_bytes\": [";
+    for (size_t w = 0; w < windows.size(); w++)
+        json << (w ? ", " : "") << windows[w];
+    json << "]}";
+
+    munmap(const_cast<uint8_t *>(data), size);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const value_flags[] = { "--gap-factor", "--window-s", "--max-gaps", "--json" };
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            inputs.push_back(argv[i]);
+            continue;
+        }
+        for (const char *flag : value_flags)
+            if (std::strcmp(argv[i], flag) == 0)
+                i++;
+    }
+    if (inputs.empty())
+        die("Usage: htkinspect [--gap-factor F] [--window-s S] [--max-gaps N] [--bitrate] [--json report.json] "
+            "recording.mkv ...");
+
+    Options options;
+    std::string tmp;
+    if (parse_arg_value(argc, argv, "--gap-factor", tmp))
+        options.gap_factor = std::stod(tmp);
+    if (parse_arg_value(argc, argv, "--window-s", tmp))
+        options.window_s = std::stod(tmp);
+    if (options.window_s <= 0)
+        die("--window-s must be positive.");
+    if (parse_arg_value(argc, argv, "--max-gaps", tmp))
+        options.max_gaps = static_cast<size_t>(std::max(0, std::stoi(tmp)));
+    for (int i = 1; i < argc; i++)
+        if (std::strcmp(argv[i], "--bitrate") == 0)
+            options.bitrate = true;
+
+    std::ostringstream json;
+    json << "[";
+    size_t damaged = 0, unreadable = 0;
+    for (auto &path : inputs)
+        if (!inspect(path, options, json, &damaged))
+            unreadable++;
+    json << "\n]\n";
+
+    if (parse_arg_value(argc, argv, "--json", tmp))
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << json.str();
+        if (!out)
+            die("Unable to write " + tmp);
+    }
+    if (unreadable)
+        return 1;
+    return damaged ? 2 : 0;
+}
@@ -0,0 +1,231 @@
+#include "jpeg_payload.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+static inline uint16_t read_be16(const uint8_t *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+size_t jpeg_payload_length(const uint8_t *data, size_t size)
+{
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    {
+        return 0;
+    }
+    // EOI is almost always within the last few bytes, so search backwards
+    for (size_t i = size - 1; i >= 3; i--)
+    {
+        if (data[i] == 0xD9 && data[i - 1] == 0xFF)
+        {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// Marker segments from SOI up to and including SOS.
+static JpegDefect walk_headers(const uint8_t *data, size_t size, JpegFrameInfo *info)
+{
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+    {
+        return JpegDefect::NoSoi;
+    }
+
+    bool have_frame = false;
+    size_t pos = 2;
+    while (pos + 4 <= size)
+    {
+        if (data[pos] != 0xFF)
+        {
+            return JpegDefect::BadSegment;
+        }
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF)
+        {
+            // fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+        {
+            // standalone markers carry no length
+            pos += 2;
+            continue;
+        }
+
+        size_t length = read_be16(data + pos + 2);
+        if (length < 2 || pos + 2 + length > size)
+        {
+            return JpegDefect::BadSegment;
+        }
+        const uint8_t *segment = data + pos + 4;
+
+        // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+        {
+            if (length < 8)
+            {
+                return JpegDefect::BadSegment;
+            }
+            info->height = read_be16(segment + 1);
+            info->width = read_be16(segment + 3);
+            info->components = segment[5];
+            have_frame = true;
+        }
+        else if (marker == 0xDA)
+        {
+            info->scan_offset = pos + 2 + length;
+            return have_frame ? JpegDefect::None : JpegDefect::NoFrameHeader;
+        }
+        pos += 2 + length;
+    }
+    return have_frame ? JpegDefect::NoEoi : JpegDefect::NoFrameHeader;
+}
+
+bool jpeg_read_frame_info(const uint8_t *data, size_t size, JpegFrameInfo *info)
+{
+    return walk_headers(data, size, info) == JpegDefect::None;
+}
+
+// First 0xFF in [p, end), or end. Entropy-coded data has one every few
+// hundred bytes (mostly stuffing), so this is where validation spends its time.
+static inline const uint8_t *find_ff(const uint8_t *p, const uint8_t *end)
+{
+#if defined(__AVX2__)
+    const __m256i ff32 = _mm256_set1_epi8(static_cast<char>(0xFF));
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ff32)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i ff16 = _mm_set1_epi8(static_cast<char>(0xFF));
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, ff16)));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    const void *hit = std::memchr(p, 0xFF, static_cast<size_t>(end - p));
+    return hit ? static_cast<const uint8_t *>(hit) : end;
+}
+
+JpegDefect jpeg_validate(const uint8_t *data, size_t size, int expect_width, int expect_height)
+{
+    JpegFrameInfo info;
+    JpegDefect defect = walk_headers(data, size, &info);
+    if (defect != JpegDefect::None)
+    {
+        return defect;
+    }
+    if (expect_width != 0 && (info.width != expect_width || info.height != expect_height))
+    {
+        return JpegDefect::WrongDimensions;
+    }
+
+    const uint8_t *p = data + info.scan_offset;
+    const uint8_t *end = data + size;
+    int next_restart = 0;
+    while ((p = find_ff(p, end)) + 1 < end)
+    {
+        uint8_t m = p[1];
+        if (m == 0x00)
+        {
+            p += 2; // stuffed 0xFF data byte
+        }
+        else if (m == 0xFF)
+        {
+            p += 1; // fill bytes before a marker
+        }
+        else if (m >= 0xD0 && m <= 0xD7)
+        {
+            if (m - 0xD0 != next_restart)
+                return JpegDefect::BadRestart;
+            next_restart = (next_restart + 1) & 7;
+            p += 2;
+        }
+        else if (m == 0xD9)
+        {
+            return JpegDefect::None;
+        }
+        else
+        {
+            return JpegDefect::BadScanMarker;
+        }
+    }
+    return JpegDefect::NoEoi;
+}
+
+const char *jpeg_defect_name(JpegDefect defect)
+{
+    switch (defect)
+    {
+    case JpegDefect::None:
+        return "none";
+    case JpegDefect::NoSoi:
+        return "no_soi";
+    case JpegDefect::BadSegment:
+        return "bad_segment";
+    case JpegDefect::NoFrameHeader:
+        return "no_frame_header";
+    case JpegDefect::WrongDimensions:
+        return "wrong_dimensions";
+    case JpegDefect::BadScanMarker:
+        return "bad_scan_marker";
+    case JpegDefect::BadRestart:
+        return "bad_restart";
+    case JpegDefect::NoEoi:
+        return "no_eoi";
+    }
+    return "unknown";
+}
+
+std::vector<uint8_t> jpeg_synthetic_payload(int width, int height, size_t size, uint32_t seed)
+{
+    const uint8_t w_hi = static_cast<uint8_t>(width >> 8), w_lo = static_cast<uint8_t>(width);
+    const uint8_t h_hi = static_cast<uint8_t>(height >> 8), h_lo = static_cast<uint8_t>(height);
+    const uint8_t header[] = {
+        0xFF, 0xD8,                   // SOI
+        0xFF, 0xDB, 0x00, 0x43, 0x00, // DQT, 64 table bytes follow
+    };
+    const uint8_t frame[] = {
+        0xFF, 0xC0, 0x00, 0x11, 0x08, h_hi, h_lo, w_hi, w_lo, 0x03, // SOF0, 3 components, 4:2:2
+        0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01,
+        0xFF, 0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3F, 0x00, // SOS
+    };
+
+    std::vector<uint8_t> out(header, header + sizeof(header));
+    out.insert(out.end(), 64, 0x01);
+    out.insert(out.end(), frame, frame + sizeof(frame));
+    out.reserve(size + 2);
+
+    uint32_t x = seed ? seed : 0x2545F491;
+    while (out.size() + 2 < size)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        uint8_t b = static_cast<uint8_t>(x);
+        out.push_back(b);
+        if (b == 0xFF)
+            out.push_back(0x00); // byte stuffing
+    }
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+    return out;
+}
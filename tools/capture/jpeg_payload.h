@@ -0,0 +1,52 @@
+#ifndef JPEG_PAYLOAD_H
+#define JPEG_PAYLOAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Helpers for the compressed MJPEG payloads the color camera hands us. None
+// of these decode entropy-coded data; they only look at markers.
+
+struct JpegFrameInfo
+{
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    size_t scan_offset = 0; // first byte after the SOS header
+};
+
+// Bytes up to and including the EOI marker, or 0 if the buffer does not
+// start with SOI or no EOI is found. USB transfers can leave padding after EOI.
+size_t jpeg_payload_length(const uint8_t *data, size_t size);
+
+// Walks the marker segments up to SOS and pulls the frame header out.
+bool jpeg_read_frame_info(const uint8_t *data, size_t size, JpegFrameInfo *info);
+
+enum class JpegDefect
+{
+    None,
+    NoSoi,           // does not start with a JPEG
+    BadSegment,      // marker segment length runs off the end or is not followed by a marker
+    NoFrameHeader,   // no SOF before SOS
+    WrongDimensions, // SOF disagrees with the configured resolution
+    BadScanMarker,   // marker other than RSTn/EOI inside entropy-coded data
+    BadRestart,      // RSTn out of sequence, i.e. data went missing in between
+    NoEoi,           // truncated
+};
+
+const char *jpeg_defect_name(JpegDefect defect);
+
+// Structural check of a whole payload, markers only: SOI, sane segment
+// lengths up to SOS, SOF dimensions (skipped when expect_width is 0), then a
+// vectorised sweep of the entropy-coded data for 0xFF bytes to check stuffing,
+// restart marker order and EOI. Padding after EOI is allowed. Runs at memory
+// bandwidth, so it is cheap enough for every frame.
+JpegDefect jpeg_validate(const uint8_t *data, size_t size, int expect_width, int expect_height);
+
+// Marker-valid stand-in for a camera frame (SOI, DQT, SOF0, SOS, stuffed
+// pseudo-random scan data, EOI) for benchmarks and simulated devices. It
+// parses like a real payload but does not decode to a picture.
+std::vector<uint8_t> jpeg_synthetic_payload(int width, int height, size_t size, uint32_t seed);
+
+#endif
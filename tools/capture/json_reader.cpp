@@ -0,0 +1,285 @@
+#include "json_reader.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+const JsonValue *JsonValue::get(const std::string &key) const
+{
+    if (type != Object)
+        return nullptr;
+    for (auto &m : members)
+        if (m.first == key)
+            return &m.second;
+    return nullptr;
+}
+
+std::string JsonValue::str(const std::string &fallback) const
+{
+    return type == String ? text : fallback;
+}
+
+int64_t JsonValue::int64(int64_t fallback) const
+{
+    return type == Number ? std::strtoll(text.c_str(), nullptr, 10) : fallback;
+}
+
+uint64_t JsonValue::uint64(uint64_t fallback) const
+{
+    return type == Number ? std::strtoull(text.c_str(), nullptr, 10) : fallback;
+}
+
+double JsonValue::number(double fallback) const
+{
+    return type == Number ? std::strtod(text.c_str(), nullptr) : fallback;
+}
+
+namespace
+{
+class Parser
+{
+public:
+    explicit Parser(const std::string &text) : m_text(text) {}
+
+    bool parse(JsonValue *out, std::string *error)
+    {
+        if (!value(out, 0))
+        {
+            *error = m_error + " at offset " + std::to_string(m_pos);
+            return false;
+        }
+        skip_ws();
+        if (m_pos != m_text.size())
+        {
+            *error = "trailing data at offset " + std::to_string(m_pos);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    bool fail(const char *msg)
+    {
+        m_error = msg;
+        return false;
+    }
+
+    void skip_ws()
+    {
+        while (m_pos < m_text.size() &&
+               (m_text[m_pos] == ' ' || m_text[m_pos] == '\t' || m_text[m_pos] == '\n' || m_text[m_pos] == '\r'))
+            m_pos++;
+    }
+
+    bool literal(const char *word)
+    {
+        size_t n = std::char_traits<char>::length(word);
+        if (m_text.compare(m_pos, n, word) != 0)
+            return fail("unexpected token");
+        m_pos += n;
+        return true;
+    }
+
+    static void append_utf8(std::string *s, uint32_t cp)
+    {
+        if (cp < 0x80)
+        {
+            s->push_back(static_cast<char>(cp));
+        }
+        else if (cp < 0x800)
+        {
+            s->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            s->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+        else
+        {
+            s->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            s->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            s->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    bool string(std::string *out)
+    {
+        m_pos++; // opening quote
+        while (m_pos < m_text.size())
+        {
+            char c = m_text[m_pos++];
+            if (c == '"')
+                return true;
+            if (c != '\\')
+            {
+                out->push_back(c);
+                continue;
+            }
+            if (m_pos >= m_text.size())
+                break;
+            char e = m_text[m_pos++];
+            switch (e)
+            {
+            case '"':
+            case '\\':
+            case '/':
+                out->push_back(e);
+                break;
+            case 'b':
+                out->push_back('\b');
+                break;
+            case 'f':
+                out->push_back('\f');
+                break;
+            case 'n':
+                out->push_back('\n');
+                break;
+            case 'r':
+                out->push_back('\r');
+                break;
+            case 't':
+                out->push_back('\t');
+                break;
+            case 'u':
+                if (m_pos + 4 > m_text.size())
+                    return fail("bad \\u escape");
+                append_utf8(out, static_cast<uint32_t>(std::strtoul(m_text.substr(m_pos, 4).c_str(), nullptr, 16)));
+                m_pos += 4;
+                break;
+            default:
+                return fail("bad escape");
+            }
+        }
+        return fail("unterminated string");
+    }
+
+    bool value(JsonValue *out, int depth)
+    {
+        if (depth > 64)
+            return fail("nesting too deep");
+        skip_ws();
+        if (m_pos >= m_text.size())
+            return fail("unexpected end of input");
+
+        char c = m_text[m_pos];
+        if (c == '{')
+        {
+            out->type = JsonValue::Object;
+            m_pos++;
+            skip_ws();
+            if (m_pos < m_text.size() && m_text[m_pos] == '}')
+            {
+                m_pos++;
+                return true;
+            }
+            while (true)
+            {
+                skip_ws();
+                if (m_pos >= m_text.size() || m_text[m_pos] != '"')
+                    return fail("expected a key");
+                out->members.emplace_back();
+                if (!string(&out->members.back().first))
+                    return false;
+                skip_ws();
+                if (m_pos >= m_text.size() || m_text[m_pos] != ':')
+                    return fail("expected ':'");
+                m_pos++;
+                if (!value(&out->members.back().second, depth + 1))
+                    return false;
+                skip_ws();
+                if (m_pos < m_text.size() && m_text[m_pos] == ',')
+                {
+                    m_pos++;
+                    continue;
+                }
+                if (m_pos < m_text.size() && m_text[m_pos] == '}')
+                {
+                    m_pos++;
+                    return true;
+                }
+                return fail("expected ',' or '}'");
+            }
+        }
+        if (c == '[')
+        {
+            out->type = JsonValue::Array;
+            m_pos++;
+            skip_ws();
+            if (m_pos < m_text.size() && m_text[m_pos] == ']')
+            {
+                m_pos++;
+                return true;
+            }
+            while (true)
+            {
+                out->items.emplace_back();
+                if (!value(&out->items.back(), depth + 1))
+                    return false;
+                skip_ws();
+                if (m_pos < m_text.size() && m_text[m_pos] == ',')
+                {
+                    m_pos++;
+                    continue;
+                }
+                if (m_pos < m_text.size() && m_text[m_pos] == ']')
+                {
+                    m_pos++;
+                    return true;
+                }
+                return fail("expected ',' or ']'");
+            }
+        }
+        if (c == '"')
+        {
+            out->type = JsonValue::String;
+            return string(&out->text);
+        }
+        if (c == 't' || c == 'f')
+        {
+            out->type = JsonValue::Bool;
+            out->boolean = c == 't';
+            return literal(c == 't' ? "true" : "false");
+        }
+        if (c == 'n')
+        {
+            out->type = JsonValue::Null;
+            return literal("null");
+        }
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            out->type = JsonValue::Number;
+            size_t start = m_pos;
+            while (m_pos < m_text.size() && std::string("+-.eE0123456789").find(m_text[m_pos]) != std::string::npos)
+                m_pos++;
+            out->text = m_text.substr(start, m_pos - start);
+            return true;
+        }
+        return fail("unexpected character");
+    }
+
+    const std::string &m_text;
+    size_t m_pos = 0;
+    std::string m_error;
+};
+} // namespace
+
+bool parse_json(const std::string &text, JsonValue *out, std::string *error)
+{
+    *out = JsonValue();
+    return Parser(text).parse(out, error);
+}
+
+bool load_json_file(const std::string &path, JsonValue *out, std::string *error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        *error = "Unable to open " + path;
+        return false;
+    }
+    std::stringstream buf;
+    buf << in.rdbuf();
+    if (!parse_json(buf.str(), out, error))
+    {
+        *error = path + ": " + *error;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef JSON_READER_H
+#define JSON_READER_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Just enough JSON to read back what the tools write (session manifests).
+// Numbers keep their source text so 64-bit counters and timestamps survive.
+struct JsonValue
+{
+    enum Type
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    Type type = Null;
+    bool boolean = false;
+    std::string text; // String contents, or a Number as written
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    // nullptr when missing or not an object
+    const JsonValue *get(const std::string &key) const;
+
+    std::string str(const std::string &fallback = "") const;
+    int64_t int64(int64_t fallback = 0) const;
+    uint64_t uint64(uint64_t fallback = 0) const;
+    double number(double fallback = 0) const;
+};
+
+bool parse_json(const std::string &text, JsonValue *out, std::string *error);
+bool load_json_file(const std::string &path, JsonValue *out, std::string *error);
+
+#endif
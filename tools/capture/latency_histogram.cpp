@@ -0,0 +1,95 @@
+#include "latency_histogram.h"
+
+#include <algorithm>
+
+int LatencyHistogram::bucket_index(uint64_t ns)
+{
+    if (ns < static_cast<uint64_t>(kSubBuckets))
+    {
+        return static_cast<int>(ns);
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    if (exponent > kMaxExponent)
+    {
+        return kBucketCount - 1;
+    }
+    int sub = static_cast<int>((ns >> (exponent - kSubBits)) & (kSubBuckets - 1));
+    return (exponent - kSubBits + 1) * kSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::bucket_value(int index)
+{
+    if (index < kSubBuckets)
+    {
+        return static_cast<uint64_t>(index);
+    }
+    int exponent = index / kSubBuckets + kSubBits - 1;
+    uint64_t sub = static_cast<uint64_t>(index % kSubBuckets);
+    uint64_t width = 1ull << (exponent - kSubBits);
+    return (1ull << exponent) + (sub + 1) * width - 1;
+}
+
+void LatencyHistogram::record(int64_t ns)
+{
+    uint64_t v = ns < 0 ? 0 : static_cast<uint64_t>(ns);
+    m_counts[static_cast<size_t>(bucket_index(v))].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t prev = m_max.load(std::memory_order_relaxed);
+    while (v > prev && !m_max.compare_exchange_weak(prev, v, std::memory_order_relaxed))
+    {
+    }
+}
+
+LatencySnapshot LatencyHistogram::snapshot() const
+{
+    LatencySnapshot s;
+    for (int i = 0; i < kBucketCount; i++)
+    {
+        s.m_counts[i] = m_counts[i].load(std::memory_order_relaxed);
+        s.m_total += s.m_counts[i];
+    }
+    s.m_max = m_max.load(std::memory_order_relaxed);
+    return s;
+}
+
+uint64_t LatencySnapshot::percentile(double p) const
+{
+    if (m_total == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(m_total) + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (int i = 0; i < LatencyHistogram::kBucketCount; i++)
+    {
+        seen += m_counts[i];
+        if (seen >= rank)
+        {
+            return std::min(LatencyHistogram::bucket_value(i), m_max);
+        }
+    }
+    return m_max;
+}
+
+LatencySnapshot LatencySnapshot::since(const LatencySnapshot &earlier) const
+{
+    LatencySnapshot d;
+    for (int i = 0; i < LatencyHistogram::kBucketCount; i++)
+    {
+        d.m_counts[i] = m_counts[i] - earlier.m_counts[i];
+        d.m_total += d.m_counts[i];
+    }
+    d.m_max = m_max;
+    return d;
+}
+
+void LatencySnapshot::merge(const LatencySnapshot &other)
+{
+    for (int i = 0; i < LatencyHistogram::kBucketCount; i++)
+    {
+        m_counts[i] += other.m_counts[i];
+    }
+    m_total += other.m_total;
+    m_max = std::max(m_max, other.m_max);
+}
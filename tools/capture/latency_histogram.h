@@ -0,0 +1,61 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Log-linear histogram of nanosecond latencies in the spirit of HdrHistogram:
+// each power of two is split into 16 linear sub-buckets, so any reported
+// percentile is within ~6% of the true value. Recording is one relaxed
+// atomic increment and safe from any thread; readers take snapshots.
+class LatencySnapshot;
+
+class LatencyHistogram
+{
+public:
+    static const int kSubBits = 4;
+    static const int kSubBuckets = 1 << kSubBits;
+    static const int kMaxExponent = 42; // ~73 minutes in ns
+    static const int kBucketCount = (kMaxExponent - kSubBits + 2) * kSubBuckets;
+
+    void record(int64_t ns);
+    LatencySnapshot snapshot() const;
+
+    static int bucket_index(uint64_t ns);
+    // upper bound of the values that land in a bucket
+    static uint64_t bucket_value(int index);
+
+private:
+    std::array<std::atomic<uint64_t>, kBucketCount> m_counts{};
+    std::atomic<uint64_t> m_max{ 0 };
+};
+
+class LatencySnapshot
+{
+public:
+    uint64_t count() const
+    {
+        return m_total;
+    }
+    uint64_t max() const
+    {
+        return m_max;
+    }
+    // p in [0, 100]; 0 when empty
+    uint64_t percentile(double p) const;
+
+    // counts recorded since an earlier snapshot of the same histogram
+    // (max stays the running maximum)
+    LatencySnapshot since(const LatencySnapshot &earlier) const;
+    void merge(const LatencySnapshot &other);
+
+private:
+    friend class LatencyHistogram;
+
+    std::array<uint64_t, LatencyHistogram::kBucketCount> m_counts{};
+    uint64_t m_total = 0;
+    uint64_t m_max = 0;
+};
+
+#endif
@@ -1,33 +1,45 @@
 #include <k4a/k4a.h>
 #include <k4arecord/record.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <cstdio>
 #include <cstring>
+#include <ctime>
+#include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
+#include <sys/stat.h>
 #include <thread>
 #include <vector>
 
-using namespace std::chrono;
+#include "calibration_capture.h"
+#include "capture_device.h"
+#include "capture_session.h"
+#include "cli.h"
+#include "event_markers.h"
+#include "fault_injection.h"
+#include "rig_calibration.h"
+#include "session_manifest.h"
 
-static void die(const std::string &msg, int code = 1)
-{
-    std::cerr << msg << std::endl;
-    std::exit(code);
-}
+#ifdef HTK_HAVE_DRIFT_MONITOR
+#include "calibrate/drift_monitor.h"
+#endif
 
-static bool parse_arg_value(int argc, char **argv, const char *key, std::string &out)
+using namespace std::chrono;
+
+// write-then-rename so a reader never sees a half-written file
+static void write_stats_file(const std::string &path, const std::string &json)
 {
-    for (int i = 1; i < argc - 1; i++)
+    std::string tmp_path = path + ".tmp";
     {
-        if (std::strcmp(argv[i], key) == 0)
-        {
-            out = argv[i + 1];
-            return true;
-        }
+        std::ofstream out(tmp_path, std::ios::trunc);
+        out << json << std::endl;
+        if (!out)
+            return;
     }
-    return false;
+    std::rename(tmp_path.c_str(), path.c_str());
 }
 
 static std::string get_serial(k4a_device_t dev)
@@ -41,13 +53,6 @@ static std::string get_serial(k4a_device_t dev)
     return std::string(buf);
 }
 
-static std::string make_filename(int index, const std::string &serial)
-{
-    std::ostringstream oss;
-    oss << "k4a_" << index << "_" << serial << ".mkv";
-    return oss.str();
-}
-
 static void set_manual_exposure_and_gain(k4a_device_t dev,
                                          int32_t exposure_usec,
                                          int32_t gain)
@@ -97,17 +102,80 @@ static void set_manual_color_controls(k4a_device_t dev,
         die("Failed to set manual sharpness.");
 }
 
-struct DeviceCtx
+// Factory calibration of the connected devices, with the extrinsics of a
+// solved rig file (htkcalibrate's rig_calibration.bin) when one is given.
+// Dies if that file is missing a connected camera or was made for another
+// color resolution.
+static void build_rig_calibration(Session &session, const std::string &solved_path, RigCalibration *rig)
+{
+    std::string error;
+    if (!read_rig_calibration(session, rig, &error))
+        die(error);
+    if (solved_path.empty())
+        return;
+
+    RigCalibration solved;
+    if (!load_rig_calibration(solved_path, &solved, nullptr, &error))
+        die(error);
+    rig->reference = -1;
+    for (size_t i = 0; i < rig->cameras.size(); i++)
+    {
+        RigCameraRecord &r = rig->cameras[i];
+        const int j = rig_find_camera(solved, r.serial);
+        if (j < 0)
+            die(solved_path + " has no calibration for device " + std::string(r.serial));
+        const RigCameraRecord &from = solved.cameras[j];
+        if (from.width != r.width || from.height != r.height)
+            die(solved_path + " was calibrated at " + std::to_string(from.width) + "x" + std::to_string(from.height) +
+                ", device " + std::string(r.serial) + " records at " + std::to_string(r.width) + "x" +
+                std::to_string(r.height));
+        std::memcpy(r.name, from.name, sizeof(r.name));
+        std::memcpy(r.camera_to_reference, from.camera_to_reference, sizeof(r.camera_to_reference));
+        r.rms_px = from.rms_px;
+        r.flags |= from.flags & kRigExtrinsicsSolved;
+        if (j == solved.reference)
+            rig->reference = static_cast<int32_t>(i);
+    }
+}
+
+// --calibrate: frame sets and factory intrinsics instead of a recording
+static int run_calibration(Session &session, const CalibrationOptions &options)
 {
-    int index = -1;
-    k4a_device_t dev = nullptr;
-    std::string serial;
+    // fail before the operator has walked the target around, not after
+    std::string error;
+    if (!write_calibration_intrinsics(session, options.dir, &error))
+    {
+        die(error);
+    }
+
+    std::vector<CalibrationSet> sets;
+    if (session_start_cameras(session))
+    {
+        std::cout << "Capturing " << options.sets << " calibration set(s) into " << options.dir << "/" << std::endl;
+        calibration_capture_sets(session, options, &sets);
+    }
+    for (auto &d : session.devices)
+    {
+        d.device->stop_cameras();
+    }
 
-    k4a_device_configuration_t config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+    if (!write_calibration_index(session, sets, options.dir, &error))
+    {
+        std::cerr << error << std::endl;
+    }
+    for (auto &d : session.devices)
+    {
+        k4a_device_close(d.device->handle());
+    }
+    if (!session.error.empty())
+    {
+        die(session.error);
+    }
 
-    k4a_record_t rec = nullptr;
-    std::string filename;
-};
+    std::cout << "Done. " << sets.size() << " set(s), intrinsics for " << session.devices.size()
+              << " camera(s) in " << options.dir << "/" << std::endl;
+    return 0;
+}
 
 int main(int argc, char **argv)
 {
@@ -137,6 +205,12 @@ int main(int argc, char **argv)
     // IR depth delay between master and sub
     int32_t subordinate_delay_usec = 160;
 
+    // captures buffered per device between the capture and writer threads
+    int queue_frames = 16;
+
+    // split long sessions into files of this many seconds (0 = one file per device)
+    int segment_seconds = 0;
+
     std::string tmp;
     if (parse_arg_value(argc, argv, "--seconds", tmp))
         recording_length_sec = std::stoi(tmp);
@@ -167,29 +241,179 @@ int main(int argc, char **argv)
     if (parse_arg_value(argc, argv, "--sub-delay-usec", tmp))
         subordinate_delay_usec = std::stoi(tmp);
 
+    if (parse_arg_value(argc, argv, "--queue-frames", tmp))
+        queue_frames = std::stoi(tmp);
+    if (queue_frames < 1)
+        die("--queue-frames must be at least 1.");
+
+    if (parse_arg_value(argc, argv, "--segment-seconds", tmp))
+        segment_seconds = std::stoi(tmp);
+
+    // fdatasync the recordings this often so the durable latency is known (0 = never)
+    int sync_ms = 0;
+    if (parse_arg_value(argc, argv, "--sync-ms", tmp))
+        sync_ms = std::stoi(tmp);
+
+    // per-device counters and latency percentiles, rewritten about once a second
+    std::string stats_file;
+    parse_arg_value(argc, argv, "--stats-file", stats_file);
+
+    // what to do with MJPEG frames that fail validation: off, count or quarantine
+    JpegCheck jpeg_check = JpegCheck::Count;
+    if (parse_arg_value(argc, argv, "--jpeg-check", tmp) && !parse_jpeg_check(tmp, &jpeg_check))
+        die("--jpeg-check must be off, count or quarantine.");
+
+    // color as the camera's MJPEG, or uncompressed NV12/YUY2 (720p only) that
+    // we encode ourselves at --jpeg-quality, see host_jpeg_encoder.h
+    k4a_image_format_t color_format = K4A_IMAGE_FORMAT_COLOR_MJPG;
+    if (parse_arg_value(argc, argv, "--color-format", tmp))
+    {
+        if (tmp == "nv12")
+            color_format = K4A_IMAGE_FORMAT_COLOR_NV12;
+        else if (tmp == "yuy2")
+            color_format = K4A_IMAGE_FORMAT_COLOR_YUY2;
+        else if (tmp != "mjpg")
+            die("--color-format must be mjpg, nv12 or yuy2.");
+    }
+    HostJpegOptions host_jpeg;
+    if (parse_arg_value(argc, argv, "--jpeg-quality", tmp) && !parse_jpeg_quality(tmp, &host_jpeg))
+        die("--jpeg-quality must be 1-100.");
+    if (parse_arg_value(argc, argv, "--jpeg-threads", tmp))
+        host_jpeg.threads = std::stoi(tmp);
+    if (host_jpeg.threads < 1)
+        die("--jpeg-threads must be at least 1.");
+    // workspace crop, "--crop X,Y,WxH" for every camera or "--crop SERIAL=X,Y,WxH",
+    // repeatable; a camera's own crop wins
+    std::vector<std::pair<std::string, ColorCrop>> crops;
+    for (const std::string &value : parse_arg_values(argc, argv, "--crop"))
+    {
+        const size_t eq = value.find('=');
+        ColorCrop crop;
+        if (!parse_color_crop(eq == std::string::npos ? value : value.substr(eq + 1), &crop))
+            die("--crop must be X,Y,WxH or SERIAL=X,Y,WxH.");
+        crops.emplace_back(eq == std::string::npos ? "" : value.substr(0, eq), crop);
+    }
+    if (color_format != K4A_IMAGE_FORMAT_COLOR_MJPG || !crops.empty())
+    {
+        std::string error;
+        if (!host_jpeg_available(host_jpeg, &error))
+            die(error);
+    }
+
+    // per-frame exposure/white balance/timing records in a custom track of each MKV
+    const bool frame_metadata = !has_flag(argc, argv, "--no-frame-metadata");
+
+    // event markers: "--events stdin" (one label per line), "--events keys"
+    // (single keypresses), and/or "--event-socket PATH" (unix datagrams)
+    std::string events_mode, event_socket;
+    parse_arg_value(argc, argv, "--events", events_mode);
+    parse_arg_value(argc, argv, "--event-socket", event_socket);
+    if (!events_mode.empty() && events_mode != "stdin" && events_mode != "keys")
+        die("--events must be stdin or keys.");
+
+    // recordings and the session manifest go here
+    std::string output_dir;
+    if (parse_arg_value(argc, argv, "--output-dir", output_dir))
+    {
+        while (output_dir.size() > 1 && output_dir.back() == '/')
+            output_dir.pop_back();
+        if (mkdir(output_dir.c_str(), 0755) != 0 && errno != EEXIST)
+            die("Unable to create output directory: " + output_dir);
+    }
+
+    std::string manifest_path = output_dir.empty() ? "session_manifest.json" : output_dir + "/session_manifest.json";
+    parse_arg_value(argc, argv, "--manifest", manifest_path);
+
+    // all devices' frames interleaved by timestamp into one file as well, see rig_sink.h
+    std::string rig_file;
+    parse_arg_value(argc, argv, "--rig-file", rig_file);
+    RigSinkOptions rig_options;
+    if (parse_arg_value(argc, argv, "--rig-wait-ms", tmp))
+        rig_options.max_wait_ms = std::stoi(tmp);
+    if (rig_options.max_wait_ms < 0)
+        die("--rig-wait-ms must not be negative.");
+
+    // calibration capture instead of recording, see calibration_capture.h
+    const bool calibrate = has_flag(argc, argv, "--calibrate");
+    CalibrationOptions calibration;
+    {
+        char date[32];
+        std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%d", std::localtime(&now));
+        calibration.dir = (output_dir.empty() ? "" : output_dir + "/") + "calib_" + date;
+    }
+    parse_arg_value(argc, argv, "--calib-dir", calibration.dir);
+    if (parse_arg_value(argc, argv, "--calib-sets", tmp))
+        calibration.sets = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--calib-interval-ms", tmp))
+        calibration.interval_ms = std::stoi(tmp);
+    if (calibrate && calibration.sets < 1)
+        die("--calib-sets must be at least 1.");
+    if (calibrate && (color_format != K4A_IMAGE_FORMAT_COLOR_MJPG || !crops.empty()))
+        die("--calibrate saves the camera's whole MJPEG frames; drop --color-format and --crop.");
+
+    // extrinsics to embed in the recordings, see rig_calibration.h
+    std::string rig_calibration_path;
+    parse_arg_value(argc, argv, "--rig-calibration", rig_calibration_path);
+
+    // background check for bumped cameras, see calibrate/drift_monitor.h
+    const bool drift_monitor = has_flag(argc, argv, "--drift-monitor");
+#ifdef HTK_HAVE_DRIFT_MONITOR
+    DriftOptions drift;
+    if (parse_arg_value(argc, argv, "--drift-interval-s", tmp))
+        drift.interval_s = std::max(1, std::stoi(tmp));
+    if (parse_arg_value(argc, argv, "--drift-mm", tmp))
+        drift.max_shift_mm = std::stod(tmp);
+    if (parse_arg_value(argc, argv, "--drift-deg", tmp))
+        drift.max_bearing_deg = std::stod(tmp);
+    if (parse_arg_value(argc, argv, "--drift-tag-size-m", tmp))
+        drift.tag_size_m = std::stod(tmp);
+    drift.log_path = (output_dir.empty() ? "" : output_dir + "/") + "drift_log.jsonl";
+#else
+    if (drift_monitor)
+        die("--drift-monitor needs a build with Eigen3, libjpeg and AprilTag.");
+#endif
+
+    // scripted device/disk faults, see fault_injection.h
+    std::string fault_script;
+    std::vector<FaultRule> faults;
+    if (parse_arg_value(argc, argv, "--faults", fault_script))
+    {
+        std::string error;
+        if (!load_fault_script(fault_script, &faults, &error))
+            die("Bad --faults script: " + error);
+    }
+
     std::cout << device_count << " device(s) found." << std::endl;
 
     // Open all devices
-    std::vector<DeviceCtx> devices;
-    devices.reserve(device_count);
+    Session session;
+    session.queue_frames = queue_frames;
+    session.segment_seconds = segment_seconds;
+    session.sync_ms = sync_ms;
+    session.output_dir = output_dir;
+    session.jpeg_check = jpeg_check;
+    session.frame_metadata = frame_metadata;
+    session.event_track = !events_mode.empty() || !event_socket.empty();
+    auto &devices = session.devices;
 
     for (uint32_t i = 0; i < device_count; i++)
     {
-        DeviceCtx ctx;
+        devices.emplace_back();
+        DeviceCtx &ctx = devices.back();
         ctx.index = static_cast<int>(i);
 
-        if (K4A_FAILED(k4a_device_open(i, &ctx.dev)))
+        k4a_device_t dev = nullptr;
+        if (K4A_FAILED(k4a_device_open(i, &dev)))
         {
             die("Failed to open device " + std::to_string(i));
         }
 
-        ctx.serial = get_serial(ctx.dev);
-        ctx.filename = make_filename(ctx.index, ctx.serial);
+        ctx.serial = get_serial(dev);
+        ctx.device.reset(new K4aDevice(dev, ctx.serial));
 
         std::cout << "Device " << ctx.index << " serial: " << ctx.serial << std::endl;
-        devices.push_back(ctx);
     }
-
     // Determine master camera from sync jack state (master = SYNC OUT connected, SYNC IN disconnected)
     // unless user overrides via --master-index or --master-serial
     auto find_master_by_serial = [&](const std::string &serial) -> int {
@@ -203,7 +427,7 @@ int main(int argc, char **argv)
         for (auto &d : devices)
         {
             bool sync_in = false, sync_out = false;
-            if (K4A_FAILED(k4a_device_get_sync_jack(d.dev, &sync_in, &sync_out)))
+            if (K4A_FAILED(k4a_device_get_sync_jack(d.device->handle(), &sync_in, &sync_out)))
             {
                 die("Failed to read sync jack state for device " + std::to_string(d.index));
             }
@@ -226,6 +450,18 @@ int main(int argc, char **argv)
         return found_index;
     };
 
+    ManifestInfo manifest;
+    manifest.tool = "htkrecorder";
+    manifest.master_election = master_serial_provided ? "serial" : master_index == -1 ? "sync_jack" : "index";
+    manifest.settings = { { "exposure_usec", exposure_usec },
+                          { "gain", gain },
+                          { "whitebalance", whitebalance },
+                          { "brightness", brightness },
+                          { "contrast", contrast },
+                          { "saturation", saturation },
+                          { "sharpness", sharpness },
+                          { "subordinate_delay_usec", subordinate_delay_usec } };
+
     if (master_serial_provided)
     {
         master_index = find_master_by_serial(master_serial_arg);
@@ -250,6 +486,7 @@ int main(int argc, char **argv)
     }
 
     std::cout << "MASTER device index: " << master_index << std::endl;
+    session.master_index = master_index;
 
     // CONFIGURE DEVICES
     for (auto &d : devices)
@@ -257,10 +494,37 @@ int main(int argc, char **argv)
         d.config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
 
         // https://microsoft.github.io/Azure-Kinect-Sensor-SDK/master/group___enumerations_gabd9688eb20d5cb878fd22d36de882ddb.html
-        d.config.color_format = K4A_IMAGE_FORMAT_COLOR_MJPG;
+        d.config.color_format = color_format;
 
         // https://microsoft.github.io/Azure-Kinect-Sensor-SDK/master/group___enumerations_gabc7cab5e5396130f97b8ab392443c7b8.html
-        d.config.color_resolution = K4A_COLOR_RESOLUTION_1440P;
+        // the camera only sends NV12 and YUY2 at 720p
+        d.config.color_resolution =
+            color_format == K4A_IMAGE_FORMAT_COLOR_MJPG ? K4A_COLOR_RESOLUTION_1440P : K4A_COLOR_RESOLUTION_720P;
+
+        HostJpegOptions options = host_jpeg;
+        // a JPEG block for every frame the ring holds, one per encoder
+        // thread, and a few for the writer and the drift monitor's sample
+        options.output_buffers = static_cast<size_t>(queue_frames + options.threads) + 4;
+        for (auto &c : crops)
+            if (c.first.empty())
+                options.crop = c.second;
+        for (auto &c : crops)
+            if (c.first == d.serial)
+                options.crop = c.second;
+        if (options.crop.width > 0)
+        {
+            // whole MCUs, so the camera's MJPEG can be cropped losslessly
+            int width, height;
+            color_resolution_size(d.config.color_resolution, &width, &height);
+            const ColorCrop asked = options.crop;
+            if (!align_color_crop(&options.crop, width, height))
+                die("--crop " + color_crop_string(asked) + " is outside device " + d.serial + "'s " +
+                    std::to_string(width) + "x" + std::to_string(height) + " frame.");
+            std::cout << "Device " << d.index << " (" << d.serial << "): recording " << color_crop_string(options.crop)
+                      << " of " << width << "x" << height << std::endl;
+        }
+        if (color_format != K4A_IMAGE_FORMAT_COLOR_MJPG || options.crop.width > 0)
+            d.encoder.reset(new HostJpegEncoder(options));
 
         // https://microsoft.github.io/Azure-Kinect-Sensor-SDK/master/group___enumerations_ga3507ee60c1ffe1909096e2080dd2a05d.html
         d.config.depth_mode = K4A_DEPTH_MODE_OFF;
@@ -284,107 +548,180 @@ int main(int argc, char **argv)
         d.config.depth_delay_off_color_usec = 0;
     }
 
-    for (auto &d : devices)
+    for (auto &c : crops)
     {
-        set_manual_exposure_and_gain(d.dev, exposure_usec, gain);
-        set_manual_color_controls(d.dev, whitebalance, brightness, contrast, saturation, sharpness);
+        bool found = c.first.empty();
+        for (auto &d : devices)
+            found = found || d.serial == c.first;
+        if (!found)
+            die("--crop names device " + c.first + ", which is not connected.");
     }
 
+    if (color_format != K4A_IMAGE_FORMAT_COLOR_MJPG)
+        std::cout << "Color: " << (color_format == K4A_IMAGE_FORMAT_COLOR_NV12 ? "NV12" : "YUY2")
+                  << " 720p, JPEG-encoded here ("
+                  << "quality " << host_jpeg.quality
+                  << ", " << host_jpeg.threads << " thread(s) per device)" << std::endl;
+
     for (auto &d : devices)
     {
-        if (K4A_FAILED(k4a_record_create(d.filename.c_str(), d.dev, d.config, &d.rec)))
-        {
-            die("Unable to create recording file: " + d.filename);
-        }
-        if (K4A_FAILED(k4a_record_write_header(d.rec)))
-        {
-            die("Unable to write header for: " + d.filename);
-        }
+        set_manual_exposure_and_gain(d.device->handle(), exposure_usec, gain);
+        set_manual_color_controls(d.device->handle(), whitebalance, brightness, contrast, saturation, sharpness);
     }
 
-    // start the cameras in the order described: subs then master
-    for (auto &d : devices)
+    if (calibrate)
     {
-        if (d.index == master_index)
-            continue;
+        return run_calibration(session, calibration);
+    }
 
-        std::cout << "Starting SUBORDINATE device " << d.index << "..." << std::endl;
-        if (K4A_FAILED(k4a_device_start_cameras(d.dev, &d.config)))
+    // the rig's calibration goes next to the recordings and into every recording
+    {
+        RigCalibration rig;
+        build_rig_calibration(session, rig_calibration_path, &rig);
+        // the intrinsics of cropped cameras are those of their crop
+        for (auto &d : devices)
         {
-            die("Failed to start cameras on subordinate device " + std::to_string(d.index));
+            const int i = rig_find_camera(rig, d.serial);
+            if (i >= 0 && d.encoder && d.encoder->options().crop.width > 0)
+            {
+                const ColorCrop &c = d.encoder->options().crop;
+                rig_camera_set_crop(&rig.cameras[static_cast<size_t>(i)], c.x, c.y, c.width, c.height);
+            }
         }
+        session.rig_calibration = rig_calibration_encode(rig, &session.rig_calibration_id);
+        const std::string path = (output_dir.empty() ? "" : output_dir + "/") + kRigCalibrationFile;
+        manifest.rig_calibration_file = path;
+        std::string error;
+        if (!write_rig_calibration(path, rig, nullptr, &error))
+            die(error);
+        std::cout << "Rig calibration " << rig_id_hex(session.rig_calibration_id) << " ("
+                  << (rig.reference >= 0 ? "with extrinsics" : "factory intrinsics only") << ") -> " << path
+                  << std::endl;
     }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    if (!faults.empty())
+    {
+        install_faults(session, faults);
+        std::cout << "Injecting " << faults.size() << " fault rule(s) from " << fault_script << std::endl;
+    }
 
+    rig_options.sync_ms = sync_ms;
+    if (!session_open_recordings(session) ||
+        (!rig_file.empty() && !session_open_rig_file(session, rig_file, rig_options)) ||
+        !session_start_cameras(session))
     {
-        auto &m = devices[master_index];
-        std::cout << "Starting MASTER device " << m.index << "..." << std::endl;
-        if (K4A_FAILED(k4a_device_start_cameras(m.dev, &m.config)))
-        {
-            die("Failed to start cameras on master device " + std::to_string(m.index));
-        }
+        die(session.error);
     }
 
     std::cout << "All devices started. Recording for " << recording_length_sec << "s..." << std::endl;
 
-    const auto end_time = steady_clock::now() + seconds(recording_length_sec);
-    const int timeout_ms = 100;
+    manifest.started_utc = utc_timestamp_now();
+    if (!session_start_threads(session))
+    {
+        session_stop(session);
+        die(session.error);
+    }
 
-    // capture loop write to .mkv for each camera
-    while (steady_clock::now() < end_time)
+    EventServer events(session);
+    if (session.event_track)
     {
-        for (auto &d : devices)
-        {
-            k4a_capture_t cap = nullptr;
-            k4a_wait_result_t wr = k4a_device_get_capture(d.dev, &cap, timeout_ms);
+        std::string error;
+        if (!events_mode.empty() && !events.listen_stdin(events_mode == "keys", &error))
+            session_fail(session, error);
+        if (!event_socket.empty() && !events.listen_socket(event_socket, &error))
+            session_fail(session, error);
+        events.start();
+        if (events_mode == "keys")
+            std::cout << "Keys: s handover_start, e handover_end, space mark, q stop." << std::endl;
+    }
 
-            if (wr == K4A_WAIT_RESULT_SUCCEEDED)
-            {
-                if (K4A_FAILED(k4a_record_write_capture(d.rec, cap)))
-                {
-                    k4a_capture_release(cap);
-                    die("Failed to write capture for device " + std::to_string(d.index));
-                }
-                k4a_capture_release(cap);
-            }
-            else if (wr == K4A_WAIT_RESULT_TIMEOUT)
-            {
-                continue;
-            }
-            else
-            {
-                die("k4a_device_get_capture() failed on device " + std::to_string(d.index));
-            }
+#ifdef HTK_HAVE_DRIFT_MONITOR
+    DriftMonitor monitor(session, drift);
+    if (drift_monitor)
+    {
+        std::string error;
+        if (monitor.start(&error))
+            std::cout << "Drift monitor: checking every " << drift.interval_s << " s, log in " << drift.log_path
+                      << std::endl;
+        else
+            std::cerr << error << " Recording without drift monitoring." << std::endl;
+    }
+#endif
+
+    const auto end_time = steady_clock::now() + seconds(recording_length_sec);
+    auto next_stats = steady_clock::now() + seconds(1);
+    while (!session.stop && steady_clock::now() < end_time)
+    {
+        std::this_thread::sleep_for(milliseconds(50));
+        if (!stats_file.empty() && steady_clock::now() >= next_stats)
+        {
+            write_stats_file(stats_file, session_stats_json(session));
+            next_stats += seconds(1);
         }
     }
 
     std::cout << "Stopping cameras and closing recordings..." << std::endl;
+    events.stop();
+#ifdef HTK_HAVE_DRIFT_MONITOR
+    monitor.stop();
+    if (monitor.alerts() > 0)
+        std::cerr << monitor.alerts() << " drift alert(s); see the manifest's events and " << drift.log_path
+                  << std::endl;
+#endif
 
     // DONE!
+    session_stop(session);
+
     for (auto &d : devices)
     {
-        k4a_device_stop_cameras(d.dev);
+        k4a_device_close(d.device->handle());
     }
 
-    for (auto &d : devices)
+    if (!stats_file.empty())
     {
-        (void)k4a_record_flush(d.rec);
-        k4a_record_close(d.rec);
-        d.rec = nullptr;
+        write_stats_file(stats_file, session_stats_json(session));
     }
 
-    for (auto &d : devices)
+    // written for failed sessions too, so batch jobs can tell what is usable
+    manifest.ended_utc = utc_timestamp_now();
+    std::string manifest_error;
+    if (!write_session_manifest(session, manifest, manifest_path, &manifest_error))
     {
-        k4a_device_close(d.dev);
-        d.dev = nullptr;
+        std::cerr << manifest_error << std::endl;
+    }
+
+    if (!session.error.empty())
+    {
+        die(session.error);
     }
 
     std::cout << "Done. Wrote:" << std::endl;
     for (auto &d : devices)
     {
-        std::cout << "  " << d.filename << std::endl;
+        for (auto &seg : d.segments)
+        {
+            std::cout << "  " << seg.path << " (" << seg.frames << " frames)" << std::endl;
+        }
+        if (d.dropped > 0 || d.missed > 0 || d.corrupt > 0)
+        {
+            std::cout << "  device " << d.index << ": " << d.dropped << " dropped at the queue, " << d.missed
+                      << " missing from the device, " << d.corrupt << " corrupt" << std::endl;
+        }
+        if (d.event_failures > 0)
+            std::cout << "  device " << d.index << ": " << d.event_failures
+                      << " event markers could not be written to the event track" << std::endl;
     }
+    if (session.rig)
+    {
+        std::cout << "  " << session.rig->path() << " (" << session.rig->sets() << " frame sets, "
+                  << session.rig->frames() << " frames";
+        if (session.rig->late() > 0 || session.rig->dropped() > 0)
+            std::cout << "; " << session.rig->late() << " late, " << session.rig->dropped() << " dropped";
+        std::cout << ")" << std::endl;
+    }
+    print_latency_report(session, std::cout);
+    print_host_jpeg_report(session, std::cout);
+    std::cout << "Session manifest: " << manifest_path << std::endl;
 
     return 0;
-}
\ No newline at end of file
+}
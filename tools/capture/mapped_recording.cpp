@@ -0,0 +1,203 @@
+#include "mapped_recording.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+std::string mkv_frame_index_path(const std::string &recording_path)
+{
+    return recording_path + ".frames";
+}
+
+MappedRecording::~MappedRecording()
+{
+    close();
+}
+
+void MappedRecording::close()
+{
+    if (m_data)
+        munmap(const_cast<uint8_t *>(m_data), m_size);
+    m_data = nullptr;
+    m_size = 0;
+    m_entries.clear();
+    m_layout = MatroskaLayout();
+    m_index_from_file = false;
+}
+
+bool MappedRecording::open(const std::string &path, const MappedRecordingOptions &options, std::string *error)
+{
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        *error = "Unable to open " + path + (fd < 0 ? std::string(": ") + std::strerror(errno) : "");
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    void *p = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        *error = "Unable to map " + path;
+        m_size = 0;
+        return false;
+    }
+    m_data = static_cast<const uint8_t *>(p);
+    const uint64_t mtime_ns = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec;
+    m_track_name = options.track;
+
+    const std::string index_path = mkv_frame_index_path(path);
+    m_index_from_file = options.use_index_file && load_index(index_path, mtime_ns, options.track);
+    if (!m_index_from_file)
+    {
+        // the walk touches every block header: random access keeps it from
+        // reading the payloads in between
+        madvise(p, m_size, MADV_RANDOM);
+        if (!build_index(options.track, error))
+        {
+            *error = path + ": " + *error;
+            close();
+            return false;
+        }
+        if (options.use_index_file)
+            write_index(index_path, mtime_ns);
+    }
+    madvise(p, m_size, options.sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    return true;
+}
+
+bool MappedRecording::load_index(const std::string &index_path, uint64_t mtime_ns, const std::string &track)
+{
+    FILE *f = std::fopen(index_path.c_str(), "rb");
+    if (f == nullptr)
+        return false;
+    MkvFrameIndexHeader h;
+    bool ok = std::fread(&h, sizeof(h), 1, f) == 1 &&
+              std::memcmp(h.magic, kMkvFrameIndexMagic, sizeof(h.magic)) == 0 &&
+              h.version == kMkvFrameIndexVersion && h.header_bytes == sizeof(h) &&
+              h.entry_bytes == sizeof(MkvFrameIndexEntry) && h.file_bytes == m_size && h.file_mtime_ns == mtime_ns &&
+              std::string(h.track_name, strnlen(h.track_name, sizeof(h.track_name))) == track;
+    if (ok)
+    {
+        m_entries.resize(static_cast<size_t>(h.entry_count));
+        ok = std::fread(m_entries.data(), sizeof(MkvFrameIndexEntry), m_entries.size(), f) == m_entries.size();
+        for (size_t i = 0; ok && i < m_entries.size(); i++)
+            ok = m_entries[i].offset + m_entries[i].size <= m_size;
+    }
+    std::fclose(f);
+    if (!ok)
+    {
+        m_entries.clear();
+        return false;
+    }
+    m_track = h.track;
+    m_start_offset_ns = h.start_offset_ns;
+    return true;
+}
+
+bool MappedRecording::build_index(const std::string &track, std::string *error)
+{
+    // the track is only known once the Tracks element has been read, which
+    // libk4arecord writes before the first cluster
+    uint64_t number = 0;
+    bool looked_up = false;
+    bool ok = matroska_scan(
+        m_data, m_size, &m_layout,
+        [&](const MatroskaBlock &b) {
+            if (!looked_up)
+            {
+                const MatroskaTrack *t = m_layout.find_track(track);
+                number = t ? t->number : 0;
+                looked_up = true;
+            }
+            if (b.track != number || b.size > UINT32_MAX)
+                return;
+            MkvFrameIndexEntry e;
+            std::memset(&e, 0, sizeof(e));
+            e.device_timestamp_usec = static_cast<uint64_t>(b.timestamp_ns); // offset added below
+            e.offset = b.offset;
+            e.size = static_cast<uint32_t>(b.size);
+            m_entries.push_back(e);
+        },
+        error);
+    if (!ok)
+        return false;
+    const MatroskaTrack *t = m_layout.find_track(track);
+    if (t == nullptr)
+    {
+        *error = "no " + track + " track";
+        return false;
+    }
+    m_track = static_cast<uint32_t>(t->number);
+    // the Tags element may come after the clusters, so the offset is applied last
+    m_start_offset_ns = std::atoll(m_layout.tag("K4A_START_OFFSET_NS", 0, "0").c_str());
+    for (auto &e : m_entries)
+        e.device_timestamp_usec = (static_cast<int64_t>(e.device_timestamp_usec) + m_start_offset_ns) / 1000;
+    return true;
+}
+
+void MappedRecording::write_index(const std::string &index_path, uint64_t mtime_ns) const
+{
+    MkvFrameIndexHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kMkvFrameIndexMagic, sizeof(h.magic));
+    h.version = kMkvFrameIndexVersion;
+    h.header_bytes = sizeof(h);
+    h.entry_bytes = sizeof(MkvFrameIndexEntry);
+    h.track = m_track;
+    h.entry_count = m_entries.size();
+    h.file_bytes = m_size;
+    h.file_mtime_ns = mtime_ns;
+    h.start_offset_ns = m_start_offset_ns;
+    std::strncpy(h.track_name, m_track_name.c_str(), sizeof(h.track_name) - 1);
+
+    // best effort: a read-only directory just means walking again next time
+    const std::string tmp = index_path + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (f == nullptr)
+        return;
+    bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 &&
+              std::fwrite(m_entries.data(), sizeof(MkvFrameIndexEntry), m_entries.size(), f) == m_entries.size();
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), index_path.c_str()) != 0)
+        std::remove(tmp.c_str());
+}
+
+size_t MappedRecording::find_frame(uint64_t device_timestamp_usec) const
+{
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), device_timestamp_usec,
+                               [](const MkvFrameIndexEntry &e, uint64_t ts) { return e.device_timestamp_usec < ts; });
+    return static_cast<size_t>(it - m_entries.begin());
+}
+
+void MappedRecording::advise(size_t first, size_t count, int advice) const
+{
+    if (first >= m_entries.size() || count == 0)
+        return;
+    const size_t last = std::min(first + count, m_entries.size()) - 1;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t begin = static_cast<size_t>(m_entries[first].offset) / page * page;
+    const size_t end = static_cast<size_t>(m_entries[last].offset + m_entries[last].size);
+    madvise(const_cast<uint8_t *>(m_data) + begin, end - begin, advice);
+}
+
+void MappedRecording::prefetch(size_t first, size_t count) const
+{
+    advise(first, count, MADV_WILLNEED);
+}
+
+void MappedRecording::release(size_t first, size_t count) const
+{
+    advise(first, count, MADV_DONTNEED);
+}
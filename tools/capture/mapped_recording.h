@@ -0,0 +1,167 @@
+#ifndef MAPPED_RECORDING_H
+#define MAPPED_RECORDING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "matroska.h"
+
+// Zero-copy access to the frames of a k4a recording: the file is mapped
+// read-only and each frame is handed out as a view of its block payload in
+// the mapping, so decoding or hashing reads straight from the page cache.
+//
+// The frame index (offset, size and device timestamp of every frame of one
+// track) comes from a walk of the block headers (matroska.h), or from the
+// sidecar <recording>.frames written after the first walk. The sidecar is
+// little-endian and used in place:
+//
+//   hdr   = np.dtype([('magic', 'S8'), ('version', '<u4'), ('header_bytes', '<u4'),
+//                     ('entry_bytes', '<u4'), ('track', '<u4'), ('entry_count', '<u8'),
+//                     ('file_bytes', '<u8'), ('file_mtime_ns', '<u8'),
+//                     ('start_offset_ns', '<i8'), ('track_name', 'S32'), ('reserved', '<u8')])
+//   entry = np.dtype([('device_timestamp_usec', '<u8'), ('offset', '<u8'), ('size', '<u4'),
+//                     ('reserved', '<u4')])
+//
+// It covers one track and is only trusted while the recording's size and
+// mtime match. tools/mkv/mkv_frames.py reads both from Python.
+
+static const char kMkvFrameIndexMagic[8] = { 'H', 'T', 'K', 'M', 'K', 'V', 'I', 'X' };
+static const uint32_t kMkvFrameIndexVersion = 1;
+
+#pragma pack(push, 1)
+struct MkvFrameIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint32_t entry_bytes;
+    uint32_t track; // Matroska track number
+    uint64_t entry_count;
+    uint64_t file_bytes;
+    uint64_t file_mtime_ns;
+    int64_t start_offset_ns; // K4A_START_OFFSET_NS
+    char track_name[32];     // NUL-padded
+    uint64_t reserved;
+};
+
+struct MkvFrameIndexEntry
+{
+    uint64_t device_timestamp_usec;
+    uint64_t offset; // of the payload in the recording
+    uint32_t size;
+    uint32_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(MkvFrameIndexHeader) == 96, "MkvFrameIndexHeader is an on-disk format");
+static_assert(sizeof(MkvFrameIndexEntry) == 24, "MkvFrameIndexEntry is an on-disk format");
+
+// <recording>.frames
+std::string mkv_frame_index_path(const std::string &recording_path);
+
+// A frame's payload inside the mapping, std::span style. Valid until the
+// MappedRecording is closed.
+struct FrameSpan
+{
+    const uint8_t *ptr = nullptr;
+    size_t length = 0;
+    uint64_t device_timestamp_usec = 0;
+
+    const uint8_t *data() const
+    {
+        return ptr;
+    }
+    size_t size() const
+    {
+        return length;
+    }
+    const uint8_t *begin() const
+    {
+        return ptr;
+    }
+    const uint8_t *end() const
+    {
+        return ptr + length;
+    }
+};
+
+struct MappedRecordingOptions
+{
+    std::string track = "COLOR";
+    bool use_index_file = true; // load the sidecar if current, write it after a walk
+    bool sequential = true;     // readahead for front-to-back reads; false for random access
+};
+
+class MappedRecording
+{
+public:
+    MappedRecording() = default;
+    ~MappedRecording();
+
+    MappedRecording(const MappedRecording &) = delete;
+    MappedRecording &operator=(const MappedRecording &) = delete;
+
+    bool open(const std::string &path, const MappedRecordingOptions &options, std::string *error);
+    void close();
+
+    size_t frame_count() const
+    {
+        return m_entries.size();
+    }
+    const MkvFrameIndexEntry &entry(size_t i) const
+    {
+        return m_entries[i];
+    }
+    FrameSpan frame(size_t i) const
+    {
+        const MkvFrameIndexEntry &e = m_entries[i];
+        return { m_data + e.offset, e.size, e.device_timestamp_usec };
+    }
+    // first frame at or after the timestamp; frame_count() if there is none
+    size_t find_frame(uint64_t device_timestamp_usec) const;
+
+    // Asks the kernel to start reading frames [first, first + count) now
+    // (MADV_WILLNEED), e.g. the next batch while this one decodes.
+    void prefetch(size_t first, size_t count) const;
+    // Lets go of frames already used (MADV_DONTNEED), so a one-pass job does
+    // not keep the whole recording resident.
+    void release(size_t first, size_t count) const;
+
+    // true when the sidecar was current and no walk was needed
+    bool index_from_file() const
+    {
+        return m_index_from_file;
+    }
+    // Empty unless the index was built by a walk, which also fills this.
+    const MatroskaLayout &layout() const
+    {
+        return m_layout;
+    }
+    const uint8_t *data() const
+    {
+        return m_data;
+    }
+    size_t size() const
+    {
+        return m_size;
+    }
+
+private:
+    bool load_index(const std::string &index_path, uint64_t mtime_ns, const std::string &track);
+    bool build_index(const std::string &track, std::string *error);
+    void write_index(const std::string &index_path, uint64_t mtime_ns) const;
+    void advise(size_t first, size_t count, int advice) const;
+
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+    uint32_t m_track = 0;
+    std::string m_track_name;
+    int64_t m_start_offset_ns = 0;
+    std::vector<MkvFrameIndexEntry> m_entries;
+    bool m_index_from_file = false;
+    MatroskaLayout m_layout;
+};
+
+#endif
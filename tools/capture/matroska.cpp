@@ -0,0 +1,478 @@
+#include "matroska.h"
+
+#include <cstdio>
+#include <cstring>
+
+// element ids, marker bits included
+static const uint32_t kEbml = 0x1A45DFA3;
+static const uint32_t kDocType = 0x4282;
+static const uint32_t kSegment = 0x18538067;
+static const uint32_t kSeekHead = 0x114D9B74;
+static const uint32_t kInfo = 0x1549A966;
+static const uint32_t kTimecodeScale = 0x2AD7B1;
+static const uint32_t kDuration = 0x4489;
+static const uint32_t kTracks = 0x1654AE6B;
+static const uint32_t kTrackEntry = 0xAE;
+static const uint32_t kTrackNumber = 0xD7;
+static const uint32_t kTrackUid = 0x73C5;
+static const uint32_t kTrackType = 0x83;
+static const uint32_t kCodecId = 0x86;
+static const uint32_t kCodecPrivate = 0x63A2;
+static const uint32_t kName = 0x536E;
+static const uint32_t kDefaultDuration = 0x23E383;
+static const uint32_t kVideo = 0xE0;
+static const uint32_t kPixelWidth = 0xB0;
+static const uint32_t kPixelHeight = 0xBA;
+static const uint32_t kCluster = 0x1F43B675;
+static const uint32_t kTimecode = 0xE7;
+static const uint32_t kSimpleBlock = 0xA3;
+static const uint32_t kBlockGroup = 0xA0;
+static const uint32_t kBlock = 0xA1;
+static const uint32_t kReferenceBlock = 0xFB;
+static const uint32_t kCues = 0x1C53BB6B;
+static const uint32_t kAttachments = 0x1941A469;
+static const uint32_t kAttachedFile = 0x61A7;
+static const uint32_t kFileName = 0x466E;
+static const uint32_t kFileMimeType = 0x4660;
+static const uint32_t kFileData = 0x465C;
+static const uint32_t kTags = 0x1254C367;
+static const uint32_t kTag = 0x7373;
+static const uint32_t kTargets = 0x63C0;
+static const uint32_t kTagTrackUid = 0x63C5;
+static const uint32_t kSimpleTag = 0x67C8;
+static const uint32_t kTagName = 0x45A3;
+static const uint32_t kTagString = 0x4487;
+static const uint32_t kChapters = 0x1043A770;
+
+namespace
+{
+struct Element
+{
+    uint32_t id = 0;
+    uint64_t start = 0; // of the header
+    uint64_t data = 0;
+    uint64_t size = 0;
+    bool unknown_size = false;
+
+    uint64_t end() const
+    {
+        return data + size;
+    }
+};
+
+class Reader
+{
+public:
+    Reader(const uint8_t *data, size_t size) : m_data(data), m_size(size)
+    {
+    }
+
+    // Element header at pos; false if it does not fit before limit.
+    bool header(uint64_t pos, uint64_t limit, Element *e) const
+    {
+        int len = 0;
+        uint64_t id = 0;
+        if (!vint(pos, limit, &id, &len, true) || len > 4)
+            return false;
+        e->id = static_cast<uint32_t>(id);
+        e->start = pos;
+        pos += len;
+        if (!vint(pos, limit, &e->size, &len, false))
+            return false;
+        // all value bits set means the size is unknown (still being written)
+        e->unknown_size = e->size == (1ull << (7 * len)) - 1;
+        e->data = pos + len;
+        return true;
+    }
+
+    uint64_t uint(const Element &e) const
+    {
+        uint64_t v = 0;
+        for (uint64_t i = 0; i < e.size && i < 8; i++)
+            v = (v << 8) | m_data[e.data + i];
+        return v;
+    }
+
+    double real(const Element &e) const
+    {
+        if (e.size == 4)
+        {
+            uint32_t bits = static_cast<uint32_t>(uint(e));
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            return f;
+        }
+        if (e.size == 8)
+        {
+            uint64_t bits = uint(e);
+            double d;
+            std::memcpy(&d, &bits, sizeof(d));
+            return d;
+        }
+        return 0;
+    }
+
+    std::string str(const Element &e) const
+    {
+        std::string s(reinterpret_cast<const char *>(m_data + e.data), static_cast<size_t>(e.size));
+        return s.substr(0, s.find('\0'));
+    }
+
+    // Walks the children of a known-size element.
+    template <typename Fn>
+    void children(const Element &parent, Fn fn) const
+    {
+        uint64_t pos = parent.data;
+        Element c;
+        while (pos < parent.end() && header(pos, parent.end(), &c) && !c.unknown_size && c.end() <= parent.end())
+        {
+            fn(c);
+            pos = c.end();
+        }
+    }
+
+    bool vint(uint64_t pos, uint64_t limit, uint64_t *value, int *len, bool keep_marker) const
+    {
+        if (pos >= limit || pos >= m_size)
+            return false;
+        const uint8_t first = m_data[pos];
+        int n = 1;
+        while (n <= 8 && !(first & (0x80 >> (n - 1))))
+            n++;
+        if (n > 8 || pos + n > limit || pos + n > m_size)
+            return false;
+        uint64_t v = keep_marker ? first : (first & (0xFF >> n));
+        for (int i = 1; i < n; i++)
+            v = (v << 8) | m_data[pos + i];
+        *value = v;
+        *len = n;
+        return true;
+    }
+
+    uint8_t byte(uint64_t pos) const
+    {
+        return m_data[pos];
+    }
+
+private:
+    const uint8_t *m_data;
+    uint64_t m_size;
+};
+} // namespace
+
+static std::string id_name(uint32_t id)
+{
+    char name[16];
+    std::snprintf(name, sizeof(name), "0x%X", id);
+    return name;
+}
+
+static bool is_top_level(uint32_t id)
+{
+    return id == kCluster || id == kCues || id == kTags || id == kAttachments || id == kSeekHead || id == kInfo ||
+           id == kTracks || id == kChapters;
+}
+
+static void parse_tracks(const Reader &r, const Element &tracks, MatroskaLayout *layout)
+{
+    r.children(tracks, [&](const Element &entry) {
+        if (entry.id != kTrackEntry)
+            return;
+        MatroskaTrack t;
+        r.children(entry, [&](const Element &e) {
+            switch (e.id)
+            {
+            case kTrackNumber:
+                t.number = r.uint(e);
+                break;
+            case kTrackUid:
+                t.uid = r.uint(e);
+                break;
+            case kTrackType:
+                t.type = static_cast<uint32_t>(r.uint(e));
+                break;
+            case kName:
+                t.name = r.str(e);
+                break;
+            case kCodecId:
+                t.codec = r.str(e);
+                break;
+            case kCodecPrivate:
+                t.codec_private_bytes = e.size;
+                break;
+            case kDefaultDuration:
+                t.default_duration_ns = r.uint(e);
+                break;
+            case kVideo:
+                r.children(e, [&](const Element &v) {
+                    if (v.id == kPixelWidth)
+                        t.width = static_cast<uint32_t>(r.uint(v));
+                    else if (v.id == kPixelHeight)
+                        t.height = static_cast<uint32_t>(r.uint(v));
+                });
+                break;
+            }
+        });
+        layout->tracks.push_back(t);
+    });
+}
+
+static void parse_attachments(const Reader &r, const Element &attachments, MatroskaLayout *layout)
+{
+    r.children(attachments, [&](const Element &file) {
+        if (file.id != kAttachedFile)
+            return;
+        MatroskaAttachment a;
+        r.children(file, [&](const Element &e) {
+            if (e.id == kFileName)
+                a.name = r.str(e);
+            else if (e.id == kFileMimeType)
+                a.mime = r.str(e);
+            else if (e.id == kFileData)
+            {
+                a.offset = e.data;
+                a.size = e.size;
+            }
+        });
+        layout->attachments.push_back(a);
+    });
+}
+
+static void parse_tags(const Reader &r, const Element &tags, MatroskaLayout *layout)
+{
+    r.children(tags, [&](const Element &tag) {
+        if (tag.id != kTag)
+            return;
+        uint64_t track_uid = 0;
+        r.children(tag, [&](const Element &e) {
+            if (e.id == kTargets)
+            {
+                r.children(e, [&](const Element &t) {
+                    if (t.id == kTagTrackUid)
+                        track_uid = r.uint(t);
+                });
+            }
+            else if (e.id == kSimpleTag)
+            {
+                MatroskaTag t;
+                t.track_uid = track_uid;
+                r.children(e, [&](const Element &s) {
+                    if (s.id == kTagName)
+                        t.name = r.str(s);
+                    else if (s.id == kTagString)
+                        t.value = r.str(s);
+                });
+                layout->tags.push_back(t);
+            }
+        });
+    });
+}
+
+// The block header: track number, 16-bit timestamp relative to the cluster,
+// flags and, for laced blocks, the frame count.
+static bool parse_block(const Reader &r,
+                        const Element &e,
+                        int64_t cluster_timecode,
+                        uint64_t scale,
+                        MatroskaBlock *block,
+                        uint8_t *flags_out)
+{
+    int len = 0;
+    if (!r.vint(e.data, e.end(), &block->track, &len, false) || e.data + len + 3 > e.end())
+        return false;
+    uint64_t pos = e.data + len;
+    const int16_t relative = static_cast<int16_t>((r.byte(pos) << 8) | r.byte(pos + 1));
+    const uint8_t flags = r.byte(pos + 2);
+    *flags_out = flags;
+    pos += 3;
+    block->frames = 1;
+    if (flags & 0x06)
+    {
+        if (pos >= e.end())
+            return false;
+        block->frames = r.byte(pos) + 1u;
+        pos++;
+    }
+    block->timestamp_ns = (cluster_timecode + relative) * static_cast<int64_t>(scale);
+    block->offset = pos;
+    block->size = e.end() - pos;
+    return true;
+}
+
+// Returns where the cluster ends; sets layout->problem if it is cut short.
+static uint64_t scan_cluster(const Reader &r,
+                             const Element &cluster,
+                             uint64_t segment_end,
+                             MatroskaLayout *layout,
+                             const MatroskaBlockFn &on_block)
+{
+    uint64_t end = segment_end;
+    if (!cluster.unknown_size && cluster.end() <= segment_end)
+        end = cluster.end();
+    int64_t timecode = 0;
+    uint64_t pos = cluster.data;
+    Element e;
+    while (pos < end)
+    {
+        if (!r.header(pos, end, &e))
+        {
+            layout->problem = "cluster at " + std::to_string(cluster.start) + " is cut off at " + std::to_string(pos);
+            return pos;
+        }
+        // an unknown-size cluster ends where the next top-level element starts
+        if (cluster.unknown_size && is_top_level(e.id))
+            return pos;
+        if (e.unknown_size || e.end() > end)
+        {
+            layout->problem = "cluster at " + std::to_string(cluster.start) + " is cut off at " + std::to_string(pos);
+            return pos;
+        }
+        MatroskaBlock block;
+        uint8_t flags = 0;
+        switch (e.id)
+        {
+        case kTimecode:
+            timecode = static_cast<int64_t>(r.uint(e));
+            break;
+        case kSimpleBlock:
+            if (parse_block(r, e, timecode, layout->timecode_scale_ns, &block, &flags))
+            {
+                block.keyframe = (flags & 0x80) != 0;
+                if (on_block)
+                    on_block(block);
+            }
+            break;
+        case kBlockGroup:
+        {
+            bool have_block = false;
+            bool keyframe = true;
+            r.children(e, [&](const Element &g) {
+                if (g.id == kBlock)
+                    have_block = parse_block(r, g, timecode, layout->timecode_scale_ns, &block, &flags);
+                else if (g.id == kReferenceBlock)
+                    keyframe = false;
+            });
+            block.keyframe = keyframe;
+            if (have_block && on_block)
+                on_block(block);
+            break;
+        }
+        }
+        pos = e.end();
+    }
+    if (!cluster.unknown_size && cluster.end() > segment_end)
+        layout->problem = "cluster at " + std::to_string(cluster.start) + " runs past the end of the file";
+    return pos;
+}
+
+const MatroskaTrack *MatroskaLayout::find_track(uint64_t number) const
+{
+    for (auto &t : tracks)
+        if (t.number == number)
+            return &t;
+    return nullptr;
+}
+
+const MatroskaTrack *MatroskaLayout::find_track(const std::string &name) const
+{
+    for (auto &t : tracks)
+        if (t.name == name)
+            return &t;
+    return nullptr;
+}
+
+std::string MatroskaLayout::tag(const std::string &name, uint64_t track_uid, const std::string &fallback) const
+{
+    for (auto &t : tags)
+        if (t.track_uid == track_uid && t.name == name)
+            return t.value;
+    return fallback;
+}
+
+bool matroska_scan(const uint8_t *data,
+                   size_t size,
+                   MatroskaLayout *layout,
+                   const MatroskaBlockFn &on_block,
+                   std::string *error)
+{
+    *layout = MatroskaLayout();
+    Reader r(data, size);
+    Element ebml;
+    if (!r.header(0, size, &ebml) || ebml.id != kEbml || ebml.unknown_size || ebml.end() > size)
+    {
+        *error = "not a Matroska file";
+        return false;
+    }
+    r.children(ebml, [&](const Element &e) {
+        if (e.id == kDocType)
+            layout->doc_type = r.str(e);
+    });
+    if (layout->doc_type != "matroska" && layout->doc_type != "webm")
+    {
+        *error = "EBML document type is " + layout->doc_type + ", not matroska";
+        return false;
+    }
+
+    // libk4arecord writes no Void or CRC-32 elements before the segment, but others might
+    uint64_t pos = ebml.end();
+    Element segment;
+    while (r.header(pos, size, &segment) && segment.id != kSegment && !segment.unknown_size)
+        pos = segment.end();
+    if (segment.id != kSegment)
+    {
+        *error = "no Matroska segment";
+        return false;
+    }
+    layout->segment_offset = segment.data;
+    layout->segment_complete = !segment.unknown_size && segment.end() <= size;
+    const uint64_t segment_end = layout->segment_complete ? segment.end() : size;
+
+    pos = segment.data;
+    Element e;
+    while (pos < segment_end && layout->problem.empty())
+    {
+        if (!r.header(pos, segment_end, &e))
+        {
+            layout->problem = "element header cut off at " + std::to_string(pos);
+            break;
+        }
+        if (e.id == kCluster)
+        {
+            layout->clusters++;
+            pos = scan_cluster(r, e, segment_end, layout, on_block);
+            continue;
+        }
+        if (e.unknown_size || e.end() > segment_end)
+        {
+            layout->problem = "element " + id_name(e.id) + " at " + std::to_string(pos) + " is cut off";
+            break;
+        }
+        switch (e.id)
+        {
+        case kInfo:
+            r.children(e, [&](const Element &c) {
+                if (c.id == kTimecodeScale)
+                    layout->timecode_scale_ns = r.uint(c);
+                else if (c.id == kDuration)
+                    layout->duration_ns = r.real(c);
+            });
+            layout->duration_ns *= static_cast<double>(layout->timecode_scale_ns);
+            break;
+        case kTracks:
+            parse_tracks(r, e, layout);
+            break;
+        case kAttachments:
+            parse_attachments(r, e, layout);
+            break;
+        case kTags:
+            parse_tags(r, e, layout);
+            break;
+        case kCues:
+            layout->has_cues = true;
+            break;
+        }
+        pos = e.end();
+    }
+    layout->scanned_bytes = pos;
+    return true;
+}
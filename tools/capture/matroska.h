@@ -0,0 +1,91 @@
+#ifndef MATROSKA_H
+#define MATROSKA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Structure of a Matroska file as libk4arecord writes it, read straight from
+// memory (normally a mapping of the whole file). Only EBML element headers
+// are parsed: block payloads, attachment data and codec private data are
+// skipped over and reported by offset, so a scan reads a few bytes per frame.
+//
+// Timestamps are Matroska's, in ns from the start of the recording; k4a
+// recordings store the device timestamp of the first frame in the
+// K4A_START_OFFSET_NS tag.
+
+struct MatroskaTrack
+{
+    uint64_t number = 0;
+    uint64_t uid = 0;
+    uint32_t type = 0; // 1 video, 0x11 subtitle, 0x12 buttons, ...
+    std::string name;
+    std::string codec;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint64_t default_duration_ns = 0;
+    uint64_t codec_private_bytes = 0;
+};
+
+struct MatroskaAttachment
+{
+    std::string name;
+    std::string mime;
+    uint64_t offset = 0; // of the data in the file
+    uint64_t size = 0;
+};
+
+struct MatroskaTag
+{
+    uint64_t track_uid = 0; // 0 for the whole file
+    std::string name;
+    std::string value;
+};
+
+struct MatroskaBlock
+{
+    uint64_t track = 0;
+    int64_t timestamp_ns = 0;
+    uint64_t offset = 0; // of the frame data in the file
+    uint64_t size = 0;
+    uint32_t frames = 1; // > 1 for a laced block; offset and size then cover the lace
+    bool keyframe = true;
+};
+
+struct MatroskaLayout
+{
+    std::string doc_type;
+    uint64_t timecode_scale_ns = 1000000;
+    double duration_ns = 0;
+    uint64_t segment_offset = 0; // first byte of the segment's data
+    bool segment_complete = false; // known size that fits in the file
+    uint64_t clusters = 0;
+    bool has_cues = false;
+    uint64_t scanned_bytes = 0; // where the scan stopped
+    std::string problem;        // why it stopped early, empty if it did not
+
+    std::vector<MatroskaTrack> tracks;
+    std::vector<MatroskaAttachment> attachments;
+    std::vector<MatroskaTag> tags;
+
+    const MatroskaTrack *find_track(uint64_t number) const;
+    const MatroskaTrack *find_track(const std::string &name) const;
+    // first tag of that name on the track (0: on the file); fallback if none
+    std::string tag(const std::string &name, uint64_t track_uid = 0, const std::string &fallback = "") const;
+};
+
+using MatroskaBlockFn = std::function<void(const MatroskaBlock &)>;
+
+// Walks the file, calling on_block (may be empty) for every block in file
+// order. False and fills error only when the data is not Matroska at all; a
+// truncated or damaged file is scanned up to the damage, which is described
+// in layout->problem.
+bool matroska_scan(const uint8_t *data,
+                   size_t size,
+                   MatroskaLayout *layout,
+                   const MatroskaBlockFn &on_block,
+                   std::string *error);
+
+#endif
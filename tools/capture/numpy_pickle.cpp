@@ -0,0 +1,133 @@
+#include "numpy_pickle.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+// pickle opcodes, see Lib/pickletools.py
+static const char kProto = '\x80';
+static const char kGlobal = 'c';
+static const char kBinInt1 = 'K';
+static const char kBinInt = 'J';
+static const char kBinUnicode = 'X';
+static const char kShortBinBytes = 'C';
+static const char kBinBytes = 'B';
+static const char kNone = 'N';
+static const char kNewTrue = '\x88';
+static const char kNewFalse = '\x89';
+static const char kMark = '(';
+static const char kTuple = 't';
+static const char kTuple1 = '\x85';
+static const char kTuple2 = '\x86';
+static const char kTuple3 = '\x87';
+static const char kReduce = 'R';
+static const char kBuild = 'b';
+static const char kStop = '.';
+
+static void put_u32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+static void put_int(std::string &out, int64_t v)
+{
+    if (v >= 0 && v < 256)
+    {
+        out.push_back(kBinInt1);
+        out.push_back(static_cast<char>(v));
+    }
+    else
+    {
+        out.push_back(kBinInt);
+        put_u32(out, static_cast<uint32_t>(static_cast<int32_t>(v)));
+    }
+}
+
+static void put_str(std::string &out, const std::string &s)
+{
+    out.push_back(kBinUnicode);
+    put_u32(out, static_cast<uint32_t>(s.size()));
+    out += s;
+}
+
+static void put_bytes(std::string &out, const void *data, size_t size)
+{
+    if (size < 256)
+    {
+        out.push_back(kShortBinBytes);
+        out.push_back(static_cast<char>(size));
+    }
+    else
+    {
+        out.push_back(kBinBytes);
+        put_u32(out, static_cast<uint32_t>(size));
+    }
+    out.append(static_cast<const char *>(data), size);
+}
+
+std::string numpy_pickle_matrix(const double *data, size_t rows, size_t cols)
+{
+    std::string out;
+    out.push_back(kProto);
+    out.push_back('\x03');
+
+    // numpy.core is the 1.x name; numpy 2 still resolves it when unpickling
+    out.push_back(kGlobal);
+    out += "numpy.core.multiarray\n_reconstruct\n";
+    out.push_back(kGlobal);
+    out += "numpy\nndarray\n";
+    put_int(out, 0);
+    out.push_back(kTuple1);
+    put_bytes(out, "b", 1);
+    out.push_back(kTuple3);
+    out.push_back(kReduce);
+
+    // ndarray.__setstate__((version, shape, dtype, is_fortran, data))
+    out.push_back(kMark);
+    put_int(out, 1);
+    put_int(out, static_cast<int64_t>(rows));
+    put_int(out, static_cast<int64_t>(cols));
+    out.push_back(kTuple2);
+
+    out.push_back(kGlobal);
+    out += "numpy\ndtype\n";
+    put_str(out, "f8");
+    out.push_back(kNewFalse);
+    out.push_back(kNewTrue);
+    out.push_back(kTuple3);
+    out.push_back(kReduce);
+    out.push_back(kMark);
+    put_int(out, 3);
+    put_str(out, "<");
+    out.push_back(kNone);
+    out.push_back(kNone);
+    out.push_back(kNone);
+    put_int(out, -1);
+    put_int(out, -1);
+    put_int(out, 0);
+    out.push_back(kTuple);
+    out.push_back(kBuild);
+
+    out.push_back(kNewFalse);
+    // the host is little-endian like the "<f8" dtype above
+    put_bytes(out, data, rows * cols * sizeof(double));
+    out.push_back(kTuple);
+    out.push_back(kBuild);
+    out.push_back(kStop);
+    return out;
+}
+
+bool write_numpy_pickle(const std::string &path, const double *data, size_t rows, size_t cols, std::string *error)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << numpy_pickle_matrix(data, rows, cols);
+    out.close();
+    if (!out)
+    {
+        *error = "Unable to write " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
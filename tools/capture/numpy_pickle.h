@@ -0,0 +1,18 @@
+#ifndef NUMPY_PICKLE_H
+#define NUMPY_PICKLE_H
+
+#include <cstddef>
+#include <string>
+
+// Writes the calibration matrices the Python side loads with pickle.load()
+// (tools/calibration, infer_hand.py). The output is what
+// pickle.dumps(np.array(..., dtype=np.float64), protocol=3) produces: a real
+// ndarray, loadable by numpy 1.x and 2.x without importing anything of ours.
+
+// Pickle bytes for a row-major rows x cols float64 matrix.
+std::string numpy_pickle_matrix(const double *data, size_t rows, size_t cols);
+
+// False and fills error if the file cannot be written.
+bool write_numpy_pickle(const std::string &path, const double *data, size_t rows, size_t cols, std::string *error);
+
+#endif
@@ -0,0 +1,116 @@
+#include "recording_sink.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+K4aRecordSink::~K4aRecordSink()
+{
+    close();
+}
+
+k4a_result_t K4aRecordSink::create(const std::string &path,
+                                   k4a_device_t device,
+                                   const k4a_device_configuration_t &config)
+{
+    close();
+    k4a_result_t result = k4a_record_create(path.c_str(), device, config, &m_rec);
+    if (K4A_FAILED(result))
+    {
+        m_rec = nullptr;
+        return result;
+    }
+    m_sync_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    return result;
+}
+
+k4a_result_t K4aRecordSink::add_metadata_track()
+{
+    const std::string context = frame_metadata_codec_context();
+    // frame-rate records, so not the SDK's high-frequency (IMU style) block grouping
+    k4a_record_subtitle_settings_t settings = { false };
+    return k4a_record_add_custom_subtitle_track(m_rec,
+                                                kFrameMetadataTrack,
+                                                kFrameMetadataCodec,
+                                                reinterpret_cast<const uint8_t *>(context.data()),
+                                                context.size(),
+                                                &settings);
+}
+
+k4a_result_t K4aRecordSink::add_event_track()
+{
+    k4a_record_subtitle_settings_t settings = { false };
+    return k4a_record_add_custom_subtitle_track(m_rec, kEventTrack, "S_TEXT/UTF8", nullptr, 0, &settings);
+}
+
+k4a_result_t K4aRecordSink::add_attachment(const std::string &name, const std::string &data)
+{
+    return k4a_record_add_attachment(m_rec, name.c_str(), reinterpret_cast<const uint8_t *>(data.data()), data.size());
+}
+
+k4a_result_t K4aRecordSink::add_tag(const std::string &name, const std::string &value)
+{
+    return k4a_record_add_tag(m_rec, name.c_str(), value.c_str());
+}
+
+k4a_result_t K4aRecordSink::write_header()
+{
+    return k4a_record_write_header(m_rec);
+}
+
+k4a_result_t K4aRecordSink::write_capture(k4a_capture_t capture)
+{
+    return k4a_record_write_capture(m_rec, capture);
+}
+
+k4a_result_t K4aRecordSink::write_metadata(const FrameMetadata &meta)
+{
+    // the SDK copies the block, so a stack copy is enough (it wants a non-const pointer)
+    FrameMetadata record = meta;
+    return k4a_record_write_custom_track_data(m_rec,
+                                              kFrameMetadataTrack,
+                                              record.device_timestamp_usec,
+                                              reinterpret_cast<uint8_t *>(&record),
+                                              sizeof(record));
+}
+
+k4a_result_t K4aRecordSink::write_event(uint64_t device_timestamp_usec, const std::string &label)
+{
+    std::string text = label;
+    return k4a_record_write_custom_track_data(m_rec,
+                                              kEventTrack,
+                                              device_timestamp_usec,
+                                              reinterpret_cast<uint8_t *>(&text[0]),
+                                              text.size());
+}
+
+k4a_result_t K4aRecordSink::flush()
+{
+    return k4a_record_flush(m_rec);
+}
+
+k4a_result_t K4aRecordSink::sync()
+{
+    if (K4A_FAILED(k4a_record_flush(m_rec)))
+    {
+        return K4A_RESULT_FAILED;
+    }
+    if (m_sync_fd < 0 || fdatasync(m_sync_fd) != 0)
+    {
+        return K4A_RESULT_FAILED;
+    }
+    return K4A_RESULT_SUCCEEDED;
+}
+
+void K4aRecordSink::close()
+{
+    if (m_rec != nullptr)
+    {
+        k4a_record_close(m_rec);
+        m_rec = nullptr;
+    }
+    if (m_sync_fd >= 0)
+    {
+        ::close(m_sync_fd);
+        m_sync_fd = -1;
+    }
+}
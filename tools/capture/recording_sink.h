@@ -0,0 +1,69 @@
+#ifndef RECORDING_SINK_H
+#define RECORDING_SINK_H
+
+#include <k4a/k4a.h>
+#include <k4arecord/record.h>
+
+#include <string>
+
+#include "frame_metadata.h"
+
+// custom track for event markers; plain UTF-8 subtitles, so video players show them
+static const char kEventTrack[] = "HTK_EVENTS";
+
+// Where a device's captures end up. The pipeline only talks to this
+// interface, so fault injection (and other containers) can sit in place of
+// libk4arecord. One sink is reused for every segment of a device.
+class RecordingSink
+{
+public:
+    virtual ~RecordingSink() = default;
+
+    virtual k4a_result_t create(const std::string &path,
+                                k4a_device_t device,
+                                const k4a_device_configuration_t &config) = 0;
+    // between create() and write_header(), to carry FrameMetadata records
+    virtual k4a_result_t add_metadata_track() = 0;
+    // between create() and write_header(), a UTF-8 subtitle track for event labels
+    virtual k4a_result_t add_event_track() = 0;
+    // between create() and write_header(), a file stored in the recording
+    virtual k4a_result_t add_attachment(const std::string &name, const std::string &data) = 0;
+    // between create() and write_header()
+    virtual k4a_result_t add_tag(const std::string &name, const std::string &value) = 0;
+    virtual k4a_result_t write_header() = 0;
+    virtual k4a_result_t write_capture(k4a_capture_t capture) = 0;
+    // after the capture it describes
+    virtual k4a_result_t write_metadata(const FrameMetadata &meta) = 0;
+    virtual k4a_result_t write_event(uint64_t device_timestamp_usec, const std::string &label) = 0;
+    virtual k4a_result_t flush() = 0;
+    // flush, then make everything written so far durable (fdatasync)
+    virtual k4a_result_t sync() = 0;
+    virtual void close() = 0;
+};
+
+class K4aRecordSink : public RecordingSink
+{
+public:
+    ~K4aRecordSink() override;
+
+    k4a_result_t create(const std::string &path, k4a_device_t device, const k4a_device_configuration_t &config) override;
+    k4a_result_t add_metadata_track() override;
+    k4a_result_t add_event_track() override;
+    k4a_result_t add_attachment(const std::string &name, const std::string &data) override;
+    k4a_result_t add_tag(const std::string &name, const std::string &value) override;
+    k4a_result_t write_header() override;
+    k4a_result_t write_capture(k4a_capture_t capture) override;
+    k4a_result_t write_metadata(const FrameMetadata &meta) override;
+    k4a_result_t write_event(uint64_t device_timestamp_usec, const std::string &label) override;
+    k4a_result_t flush() override;
+    k4a_result_t sync() override;
+    void close() override;
+
+private:
+    k4a_record_t m_rec = nullptr;
+    // libk4arecord does not expose its descriptor; a second one on the same
+    // file is enough for fdatasync()
+    int m_sync_fd = -1;
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include "rig_calibration.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+
+#include <k4arecord/playback.h>
+
+// FNV-1a: the id has to come out the same in every build and in Python,
+// whatever chunk_hash() happens to be
+static uint64_t rig_hash(const uint8_t *data, size_t size)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++)
+    {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static void copy_padded(char *dst, size_t dst_size, const std::string &src)
+{
+    std::memset(dst, 0, dst_size);
+    std::memcpy(dst, src.data(), std::min(src.size(), dst_size - 1));
+}
+
+RigCameraRecord rig_camera_record(const std::string &serial, const std::string &name, int device_index)
+{
+    RigCameraRecord r;
+    std::memset(&r, 0, sizeof(r));
+    copy_padded(r.serial, sizeof(r.serial), serial);
+    copy_padded(r.name, sizeof(r.name), name);
+    r.device_index = device_index;
+    for (int i = 0; i < 4; i++)
+        r.camera_to_reference[i * 5] = 1;
+    return r;
+}
+
+void rig_camera_set_intrinsics(RigCameraRecord *record, const k4a_calibration_camera_t &color)
+{
+    const auto &p = color.intrinsics.parameters.param;
+    record->width = color.resolution_width;
+    record->height = color.resolution_height;
+    record->distortion_model = static_cast<uint32_t>(color.intrinsics.type);
+    const double k[9] = { p.fx, 0, p.cx, 0, p.fy, p.cy, 0, 0, 1 };
+    std::memcpy(record->camera_matrix, k, sizeof(k));
+    for (int i = 0; i < 15; i++)
+        record->k4a_intrinsics[i] = color.intrinsics.parameters.v[i];
+    const double cv[8] = { p.k1, p.k2, p.p1, p.p2, p.k3, p.k4, p.k5, p.k6 };
+    std::memcpy(record->opencv_distortion, cv, sizeof(cv));
+    record->flags |= kRigIntrinsicsValid;
+}
+
+void rig_camera_set_crop(RigCameraRecord *record, int x, int y, int width, int height)
+{
+    record->width = width;
+    record->height = height;
+    record->camera_matrix[2] -= x;
+    record->camera_matrix[5] -= y;
+    // cx and cy lead k4a's parameter order
+    record->k4a_intrinsics[0] -= x;
+    record->k4a_intrinsics[1] -= y;
+    record->crop_x = x;
+    record->crop_y = y;
+    record->flags |= kRigColorCropped;
+}
+
+std::string rig_calibration_encode(const RigCalibration &rig, uint64_t *rig_id)
+{
+    const size_t n = rig.cameras.size();
+    std::vector<RigCameraRecord> records = rig.cameras;
+    uint64_t offset = sizeof(RigCalibrationHeader) + n * sizeof(RigCameraRecord);
+    for (size_t i = 0; i < n; i++)
+    {
+        const size_t raw = i < rig.raw.size() ? rig.raw[i].size() : 0;
+        records[i].raw_offset = raw ? offset : 0;
+        records[i].raw_bytes = raw;
+        offset += raw;
+    }
+
+    std::string out(sizeof(RigCalibrationHeader), '\0');
+    out.append(reinterpret_cast<const char *>(records.data()), n * sizeof(RigCameraRecord));
+    for (size_t i = 0; i < n && i < rig.raw.size(); i++)
+        out += rig.raw[i];
+
+    RigCalibrationHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kRigCalibrationMagic, sizeof(header.magic));
+    header.version = kRigCalibrationVersion;
+    header.camera_count = static_cast<uint32_t>(n);
+    header.header_bytes = sizeof(RigCalibrationHeader);
+    header.camera_bytes = sizeof(RigCameraRecord);
+    header.file_bytes = out.size();
+    header.reference = rig.reference;
+    header.rig_id = rig_hash(reinterpret_cast<const uint8_t *>(out.data()) + sizeof(header), out.size() - sizeof(header));
+    std::memcpy(&out[0], &header, sizeof(header));
+    if (rig_id != nullptr)
+        *rig_id = header.rig_id;
+    return out;
+}
+
+bool rig_calibration_decode(const uint8_t *data, size_t size, RigCalibration *rig, uint64_t *rig_id, std::string *error)
+{
+    RigCalibrationHeader header;
+    if (size < sizeof(header))
+    {
+        *error = "too short for a rig calibration";
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, kRigCalibrationMagic, sizeof(header.magic)) != 0)
+    {
+        *error = "not a rig calibration file";
+        return false;
+    }
+    // later versions only append fields, so sizes come from the header
+    if (header.version > kRigCalibrationVersion || header.header_bytes < sizeof(header) ||
+        header.camera_bytes < sizeof(RigCameraRecord) || header.file_bytes != size ||
+        header.header_bytes + static_cast<uint64_t>(header.camera_count) * header.camera_bytes > size)
+    {
+        *error = "rig calibration version " + std::to_string(header.version) + " is newer or the file is truncated";
+        return false;
+    }
+    if (rig_hash(data + sizeof(header), size - sizeof(header)) != header.rig_id)
+    {
+        *error = "rig calibration is corrupt (id does not match its contents)";
+        return false;
+    }
+
+    rig->reference = header.reference;
+    rig->cameras.resize(header.camera_count);
+    rig->raw.assign(header.camera_count, std::string());
+    for (uint32_t i = 0; i < header.camera_count; i++)
+    {
+        RigCameraRecord &r = rig->cameras[i];
+        std::memcpy(&r, data + header.header_bytes + static_cast<size_t>(i) * header.camera_bytes, sizeof(r));
+        r.serial[sizeof(r.serial) - 1] = '\0';
+        r.name[sizeof(r.name) - 1] = '\0';
+        if (r.raw_bytes > 0)
+        {
+            if (r.raw_offset > size || r.raw_bytes > size - r.raw_offset)
+            {
+                *error = "rig calibration raw data out of range";
+                return false;
+            }
+            rig->raw[i].assign(reinterpret_cast<const char *>(data + r.raw_offset), r.raw_bytes);
+        }
+    }
+    if (rig_id != nullptr)
+        *rig_id = header.rig_id;
+    return true;
+}
+
+bool write_rig_calibration(const std::string &path, const RigCalibration &rig, uint64_t *rig_id, std::string *error)
+{
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out << rig_calibration_encode(rig, rig_id);
+        out.close();
+        if (!out)
+        {
+            *error = "Unable to write " + tmp_path + ": " + std::strerror(errno);
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        *error = "Unable to rename " + tmp_path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool load_rig_calibration(const std::string &path, RigCalibration *rig, uint64_t *rig_id, std::string *error)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        *error = "Unable to open " + path;
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!rig_calibration_decode(reinterpret_cast<const uint8_t *>(data.data()), data.size(), rig, rig_id, error))
+    {
+        *error = path + ": " + *error;
+        return false;
+    }
+    return true;
+}
+
+int rig_find_camera(const RigCalibration &rig, const std::string &serial)
+{
+    for (size_t i = 0; i < rig.cameras.size(); i++)
+        if (serial == rig.cameras[i].serial)
+            return static_cast<int>(i);
+    return -1;
+}
+
+std::string rig_id_hex(uint64_t rig_id)
+{
+    std::ostringstream out;
+    out << std::hex << std::setw(16) << std::setfill('0') << rig_id;
+    return out.str();
+}
+
+bool read_recording_rig_calibration(const std::string &recording_path, std::string *data)
+{
+    k4a_playback_t playback = nullptr;
+    if (K4A_FAILED(k4a_playback_open(recording_path.c_str(), &playback)))
+        return false;
+    size_t size = 0;
+    bool ok = k4a_playback_get_attachment(playback, kRigCalibrationAttachment, nullptr, &size) ==
+              K4A_BUFFER_RESULT_TOO_SMALL;
+    if (ok)
+    {
+        data->resize(size);
+        ok = k4a_playback_get_attachment(playback, kRigCalibrationAttachment, reinterpret_cast<uint8_t *>(&(*data)[0]),
+                                         &size) == K4A_BUFFER_RESULT_SUCCEEDED;
+    }
+    k4a_playback_close(playback);
+    return ok;
+}
@@ -0,0 +1,123 @@
+#ifndef RIG_CALIBRATION_H
+#define RIG_CALIBRATION_H
+
+#include <k4a/k4a.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A whole rig's calibration in one little-endian file: a 64-byte header, one
+// 512-byte record per camera, then every camera's raw factory calibration
+// (the SDK's JSON blob). Fixed-size records mean a reader can mmap the file,
+// or read it in one go, and use it in place:
+//
+//   hdr = np.dtype([('magic', 'S8'), ('version', '<u4'), ('camera_count', '<u4'),
+//                   ('header_bytes', '<u4'), ('camera_bytes', '<u4'), ('rig_id', '<u8'),
+//                   ('file_bytes', '<u8'), ('reference', '<i4'), ('flags', '<u4'), ('reserved', 'u1', 16)])
+//   cam = np.dtype([('serial', 'S32'), ('name', 'S32'), ('device_index', '<i4'), ('width', '<i4'),
+//                   ('height', '<i4'), ('distortion_model', '<u4'), ('flags', '<u4'), ('reserved0', '<u4'),
+//                   ('camera_matrix', '<f8', (3, 3)), ('k4a_intrinsics', '<f8', 15),
+//                   ('opencv_distortion', '<f8', 8), ('camera_to_reference', '<f8', (4, 4)),
+//                   ('rms_px', '<f8'), ('raw_offset', '<u8'), ('raw_bytes', '<u8'), ('crop_x', '<i4'),
+//                   ('crop_y', '<i4'), ('reserved', 'u1', 8)])
+//
+// rig_id is a hash of everything after the header, so two files with the
+// same id hold the same calibration. htkrecorder attaches the file to every
+// recording and tags the recording with the id; htkcalibrate writes one with
+// solved extrinsics. tools/calibration/rig_calibration.py reads it.
+
+static const char kRigCalibrationMagic[8] = { 'H', 'T', 'K', 'R', 'I', 'G', '0', '1' };
+static const uint32_t kRigCalibrationVersion = 1;
+static const char kRigCalibrationFile[] = "rig_calibration.bin";
+// MKV attachment name and the tag holding the id in hex
+static const char kRigCalibrationAttachment[] = "htk_rig_calibration.bin";
+static const char kRigCalibrationTag[] = "HTK_RIG_CALIBRATION_ID";
+
+enum RigCameraFlags : uint32_t
+{
+    kRigIntrinsicsValid = 1 << 0, // factory intrinsics present
+    kRigExtrinsicsSolved = 1 << 1, // camera_to_reference is a solved transform, not identity by default
+    kRigColorCropped = 1 << 2,     // recorded cropped, see rig_camera_set_crop()
+};
+
+#pragma pack(push, 1)
+struct RigCalibrationHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t camera_count;
+    uint32_t header_bytes;
+    uint32_t camera_bytes;
+    uint64_t rig_id;
+    uint64_t file_bytes;
+    int32_t reference; // camera record of the extrinsics' reference frame, -1 if none
+    uint32_t flags;
+    uint8_t reserved[16];
+};
+
+struct RigCameraRecord
+{
+    char serial[32]; // NUL-padded
+    char name[32];   // file stem in cam_intr/cam_extr, e.g. camera_1
+    int32_t device_index;
+    int32_t width;
+    int32_t height;
+    uint32_t distortion_model; // k4a_calibration_model_type_t
+    uint32_t flags;            // RigCameraFlags
+    uint32_t reserved0;
+    double camera_matrix[9];        // row-major, pixels
+    double k4a_intrinsics[15];      // k4a_calibration_intrinsic_parameters_t order
+    double opencv_distortion[8];    // k1 k2 p1 p2 k3 k4 k5 k6
+    double camera_to_reference[16]; // row-major, meters
+    double rms_px;                  // reprojection error of the extrinsic solve, 0 if unknown
+    uint64_t raw_offset;            // from the start of the file
+    uint64_t raw_bytes;
+    int32_t crop_x; // origin of the recorded crop in the sensor image
+    int32_t crop_y;
+    uint8_t reserved[8];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(RigCalibrationHeader) == 64, "RigCalibrationHeader is an on-disk format");
+static_assert(sizeof(RigCameraRecord) == 512, "RigCameraRecord is an on-disk format");
+
+struct RigCalibration
+{
+    int32_t reference = -1;
+    std::vector<RigCameraRecord> cameras;
+    std::vector<std::string> raw; // per camera, may be empty
+};
+
+// A zeroed record with identity extrinsics.
+RigCameraRecord rig_camera_record(const std::string &serial, const std::string &name, int device_index);
+
+// Fills the intrinsics from the SDK's color camera calibration.
+void rig_camera_set_intrinsics(RigCameraRecord *record, const k4a_calibration_camera_t &color);
+
+// For a camera recorded cropped (htkrecorder --crop): width, height and the
+// principal point become those of the crop, so the intrinsics fit the
+// recorded frames as they are. crop_x/crop_y keep the way back to the
+// sensor's pixels; the raw factory calibration is left as it was.
+void rig_camera_set_crop(RigCameraRecord *record, int x, int y, int width, int height);
+
+// Encodes the file; raw offsets, file size and rig_id are filled in here.
+std::string rig_calibration_encode(const RigCalibration &rig, uint64_t *rig_id = nullptr);
+
+// False and fills error on a truncated, foreign or newer file.
+bool rig_calibration_decode(const uint8_t *data, size_t size, RigCalibration *rig, uint64_t *rig_id, std::string *error);
+
+// Written next to path and renamed into place.
+bool write_rig_calibration(const std::string &path, const RigCalibration &rig, uint64_t *rig_id, std::string *error);
+bool load_rig_calibration(const std::string &path, RigCalibration *rig, uint64_t *rig_id, std::string *error);
+
+// The kRigCalibrationAttachment bytes of a recording; false if the file cannot
+// be opened or has none.
+bool read_recording_rig_calibration(const std::string &recording_path, std::string *data);
+
+// Index of the record for serial, -1 if the rig does not have that camera.
+int rig_find_camera(const RigCalibration &rig, const std::string &serial);
+
+std::string rig_id_hex(uint64_t rig_id);
+
+#endif
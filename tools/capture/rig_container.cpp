@@ -0,0 +1,294 @@
+#include "rig_container.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void rig_camera_init(RigContainerCamera *camera, const std::string &serial, int device_index)
+{
+    std::memset(camera, 0, sizeof(*camera));
+    std::memcpy(camera->serial, serial.data(), std::min(serial.size(), sizeof(camera->serial) - 1));
+    camera->device_index = device_index;
+}
+
+RigContainerWriter::~RigContainerWriter()
+{
+    // an unfinished file is left without an index
+    if (m_file)
+        m_file->close();
+}
+
+bool RigContainerWriter::write(const void *data, size_t size, std::string *error)
+{
+    if (!m_file->write(static_cast<const uint8_t *>(data), size))
+    {
+        *error = "Failed to write " + m_path + ": " + std::strerror(m_file->last_errno());
+        return false;
+    }
+    m_bytes += size;
+    return true;
+}
+
+bool RigContainerWriter::open(const std::string &path,
+                              const std::vector<RigContainerCamera> &cameras,
+                              int master_camera,
+                              uint32_t period_usec,
+                              WriterMode mode,
+                              std::string *error)
+{
+    if (cameras.empty() || cameras.size() > kRigMaxCameras)
+    {
+        *error = "A rig file holds 1 to " + std::to_string(kRigMaxCameras) + " cameras.";
+        return false;
+    }
+    m_path = path;
+    m_file = make_file_writer(mode, 8 << 20);
+    if (!m_file)
+    {
+        *error = std::string("The ") + writer_mode_name(mode) + " writer is not available in this build.";
+        return false;
+    }
+    if (!m_file->open(path))
+    {
+        *error = "Unable to create " + path + ": " + std::strerror(m_file->last_errno());
+        m_file.reset();
+        return false;
+    }
+    m_camera_count = cameras.size();
+    m_bytes = 0;
+    m_frames = 0;
+    m_sets.clear();
+
+    RigContainerHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, kRigContainerMagic, sizeof(h.magic));
+    h.version = kRigContainerVersion;
+    h.header_bytes = sizeof(h);
+    h.camera_bytes = sizeof(RigContainerCamera);
+    h.set_bytes = sizeof(RigFrameSetHeader);
+    h.frame_bytes = sizeof(RigFrameHeader);
+    h.entry_bytes = sizeof(RigSetEntry);
+    h.camera_count = static_cast<uint32_t>(cameras.size());
+    h.master_camera = master_camera;
+    h.period_usec = period_usec;
+    return write(&h, sizeof(h), error) && write(cameras.data(), cameras.size() * sizeof(cameras[0]), error);
+}
+
+bool RigContainerWriter::append_set(int64_t timestamp_ns, std::vector<RigFramePart> &frames, std::string *error)
+{
+    RigFrameSetHeader h;
+    std::memset(&h, 0, sizeof(h));
+    h.marker = kRigSetMarker;
+    h.frame_count = static_cast<uint16_t>(frames.size());
+    h.set = m_sets.size();
+    h.timestamp_ns = timestamp_ns;
+    uint64_t bytes = sizeof(h);
+    for (auto &f : frames)
+    {
+        if (f.header.camera >= m_camera_count)
+        {
+            *error = "Frame for camera " + std::to_string(f.header.camera) + " in a rig file of " +
+                     std::to_string(m_camera_count);
+            return false;
+        }
+        h.camera_mask |= 1u << f.header.camera;
+        bytes += sizeof(RigFrameHeader) + f.header.size;
+    }
+    if (bytes > UINT32_MAX || frames.size() > UINT16_MAX)
+    {
+        *error = "Frame set too large for " + m_path;
+        return false;
+    }
+    h.bytes = static_cast<uint32_t>(bytes);
+
+    RigSetEntry entry;
+    entry.timestamp_ns = timestamp_ns;
+    entry.offset = m_bytes;
+    entry.bytes = h.bytes;
+    entry.camera_mask = h.camera_mask;
+    if (!write(&h, sizeof(h), error))
+        return false;
+    for (auto &f : frames)
+    {
+        if (!write(&f.header, sizeof(f.header), error) || !write(f.data, f.header.size, error))
+            return false;
+    }
+    m_sets.push_back(entry);
+    m_frames += frames.size();
+    return true;
+}
+
+bool RigContainerWriter::sync(std::string *error)
+{
+    if (!m_file->sync())
+    {
+        *error = "Failed to sync " + m_path + ": " + std::strerror(m_file->last_errno());
+        return false;
+    }
+    return true;
+}
+
+bool RigContainerWriter::finish(std::string *error)
+{
+    if (!m_file)
+        return true;
+    RigContainerFooter footer;
+    std::memset(&footer, 0, sizeof(footer));
+    std::memcpy(footer.magic, kRigContainerIndexMagic, sizeof(footer.magic));
+    footer.index_offset = m_bytes;
+    footer.set_count = m_sets.size();
+    footer.frame_count = m_frames;
+    bool ok = write(m_sets.data(), m_sets.size() * sizeof(RigSetEntry), error) &&
+              write(&footer, sizeof(footer), error);
+    if (!m_file->close() && ok)
+    {
+        *error = "Failed to close " + m_path + ": " + std::strerror(m_file->last_errno());
+        ok = false;
+    }
+    m_file.reset();
+    return ok;
+}
+
+RigContainer::~RigContainer()
+{
+    close();
+}
+
+void RigContainer::close()
+{
+    if (m_data)
+        munmap(m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+    m_header = nullptr;
+    m_cameras = nullptr;
+    m_sets.clear();
+    m_recovered = false;
+}
+
+bool RigContainer::open(const std::string &path, std::string *error)
+{
+    close();
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        *error = "Unable to open " + path + ": " + std::strerror(errno);
+        if (fd >= 0)
+            ::close(fd);
+        return false;
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    void *p = m_size ? mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        *error = "Unable to map " + path;
+        m_size = 0;
+        return false;
+    }
+    m_data = p;
+    const uint8_t *base = static_cast<const uint8_t *>(p);
+
+    const RigContainerHeader *h = static_cast<const RigContainerHeader *>(p);
+    if (m_size < sizeof(*h) || std::memcmp(h->magic, kRigContainerMagic, sizeof(h->magic)) != 0 ||
+        h->version > kRigContainerVersion || h->header_bytes != sizeof(RigContainerHeader) ||
+        h->camera_bytes != sizeof(RigContainerCamera) || h->set_bytes != sizeof(RigFrameSetHeader) ||
+        h->frame_bytes != sizeof(RigFrameHeader) || h->entry_bytes != sizeof(RigSetEntry) ||
+        h->camera_count > kRigMaxCameras || sizeof(*h) + h->camera_count * sizeof(RigContainerCamera) > m_size)
+    {
+        *error = path + " is not a rig file this build can read.";
+        close();
+        return false;
+    }
+    m_header = h;
+    m_cameras = reinterpret_cast<const RigContainerCamera *>(base + sizeof(*h));
+
+    const RigContainerFooter *footer = nullptr;
+    if (m_size >= sizeof(*h) + sizeof(RigContainerFooter))
+        footer = reinterpret_cast<const RigContainerFooter *>(base + m_size - sizeof(RigContainerFooter));
+    if (footer && std::memcmp(footer->magic, kRigContainerIndexMagic, sizeof(footer->magic)) == 0 &&
+        footer->index_offset + footer->set_count * sizeof(RigSetEntry) + sizeof(*footer) == m_size)
+    {
+        const RigSetEntry *entries = reinterpret_cast<const RigSetEntry *>(base + footer->index_offset);
+        m_sets.assign(entries, entries + footer->set_count);
+        for (auto &e : m_sets)
+        {
+            if (e.offset + e.bytes > footer->index_offset || e.bytes < sizeof(RigFrameSetHeader))
+            {
+                *error = path + " has a corrupt set index.";
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+    m_recovered = true;
+    return walk_sets();
+}
+
+bool RigContainer::walk_sets()
+{
+    const uint8_t *base = static_cast<const uint8_t *>(m_data);
+    uint64_t pos = sizeof(RigContainerHeader) + m_header->camera_count * sizeof(RigContainerCamera);
+    // stops at the first set that is cut off or does not add up: whatever
+    // follows a torn write is not trustworthy
+    while (pos + sizeof(RigFrameSetHeader) <= m_size)
+    {
+        const RigFrameSetHeader *s = reinterpret_cast<const RigFrameSetHeader *>(base + pos);
+        if (s->marker != kRigSetMarker || s->set != m_sets.size() || s->bytes < sizeof(*s) ||
+            pos + s->bytes > m_size)
+            break;
+        uint64_t inner = pos + sizeof(*s);
+        bool ok = true;
+        for (uint16_t i = 0; ok && i < s->frame_count; i++)
+        {
+            const RigFrameHeader *f = reinterpret_cast<const RigFrameHeader *>(base + inner);
+            ok = inner + sizeof(*f) <= pos + s->bytes && inner + sizeof(*f) + f->size <= pos + s->bytes &&
+                 f->camera < m_header->camera_count;
+            inner += sizeof(*f) + (ok ? f->size : 0);
+        }
+        if (!ok || inner != pos + s->bytes)
+            break;
+        RigSetEntry e;
+        e.timestamp_ns = s->timestamp_ns;
+        e.offset = pos;
+        e.bytes = s->bytes;
+        e.camera_mask = s->camera_mask;
+        m_sets.push_back(e);
+        pos += s->bytes;
+    }
+    return true;
+}
+
+std::vector<RigFrameView> RigContainer::frames(size_t i) const
+{
+    std::vector<RigFrameView> out;
+    const uint8_t *base = static_cast<const uint8_t *>(m_data);
+    const RigSetEntry &e = m_sets[i];
+    const RigFrameSetHeader *s = reinterpret_cast<const RigFrameSetHeader *>(base + e.offset);
+    uint64_t pos = e.offset + sizeof(*s);
+    const uint64_t end = e.offset + e.bytes;
+    for (uint16_t k = 0; k < s->frame_count && pos + sizeof(RigFrameHeader) <= end; k++)
+    {
+        RigFrameView v;
+        v.header = reinterpret_cast<const RigFrameHeader *>(base + pos);
+        v.data = base + pos + sizeof(RigFrameHeader);
+        if (pos + sizeof(RigFrameHeader) + v.header->size > end)
+            break;
+        out.push_back(v);
+        pos += sizeof(RigFrameHeader) + v.header->size;
+    }
+    return out;
+}
+
+size_t RigContainer::find_set(int64_t timestamp_ns) const
+{
+    auto it = std::lower_bound(m_sets.begin(), m_sets.end(), timestamp_ns,
+                               [](const RigSetEntry &e, int64_t ts) { return e.timestamp_ns < ts; });
+    return static_cast<size_t>(it - m_sets.begin());
+}
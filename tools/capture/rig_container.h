@@ -0,0 +1,264 @@
+#ifndef RIG_CONTAINER_H
+#define RIG_CONTAINER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "file_writer.h"
+
+// One file for a whole rig: every camera's frames interleaved in timestamp
+// order and grouped into frame sets, one frame per camera per instant. The
+// per-device MKVs need a seek into each of N files to read one multi-view
+// instant; here the views of an instant are adjacent, so reading a take
+// front to back is one linear scan. htkrecorder --rig-file writes it next to
+// the MKVs (see rig_sink.h).
+//
+// Little-endian. A 64-byte header and the camera table, then the frame sets
+// back to back, then the set index and a 32-byte footer. A set is a set
+// header, and per frame a frame header followed by its image payload (the
+// color MJPEG as recorded, and depth/IR when enabled):
+//
+//   hdr    = np.dtype([('magic', 'S8'), ('version', '<u4'), ('header_bytes', '<u4'),
+//                      ('camera_bytes', '<u4'), ('set_bytes', '<u4'), ('frame_bytes', '<u4'),
+//                      ('entry_bytes', '<u4'), ('camera_count', '<u4'), ('master_camera', '<i4'),
+//                      ('period_usec', '<u4'), ('reserved', '<u4', 5)])
+//   camera = np.dtype([('serial', 'S32'), ('device_index', '<i4'), ('color_format', '<u4'),
+//                      ('color_width', '<u4'), ('color_height', '<u4'), ('color_x', '<i4'),
+//                      ('color_y', '<i4'), ('reserved', '<u8')])
+//   set    = np.dtype([('marker', '<u4'), ('frame_count', '<u2'), ('reserved0', '<u2'),
+//                      ('set', '<u8'), ('timestamp_ns', '<i8'), ('bytes', '<u4'),
+//                      ('camera_mask', '<u4')])
+//   frame  = np.dtype([('camera', '<u2'), ('image', 'u1'), ('reserved0', 'u1'), ('format', '<u4'),
+//                      ('width', '<u4'), ('height', '<u4'), ('stride', '<u4'),
+//                      ('device_timestamp_usec', '<u8'), ('system_timestamp_ns', '<u8'),
+//                      ('flags', '<u4'), ('size', '<u4'), ('reserved', '<u4')])
+//   entry  = np.dtype([('timestamp_ns', '<i8'), ('offset', '<u8'), ('bytes', '<u4'),
+//                      ('camera_mask', '<u4')])
+//   footer = np.dtype([('magic', 'S8'), ('index_offset', '<u8'), ('set_count', '<u8'),
+//                      ('frame_count', '<u8')])
+//
+// A set's timestamp is host CLOCK_MONOTONIC (the clock of the frames' system
+// timestamps) of its earliest frame, with each device's timestamps mapped
+// onto it, so sets from different devices' clocks order correctly. The
+// index is written last: a file without the footer (a recorder that was
+// killed) is read by walking the set headers instead.
+// tools/mkv/rig_file.py reads the file from Python.
+
+static const char kRigContainerMagic[8] = { 'H', 'T', 'K', 'R', 'I', 'G', 'F', 'S' };
+static const char kRigContainerIndexMagic[8] = { 'H', 'T', 'K', 'R', 'I', 'G', 'I', 'X' };
+static const uint32_t kRigContainerVersion = 1;
+static const uint32_t kRigSetMarker = 0x54455352; // "RSET"
+// camera_mask is 32 bits wide
+static const size_t kRigMaxCameras = 32;
+
+enum RigImageKind : uint8_t
+{
+    kRigImageColor = 0,
+    kRigImageDepth = 1,
+    kRigImageIr = 2,
+};
+
+#pragma pack(push, 1)
+struct RigContainerHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_bytes;
+    uint32_t camera_bytes;
+    uint32_t set_bytes;
+    uint32_t frame_bytes;
+    uint32_t entry_bytes;
+    uint32_t camera_count;
+    int32_t master_camera; // index into the camera table, -1 if unknown
+    uint32_t period_usec;  // frame period the sets were grouped with
+    uint32_t reserved[5];
+};
+
+struct RigContainerCamera
+{
+    char serial[32]; // NUL-padded
+    int32_t device_index;
+    uint32_t color_format; // k4a_image_format_t
+    uint32_t color_width;
+    uint32_t color_height;
+    // origin of a cropped camera's frames in the sensor image, 0 otherwise
+    int32_t color_x;
+    int32_t color_y;
+    uint64_t reserved;
+};
+
+struct RigFrameSetHeader
+{
+    uint32_t marker; // kRigSetMarker
+    uint16_t frame_count;
+    uint16_t reserved0;
+    uint64_t set;
+    int64_t timestamp_ns;
+    uint32_t bytes;       // the whole set, this header included
+    uint32_t camera_mask; // bit i: camera i has frames in the set
+};
+
+struct RigFrameHeader
+{
+    uint16_t camera; // index into the camera table
+    uint8_t image;   // RigImageKind
+    uint8_t reserved0;
+    uint32_t format; // k4a_image_format_t
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint64_t device_timestamp_usec;
+    uint64_t system_timestamp_ns;
+    uint32_t flags; // FrameMetadataFlags
+    uint32_t size;  // payload bytes following this header
+    uint32_t reserved;
+};
+
+struct RigSetEntry
+{
+    int64_t timestamp_ns;
+    uint64_t offset; // of the set header
+    uint32_t bytes;
+    uint32_t camera_mask;
+};
+
+struct RigContainerFooter
+{
+    char magic[8];
+    uint64_t index_offset;
+    uint64_t set_count;
+    uint64_t frame_count;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(RigContainerHeader) == 64, "RigContainerHeader is an on-disk format");
+static_assert(sizeof(RigContainerCamera) == 64, "RigContainerCamera is an on-disk format");
+static_assert(sizeof(RigFrameSetHeader) == 32, "RigFrameSetHeader is an on-disk format");
+static_assert(sizeof(RigFrameHeader) == 48, "RigFrameHeader is an on-disk format");
+static_assert(sizeof(RigSetEntry) == 24, "RigSetEntry is an on-disk format");
+static_assert(sizeof(RigContainerFooter) == 32, "RigContainerFooter is an on-disk format");
+
+void rig_camera_init(RigContainerCamera *camera, const std::string &serial, int device_index);
+
+// One frame of a set being written; data stays the caller's.
+struct RigFramePart
+{
+    RigFrameHeader header;
+    const uint8_t *data = nullptr;
+};
+
+// Appends sets from one thread.
+class RigContainerWriter
+{
+public:
+    RigContainerWriter() = default;
+    ~RigContainerWriter();
+
+    RigContainerWriter(const RigContainerWriter &) = delete;
+    RigContainerWriter &operator=(const RigContainerWriter &) = delete;
+
+    bool open(const std::string &path,
+              const std::vector<RigContainerCamera> &cameras,
+              int master_camera,
+              uint32_t period_usec,
+              WriterMode mode,
+              std::string *error);
+    // frames with camera < camera count; each header's size is filled in here
+    bool append_set(int64_t timestamp_ns, std::vector<RigFramePart> &frames, std::string *error);
+    bool sync(std::string *error);
+    // Writes the index and footer and closes the file.
+    bool finish(std::string *error);
+
+    uint64_t set_count() const
+    {
+        return m_sets.size();
+    }
+    uint64_t frame_count() const
+    {
+        return m_frames;
+    }
+    uint64_t bytes() const
+    {
+        return m_bytes;
+    }
+
+private:
+    bool write(const void *data, size_t size, std::string *error);
+
+    std::string m_path;
+    std::unique_ptr<FileWriter> m_file;
+    size_t m_camera_count = 0;
+    // the next set's offset; FileWriter::bytes_written() lags behind what it has staged
+    uint64_t m_bytes = 0;
+    uint64_t m_frames = 0;
+    std::vector<RigSetEntry> m_sets;
+};
+
+// A frame of a set in a mapped file.
+struct RigFrameView
+{
+    const RigFrameHeader *header = nullptr;
+    const uint8_t *data = nullptr;
+};
+
+// Reads a rig file, finished or not. The file is mapped read-only, so a
+// frame's data is a pointer into the page cache; every method is safe from
+// any number of threads.
+class RigContainer
+{
+public:
+    RigContainer() = default;
+    ~RigContainer();
+
+    RigContainer(const RigContainer &) = delete;
+    RigContainer &operator=(const RigContainer &) = delete;
+
+    bool open(const std::string &path, std::string *error);
+    void close();
+
+    const RigContainerHeader &header() const
+    {
+        return *m_header;
+    }
+    size_t camera_count() const
+    {
+        return m_header ? m_header->camera_count : 0;
+    }
+    const RigContainerCamera &camera(size_t i) const
+    {
+        return m_cameras[i];
+    }
+    size_t set_count() const
+    {
+        return m_sets.size();
+    }
+    const RigSetEntry &set(size_t i) const
+    {
+        return m_sets[i];
+    }
+    // the frames of set i, in the order they were written
+    std::vector<RigFrameView> frames(size_t i) const;
+    // first set at or after the timestamp; set_count() if there is none
+    size_t find_set(int64_t timestamp_ns) const;
+
+    // true when the footer was missing and the sets were found by walking
+    bool recovered() const
+    {
+        return m_recovered;
+    }
+
+private:
+    bool walk_sets();
+
+    void *m_data = nullptr;
+    size_t m_size = 0;
+    const RigContainerHeader *m_header = nullptr;
+    const RigContainerCamera *m_cameras = nullptr;
+    std::vector<RigSetEntry> m_sets;
+    bool m_recovered = false;
+};
+
+#endif
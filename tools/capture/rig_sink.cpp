@@ -0,0 +1,278 @@
+#include "rig_sink.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "capture_device.h"
+
+RigSink::RigSink(const RigSinkOptions &options) : m_options(options)
+{
+}
+
+RigSink::~RigSink()
+{
+    if (m_thread.joinable())
+    {
+        std::string error;
+        stop(&error);
+    }
+}
+
+bool RigSink::open(const std::string &path,
+                   const std::vector<RigContainerCamera> &cameras,
+                   int master_camera,
+                   uint32_t period_usec,
+                   std::string *error)
+{
+    if (!m_writer.open(path, cameras, master_camera, period_usec, m_options.writer, error))
+        return false;
+    m_path = path;
+    m_cameras.clear();
+    m_cameras.resize(cameras.size());
+    for (auto &c : m_cameras)
+        c.ring.reset(new FrameRing<Pending>(m_options.queue_frames));
+    m_all_mask = cameras.size() == 32 ? UINT32_MAX : (1u << cameras.size()) - 1;
+    m_half_period_ns = static_cast<int64_t>(period_usec) * 500;
+    return true;
+}
+
+void RigSink::set_error_handler(std::function<void(const std::string &)> handler)
+{
+    m_on_error = handler;
+}
+
+void RigSink::start()
+{
+    m_last_sync_ns = monotonic_ns();
+    m_thread = std::thread(&RigSink::run, this);
+}
+
+bool RigSink::push(size_t camera, k4a_capture_t capture, int64_t host_ns, uint32_t flags)
+{
+    Camera &c = m_cameras[camera];
+    // the clock mapping can step back by a little as its estimate improves
+    if (host_ns <= c.last_host_ns)
+        host_ns = c.last_host_ns + 1;
+    c.last_host_ns = host_ns;
+
+    k4a_capture_reference(capture);
+    Pending p;
+    p.capture = capture;
+    p.host_ns = host_ns;
+    p.flags = flags;
+    if (!c.ring->try_push(p))
+    {
+        k4a_capture_release(capture);
+        m_dropped++;
+        return false;
+    }
+    // pairs with the fence in wait_for_frames(), as in FrameRing
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiting.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_cv.notify_one();
+    }
+    return true;
+}
+
+void RigSink::close_camera(size_t camera)
+{
+    m_closed_mask.fetch_or(1u << camera, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cv.notify_one();
+}
+
+void RigSink::wait_for_frames(uint32_t closed, int64_t deadline_ns)
+{
+    // a frame for a camera without one, or a camera closing since `closed` was read
+    auto news = [&] {
+        if (m_closed_mask.load(std::memory_order_acquire) != closed)
+            return true;
+        for (auto &c : m_cameras)
+            if (!c.has_head && c.ring->size() != 0)
+                return true;
+        return false;
+    };
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_waiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t wait_ns = deadline_ns - monotonic_ns();
+    if (wait_ns > 0)
+        m_cv.wait_for(lock, std::chrono::nanoseconds(wait_ns), news);
+    m_waiting.store(false, std::memory_order_relaxed);
+}
+
+void RigSink::run()
+{
+    const int64_t max_wait_ns = static_cast<int64_t>(m_options.max_wait_ms) * 1000000;
+    for (;;)
+    {
+        // read before the rings: a camera seen closed has pushed everything
+        const uint32_t closed = m_closed_mask.load(std::memory_order_acquire);
+        size_t best = m_cameras.size();
+        bool missing = false; // a running camera with nothing queued
+        for (size_t i = 0; i < m_cameras.size(); i++)
+        {
+            Camera &c = m_cameras[i];
+            if (!c.has_head)
+                c.has_head = c.ring->try_pop(c.head);
+            if (c.has_head)
+            {
+                if (best == m_cameras.size() || c.head.host_ns < m_cameras[best].head.host_ns)
+                    best = i;
+            }
+            else if ((closed & (1u << i)) == 0)
+            {
+                missing = true;
+            }
+        }
+        if (best == m_cameras.size())
+        {
+            if (!missing)
+                break;
+            wait_for_frames(closed, monotonic_ns() + 100000000);
+            continue;
+        }
+        const int64_t oldest_ns = m_cameras[best].head.host_ns;
+        if (missing && monotonic_ns() - oldest_ns < max_wait_ns)
+        {
+            wait_for_frames(closed, oldest_ns + max_wait_ns);
+            continue;
+        }
+
+        Camera &c = m_cameras[best];
+        c.has_head = false;
+        if (m_failed || (m_any_set && c.head.host_ns < m_set_ns))
+        {
+            if (!m_failed)
+                m_late++;
+            k4a_capture_release(c.head.capture);
+            continue;
+        }
+        add_to_set(best, c.head);
+    }
+    write_set();
+}
+
+void RigSink::add_to_set(size_t camera, const Pending &p)
+{
+    const uint32_t bit = 1u << camera;
+    if (!m_set.empty() && ((m_set_mask & bit) != 0 || p.host_ns - m_set_ns >= m_half_period_ns))
+        write_set();
+    if (m_set.empty())
+    {
+        m_set_ns = p.host_ns;
+        m_any_set = true;
+    }
+    m_set.push_back(p);
+    m_set_cameras.push_back(camera);
+    m_set_mask |= bit;
+    // complete, nothing else can join it
+    if (m_set_mask == m_all_mask)
+        write_set();
+}
+
+void RigSink::release_set()
+{
+    for (auto &p : m_set)
+        k4a_capture_release(p.capture);
+    m_set.clear();
+    m_set_cameras.clear();
+    m_set_mask = 0;
+}
+
+void RigSink::write_set()
+{
+    if (m_set.empty() || m_failed)
+    {
+        release_set();
+        return;
+    }
+
+    static k4a_image_t (*const getters[])(k4a_capture_t) = { k4a_capture_get_color_image,
+                                                             k4a_capture_get_depth_image,
+                                                             k4a_capture_get_ir_image };
+    static const RigImageKind kinds[] = { kRigImageColor, kRigImageDepth, kRigImageIr };
+
+    std::vector<k4a_image_t> images;
+    std::vector<RigFramePart> parts;
+    for (size_t i = 0; i < m_set.size(); i++)
+    {
+        for (size_t k = 0; k < 3; k++)
+        {
+            k4a_image_t image = getters[k](m_set[i].capture);
+            if (image == nullptr)
+                continue;
+            images.push_back(image);
+            RigFramePart part;
+            std::memset(&part.header, 0, sizeof(part.header));
+            part.header.camera = static_cast<uint16_t>(m_set_cameras[i]);
+            part.header.image = kinds[k];
+            part.header.format = static_cast<uint32_t>(k4a_image_get_format(image));
+            part.header.width = static_cast<uint32_t>(k4a_image_get_width_pixels(image));
+            part.header.height = static_cast<uint32_t>(k4a_image_get_height_pixels(image));
+            part.header.stride = static_cast<uint32_t>(k4a_image_get_stride_bytes(image));
+            part.header.device_timestamp_usec = k4a_image_get_device_timestamp_usec(image);
+            part.header.system_timestamp_ns = k4a_image_get_system_timestamp_nsec(image);
+            part.header.flags = m_set[i].flags;
+            part.header.size = static_cast<uint32_t>(k4a_image_get_size(image));
+            part.data = k4a_image_get_buffer(image);
+            parts.push_back(part);
+        }
+    }
+
+    std::string error;
+    bool ok = m_writer.append_set(m_set_ns, parts, &error);
+    if (ok && m_options.sync_ms > 0)
+    {
+        const int64_t now = monotonic_ns();
+        if (now - m_last_sync_ns >= static_cast<int64_t>(m_options.sync_ms) * 1000000)
+        {
+            ok = m_writer.sync(&error);
+            m_last_sync_ns = now;
+        }
+    }
+    for (k4a_image_t image : images)
+        k4a_image_release(image);
+    if (ok)
+    {
+        m_sets++;
+        m_frames += m_set.size();
+    }
+    release_set();
+    if (!ok)
+        fail(error);
+}
+
+void RigSink::fail(const std::string &msg)
+{
+    m_failed = true;
+    m_error = msg;
+    if (m_on_error)
+        m_on_error(msg);
+}
+
+bool RigSink::stop(std::string *error)
+{
+    if (m_thread.joinable())
+    {
+        // writers that never ran have nothing more to send
+        m_closed_mask.fetch_or(m_all_mask, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cv.notify_one();
+        }
+        m_thread.join();
+    }
+    // a failed file still gets the index of what made it out
+    std::string finish_error;
+    const bool finished = m_writer.finish(&finish_error);
+    if (m_failed || !finished)
+    {
+        *error = m_failed ? m_error : finish_error;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,146 @@
+#ifndef RIG_SINK_H
+#define RIG_SINK_H
+
+#include <k4a/k4a.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_ring.h"
+#include "rig_container.h"
+
+struct RigSinkOptions
+{
+    size_t queue_frames = 64; // per camera, between its writer and the merge
+    // How long the merge holds the oldest frame for a camera that has sent
+    // nothing newer. A camera later than this misses those sets; its frames
+    // still go to its MKV.
+    int max_wait_ms = 500;
+    int sync_ms = 0; // fdatasync the file this often, 0 never
+    WriterMode writer = WriterMode::Buffered;
+};
+
+// The rig-level sink behind htkrecorder --rig-file: each device's writer
+// thread hands over the captures it has written to its MKV, and one merge
+// thread takes them in timestamp order across cameras, groups them into
+// frame sets and appends those to a rig file (rig_container.h).
+//
+// The merge is a k-way merge over one FrameRing per camera. It only takes a
+// frame once every camera still running has a frame queued (so nothing older
+// can turn up), or once the oldest frame has waited max_wait_ms. A frame
+// joins the set being built unless that set already has its camera or
+// started half a frame period earlier. Frames older than the newest set,
+// from a camera that fell behind by more than max_wait_ms, are counted as
+// late and left out. The ordering timestamp is each device's timestamp mapped
+// onto the host clock by its writer (DeviceClockMap in capture_session.cpp).
+class RigSink
+{
+public:
+    explicit RigSink(const RigSinkOptions &options);
+    ~RigSink();
+
+    RigSink(const RigSink &) = delete;
+    RigSink &operator=(const RigSink &) = delete;
+
+    bool open(const std::string &path,
+              const std::vector<RigContainerCamera> &cameras,
+              int master_camera,
+              uint32_t period_usec,
+              std::string *error);
+    // called on the merge thread with the first failure; the merge then
+    // drops everything it is given
+    void set_error_handler(std::function<void(const std::string &)> handler);
+    void start();
+
+    // Writer thread of `camera`. Takes its own reference to the capture;
+    // false (and counted as dropped) if the merge is that far behind.
+    bool push(size_t camera, k4a_capture_t capture, int64_t host_ns, uint32_t flags);
+    // writer thread of `camera`, once it has pushed its last capture
+    void close_camera(size_t camera);
+
+    // After every camera is closed: drains the queues, writes the last sets
+    // and the index.
+    bool stop(std::string *error);
+
+    const std::string &path() const
+    {
+        return m_path;
+    }
+    uint64_t sets() const
+    {
+        return m_sets;
+    }
+    uint64_t frames() const
+    {
+        return m_frames;
+    }
+    uint64_t late() const
+    {
+        return m_late;
+    }
+    uint64_t dropped() const
+    {
+        return m_dropped;
+    }
+
+private:
+    struct Pending
+    {
+        k4a_capture_t capture = nullptr;
+        int64_t host_ns = 0;
+        uint32_t flags = 0;
+    };
+    struct Camera
+    {
+        std::unique_ptr<FrameRing<Pending>> ring;
+        Pending head; // popped from the ring, not merged yet
+        bool has_head = false;
+        int64_t last_host_ns = 0; // writer side, keeps each camera's order strict
+    };
+
+    void run();
+    void wait_for_frames(uint32_t closed, int64_t deadline_ns);
+    void add_to_set(size_t camera, const Pending &p);
+    void release_set();
+    void write_set();
+    void fail(const std::string &msg);
+
+    RigSinkOptions m_options;
+    std::string m_path;
+    RigContainerWriter m_writer;
+    std::vector<Camera> m_cameras;
+    int64_t m_half_period_ns = 0;
+    std::thread m_thread;
+    std::function<void(const std::string &)> m_on_error;
+
+    // the set being built, merge thread only
+    std::vector<Pending> m_set;
+    std::vector<size_t> m_set_cameras;
+    uint32_t m_set_mask = 0;
+    uint32_t m_all_mask = 0;
+    int64_t m_set_ns = 0; // start of the newest set, written or being built
+    bool m_any_set = false;
+    int64_t m_last_sync_ns = 0;
+    bool m_failed = false;
+    std::string m_error;
+
+    // writers wake the merge thread through this when it sleeps
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::atomic_bool m_waiting{ false };
+    std::atomic<uint32_t> m_closed_mask{ 0 };
+
+    std::atomic<uint64_t> m_sets{ 0 };
+    std::atomic<uint64_t> m_frames{ 0 };
+    std::atomic<uint64_t> m_late{ 0 };
+    std::atomic<uint64_t> m_dropped{ 0 };
+};
+
+#endif
@@ -0,0 +1,343 @@
+#include "session_manifest.h"
+
+#include "rig_calibration.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+std::string json_string(const std::string &v)
+{
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c : v)
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c < 0x20)
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+        else
+            out << c;
+    }
+    out << '"';
+    return out.str();
+}
+
+static const char *color_format_name(k4a_image_format_t f)
+{
+    switch (f)
+    {
+    case K4A_IMAGE_FORMAT_COLOR_MJPG:
+        return "MJPG";
+    case K4A_IMAGE_FORMAT_COLOR_NV12:
+        return "NV12";
+    case K4A_IMAGE_FORMAT_COLOR_YUY2:
+        return "YUY2";
+    case K4A_IMAGE_FORMAT_COLOR_BGRA32:
+        return "BGRA32";
+    default:
+        return "other";
+    }
+}
+
+const char *color_resolution_name(k4a_color_resolution_t r)
+{
+    switch (r)
+    {
+    case K4A_COLOR_RESOLUTION_OFF:
+        return "OFF";
+    case K4A_COLOR_RESOLUTION_720P:
+        return "720P";
+    case K4A_COLOR_RESOLUTION_1080P:
+        return "1080P";
+    case K4A_COLOR_RESOLUTION_1440P:
+        return "1440P";
+    case K4A_COLOR_RESOLUTION_1536P:
+        return "1536P";
+    case K4A_COLOR_RESOLUTION_2160P:
+        return "2160P";
+    case K4A_COLOR_RESOLUTION_3072P:
+        return "3072P";
+    }
+    return "other";
+}
+
+static const char *depth_mode_name(k4a_depth_mode_t m)
+{
+    switch (m)
+    {
+    case K4A_DEPTH_MODE_OFF:
+        return "OFF";
+    case K4A_DEPTH_MODE_NFOV_2X2BINNED:
+        return "NFOV_2X2BINNED";
+    case K4A_DEPTH_MODE_NFOV_UNBINNED:
+        return "NFOV_UNBINNED";
+    case K4A_DEPTH_MODE_WFOV_2X2BINNED:
+        return "WFOV_2X2BINNED";
+    case K4A_DEPTH_MODE_WFOV_UNBINNED:
+        return "WFOV_UNBINNED";
+    case K4A_DEPTH_MODE_PASSIVE_IR:
+        return "PASSIVE_IR";
+    }
+    return "other";
+}
+
+static const char *sync_mode_name(k4a_wired_sync_mode_t m)
+{
+    switch (m)
+    {
+    case K4A_WIRED_SYNC_MODE_STANDALONE:
+        return "STANDALONE";
+    case K4A_WIRED_SYNC_MODE_MASTER:
+        return "MASTER";
+    case K4A_WIRED_SYNC_MODE_SUBORDINATE:
+        return "SUBORDINATE";
+    }
+    return "other";
+}
+
+std::string utc_timestamp_now()
+{
+    std::time_t now = std::time(nullptr);
+    std::tm tm;
+    gmtime_r(&now, &tm);
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+// Components of path made absolute against the working directory, with "."
+// and ".." resolved lexically. False if the working directory is unknown.
+static bool absolute_components(const std::string &path, std::vector<std::string> *out)
+{
+    std::string full = path;
+    if (full.empty() || full[0] != '/')
+    {
+        char cwd[PATH_MAX];
+        if (getcwd(cwd, sizeof(cwd)) == nullptr)
+            return false;
+        full = std::string(cwd) + "/" + path;
+    }
+    out->clear();
+    size_t start = 0;
+    while (start <= full.size())
+    {
+        size_t end = full.find('/', start);
+        if (end == std::string::npos)
+            end = full.size();
+        const std::string part = full.substr(start, end - start);
+        if (part == "..")
+        {
+            if (!out->empty())
+                out->pop_back();
+        }
+        else if (!part.empty() && part != ".")
+            out->push_back(part);
+        start = end + 1;
+    }
+    return true;
+}
+
+// A file as the manifest lists it: relative to the manifest's own directory,
+// which is where every reader resolves it, wherever --output-dir was.
+static std::string manifest_relative(const std::string &manifest_path, const std::string &path)
+{
+    std::vector<std::string> dir, file;
+    if (!absolute_components(manifest_path, &dir) || !absolute_components(path, &file) || dir.empty() ||
+        file.empty())
+        return path;
+    dir.pop_back(); // the manifest's file name
+    size_t common = 0;
+    while (common < dir.size() && common + 1 < file.size() && dir[common] == file[common])
+        common++;
+    std::string relative;
+    for (size_t i = common; i < dir.size(); i++)
+        relative += "../";
+    for (size_t i = common; i < file.size(); i++)
+        relative += (i > common ? "/" : "") + file[i];
+    return relative;
+}
+
+static void write_config(std::ostream &out, const k4a_device_configuration_t &c)
+{
+    out << "{\"color_format\": \"" << color_format_name(c.color_format) << "\""
+        << ", \"color_resolution\": \"" << color_resolution_name(c.color_resolution) << "\""
+        << ", \"depth_mode\": \"" << depth_mode_name(c.depth_mode) << "\""
+        << ", \"camera_fps\": " << fps_to_uint(c.camera_fps)
+        << ", \"synchronized_images_only\": " << (c.synchronized_images_only ? "true" : "false")
+        << ", \"depth_delay_off_color_usec\": " << c.depth_delay_off_color_usec
+        << ", \"wired_sync_mode\": \"" << sync_mode_name(c.wired_sync_mode) << "\""
+        << ", \"subordinate_delay_off_master_usec\": " << c.subordinate_delay_off_master_usec << "}";
+}
+
+bool write_session_manifest(Session &s, const ManifestInfo &info, const std::string &path, std::string *error)
+{
+    const DeviceCtx *master = nullptr;
+    for (auto &d : s.devices)
+        if (d.index == s.master_index)
+            master = &d;
+
+    std::ostringstream out;
+    out << "{\n";
+    out << "  \"format\": \"htk-session\",\n  \"version\": 1,\n";
+    out << "  \"tool\": " << json_string(info.tool) << ",\n";
+    out << "  \"started_utc\": " << json_string(info.started_utc) << ",\n";
+    out << "  \"ended_utc\": " << json_string(info.ended_utc) << ",\n";
+    out << "  \"completed\": " << (s.error.empty() ? "true" : "false") << ",\n";
+    if (!s.error.empty())
+        out << "  \"error\": " << json_string(s.error) << ",\n";
+    out << "  \"master\": {\"index\": " << s.master_index
+        << ", \"serial\": " << json_string(master ? master->serial : "")
+        << ", \"election\": " << json_string(info.master_election) << "},\n";
+    out << "  \"segment_seconds\": " << s.segment_seconds << ",\n";
+    if (!s.rig_calibration.empty())
+        out << "  \"rig_calibration\": {\"id\": " << json_string(rig_id_hex(s.rig_calibration_id))
+            << ", \"file\": " << json_string(manifest_relative(path, info.rig_calibration_file))
+            << ", \"attachment\": " << json_string(kRigCalibrationAttachment) << "},\n";
+    if (s.rig)
+        out << "  \"rig_file\": {\"file\": " << json_string(manifest_relative(path, s.rig->path()))
+            << ", \"sets\": " << s.rig->sets() << ", \"frames\": " << s.rig->frames()
+            << ", \"late\": " << s.rig->late() << ", \"dropped\": " << s.rig->dropped() << "},\n";
+
+    out << "  \"settings\": {";
+    for (size_t i = 0; i < info.settings.size(); i++)
+        out << (i ? ", " : "") << json_string(info.settings[i].first) << ": " << info.settings[i].second;
+    out << "},\n";
+
+    // events with where each device's writer placed them; a device that
+    // stopped before an event arrived has no placement for it
+    out << "  \"events\": [";
+    {
+        std::lock_guard<std::mutex> lock(s.event_mutex);
+        for (size_t i = 0; i < s.events.size(); i++)
+        {
+            const EventMarker &e = s.events[i];
+            std::time_t secs = static_cast<std::time_t>(e.wall_ns / 1000000000);
+            std::tm tm;
+            gmtime_r(&secs, &tm);
+            char utc[40];
+            size_t n = std::strftime(utc, sizeof(utc), "%Y-%m-%dT%H:%M:%S", &tm);
+            std::snprintf(utc + n, sizeof(utc) - n, ".%06dZ", static_cast<int>(e.wall_ns % 1000000000 / 1000));
+
+            out << (i ? ",\n" : "\n") << "    {\"label\": " << json_string(e.label) << ", \"source\": "
+                << json_string(e.source) << ", \"host_monotonic_ns\": " << e.host_ns << ", \"utc\": \"" << utc
+                << "\", \"devices\": [";
+            bool first = true;
+            for (auto &d : s.devices)
+            {
+                if (i >= d.events.size())
+                    continue;
+                out << (first ? "" : ", ") << "{\"index\": " << d.index
+                    << ", \"device_timestamp_usec\": " << d.events[i].device_timestamp_usec
+                    << ", \"segment\": " << d.events[i].segment
+                    << ", \"written\": " << (d.events[i].written ? "true" : "false") << "}";
+                first = false;
+            }
+            out << "]}";
+        }
+        out << (s.events.empty() ? "],\n" : "\n  ],\n");
+    }
+
+    out << "  \"devices\": [";
+    bool first_device = true;
+    for (auto &d : s.devices)
+    {
+        out << (first_device ? "\n" : ",\n");
+        first_device = false;
+
+        out << "    {\"index\": " << d.index << ", \"serial\": " << json_string(d.serial) << ", \"role\": \""
+            << (d.index == s.master_index ? "master" : "subordinate") << "\",\n";
+        out << "     \"config\": ";
+        write_config(out, d.config);
+        out << ",\n";
+        out << "     \"frames\": {\"written\": " << d.written << ", \"dropped\": " << d.dropped
+            << ", \"missed\": " << d.missed << ", \"corrupt\": " << d.corrupt << "},\n";
+        // color captured uncompressed (config.color_format) and recorded as
+        // JPEG encoded by us
+        if (d.encoder && d.config.color_format != K4A_IMAGE_FORMAT_COLOR_MJPG)
+        {
+            const HostJpegEncoder &e = *d.encoder;
+            out << "     \"host_jpeg\": {\"quality\": " << e.options().quality
+                << ", \"threads\": " << e.options().threads << ", \"encoded\": " << e.encoded()
+                << ", \"failed\": " << e.failed() << ", \"raw_bytes\": " << e.raw_bytes()
+                << ", \"jpeg_bytes\": " << e.jpeg_bytes() << "},\n";
+        }
+        // recorded frames are this region of the sensor image
+        if (d.encoder && d.encoder->options().crop.width > 0)
+        {
+            const ColorCrop &c = d.encoder->options().crop;
+            out << "     \"color_crop\": {\"x\": " << c.x << ", \"y\": " << c.y << ", \"width\": " << c.width
+                << ", \"height\": " << c.height << "},\n";
+        }
+
+        // frames that failed MJPEG validation, by segment index
+        out << "     \"corrupt_frames\": [";
+        for (size_t i = 0; i < d.corrupt_frames.size(); i++)
+        {
+            const CorruptFrame &f = d.corrupt_frames[i];
+            out << (i ? ", " : "") << "{\"timestamp_usec\": " << f.timestamp_usec << ", \"segment\": " << f.segment
+                << ", \"defect\": \"" << jpeg_defect_name(f.defect) << "\", \"quarantine\": "
+                << (f.quarantine_path.empty() ? "null" : json_string(manifest_relative(path, f.quarantine_path)))
+                << "}";
+        }
+        out << "],\n";
+
+        LatencySnapshot skew = d.sync_skew.snapshot();
+        out << "     \"sync_skew_usec\": {\"count\": " << skew.count() << ", \"p50\": " << skew.percentile(50) / 1000
+            << ", \"p99\": " << skew.percentile(99) / 1000 << ", \"max\": " << skew.max() / 1000 << "},\n";
+
+        out << "     \"segments\": [";
+        bool first_segment = true;
+        for (auto &seg : d.segments)
+        {
+            if (seg.checksum.empty() &&
+                hash_file_chunks(seg.path, kDefaultChunkBytes, &seg.chunks, &seg.bytes))
+            {
+                seg.chunk_size = kDefaultChunkBytes;
+                seg.checksum = file_checksum(seg.chunks);
+            }
+
+            out << (first_segment ? "\n" : ",\n");
+            first_segment = false;
+            out << "       {\"file\": " << json_string(manifest_relative(path, seg.path)) << ", \"bytes\": " << seg.bytes
+                << ", \"frames\": " << seg.frames << ", \"first_timestamp_usec\": " << seg.first_timestamp_usec
+                << ", \"last_timestamp_usec\": " << seg.last_timestamp_usec << ", \"checksum\": "
+                << (seg.checksum.empty() ? "null" : json_string(seg.checksum));
+            if (!seg.checksum.empty())
+            {
+                out << ", \"chunk_size\": " << seg.chunk_size << ", \"chunks\": [";
+                for (size_t i = 0; i < seg.chunks.size(); i++)
+                    out << (i ? ", \"" : "\"") << chunk_hash_hex(seg.chunks[i]) << "\"";
+                out << "]";
+            }
+            out << "}";
+        }
+        out << (first_segment ? "]}" : "\n     ]}");
+    }
+    out << "\n  ]\n}\n";
+
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream f(tmp_path, std::ios::trunc);
+        f << out.str();
+        f.close();
+        if (!f)
+        {
+            *error = "Unable to write " + tmp_path + ": " + std::strerror(errno);
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        *error = "Unable to rename " + tmp_path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,45 @@
+#ifndef SESSION_MANIFEST_H
+#define SESSION_MANIFEST_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "capture_session.h"
+
+// What the session itself does not know: who ran it, when, and how the
+// master was picked.
+struct ManifestInfo
+{
+    std::string tool;
+    std::string started_utc; // ISO 8601
+    std::string ended_utc;
+    std::string master_election; // "sync_jack", "index", "serial" or "simulated"
+    // color controls and other knobs applied to every device
+    std::vector<std::pair<std::string, int64_t>> settings;
+    // path of the rig_calibration.bin written for the session; listed with
+    // the session's id when the session attaches one
+    std::string rig_calibration_file;
+};
+
+// ISO 8601 UTC, second resolution
+std::string utc_timestamp_now();
+
+// quoted and escaped for a JSON document
+std::string json_string(const std::string &v);
+
+// "1440P" etc., as used in manifests
+const char *color_resolution_name(k4a_color_resolution_t r);
+
+// Writes <path> (JSON) describing a finished session: devices, master,
+// configuration, segments with sizes, timestamp ranges and checksums, frame
+// counters and sync skew. Checksums are per chunk (chunk_hash.h) so
+// htkverify can check copies in parallel. Every file is listed relative to
+// <path>'s directory, which need not be the session's output directory.
+// Segments without a checksum yet are hashed here, and files that are
+// already gone are listed without one. The file is written next to <path>
+// and renamed into place.
+bool write_session_manifest(Session &s, const ManifestInfo &info, const std::string &path, std::string *error);
+
+#endif
@@ -0,0 +1,182 @@
+#include "sim_device.h"
+
+#include "host_jpeg_encoder.h"
+#include "jpeg_payload.h"
+
+#include <cstdlib>
+
+#include <thread>
+
+using namespace std::chrono;
+
+// Video-range YCbCr with gradients, edges and a little noise, so an encoder
+// has roughly a camera frame's worth of work. NV12 or YUY2, tightly packed.
+static std::vector<uint8_t> synthetic_raw_frame(k4a_image_format_t format, int width, int height, uint32_t seed)
+{
+    const bool nv12 = format == K4A_IMAGE_FORMAT_COLOR_NV12;
+    std::vector<uint8_t> frame(nv12 ? static_cast<size_t>(width) * height * 3 / 2
+                                    : static_cast<size_t>(width) * height * 2);
+    uint32_t rng = seed;
+    auto noise = [&rng]() {
+        rng = rng * 1664525u + 1013904223u;
+        return static_cast<int>(rng >> 28); // 0-15
+    };
+    auto luma = [&](int x, int y) {
+        const int checker = ((x / 64 + y / 64 + static_cast<int>(seed)) & 1) ? 60 : 0;
+        return static_cast<uint8_t>(16 + (x * 100 / width + y * 60 / height + checker + noise()) % 220);
+    };
+    auto cb = [&](int x, int) { return static_cast<uint8_t>(64 + x * 128 / width); };
+    auto cr = [&](int, int y) { return static_cast<uint8_t>(64 + y * 128 / height); };
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            if (nv12)
+            {
+                frame[static_cast<size_t>(y) * width + x] = luma(x, y);
+                if (y % 2 == 0 && x % 2 == 0)
+                {
+                    uint8_t *uv = &frame[static_cast<size_t>(width) * height + static_cast<size_t>(y / 2) * width + x];
+                    uv[0] = cb(x, y);
+                    uv[1] = cr(x, y);
+                }
+            }
+            else
+            {
+                uint8_t *p = &frame[(static_cast<size_t>(y) * width + x) * 2];
+                p[0] = luma(x, y);
+                p[1] = x % 2 == 0 ? cb(x, y) : cr(x, y);
+            }
+        }
+    }
+    return frame;
+}
+
+SimDevice::SimDevice(const std::string &serial, std::shared_ptr<SimRig> rig, const SimDeviceOptions &options)
+    : m_serial(serial), m_rig(std::move(rig)), m_options(options)
+{
+    // a handful of sizes around the nominal one, like real scene-dependent frames
+    const double scale[] = { 0.9, 1.0, 1.05, 0.95, 1.1 };
+    uint32_t seed = 1;
+    for (char c : m_serial)
+        seed = seed * 31 + static_cast<uint8_t>(c);
+    if (m_options.format == K4A_IMAGE_FORMAT_COLOR_NV12 || m_options.format == K4A_IMAGE_FORMAT_COLOR_YUY2)
+    {
+        m_stride = m_options.format == K4A_IMAGE_FORMAT_COLOR_NV12 ? m_options.width : m_options.width * 2;
+        for (size_t i = 0; i < sizeof(scale) / sizeof(scale[0]); i++)
+            m_payloads.push_back(synthetic_raw_frame(m_options.format, m_options.width, m_options.height, seed++));
+        return;
+    }
+    if (m_options.decodable)
+    {
+        // 4:2:2 like the camera's own, with a restart marker per MCU row
+        HostJpegOptions jpeg;
+        jpeg.quality = 90;
+        jpeg.restart_rows = 1;
+        for (size_t i = 0; i < sizeof(scale) / sizeof(scale[0]); i++)
+        {
+            std::vector<uint8_t> raw =
+                synthetic_raw_frame(K4A_IMAGE_FORMAT_COLOR_YUY2, m_options.width, m_options.height, seed++);
+            uint8_t *data = nullptr;
+            size_t size = 0;
+            std::string error;
+            if (!host_jpeg_encode(K4A_IMAGE_FORMAT_COLOR_YUY2, raw.data(), m_options.width, m_options.height,
+                                  m_options.width * 2, jpeg, &data, &size, &error))
+                break;
+            m_payloads.emplace_back(data, data + size);
+            std::free(data);
+        }
+        if (!m_payloads.empty())
+            return;
+    }
+    for (double s : scale)
+    {
+        size_t bytes = static_cast<size_t>(static_cast<double>(m_options.payload_bytes) * s);
+        m_payloads.push_back(jpeg_synthetic_payload(m_options.width, m_options.height, bytes, seed++));
+    }
+}
+
+k4a_result_t SimDevice::start_cameras(const k4a_device_configuration_t *config)
+{
+    if (m_started)
+    {
+        return K4A_RESULT_FAILED;
+    }
+    m_master = config->wired_sync_mode != K4A_WIRED_SYNC_MODE_SUBORDINATE;
+    m_delay_ns = m_master ? 0 : static_cast<int64_t>(config->subordinate_delay_off_master_usec) * 1000;
+    m_frame = 0;
+    if (m_master)
+    {
+        m_rig->master_start_ns = monotonic_ns();
+    }
+    m_started = true;
+    return K4A_RESULT_SUCCEEDED;
+}
+
+void SimDevice::stop_cameras()
+{
+    m_started = false;
+}
+
+k4a_wait_result_t SimDevice::get_capture(k4a_capture_t *capture, int32_t timeout_ms)
+{
+    if (!m_started)
+    {
+        return K4A_WAIT_RESULT_FAILED;
+    }
+
+    const int64_t start = m_rig->master_start_ns.load();
+    const int64_t now = monotonic_ns();
+    const int64_t timeout_ns = static_cast<int64_t>(timeout_ms) * 1000000;
+    if (start == 0)
+    {
+        // subordinate waiting for the master's sync pulses
+        std::this_thread::sleep_for(nanoseconds(timeout_ns));
+        return K4A_WAIT_RESULT_TIMEOUT;
+    }
+
+    const int64_t period_ns = 1000000000 / m_options.fps;
+    int64_t due = start + m_delay_ns + static_cast<int64_t>(m_frame) * period_ns;
+    if (due < now - period_ns)
+    {
+        // we were not polled in time; the real SDK drops those frames too
+        m_frame = static_cast<uint64_t>((now - start - m_delay_ns) / period_ns);
+        due = start + m_delay_ns + static_cast<int64_t>(m_frame) * period_ns;
+    }
+    if (due - now > timeout_ns)
+    {
+        std::this_thread::sleep_for(nanoseconds(timeout_ns));
+        return K4A_WAIT_RESULT_TIMEOUT;
+    }
+    if (due > now)
+    {
+        std::this_thread::sleep_for(nanoseconds(due - now));
+    }
+
+    auto &payload = m_payloads[m_frame % m_payloads.size()];
+    k4a_image_t image = nullptr;
+    if (K4A_FAILED(k4a_image_create_from_buffer(m_stride ? m_options.format : K4A_IMAGE_FORMAT_COLOR_MJPG,
+                                                m_options.width,
+                                                m_options.height,
+                                                m_stride,
+                                                payload.data(),
+                                                payload.size(),
+                                                nullptr,
+                                                nullptr,
+                                                &image)))
+    {
+        return K4A_WAIT_RESULT_FAILED;
+    }
+    k4a_image_set_device_timestamp_usec(image, static_cast<uint64_t>(due - start) / 1000);
+    k4a_image_set_system_timestamp_nsec(image, static_cast<uint64_t>(due));
+
+    if (K4A_FAILED(k4a_capture_create(capture)))
+    {
+        k4a_image_release(image);
+        return K4A_WAIT_RESULT_FAILED;
+    }
+    k4a_capture_set_color_image(*capture, image);
+    k4a_image_release(image);
+    m_frame++;
+    return K4A_WAIT_RESULT_SUCCEEDED;
+}
@@ -0,0 +1,68 @@
+#ifndef SIM_DEVICE_H
+#define SIM_DEVICE_H
+
+#include "capture_device.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Shared timebase for a simulated rig. Like the real sync cable, subordinate
+// devices produce nothing until the master has started.
+struct SimRig
+{
+    std::atomic<int64_t> master_start_ns{ 0 };
+};
+
+struct SimDeviceOptions
+{
+    int fps = 30;
+    int width = 2560;
+    int height = 1440;
+    size_t payload_bytes = 700 * 1024; // MJPEG only
+    // MJPG, or NV12/YUY2 for host-side encoding (a textured test pattern)
+    k4a_image_format_t format = K4A_IMAGE_FORMAT_COLOR_MJPG;
+    // MJPEG of the test pattern that really decodes, for cropping; needs a
+    // build with libjpeg and ignores payload_bytes
+    bool decodable = false;
+};
+
+// Produces MJPEG-shaped (or uncompressed) color captures at the configured
+// rate with device timestamps on the rig's timebase. Payloads are generated
+// once and shared by every capture, so the per-frame cost is only the SDK
+// image/capture objects.
+class SimDevice : public CaptureDevice
+{
+public:
+    SimDevice(const std::string &serial, std::shared_ptr<SimRig> rig, const SimDeviceOptions &options);
+
+    const std::string &serial() const override
+    {
+        return m_serial;
+    }
+    k4a_device_t handle() const override
+    {
+        return nullptr;
+    }
+
+    k4a_result_t start_cameras(const k4a_device_configuration_t *config) override;
+    void stop_cameras() override;
+    k4a_wait_result_t get_capture(k4a_capture_t *capture, int32_t timeout_ms) override;
+
+private:
+    std::string m_serial;
+    std::shared_ptr<SimRig> m_rig;
+    SimDeviceOptions m_options;
+    std::vector<std::vector<uint8_t>> m_payloads;
+    int m_stride = 0; // 0 for MJPEG
+
+    std::atomic_bool m_started{ false };
+    bool m_master = false;
+    int64_t m_delay_ns = 0;
+    uint64_t m_frame = 0;
+};
+
+#endif
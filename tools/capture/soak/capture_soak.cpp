@@ -0,0 +1,442 @@
+// Long-running soak of the full recording pipeline against simulated devices.
+//
+//   htkcapture_soak --devices 8 --seconds 14400 --csv soak.csv
+//
+// Samples RSS, heap fragmentation, open fds, drops and write latency every
+// --sample-seconds and exits with status 2 as soon as a threshold is
+// exceeded. Segments are deleted as they close unless --keep-segments is
+// given, so hours of 8-camera data fit on any disk.
+//
+// --faults FILE injects scripted device and disk faults (fault_injection.h).
+// --manifest FILE writes the session manifest (session_manifest.h) at the end.
+// --event-socket PATH takes event markers like htkrecorder (event_markers.h).
+// --rig-file FILE also merges every device into one rig file (rig_sink.h).
+// --color-format nv12|yuy2 simulates uncompressed 720p color encoded on the
+// host at --jpeg-quality with --jpeg-threads per device (host_jpeg_encoder.h).
+// --crop X,Y,WxH records that region of every device, from MJPEG test frames
+// that decode when the color format is mjpg.
+// Exit status: 0 pass, 1 the pipeline failed, 2 a threshold was exceeded.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <malloc.h>
+#include <unistd.h>
+
+#include "../capture_session.h"
+#include "../cli.h"
+#include "../event_markers.h"
+#include "../fault_injection.h"
+#include "../session_manifest.h"
+#include "../sim_device.h"
+
+using namespace std::chrono;
+
+struct Thresholds
+{
+    double max_rss_growth_mb = 64;
+    uint64_t max_drops = 0;
+    uint64_t max_missed = 0;
+    double max_write_p99_ms = 100;
+    long max_fd_growth = 4;
+};
+
+struct Sample
+{
+    double elapsed_sec = 0;
+    double rss_mb = 0;
+    double heap_mb = 0;
+    double heap_free_mb = 0;
+    long fds = 0;
+    uint64_t written = 0;
+    uint64_t dropped = 0;
+    uint64_t missed = 0;
+    uint64_t corrupt = 0;
+    LatencySnapshot write_latency;
+};
+
+static double rss_mb()
+{
+    long pages_total = 0, pages_resident = 0;
+    FILE *f = std::fopen("/proc/self/statm", "r");
+    if (f == nullptr)
+        return 0;
+    if (std::fscanf(f, "%ld %ld", &pages_total, &pages_resident) != 2)
+        pages_resident = 0;
+    std::fclose(f);
+    return static_cast<double>(pages_resident) * static_cast<double>(sysconf(_SC_PAGESIZE)) / (1024.0 * 1024.0);
+}
+
+static long open_fds()
+{
+    long n = 0;
+    if (DIR *d = opendir("/proc/self/fd"))
+    {
+        while (dirent *e = readdir(d))
+        {
+            if (e->d_name[0] != '.')
+                n++;
+        }
+        closedir(d);
+    }
+    return n - 1; // the DIR itself
+}
+
+static void heap_usage(double *heap_mb, double *free_mb)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    *heap_mb = static_cast<double>(mi.arena + mi.hblkhd) / (1024.0 * 1024.0);
+    // free bytes the allocator holds but cannot hand back: fragmentation
+    *free_mb = static_cast<double>(mi.fordblks) / (1024.0 * 1024.0);
+#else
+    *heap_mb = 0;
+    *free_mb = 0;
+#endif
+}
+
+static Sample take_sample(Session &s, steady_clock::time_point start)
+{
+    Sample x;
+    x.elapsed_sec = duration<double>(steady_clock::now() - start).count();
+    x.rss_mb = rss_mb();
+    heap_usage(&x.heap_mb, &x.heap_free_mb);
+    x.fds = open_fds();
+    for (auto &d : s.devices)
+    {
+        x.written += d.written;
+        x.dropped += d.dropped;
+        x.missed += d.missed;
+        x.corrupt += d.corrupt;
+        x.write_latency.merge(d.write_latency.snapshot());
+    }
+    return x;
+}
+
+static double ms(uint64_t ns)
+{
+    return static_cast<double>(ns) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    int device_count = 8;
+    int recording_seconds = 600;
+    int fps = 30;
+    int payload_kb = 700;
+    int sample_seconds = 10;
+    int warmup_seconds = 60;
+    Thresholds limits;
+
+    Session session;
+    session.segment_seconds = 60;
+
+    std::string tmp;
+    if (parse_arg_value(argc, argv, "--devices", tmp))
+        device_count = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--seconds", tmp))
+        recording_seconds = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--fps", tmp))
+        fps = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--payload-kb", tmp))
+        payload_kb = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--sample-seconds", tmp))
+        sample_seconds = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--warmup-seconds", tmp))
+        warmup_seconds = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--queue-frames", tmp))
+        session.queue_frames = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--segment-seconds", tmp))
+        session.segment_seconds = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--sync-ms", tmp))
+        session.sync_ms = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--jpeg-check", tmp) && !parse_jpeg_check(tmp, &session.jpeg_check))
+        die("--jpeg-check must be off, count or quarantine.");
+
+    if (parse_arg_value(argc, argv, "--max-rss-growth-mb", tmp))
+        limits.max_rss_growth_mb = std::stod(tmp);
+    if (parse_arg_value(argc, argv, "--max-drops", tmp))
+        limits.max_drops = std::stoull(tmp);
+    if (parse_arg_value(argc, argv, "--max-missed", tmp))
+        limits.max_missed = std::stoull(tmp);
+    if (parse_arg_value(argc, argv, "--max-write-p99-ms", tmp))
+        limits.max_write_p99_ms = std::stod(tmp);
+    if (parse_arg_value(argc, argv, "--max-fd-growth", tmp))
+        limits.max_fd_growth = std::stol(tmp);
+
+    k4a_image_format_t color_format = K4A_IMAGE_FORMAT_COLOR_MJPG;
+    if (parse_arg_value(argc, argv, "--color-format", tmp))
+    {
+        if (tmp == "nv12")
+            color_format = K4A_IMAGE_FORMAT_COLOR_NV12;
+        else if (tmp == "yuy2")
+            color_format = K4A_IMAGE_FORMAT_COLOR_YUY2;
+        else if (tmp != "mjpg")
+            die("--color-format must be mjpg, nv12 or yuy2.");
+    }
+    HostJpegOptions host_jpeg;
+    if (parse_arg_value(argc, argv, "--jpeg-quality", tmp) && !parse_jpeg_quality(tmp, &host_jpeg))
+        die("--jpeg-quality must be 1-100.");
+    if (parse_arg_value(argc, argv, "--jpeg-threads", tmp))
+        host_jpeg.threads = std::stoi(tmp);
+    if (parse_arg_value(argc, argv, "--crop", tmp) && !parse_color_crop(tmp, &host_jpeg.crop))
+        die("--crop must be X,Y,WxH.");
+    const bool cropped = host_jpeg.crop.width > 0;
+    if (color_format != K4A_IMAGE_FORMAT_COLOR_MJPG || cropped)
+    {
+        std::string error;
+        if (host_jpeg.threads < 1)
+            die("--jpeg-threads must be at least 1.");
+        if (!host_jpeg_available(host_jpeg, &error))
+            die(error);
+    }
+
+    const bool keep_segments = has_flag(argc, argv, "--keep-segments");
+
+    std::string csv_path;
+    parse_arg_value(argc, argv, "--csv", csv_path);
+
+    std::string manifest_path;
+    parse_arg_value(argc, argv, "--manifest", manifest_path);
+
+    std::string event_socket;
+    if (parse_arg_value(argc, argv, "--event-socket", event_socket))
+        session.event_track = true;
+
+    std::string rig_file;
+    parse_arg_value(argc, argv, "--rig-file", rig_file);
+
+    std::string fault_script;
+    std::vector<FaultRule> faults;
+    if (parse_arg_value(argc, argv, "--faults", fault_script))
+    {
+        std::string error;
+        if (!load_fault_script(fault_script, &faults, &error))
+            die("Bad --faults script: " + error);
+    }
+
+    bool own_output_dir = false;
+    if (!parse_arg_value(argc, argv, "--output-dir", session.output_dir))
+    {
+        const char *base = std::getenv("TMPDIR");
+        std::string pattern = std::string(base ? base : "/tmp") + "/htkcapture_soak_XXXXXX";
+        std::vector<char> buf(pattern.begin(), pattern.end());
+        buf.push_back('\0');
+        if (mkdtemp(buf.data()) == nullptr)
+            die("Unable to create scratch directory for segments.");
+        session.output_dir = buf.data();
+        own_output_dir = true;
+    }
+
+    if (device_count < 1 || fps < 1 || sample_seconds < 1 || session.queue_frames < 1)
+        die("--devices, --fps, --sample-seconds and --queue-frames must be positive.");
+
+    k4a_fps_t camera_fps;
+    switch (fps)
+    {
+    case 5:
+        camera_fps = K4A_FRAMES_PER_SECOND_5;
+        break;
+    case 15:
+        camera_fps = K4A_FRAMES_PER_SECOND_15;
+        break;
+    case 30:
+        camera_fps = K4A_FRAMES_PER_SECOND_30;
+        break;
+    default:
+        die("--fps must be 5, 15 or 30.");
+        return 1;
+    }
+
+    if (!keep_segments)
+    {
+        session.on_segment_closed = [](DeviceCtx &, const SegmentInfo &seg) { unlink(seg.path.c_str()); };
+    }
+
+    // simulated rig: device 0 is the master, everything else hangs off its sync out
+    auto rig = std::make_shared<SimRig>();
+    SimDeviceOptions sim;
+    sim.fps = fps;
+    sim.payload_bytes = static_cast<size_t>(payload_kb) * 1024;
+    sim.format = color_format;
+    if (color_format != K4A_IMAGE_FORMAT_COLOR_MJPG)
+    {
+        sim.width = 1280;
+        sim.height = 720;
+    }
+    sim.decodable = cropped && color_format == K4A_IMAGE_FORMAT_COLOR_MJPG;
+    host_jpeg.output_buffers = static_cast<size_t>(session.queue_frames + host_jpeg.threads) + 4;
+    if (cropped && !align_color_crop(&host_jpeg.crop, sim.width, sim.height))
+        die("--crop is outside the " + std::to_string(sim.width) + "x" + std::to_string(sim.height) + " frame.");
+
+    session.master_index = 0;
+    for (int i = 0; i < device_count; i++)
+    {
+        session.devices.emplace_back();
+        DeviceCtx &d = session.devices.back();
+        d.index = i;
+        std::ostringstream serial;
+        serial << "sim" << std::setw(9) << std::setfill('0') << i;
+        d.serial = serial.str();
+        d.device.reset(new SimDevice(d.serial, rig, sim));
+
+        d.config = K4A_DEVICE_CONFIG_INIT_DISABLE_ALL;
+        d.config.color_format = color_format;
+        d.config.color_resolution =
+            color_format == K4A_IMAGE_FORMAT_COLOR_MJPG ? K4A_COLOR_RESOLUTION_1440P : K4A_COLOR_RESOLUTION_720P;
+        if (color_format != K4A_IMAGE_FORMAT_COLOR_MJPG || cropped)
+            d.encoder.reset(new HostJpegEncoder(host_jpeg));
+        d.config.camera_fps = camera_fps;
+        d.config.wired_sync_mode = i == 0 ? K4A_WIRED_SYNC_MODE_MASTER : K4A_WIRED_SYNC_MODE_SUBORDINATE;
+        d.config.subordinate_delay_off_master_usec = i == 0 ? 0 : 160;
+    }
+
+    std::ofstream csv;
+    if (!csv_path.empty())
+    {
+        csv.open(csv_path);
+        if (!csv)
+            die("Unable to open " + csv_path);
+        csv << "elapsed_s,rss_mb,heap_mb,heap_free_mb,fds,written,dropped,missed,"
+               "write_p50_ms,write_p99_ms,write_p999_ms,write_max_ms\n";
+    }
+
+    std::cout << "Soaking " << device_count << " simulated device(s) for " << recording_seconds << "s, segments in "
+              << session.output_dir << std::endl;
+
+    if (!faults.empty())
+    {
+        install_faults(session, faults);
+        std::cout << "Injecting " << faults.size() << " fault rule(s) from " << fault_script << std::endl;
+    }
+
+    RigSinkOptions rig_options;
+    rig_options.sync_ms = session.sync_ms;
+    if (!session_open_recordings(session) ||
+        (!rig_file.empty() && !session_open_rig_file(session, rig_file, rig_options)) ||
+        !session_start_cameras(session))
+        die(session.error);
+
+    const auto start = steady_clock::now();
+    ManifestInfo manifest;
+    manifest.tool = "htkcapture_soak";
+    manifest.master_election = "simulated";
+    manifest.started_utc = utc_timestamp_now();
+    if (!session_start_threads(session))
+    {
+        session_stop(session);
+        die(session.error);
+    }
+
+    EventServer events(session);
+    if (!event_socket.empty())
+    {
+        std::string error;
+        if (!events.listen_socket(event_socket, &error))
+            die(error);
+        events.start();
+    }
+
+    std::vector<std::string> violations;
+    Sample baseline = take_sample(session, start);
+    Sample previous = baseline;
+    bool warmed_up = warmup_seconds <= 0;
+
+    while (!session.stop && violations.empty())
+    {
+        auto next = start + seconds(static_cast<int64_t>(previous.elapsed_sec / sample_seconds + 1) * sample_seconds);
+        auto end = start + seconds(recording_seconds);
+        std::this_thread::sleep_until(std::min(next, end));
+
+        Sample now = take_sample(session, start);
+        LatencySnapshot interval = now.write_latency.since(previous.write_latency);
+
+        if (csv.is_open())
+        {
+            csv << std::fixed << std::setprecision(1) << now.elapsed_sec << "," << now.rss_mb << "," << now.heap_mb
+                << "," << now.heap_free_mb << "," << now.fds << "," << now.written << "," << now.dropped << ","
+                << now.missed << "," << std::setprecision(3) << ms(interval.percentile(50)) << ","
+                << ms(interval.percentile(99)) << "," << ms(interval.percentile(99.9)) << ","
+                << ms(interval.max()) << "\n";
+            csv.flush();
+        }
+
+        if (!warmed_up && now.elapsed_sec >= warmup_seconds)
+        {
+            // allocator pools and page cache settle during warmup; growth is measured from here
+            baseline = now;
+            warmed_up = true;
+        }
+        else if (warmed_up)
+        {
+            std::ostringstream why;
+            if (now.rss_mb - baseline.rss_mb > limits.max_rss_growth_mb)
+                why << "RSS grew " << now.rss_mb - baseline.rss_mb << " MB (limit " << limits.max_rss_growth_mb << ")";
+            else if (now.fds - baseline.fds > limits.max_fd_growth)
+                why << "open fds grew by " << now.fds - baseline.fds << " (limit " << limits.max_fd_growth << ")";
+            else if (now.dropped - baseline.dropped > limits.max_drops)
+                why << now.dropped - baseline.dropped << " frames dropped at the queue (limit " << limits.max_drops << ")";
+            else if (now.missed - baseline.missed > limits.max_missed)
+                why << now.missed - baseline.missed << " frames missing from devices (limit " << limits.max_missed << ")";
+            else if (ms(interval.percentile(99)) > limits.max_write_p99_ms)
+                why << "write p99 " << ms(interval.percentile(99)) << " ms (limit " << limits.max_write_p99_ms << ")";
+            if (!why.str().empty())
+                violations.push_back("t=" + std::to_string(static_cast<int>(now.elapsed_sec)) + "s: " + why.str());
+        }
+
+        previous = now;
+        if (now.elapsed_sec >= recording_seconds)
+            break;
+    }
+
+    events.stop();
+    session_stop(session);
+    if (!manifest_path.empty())
+    {
+        manifest.ended_utc = utc_timestamp_now();
+        std::string error;
+        if (!write_session_manifest(session, manifest, manifest_path, &error))
+            std::cerr << error << std::endl;
+    }
+    Sample last = take_sample(session, start);
+
+    if (own_output_dir && !keep_segments)
+        rmdir(session.output_dir.c_str());
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Frames written: " << last.written << ", dropped: " << last.dropped << ", missed: " << last.missed
+              << ", corrupt: " << last.corrupt << std::endl;
+    if (session.rig)
+        std::cout << "Rig file: " << session.rig->sets() << " frame sets, " << session.rig->frames() << " frames, "
+                  << session.rig->late() << " late, " << session.rig->dropped() << " dropped" << std::endl;
+    std::cout << "RSS: " << baseline.rss_mb << " MB after warmup, " << last.rss_mb << " MB at end; heap free "
+              << last.heap_free_mb << " MB of " << last.heap_mb << " MB" << std::endl;
+    std::cout << "Write latency p50/p99/p99.9/max: " << ms(last.write_latency.percentile(50)) << " / "
+              << ms(last.write_latency.percentile(99)) << " / " << ms(last.write_latency.percentile(99.9)) << " / "
+              << ms(last.write_latency.max()) << " ms" << std::endl;
+    print_latency_report(session, std::cout);
+    print_host_jpeg_report(session, std::cout);
+
+    if (!session.error.empty())
+        die("Pipeline failed: " + session.error);
+
+    if (!violations.empty())
+    {
+        for (auto &v : violations)
+            std::cerr << "THRESHOLD EXCEEDED " << v << std::endl;
+        return 2;
+    }
+
+    std::cout << "PASS" << std::endl;
+    return 0;
+}
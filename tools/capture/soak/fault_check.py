@@ -0,0 +1,128 @@
+"""
+Runs htkcapture_soak against scripted faults (see ../fault_injection.h) and
+checks what the pipeline did about them: exit status, counters and the
+session manifest, and the quarantine directory. Registered with ctest:
+
+    python3 fault_check.py build/capture/htkcapture_soak /tmp/fault_check
+
+Each case records 2 simulated devices for a few seconds; the whole run takes
+about half a minute. Exits 1 if any case fails.
+"""
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+SECONDS = 4
+
+# the cases check how faults are handled, not throughput; a loaded test
+# machine must not trip the soak thresholds
+LENIENT = ["--max-missed", "100000", "--max-drops", "100000", "--max-write-p99-ms", "100000",
+           "--max-rss-growth-mb", "100000", "--max-fd-growth", "100000"]
+
+# name, fault script, extra soak arguments, check(status, manifest, out_dir) -> error or None
+CASES = []
+
+
+def case(name, script, *args):
+    def register(check):
+        CASES.append((name, script, list(args), check))
+        return check
+    return register
+
+
+def frames(manifest, key):
+    return [d["frames"][key] for d in manifest["devices"]]
+
+
+@case("device_timeout", "device:* timeout at=1s for=1s")
+def check_timeout(status, manifest, out_dir):
+    if status != 0:
+        return "exit status %d, expected 0: a stalled device must not end the recording" % status
+    if not manifest["completed"]:
+        return "manifest not marked completed"
+    if min(frames(manifest, "missed")) == 0:
+        return "no missed frames counted for the stall: %s" % frames(manifest, "missed")
+    if min(frames(manifest, "written")) == 0:
+        return "nothing written after the stall"
+    return None
+
+
+@case("device_corrupt", "device:0 corrupt frame=20 frames=5", "--jpeg-check", "quarantine")
+def check_corrupt(status, manifest, out_dir):
+    if status != 0:
+        return "exit status %d, expected 0: corrupt frames must not end the recording" % status
+    if frames(manifest, "corrupt") != [5, 0]:
+        return "corrupt counts %s, expected [5, 0]" % frames(manifest, "corrupt")
+    bad = manifest["devices"][0]["corrupt_frames"]
+    paths = [f.get("quarantine") for f in bad]
+    # listed relative to the manifest, which is next to the output directory
+    base = os.path.dirname(out_dir)
+    if len(paths) != 5 or not all(p and os.path.isfile(os.path.join(base, p)) for p in paths):
+        return "quarantine files missing: %s" % paths
+    return None
+
+
+@case("sink_eio", "sink:* eio frame=30")
+def check_eio(status, manifest, out_dir):
+    if status != 1:
+        return "exit status %d, expected 1: a failed write must fail the pipeline" % status
+    if manifest["completed"]:
+        return "manifest marked completed after a write error"
+    if frames(manifest, "written") != [30, 30]:
+        return "written %s, expected [30, 30] up to the failed write" % frames(manifest, "written")
+    return None
+
+
+# the slow rule comes first and covers every frame; the disk must fill anyway
+@case("sink_full", "sink:* slow frame=0 frames=100000 ms=1\nsink:* full frame=40 every=5")
+def check_full(status, manifest, out_dir):
+    if status != 1:
+        return "exit status %d, expected 1: a full disk must fail the pipeline" % status
+    if manifest["completed"]:
+        return "manifest marked completed on a full disk"
+    if frames(manifest, "written") != [40, 40]:
+        return "written %s, expected [40, 40] up to the full disk" % frames(manifest, "written")
+    return None
+
+
+def run_case(soak, scratch, name, script, args, check):
+    root = os.path.join(scratch, name)
+    out_dir = os.path.join(root, "out")
+    shutil.rmtree(root, ignore_errors=True)
+    os.makedirs(out_dir)
+    faults = os.path.join(root, "faults.txt")
+    with open(faults, "w") as f:
+        f.write(script + "\n")
+    manifest_path = os.path.join(root, "manifest.json")
+    cmd = [soak, "--devices", "2", "--seconds", str(SECONDS), "--sample-seconds", "1",
+           "--warmup-seconds", "0", "--output-dir", out_dir, "--keep-segments",
+           "--manifest", manifest_path, "--faults", faults] + LENIENT + args
+    result = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    try:
+        with open(manifest_path) as f:
+            manifest = json.load(f)
+    except (OSError, ValueError) as e:
+        return "no usable manifest (%s)\n%s" % (e, result.stdout)
+    error = check(result.returncode, manifest, out_dir)
+    return None if error is None else error + "\n" + result.stdout
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage: fault_check.py HTKCAPTURE_SOAK SCRATCH_DIR")
+        return 2
+    soak, scratch = sys.argv[1], sys.argv[2]
+    failed = 0
+    for name, script, args, check in CASES:
+        error = run_case(soak, scratch, name, script, args, check)
+        print("%-16s %s" % (name, "ok" if error is None else "FAILED: " + error))
+        failed += error is not None
+    if not failed:
+        shutil.rmtree(scratch, ignore_errors=True)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,93 @@
+"""
+Records with htkcapture_soak and checks that htkverify finds every file the
+session manifest lists, with the manifest inside the output directory and
+outside it (--manifest elsewhere). Registered with ctest:
+
+    python3 manifest_check.py build/capture/htkcapture_soak build/capture/htkverify /tmp/manifest_check
+
+The soak runs from the scratch directory with relative paths, as an operator
+would type them. Exits 1 if any case fails.
+"""
+import json
+import os
+import shutil
+import subprocess
+import sys
+
+SECONDS = 2
+
+# see fault_check.py; two quarantined frames give the manifest a second kind of path
+LENIENT = ["--max-missed", "100000", "--max-drops", "100000", "--max-write-p99-ms", "100000",
+           "--max-rss-growth-mb", "100000", "--max-fd-growth", "100000"]
+FAULTS = "device:0 corrupt frame=10 frames=2\n"
+
+# name, output directory, manifest path; both relative to the case's directory
+CASES = [
+    ("inside", "out", "out/session_manifest.json"),
+    ("beside", "out", "manifests/take_001.json"),
+    ("above", "takes/take_001", "take_001.json"),
+]
+
+
+def listed_files(manifest):
+    for d in manifest["devices"]:
+        for seg in d["segments"]:
+            yield seg["file"]
+        for f in d["corrupt_frames"]:
+            if f.get("quarantine"):
+                yield f["quarantine"]
+
+
+def run_case(soak, verify, root, out_dir, manifest_rel):
+    os.makedirs(os.path.join(root, out_dir))
+    os.makedirs(os.path.dirname(os.path.join(root, manifest_rel)), exist_ok=True)
+    with open(os.path.join(root, "faults.txt"), "w") as f:
+        f.write(FAULTS)
+    cmd = [soak, "--devices", "2", "--seconds", str(SECONDS), "--sample-seconds", "1",
+           "--warmup-seconds", "0", "--segment-seconds", "1", "--output-dir", out_dir, "--keep-segments",
+           "--manifest", manifest_rel, "--faults", "faults.txt", "--jpeg-check", "quarantine"] + LENIENT
+    result = subprocess.run(cmd, cwd=root, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    if result.returncode != 0:
+        return "soak exit status %d\n%s" % (result.returncode, result.stdout)
+
+    manifest_path = os.path.join(root, manifest_rel)
+    with open(manifest_path) as f:
+        manifest = json.load(f)
+    files = list(listed_files(manifest))
+    if not any(f.endswith(".jpg") for f in files):
+        return "no quarantined frames listed"
+    base = os.path.dirname(manifest_path)
+    for f in files:
+        if os.path.isabs(f):
+            return "%s is absolute, expected relative to the manifest" % f
+        if not os.path.isfile(os.path.join(base, f)):
+            return "%s does not resolve against the manifest's directory" % f
+
+    # from another working directory, as a copy on a server would be checked
+    result = subprocess.run([verify, "--threads", "2", os.path.abspath(manifest_path)], cwd="/",
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    if result.returncode != 0:
+        return "htkverify exit status %d\n%s" % (result.returncode, result.stdout)
+    return None
+
+
+def main():
+    if len(sys.argv) != 4:
+        print("usage: manifest_check.py HTKCAPTURE_SOAK HTKVERIFY SCRATCH_DIR")
+        return 2
+    soak, verify, scratch = [os.path.abspath(a) for a in sys.argv[1:]]
+    failed = 0
+    for name, out_dir, manifest_rel in CASES:
+        root = os.path.join(scratch, name)
+        shutil.rmtree(root, ignore_errors=True)
+        error = run_case(soak, verify, root, out_dir, manifest_rel)
+        print("%-8s %s" % (name, "ok" if error is None else "FAILED: " + error))
+        failed += error is not None
+    if not failed:
+        shutil.rmtree(scratch, ignore_errors=True)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,619 @@
+// Packs recordings into a frame store (frame_store.h) and reads them back.
+//
+//   htkstore pack [--threads N] [--shard-gb 4] [--writer buffered|direct|uring]
+//                 STORE session_manifest.json|DIR|recording.mkv ...
+//   htkstore ls STORE
+//   htkstore extract [--threads N] [--frames A:B] STORE TAKE SERIAL OUT_DIR
+//   htkstore verify [--threads N] STORE
+//   htkstore optimize [--threads N] [--shard-gb 4] [--writer buffered|direct|uring] STORE NEW_STORE
+//
+// pack stores every color frame of every camera of every take as recorded:
+// MJPEG payloads are copied without decoding (padding after EOI is trimmed),
+// with the frame's flags from the metadata track. Directories are searched
+// for session_manifest.json; the take is the session directory's path
+// relative to the directory given (its own name for a manifest or MKV given
+// directly). Each camera of a take is a stream, and streams are packed in
+// parallel, each thread appending to a shard of its own.
+//
+// extract writes frame_<NNNNNN>.jpg files like tools/mkv/split.py, for tools
+// that want files. verify reads every frame in parallel and checks its JPEG
+// structure (jpeg_payload.h).
+//
+// optimize copies a store with every JPEG losslessly recompressed with its
+// own optimised Huffman tables (optimize_jpeg_huffman in
+// undistort/jpeg_image.h), which saves 10-20% over the generic tables the
+// camera uses. Frames are recompressed in parallel, a batch at a time, and
+// each result is decoded and checked against the original's coefficients
+// before it is written. A frame that does not decode, that the camera
+// flagged corrupt, or that would not shrink is copied as it is; frames that
+// do not decode or fail the check are listed and counted in the summary.
+// Exit status: 0 done, 1 bad arguments or input, 2 a stream or frame failed.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <k4a/k4a.h>
+#include <k4arecord/playback.h>
+
+#include "../cli.h"
+#include "../frame_metadata.h"
+#include "../frame_store.h"
+#include "../jpeg_payload.h"
+#include "../json_reader.h"
+#include "../work_stealing_pool.h"
+
+#ifdef HTK_HAVE_JPEG_IMAGE
+#include "../undistort/jpeg_image.h"
+#endif
+
+using namespace std::chrono;
+
+struct PackJob
+{
+    std::string take;
+    std::string serial;
+    int device_index = -1;
+    std::vector<std::string> segments;
+    uint64_t bytes = 0; // of the recordings, to start the big ones first
+};
+
+static std::string dirname_of(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+static std::string basename_of(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static unsigned thread_count(int argc, char **argv)
+{
+    std::string tmp;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (parse_arg_value(argc, argv, "--threads", tmp))
+        threads = static_cast<unsigned>(std::max(1, std::stoi(tmp)));
+    return threads;
+}
+
+// Positional arguments after the command, skipping flags and their values.
+static std::vector<std::string> positional(int argc, char **argv)
+{
+    static const char *const value_flags[] = { "--threads", "--shard-gb", "--writer", "--frames" };
+    std::vector<std::string> out;
+    for (int i = 2; i < argc; i++)
+    {
+        if (argv[i][0] != '-')
+        {
+            out.push_back(argv[i]);
+            continue;
+        }
+        for (const char *flag : value_flags)
+            if (std::strcmp(argv[i], flag) == 0)
+                i++;
+    }
+    return out;
+}
+
+static void find_manifests(const std::string &dir, const std::string &relative, std::vector<std::string> *out,
+                           std::vector<std::string> *takes)
+{
+    std::vector<std::string> entries;
+    if (DIR *d = opendir(dir.c_str()))
+    {
+        while (dirent *e = readdir(d))
+            if (std::strcmp(e->d_name, ".") != 0 && std::strcmp(e->d_name, "..") != 0)
+                entries.push_back(e->d_name);
+        closedir(d);
+    }
+    std::sort(entries.begin(), entries.end());
+    struct stat st;
+    for (auto &e : entries)
+    {
+        const std::string child = dir + "/" + e;
+        if (stat(child.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+        {
+            find_manifests(child, relative.empty() ? e : relative + "/" + e, out, takes);
+        }
+        else if (e == "session_manifest.json")
+        {
+            out->push_back(child);
+            takes->push_back(relative.empty() ? basename_of(dir) : relative);
+        }
+    }
+}
+
+static void add_session(const std::string &manifest_path, const std::string &take, std::vector<PackJob> *jobs)
+{
+    JsonValue manifest;
+    std::string error;
+    if (!load_json_file(manifest_path, &manifest, &error))
+        die(error);
+    const JsonValue *devices = manifest.get("devices");
+    if (devices == nullptr || devices->type != JsonValue::Array)
+        die(manifest_path + " is not a session manifest.");
+    const std::string root = dirname_of(manifest_path);
+    for (auto &d : devices->items)
+    {
+        PackJob job;
+        job.take = take;
+        job.device_index = d.get("index") ? static_cast<int>(d.get("index")->int64()) : -1;
+        job.serial = d.get("serial") ? d.get("serial")->str() : "";
+        if (const JsonValue *segments = d.get("segments"))
+        {
+            for (auto &s : segments->items)
+            {
+                const std::string file = s.get("file") ? s.get("file")->str() : "";
+                job.segments.push_back(file.empty() || file[0] == '/' ? file : root + "/" + file);
+                job.bytes += s.get("bytes") ? s.get("bytes")->uint64() : 0;
+            }
+        }
+        if (!job.segments.empty())
+            jobs->push_back(job);
+    }
+}
+
+static void add_recording(const std::string &path, std::vector<PackJob> *jobs)
+{
+    PackJob job;
+    const std::string dir = dirname_of(path);
+    job.take = basename_of(dir == "." ? std::string(".") : dir);
+    k4a_playback_t playback = nullptr;
+    if (K4A_FAILED(k4a_playback_open(path.c_str(), &playback)))
+        die("Unable to open " + path);
+    char serial[64] = { 0 };
+    size_t size = sizeof(serial);
+    if (k4a_playback_get_tag(playback, "K4A_DEVICE_SERIAL_NUMBER", serial, &size) == K4A_BUFFER_RESULT_SUCCEEDED)
+        job.serial = serial;
+    k4a_playback_close(playback);
+    if (job.serial.empty())
+    {
+        const std::string name = basename_of(path);
+        job.serial = name.substr(0, name.rfind('.'));
+    }
+    struct stat st;
+    job.bytes = stat(path.c_str(), &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+    job.segments.push_back(path);
+    jobs->push_back(job);
+}
+
+// Streams one camera's segments into the store.
+static bool pack_stream(FrameStoreWriter &writer, const PackJob &job, size_t *frames, std::string *error)
+{
+    size_t stream = 0;
+    if (!writer.begin_stream(job.take, job.serial, job.device_index, &stream, error))
+        return false;
+    bool ok = true;
+    for (size_t s = 0; s < job.segments.size() && ok; s++)
+    {
+        k4a_playback_t playback = nullptr;
+        if (K4A_FAILED(k4a_playback_open(job.segments[s].c_str(), &playback)))
+        {
+            *error = "Unable to open " + job.segments[s];
+            ok = false;
+            break;
+        }
+        bool more_metadata = true;
+        FrameMetadata meta;
+        k4a_capture_t capture = nullptr;
+        while (ok && k4a_playback_get_next_capture(playback, &capture) == K4A_STREAM_RESULT_SUCCEEDED)
+        {
+            k4a_image_t image = k4a_capture_get_color_image(capture);
+            k4a_capture_release(capture);
+            if (image == nullptr)
+                continue;
+            const uint64_t ts = k4a_image_get_device_timestamp_usec(image);
+
+            // records follow their frames
+            std::memset(&meta, 0, sizeof(meta));
+            k4a_playback_data_block_t block = nullptr;
+            while (more_metadata)
+            {
+                more_metadata = k4a_playback_get_next_data_block(playback, kFrameMetadataTrack, &block) ==
+                                K4A_STREAM_RESULT_SUCCEEDED;
+                if (!more_metadata)
+                    break;
+                size_t size = k4a_playback_data_block_get_buffer_size(block);
+                std::memcpy(&meta, k4a_playback_data_block_get_buffer(block), size < sizeof(meta) ? size : sizeof(meta));
+                k4a_playback_data_block_release(block);
+                if (meta.device_timestamp_usec >= ts)
+                    break;
+            }
+            const uint32_t flags = meta.device_timestamp_usec == ts ? meta.flags : 0;
+
+            const uint8_t *data = k4a_image_get_buffer(image);
+            size_t size = k4a_image_get_size(image);
+            if (k4a_image_get_format(image) == K4A_IMAGE_FORMAT_COLOR_MJPG)
+            {
+                const size_t length = jpeg_payload_length(data, size);
+                size = length ? length : size;
+            }
+            ok = writer.append(stream, ts, flags, data, size, error);
+            k4a_image_release(image);
+            (*frames)++;
+        }
+        k4a_playback_close(playback);
+    }
+    std::string end_error;
+    if (!writer.end_stream(stream, &end_error) && ok)
+    {
+        *error = end_error;
+        ok = false;
+    }
+    return ok;
+}
+
+static int pack(int argc, char **argv)
+{
+    std::vector<std::string> args = positional(argc, argv);
+    if (args.size() < 2)
+        die("Usage: htkstore pack [--threads N] [--shard-gb G] [--writer buffered|direct|uring] STORE "
+            "session_manifest.json|DIR|recording.mkv ...");
+    const unsigned threads = thread_count(argc, argv);
+    std::string tmp;
+    FrameStoreOptions options;
+    if (parse_arg_value(argc, argv, "--shard-gb", tmp))
+        options.shard_bytes = static_cast<uint64_t>(std::stod(tmp) * (1ull << 30));
+    if (parse_arg_value(argc, argv, "--writer", tmp) && !parse_writer_mode(tmp, &options.writer))
+        die("Unknown writer " + tmp);
+
+    std::vector<PackJob> jobs;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        struct stat st;
+        if (stat(args[i].c_str(), &st) != 0)
+            die(args[i] + " does not exist.");
+        std::string in = args[i];
+        while (in.size() > 1 && in.back() == '/')
+            in.pop_back();
+        if (S_ISDIR(st.st_mode))
+        {
+            std::vector<std::string> manifests, takes;
+            find_manifests(in, "", &manifests, &takes);
+            for (size_t m = 0; m < manifests.size(); m++)
+                add_session(manifests[m], takes[m], &jobs);
+        }
+        else if (basename_of(in).size() > 4 && in.substr(in.size() - 4) == ".mkv")
+        {
+            add_recording(in, &jobs);
+        }
+        else
+        {
+            add_session(in, basename_of(dirname_of(in)), &jobs);
+        }
+    }
+    if (jobs.empty())
+        die("Nothing to pack.");
+    for (auto &j : jobs)
+        if (j.take.size() >= sizeof(FrameStoreStream::take) || j.serial.size() >= sizeof(FrameStoreStream::serial))
+            die("Take name " + j.take + " or serial " + j.serial + " is too long for a frame store.");
+    std::stable_sort(jobs.begin(), jobs.end(), [](const PackJob &a, const PackJob &b) { return a.bytes > b.bytes; });
+
+    std::string error;
+    FrameStoreWriter writer(args[0], options);
+    if (!writer.open(&error))
+        die(error);
+
+    const auto t0 = steady_clock::now();
+    std::atomic<size_t> next{ 0 }, frames{ 0 }, failed{ 0 };
+    std::mutex log_mutex;
+    auto worker = [&]() {
+        size_t j;
+        while ((j = next.fetch_add(1)) < jobs.size())
+        {
+            size_t n = 0;
+            std::string e;
+            const bool ok = pack_stream(writer, jobs[j], &n, &e);
+            frames += n;
+            if (!ok)
+            {
+                failed++;
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << jobs[j].take << " " << jobs[j].serial << ": " << e << std::endl;
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads && i < jobs.size(); i++)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+    if (failed > 0)
+        die(std::to_string(failed) + " stream(s) failed; " + args[0] + " was left without an index.", 2);
+    if (!writer.finish(&error))
+        die(error, 2);
+
+    const double seconds = duration<double>(steady_clock::now() - t0).count();
+    const double mb = writer.bytes_written() / 1e6;
+    std::cout << "Packed " << frames << " frame(s) of " << jobs.size() << " stream(s) into " << args[0] << ": "
+              << std::fixed << std::setprecision(1) << mb << " MB in " << std::setprecision(2) << seconds << " s ("
+              << std::setprecision(0) << (seconds > 0 ? mb / seconds : 0) << " MB/s, " << threads << " threads)"
+              << std::endl;
+    return 0;
+}
+
+static int list(int argc, char **argv)
+{
+    std::vector<std::string> args = positional(argc, argv);
+    if (args.size() != 1)
+        die("Usage: htkstore ls STORE");
+    FrameStore store;
+    std::string error;
+    if (!store.open(args[0], &error))
+        die(error);
+    uint64_t frames = 0, bytes = 0;
+    for (size_t i = 0; i < store.stream_count(); i++)
+    {
+        const FrameStoreStream &s = store.stream(i);
+        const FrameStoreEntry *e = store.entries(i);
+        const double seconds =
+            s.entry_count > 1 ? (e[s.entry_count - 1].device_timestamp_usec - e[0].device_timestamp_usec) / 1e6 : 0;
+        std::cout << s.take << "  " << s.serial << "  " << s.entry_count << " frame(s), " << std::fixed
+                  << std::setprecision(1) << s.bytes / 1e6 << " MB, " << seconds << " s" << std::endl;
+        frames += s.entry_count;
+        bytes += s.bytes;
+    }
+    std::cout << store.stream_count() << " stream(s), " << frames << " frame(s), " << std::fixed << std::setprecision(1)
+              << bytes / 1e6 << " MB" << std::endl;
+    return 0;
+}
+
+static int extract(int argc, char **argv)
+{
+    std::vector<std::string> args = positional(argc, argv);
+    if (args.size() != 4)
+        die("Usage: htkstore extract [--threads N] [--frames A:B] STORE TAKE SERIAL OUT_DIR");
+    FrameStore store;
+    std::string error;
+    if (!store.open(args[0], &error))
+        die(error);
+    const long stream = store.find_stream(args[1], args[2]);
+    if (stream < 0)
+        die(args[0] + " has no take " + args[1] + " camera " + args[2]);
+    const FrameStoreEntry *entries = store.entries(static_cast<size_t>(stream));
+    size_t first = 0, last = static_cast<size_t>(store.stream(static_cast<size_t>(stream)).entry_count);
+    std::string tmp;
+    if (parse_arg_value(argc, argv, "--frames", tmp))
+    {
+        unsigned long a = 0, b = 0;
+        if (std::sscanf(tmp.c_str(), "%lu:%lu", &a, &b) != 2 || a > b)
+            die("--frames takes A:B, the first frame and one past the last.");
+        first = std::min<size_t>(a, last);
+        last = std::min<size_t>(b, last);
+    }
+    mkdir(args[3].c_str(), 0755);
+
+    std::atomic<size_t> next{ first }, failed{ 0 };
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < last)
+        {
+            char name[32];
+            std::snprintf(name, sizeof(name), "/frame_%06zu.jpg", i);
+            const std::string path = args[3] + name;
+            FILE *f = std::fopen(path.c_str(), "wb");
+            bool ok = f && std::fwrite(store.payload(entries[i]), 1, entries[i].size, f) == entries[i].size;
+            if (f)
+                ok = std::fclose(f) == 0 && ok;
+            failed += ok ? 0 : 1;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < thread_count(argc, argv); i++)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+    std::cout << "Wrote " << (last - first - failed) << " frame(s) to " << args[3] << std::endl;
+    return failed ? 2 : 0;
+}
+
+static int verify(int argc, char **argv)
+{
+    std::vector<std::string> args = positional(argc, argv);
+    if (args.size() != 1)
+        die("Usage: htkstore verify [--threads N] STORE");
+    FrameStore store;
+    std::string error;
+    if (!store.open(args[0], &error))
+        die(error);
+    std::vector<const FrameStoreEntry *> all;
+    for (size_t s = 0; s < store.stream_count(); s++)
+        for (uint64_t i = 0; i < store.stream(s).entry_count; i++)
+            all.push_back(store.entries(s) + i);
+
+    const unsigned threads = thread_count(argc, argv);
+    const auto t0 = steady_clock::now();
+    std::atomic<size_t> next{ 0 }, bad{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::mutex log_mutex;
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next.fetch_add(1)) < all.size())
+        {
+            const FrameStoreEntry &e = *all[i];
+            const JpegDefect defect = jpeg_validate(store.payload(e), e.size, 0, 0);
+            bytes += e.size;
+            if (defect != JpegDefect::None && !(e.flags & kFrameCorrupt))
+            {
+                bad++;
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::cerr << "shard " << e.shard << " offset " << e.offset << ": " << jpeg_defect_name(defect)
+                          << std::endl;
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+    const double seconds = duration<double>(steady_clock::now() - t0).count();
+    std::cout << "Checked " << all.size() << " frame(s), " << std::fixed << std::setprecision(1) << bytes / 1e6
+              << " MB in " << std::setprecision(2) << seconds << " s (" << std::setprecision(0)
+              << (seconds > 0 ? bytes / 1e6 / seconds : 0) << " MB/s): " << bad << " bad" << std::endl;
+    return bad ? 2 : 0;
+}
+
+#ifdef HTK_HAVE_JPEG_IMAGE
+struct OptimizedFrame
+{
+    std::vector<uint8_t> data; // empty: copy the original
+    bool failed = false;       // did not decode or recompress
+    bool mismatch = false;     // recompressed, but did not decode the same
+    std::string error;
+};
+
+static void optimize_frame(const uint8_t *data, size_t size, uint32_t flags, OptimizedFrame *out)
+{
+    if (flags & kFrameCorrupt)
+        return;
+    std::vector<uint8_t> optimized;
+    if (!optimize_jpeg_huffman(data, size, &optimized, &out->error))
+    {
+        out->failed = true;
+        return;
+    }
+    if (optimized.size() >= size)
+        return;
+    if (!jpeg_same_coefficients(data, size, optimized.data(), optimized.size(), &out->error))
+    {
+        out->mismatch = true;
+        return;
+    }
+    out->data.swap(optimized);
+}
+#endif
+
+static int optimize(int argc, char **argv)
+{
+    std::vector<std::string> args = positional(argc, argv);
+    if (args.size() != 2)
+        die("Usage: htkstore optimize [--threads N] [--shard-gb G] [--writer buffered|direct|uring] STORE NEW_STORE");
+#ifndef HTK_HAVE_JPEG_IMAGE
+    die("optimize needs libjpeg; this build has none.");
+    return 1;
+#else
+    const unsigned threads = thread_count(argc, argv);
+    std::string tmp;
+    FrameStoreOptions options;
+    if (parse_arg_value(argc, argv, "--shard-gb", tmp))
+        options.shard_bytes = static_cast<uint64_t>(std::stod(tmp) * (1ull << 30));
+    if (parse_arg_value(argc, argv, "--writer", tmp) && !parse_writer_mode(tmp, &options.writer))
+        die("Unknown writer " + tmp);
+
+    FrameStore store;
+    std::string error;
+    if (!store.open(args[0], &error))
+        die(error);
+    FrameStoreWriter writer(args[1], options);
+    if (!writer.open(&error))
+        die(error);
+
+    const auto t0 = steady_clock::now();
+    WorkStealingPool pool(threads);
+    // enough frames in flight to keep every thread busy, few enough to hold
+    const size_t batch = static_cast<size_t>(threads) * 4;
+    uint64_t frames = 0, before = 0, after = 0, copied = 0, failures = 0, mismatches = 0;
+    bool ok = true;
+    for (size_t s = 0; s < store.stream_count() && ok; s++)
+    {
+        const FrameStoreStream &record = store.stream(s);
+        const std::string take(record.take, strnlen(record.take, sizeof(record.take)));
+        const std::string serial(record.serial, strnlen(record.serial, sizeof(record.serial)));
+        const FrameStoreEntry *entries = store.entries(s);
+        size_t stream = 0;
+        if (!writer.begin_stream(take, serial, record.device_index, &stream, &error))
+            die(error, 2);
+        for (uint64_t first = 0; first < record.entry_count && ok; first += batch)
+        {
+            const size_t n = static_cast<size_t>(std::min<uint64_t>(batch, record.entry_count - first));
+            std::vector<OptimizedFrame> results(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                pool.submit([&, i] {
+                    const FrameStoreEntry &e = entries[first + i];
+                    optimize_frame(store.payload(e), e.size, e.flags, &results[i]);
+                });
+            }
+            pool.wait();
+            // the writer takes a stream's frames in order
+            for (size_t i = 0; i < n && ok; i++)
+            {
+                const FrameStoreEntry &e = entries[first + i];
+                const OptimizedFrame &r = results[i];
+                if (r.failed || r.mismatch)
+                {
+                    (r.failed ? failures : mismatches)++;
+                    std::cerr << take << " " << serial << " frame " << first + i << ": " << r.error
+                              << "; copied as recorded" << std::endl;
+                }
+                const bool keep = r.data.empty();
+                copied += keep ? 1 : 0;
+                const uint8_t *data = keep ? store.payload(e) : r.data.data();
+                const size_t size = keep ? e.size : r.data.size();
+                ok = writer.append(stream, e.device_timestamp_usec, e.flags, data, size, &error);
+                before += e.size;
+                after += size;
+                frames++;
+            }
+        }
+        std::string end_error;
+        if (!writer.end_stream(stream, &end_error) && ok)
+        {
+            error = end_error;
+            ok = false;
+        }
+    }
+    if (!ok || !writer.finish(&error))
+        die(error, 2);
+
+    const double seconds = duration<double>(steady_clock::now() - t0).count();
+    std::cout << "Optimized " << frames << " frame(s) of " << store.stream_count() << " stream(s) into " << args[1]
+              << ": " << std::fixed << std::setprecision(1) << before / 1e6 << " MB -> " << after / 1e6 << " MB ("
+              << (before ? 100.0 * (1.0 - static_cast<double>(after) / before) : 0.0) << "% smaller) in "
+              << std::setprecision(2) << seconds << " s, " << threads << " threads; " << copied
+              << " copied as recorded";
+    if (failures)
+        std::cout << ", " << failures << " of them did not recompress";
+    if (mismatches)
+        std::cout << ", " << mismatches << " of them failed verification";
+    std::cout << std::endl;
+    return mismatches ? 2 : 0;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    const std::string command = argc > 1 ? argv[1] : "";
+    if (command == "pack")
+        return pack(argc, argv);
+    if (command == "ls")
+        return list(argc, argv);
+    if (command == "extract")
+        return extract(argc, argv);
+    if (command == "verify")
+        return verify(argc, argv);
+    if (command == "optimize")
+        return optimize(argc, argv);
+    die("Usage: htkstore pack|ls|extract|verify|optimize ...  (see the top of store/htkstore.cpp)");
+    return 1;
+}
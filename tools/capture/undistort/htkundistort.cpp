@@ -0,0 +1,119 @@
+// Undistorts color frames with a cached remap table (remap.h).
+//
+//   htkundistort --rig-calibration rig_calibration.bin --camera NAME|SERIAL
+//                [--scale 1.0] [--roi X,Y,W,H] [--threads N] [--cache-dir DIR]
+//                [--quality 95] [--gray] [--camera-matrix K.pkl] [--repeat N]
+//                in.jpg out.jpg
+//
+// The table comes from the camera's factory intrinsics in the rig file (the
+// same bytes every recording carries as an attachment). It is built on first
+// use and cached in --cache-dir, by default remap_cache/ next to the rig file.
+// --camera-matrix pickles the output image's 3x3 camera matrix, which differs
+// from the source's when --scale or --roi is given. --repeat times the remap.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include "../cli.h"
+#include "../numpy_pickle.h"
+#include "../rig_calibration.h"
+#include "jpeg_image.h"
+#include "remap.h"
+
+using namespace std::chrono;
+
+int main(int argc, char **argv)
+{
+    std::string rig_path, camera;
+    if (argc < 3 || !parse_arg_value(argc, argv, "--rig-calibration", rig_path) ||
+        !parse_arg_value(argc, argv, "--camera", camera) || argv[argc - 2][0] == '-' || argv[argc - 1][0] == '-')
+        die("Usage: htkundistort --rig-calibration FILE --camera NAME|SERIAL [--scale S] [--roi X,Y,W,H] "
+            "[--threads N] [--cache-dir DIR] [--quality Q] [--gray] [--camera-matrix K.pkl] [--repeat N] "
+            "in.jpg out.jpg");
+    const std::string in_path = argv[argc - 2];
+    const std::string out_path = argv[argc - 1];
+
+    std::string tmp;
+    RemapOptions options;
+    if (parse_arg_value(argc, argv, "--scale", tmp))
+        options.scale = std::stod(tmp);
+    if (parse_arg_value(argc, argv, "--roi", tmp) &&
+        std::sscanf(tmp.c_str(), "%d,%d,%d,%d", &options.roi_x, &options.roi_y, &options.roi_width,
+                    &options.roi_height) != 4)
+        die("--roi takes X,Y,W,H in undistorted full-resolution pixels.");
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (parse_arg_value(argc, argv, "--threads", tmp))
+        threads = static_cast<unsigned>(std::max(1, std::stoi(tmp)));
+    int quality = 95;
+    if (parse_arg_value(argc, argv, "--quality", tmp))
+        quality = std::min(100, std::max(1, std::stoi(tmp)));
+    int repeat = 1;
+    if (parse_arg_value(argc, argv, "--repeat", tmp))
+        repeat = std::max(1, std::stoi(tmp));
+    const int channels = has_flag(argc, argv, "--gray") ? 1 : 3;
+
+    std::string error;
+    RigCalibration rig;
+    if (!load_rig_calibration(rig_path, &rig, nullptr, &error))
+        die(error);
+    int index = rig_find_camera(rig, camera);
+    for (size_t i = 0; index < 0 && i < rig.cameras.size(); i++)
+        if (camera == rig.cameras[i].name)
+            index = static_cast<int>(i);
+    if (index < 0)
+        die(rig_path + " has no camera " + camera);
+    const RigCameraRecord &record = rig.cameras[index];
+    CameraModel model;
+    if (!camera_model_from_rig(record, &model, &error))
+        die(error);
+
+    std::string cache_dir;
+    if (!parse_arg_value(argc, argv, "--cache-dir", cache_dir))
+    {
+        const size_t slash = rig_path.find_last_of('/');
+        cache_dir = (slash == std::string::npos ? "" : rig_path.substr(0, slash + 1)) + "remap_cache";
+    }
+    if (!cache_dir.empty())
+        mkdir(cache_dir.c_str(), 0755);
+
+    const auto t0 = steady_clock::now();
+    RemapTable table;
+    if (!get_remap_table(model, options, cache_dir, record.name, &table, &error))
+        die(error);
+    const double table_ms = duration<double, std::milli>(steady_clock::now() - t0).count();
+
+    std::vector<uint8_t> pixels;
+    int width = 0, height = 0;
+    if (!decode_jpeg_file(in_path, channels, &pixels, &width, &height, &error))
+        die(error);
+    if (width != table.source_width || height != table.source_height)
+        die(in_path + " is " + std::to_string(width) + "x" + std::to_string(height) + ", " + record.name +
+            " was calibrated at " + std::to_string(table.source_width) + "x" + std::to_string(table.source_height));
+
+    std::vector<uint8_t> out(static_cast<size_t>(table.width) * table.height * channels);
+    const auto t1 = steady_clock::now();
+    for (int i = 0; i < repeat; i++)
+        remap_image(table, pixels.data(), static_cast<size_t>(width) * channels, channels, out.data(),
+                    static_cast<size_t>(table.width) * channels, threads);
+    const double remap_ms = duration<double, std::milli>(steady_clock::now() - t1).count() / repeat;
+
+    if (!encode_jpeg_file(out_path, out.data(), table.width, table.height, channels, quality, &error))
+        die(error);
+    if (parse_arg_value(argc, argv, "--camera-matrix", tmp) &&
+        !write_numpy_pickle(tmp, table.camera_matrix, 3, 3, &error))
+        die(error);
+
+    std::cout << std::fixed << std::setprecision(2) << record.name << ": " << width << "x" << height << " -> "
+              << table.width << "x" << table.height << ", table " << table_ms << " ms, remap " << remap_ms << " ms ("
+              << threads << " threads)" << std::endl;
+    std::cout << "fx " << table.camera_matrix[0] << " fy " << table.camera_matrix[4] << " cx "
+              << table.camera_matrix[2] << " cy " << table.camera_matrix[5] << std::endl;
+    return 0;
+}
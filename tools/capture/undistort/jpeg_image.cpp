@@ -0,0 +1,289 @@
+#include "jpeg_image.h"
+
+#include <csetjmp>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include <jpeglib.h>
+
+namespace
+{
+
+struct JpegError
+{
+    jpeg_error_mgr mgr;
+    std::jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+};
+
+} // namespace
+
+// libjpeg's default handler exits the process
+static void jpeg_error_exit(j_common_ptr cinfo)
+{
+    JpegError *err = reinterpret_cast<JpegError *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+    std::longjmp(err->jump, 1);
+}
+
+// Warnings (a truncated scan, say) are kept instead of printed; libjpeg
+// counts them in num_warnings.
+static void jpeg_keep_message(j_common_ptr cinfo)
+{
+    JpegError *err = reinterpret_cast<JpegError *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, err->message);
+}
+
+bool decode_jpeg_file(const std::string &path,
+                      int channels,
+                      std::vector<uint8_t> *pixels,
+                      int *width,
+                      int *height,
+                      std::string *error)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (data.empty())
+    {
+        *error = "Empty or missing file " + path;
+        return false;
+    }
+    if (!decode_jpeg_memory(data.data(), data.size(), channels, 1, pixels, width, height, error))
+    {
+        *error = path + ": " + *error;
+        return false;
+    }
+    return true;
+}
+
+bool decode_jpeg_memory(const uint8_t *data,
+                        size_t size,
+                        int channels,
+                        int scale_denom,
+                        std::vector<uint8_t> *pixels,
+                        int *width,
+                        int *height,
+                        std::string *error)
+{
+    jpeg_decompress_struct cinfo;
+    JpegError err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        *error = err.message;
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, static_cast<unsigned long>(size));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = static_cast<unsigned int>(scale_denom);
+    jpeg_start_decompress(&cinfo);
+
+    *width = static_cast<int>(cinfo.output_width);
+    *height = static_cast<int>(cinfo.output_height);
+    const size_t stride = static_cast<size_t>(*width) * static_cast<size_t>(channels);
+    pixels->resize(stride * static_cast<size_t>(*height));
+    while (cinfo.output_scanline < cinfo.output_height)
+    {
+        JSAMPROW row = pixels->data() + static_cast<size_t>(cinfo.output_scanline) * stride;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+bool encode_jpeg_file(const std::string &path,
+                      const uint8_t *pixels,
+                      int width,
+                      int height,
+                      int channels,
+                      int quality,
+                      std::string *error)
+{
+    jpeg_compress_struct cinfo;
+    JpegError err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    unsigned char *out = nullptr;
+    unsigned long size = 0;
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_compress(&cinfo);
+        std::free(out);
+        *error = path + ": " + err.message;
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &out, &size);
+    cinfo.image_width = static_cast<JDIMENSION>(width);
+    cinfo.image_height = static_cast<JDIMENSION>(height);
+    cinfo.input_components = channels;
+    cinfo.in_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+    const size_t stride = static_cast<size_t>(width) * static_cast<size_t>(channels);
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        JSAMPROW row = const_cast<uint8_t *>(pixels) + static_cast<size_t>(cinfo.next_scanline) * stride;
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(out), static_cast<std::streamsize>(size));
+    std::free(out);
+    file.close();
+    if (!file)
+    {
+        *error = "Unable to write " + path;
+        return false;
+    }
+    return true;
+}
+
+bool optimize_jpeg_huffman(const uint8_t *data, size_t size, std::vector<uint8_t> *out, std::string *error)
+{
+    // one error manager for both sides
+    jpeg_decompress_struct src;
+    jpeg_compress_struct dst;
+    JpegError err;
+    src.err = dst.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    err.mgr.output_message = jpeg_keep_message;
+    unsigned char *buffer = nullptr;
+    unsigned long buffer_size = 0;
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        std::free(buffer);
+        *error = err.message;
+        return false;
+    }
+
+    jpeg_mem_src(&src, data, static_cast<unsigned long>(size));
+    jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+    for (int m = 0; m < 16; m++)
+        jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+    jpeg_read_header(&src, TRUE);
+    jvirt_barray_ptr *coefficients = jpeg_read_coefficients(&src);
+    // libjpeg fills in what a damaged frame lacks; that must not pass for
+    // the frame
+    if (err.mgr.num_warnings > 0)
+    {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        *error = err.message;
+        return false;
+    }
+
+    jpeg_copy_critical_parameters(&src, &dst);
+    dst.optimize_coding = TRUE;
+    // corrupt-frame detection relies on the restart markers
+    dst.restart_interval = src.restart_interval;
+    jpeg_mem_dest(&dst, &buffer, &buffer_size);
+    jpeg_write_coefficients(&dst, coefficients);
+    for (jpeg_saved_marker_ptr m = src.marker_list; m != nullptr; m = m->next)
+    {
+        // jpeg_write_coefficients has written its own JFIF and Adobe markers
+        if (dst.write_JFIF_header && m->marker == JPEG_APP0 && m->data_length >= 5 &&
+            std::memcmp(m->data, "JFIF", 5) == 0)
+            continue;
+        if (dst.write_Adobe_marker && m->marker == JPEG_APP0 + 14 && m->data_length >= 5 &&
+            std::memcmp(m->data, "Adobe", 5) == 0)
+            continue;
+        jpeg_write_marker(&dst, m->marker, m->data, m->data_length);
+    }
+    jpeg_finish_compress(&dst);
+    jpeg_finish_decompress(&src);
+
+    out->assign(buffer, buffer + buffer_size);
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    std::free(buffer);
+    return true;
+}
+
+bool jpeg_same_coefficients(const uint8_t *a, size_t a_size, const uint8_t *b, size_t b_size, std::string *error)
+{
+    jpeg_decompress_struct cinfo[2];
+    JpegError err;
+    cinfo[0].err = cinfo[1].err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+    err.mgr.output_message = jpeg_keep_message;
+    jpeg_create_decompress(&cinfo[0]);
+    jpeg_create_decompress(&cinfo[1]);
+    if (setjmp(err.jump))
+    {
+        jpeg_destroy_decompress(&cinfo[0]);
+        jpeg_destroy_decompress(&cinfo[1]);
+        *error = err.message;
+        return false;
+    }
+
+    jpeg_mem_src(&cinfo[0], a, static_cast<unsigned long>(a_size));
+    jpeg_mem_src(&cinfo[1], b, static_cast<unsigned long>(b_size));
+    jvirt_barray_ptr *coefficients[2];
+    std::string difference;
+    for (auto i : { 0, 1 })
+    {
+        // jpeg_read_header resets the shared warning count
+        jpeg_read_header(&cinfo[i], TRUE);
+        coefficients[i] = jpeg_read_coefficients(&cinfo[i]);
+        if (err.mgr.num_warnings > 0 && difference.empty())
+            difference = err.message;
+    }
+
+    const jpeg_decompress_struct &ca = cinfo[0], &cb = cinfo[1];
+    if (difference.empty() &&
+        (ca.image_width != cb.image_width || ca.image_height != cb.image_height ||
+         ca.num_components != cb.num_components || ca.jpeg_color_space != cb.jpeg_color_space))
+        difference = "frame headers differ";
+    for (int c = 0; difference.empty() && c < ca.num_components; c++)
+    {
+        const jpeg_component_info &ka = ca.comp_info[c], &kb = cb.comp_info[c];
+        if (ka.h_samp_factor != kb.h_samp_factor || ka.v_samp_factor != kb.v_samp_factor ||
+            ka.width_in_blocks != kb.width_in_blocks || ka.height_in_blocks != kb.height_in_blocks)
+        {
+            difference = "sampling of component " + std::to_string(c) + " differs";
+            break;
+        }
+        if (ka.quant_table == nullptr || kb.quant_table == nullptr ||
+            std::memcmp(ka.quant_table->quantval, kb.quant_table->quantval, sizeof(ka.quant_table->quantval)) != 0)
+        {
+            difference = "quantisation table of component " + std::to_string(c) + " differs";
+            break;
+        }
+        for (JDIMENSION row = 0; row < ka.height_in_blocks && difference.empty(); row++)
+        {
+            JBLOCKARRAY ra = (*cinfo[0].mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&cinfo[0]),
+                                                                 coefficients[0][c], row, 1, FALSE);
+            JBLOCKARRAY rb = (*cinfo[1].mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&cinfo[1]),
+                                                                 coefficients[1][c], row, 1, FALSE);
+            if (std::memcmp(ra[0][0], rb[0][0], static_cast<size_t>(ka.width_in_blocks) * sizeof(JBLOCK)) != 0)
+                difference = "coefficients of component " + std::to_string(c) + " differ in block row " +
+                             std::to_string(row);
+        }
+    }
+
+    jpeg_finish_decompress(&cinfo[0]);
+    jpeg_finish_decompress(&cinfo[1]);
+    jpeg_destroy_decompress(&cinfo[0]);
+    jpeg_destroy_decompress(&cinfo[1]);
+    *error = difference;
+    return difference.empty();
+}
@@ -0,0 +1,51 @@
+#ifndef JPEG_IMAGE_H
+#define JPEG_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Whole-file JPEG decode and encode through libjpeg, 8-bit interleaved
+// pixels with a tight stride. False and fills error on a bad or missing file.
+
+// channels is 1 (grayscale) or 3 (RGB)
+bool decode_jpeg_file(const std::string &path,
+                      int channels,
+                      std::vector<uint8_t> *pixels,
+                      int *width,
+                      int *height,
+                      std::string *error);
+
+// From memory, e.g. an MJPEG capture. scale_denom 1, 2, 4 or 8 decodes
+// straight to that fraction of the size, which skips most of the IDCT work.
+bool decode_jpeg_memory(const uint8_t *data,
+                        size_t size,
+                        int channels,
+                        int scale_denom,
+                        std::vector<uint8_t> *pixels,
+                        int *width,
+                        int *height,
+                        std::string *error);
+
+bool encode_jpeg_file(const std::string &path,
+                      const uint8_t *pixels,
+                      int width,
+                      int height,
+                      int channels,
+                      int quality,
+                      std::string *error);
+
+// Lossless recompression, as jpegtran -optimize: the coefficients are read
+// and written back with Huffman tables built for this image instead of the
+// generic ones cameras use, typically 10-20% smaller. Quantisation tables,
+// sampling, restart interval and APPn/COM markers are kept; a progressive
+// input comes out sequential.
+bool optimize_jpeg_huffman(const uint8_t *data, size_t size, std::vector<uint8_t> *out, std::string *error);
+
+// True if both decode to identical DCT coefficients under identical
+// quantisation tables, i.e. to the same pixels with any decoder. Otherwise
+// false, with the first difference (or decode failure) in error.
+bool jpeg_same_coefficients(const uint8_t *a, size_t a_size, const uint8_t *b, size_t b_size, std::string *error);
+
+#endif
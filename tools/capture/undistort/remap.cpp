@@ -0,0 +1,334 @@
+#include "remap.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+// bumped whenever the table contents for the same inputs change
+const uint32_t kRemapVersion = 1;
+const char kRemapMagic[8] = { 'H', 'T', 'K', 'R', 'E', 'M', 'A', 'P' };
+
+#pragma pack(push, 1)
+struct RemapFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t source_width, source_height, width, height;
+    uint32_t reserved;
+    uint64_t key;
+    double camera_matrix[9];
+};
+#pragma pack(pop)
+
+struct Fnv
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    template <typename T> void add(const T &v)
+    {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&v);
+        for (size_t i = 0; i < sizeof(T); i++)
+        {
+            h ^= p[i];
+            h *= 0x100000001b3ULL;
+        }
+    }
+};
+
+} // namespace
+
+uint64_t remap_table_key(const CameraModel &model, const RemapOptions &options)
+{
+    Fnv f;
+    f.add(kRemapVersion);
+    for (double v : { model.fx, model.fy, model.cx, model.cy, model.k1, model.k2, model.k3, model.k4, model.k5,
+                      model.k6, model.p1, model.p2, model.codx, model.cody, model.metric_radius, options.scale })
+        f.add(v);
+    for (int v : { model.width, model.height, model.rational ? 1 : 0, options.roi_x, options.roi_y,
+                   options.roi_width, options.roi_height })
+        f.add(v);
+    return f.h;
+}
+
+bool build_remap_table(const CameraModel &model, const RemapOptions &options, RemapTable *table, std::string *error)
+{
+    if (model.width < 2 || model.height < 2 || model.width > 0xffff || model.height > 0xffff)
+    {
+        *error = "camera model has no usable image size";
+        return false;
+    }
+    const int roi_w = options.roi_width > 0 ? options.roi_width : model.width;
+    const int roi_h = options.roi_height > 0 ? options.roi_height : model.height;
+    const int width = static_cast<int>(std::lround(roi_w * options.scale));
+    const int height = static_cast<int>(std::lround(roi_h * options.scale));
+    if (options.scale <= 0 || width < 1 || height < 1)
+    {
+        *error = "empty remap output (check --scale and --roi)";
+        return false;
+    }
+
+    table->source_width = model.width;
+    table->source_height = model.height;
+    table->width = width;
+    table->height = height;
+    table->key = remap_table_key(model, options);
+    // pixel centres map to pixel centres: u = (U - roi_x + 0.5) * scale - 0.5
+    const double k[9] = { model.fx * options.scale, 0, (model.cx - options.roi_x + 0.5) * options.scale - 0.5,
+                          0, model.fy * options.scale, (model.cy - options.roi_y + 0.5) * options.scale - 0.5,
+                          0, 0, 1 };
+    std::memcpy(table->camera_matrix, k, sizeof(k));
+    table->source.assign(static_cast<size_t>(width) * height, kRemapOutside);
+    table->fraction.assign(static_cast<size_t>(width) * height, 0);
+
+    const double max_x = model.width - 1, max_y = model.height - 1;
+    const double r2 = model.metric_radius * model.metric_radius;
+    for (int v = 0; v < height; v++)
+    {
+        const double y = options.roi_y + (v + 0.5) / options.scale - 0.5;
+        for (int u = 0; u < width; u++)
+        {
+            const double x = options.roi_x + (u + 0.5) / options.scale - 0.5;
+            const Eigen::Vector2d n((x - model.cx) / model.fx, (y - model.cy) / model.fy);
+            const double rx = n.x() - model.codx, ry = n.y() - model.cody;
+            if (r2 > 0 && rx * rx + ry * ry > r2)
+                continue;
+            const Eigen::Vector2d d = model.distort(n);
+            const double sx = d.x() * model.fx + model.cx;
+            const double sy = d.y() * model.fy + model.cy;
+            if (!(sx >= 0 && sy >= 0 && sx <= max_x && sy <= max_y))
+                continue;
+            const int ix = std::min(static_cast<int>(sx), model.width - 2);
+            const int iy = std::min(static_cast<int>(sy), model.height - 2);
+            const int fx = static_cast<int>(std::lround((sx - ix) * kRemapFractionOne));
+            const int fy = static_cast<int>(std::lround((sy - iy) * kRemapFractionOne));
+            const size_t i = static_cast<size_t>(v) * width + u;
+            table->source[i] = static_cast<uint32_t>(ix) | static_cast<uint32_t>(iy) << 16;
+            table->fraction[i] = static_cast<uint16_t>(fx | fy << 8);
+        }
+    }
+    return true;
+}
+
+std::string remap_cache_path(const std::string &dir, const std::string &name, uint64_t key)
+{
+    std::ostringstream out;
+    out << dir << "/remap_" << name << "_" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+    return out.str();
+}
+
+bool write_remap_table(const std::string &path, const RemapTable &table, std::string *error)
+{
+    RemapFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kRemapMagic, sizeof(header.magic));
+    header.version = kRemapVersion;
+    header.source_width = table.source_width;
+    header.source_height = table.source_height;
+    header.width = table.width;
+    header.height = table.height;
+    header.key = table.key;
+    std::memcpy(header.camera_matrix, table.camera_matrix, sizeof(header.camera_matrix));
+
+    const std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(table.source.data()),
+                  static_cast<std::streamsize>(table.source.size() * sizeof(uint32_t)));
+        out.write(reinterpret_cast<const char *>(table.fraction.data()),
+                  static_cast<std::streamsize>(table.fraction.size() * sizeof(uint16_t)));
+        out.close();
+        if (!out)
+        {
+            *error = "Unable to write " + tmp_path + ": " + std::strerror(errno);
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        *error = "Unable to rename " + tmp_path + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool load_remap_table(const std::string &path, uint64_t key, RemapTable *table, std::string *error)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    RemapFileHeader header;
+    if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, kRemapMagic, sizeof(header.magic)) != 0 || header.version != kRemapVersion ||
+        header.key != key || header.width < 1 || header.height < 1)
+    {
+        *error = path + " is not a remap table for this camera";
+        return false;
+    }
+    const size_t count = static_cast<size_t>(header.width) * header.height;
+    table->source.resize(count);
+    table->fraction.resize(count);
+    in.read(reinterpret_cast<char *>(table->source.data()), static_cast<std::streamsize>(count * sizeof(uint32_t)));
+    in.read(reinterpret_cast<char *>(table->fraction.data()), static_cast<std::streamsize>(count * sizeof(uint16_t)));
+    if (!in)
+    {
+        *error = path + " is truncated";
+        return false;
+    }
+    table->source_width = header.source_width;
+    table->source_height = header.source_height;
+    table->width = header.width;
+    table->height = header.height;
+    table->key = header.key;
+    std::memcpy(table->camera_matrix, header.camera_matrix, sizeof(header.camera_matrix));
+    return true;
+}
+
+bool get_remap_table(const CameraModel &model,
+                     const RemapOptions &options,
+                     const std::string &cache_dir,
+                     const std::string &name,
+                     RemapTable *table,
+                     std::string *error)
+{
+    const uint64_t key = remap_table_key(model, options);
+    const std::string path = cache_dir.empty() ? "" : remap_cache_path(cache_dir, name, key);
+    std::string cache_error;
+    if (!path.empty() && load_remap_table(path, key, table, &cache_error))
+        return true;
+    if (!build_remap_table(model, options, table, error))
+        return false;
+    // a stale or foreign file is simply replaced
+    if (!path.empty())
+        write_remap_table(path, *table, &cache_error);
+    return true;
+}
+
+template <int channels>
+static inline void remap_pixel_scalar(const uint8_t *p0, const uint8_t *p1, uint16_t fraction, uint8_t *out)
+{
+    const int fx = fraction & 0xff, fy = fraction >> 8;
+    const int w00 = (kRemapFractionOne - fx) * (kRemapFractionOne - fy);
+    const int w01 = fx * (kRemapFractionOne - fy);
+    const int w10 = (kRemapFractionOne - fx) * fy;
+    const int w11 = fx * fy;
+    for (int c = 0; c < channels; c++)
+    {
+        const int v = p0[c] * w00 + p0[c + channels] * w01 + p1[c] * w10 + p1[c + channels] * w11;
+        out[c] = static_cast<uint8_t>((v + (1 << (2 * kRemapFractionBits - 1))) >> (2 * kRemapFractionBits));
+    }
+}
+
+#if defined(__SSE2__)
+static inline __m128i load4(const uint8_t *p)
+{
+    int32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return _mm_cvtsi32_si128(v);
+}
+
+// One 3- or 4-channel pixel: each row's two taps are interleaved per channel
+// so _mm_madd_epi16 forms both products and their sum in one step.
+template <int channels>
+static inline void remap_pixel_sse2(const uint8_t *p0, const uint8_t *p1, uint16_t fraction, uint8_t *out)
+{
+    const int fx = fraction & 0xff, fy = fraction >> 8;
+    const int w00 = (kRemapFractionOne - fx) * (kRemapFractionOne - fy);
+    const int w01 = fx * (kRemapFractionOne - fy);
+    const int w10 = (kRemapFractionOne - fx) * fy;
+    const int w11 = fx * fy;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i top = _mm_unpacklo_epi8(_mm_unpacklo_epi8(load4(p0), load4(p0 + channels)), zero);
+    const __m128i bottom = _mm_unpacklo_epi8(_mm_unpacklo_epi8(load4(p1), load4(p1 + channels)), zero);
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(top, _mm_set1_epi32(w00 | w01 << 16)),
+                                _mm_madd_epi16(bottom, _mm_set1_epi32(w10 | w11 << 16)));
+    sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << (2 * kRemapFractionBits - 1))),
+                         2 * kRemapFractionBits);
+    const int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(sum, zero), zero));
+    std::memcpy(out, &packed, channels);
+}
+#endif
+
+// channels is a template argument so the per-pixel loops unroll
+template <int channels>
+static void remap_rows(const RemapTable &table,
+                       const uint8_t *source,
+                       size_t source_stride,
+                       uint8_t *dest,
+                       size_t dest_stride,
+                       int row_begin,
+                       int row_end)
+{
+#if defined(__SSE2__)
+    // the 4-byte loads read one byte past a 3-channel tap; only the very last
+    // tap of the image has nothing after it
+    const uint32_t last_tap = static_cast<uint32_t>(table.source_width - 2) |
+                              static_cast<uint32_t>(table.source_height - 2) << 16;
+    const bool simd = channels >= 3;
+#endif
+    for (int v = row_begin; v < row_end; v++)
+    {
+        const size_t row = static_cast<size_t>(v) * table.width;
+        const uint32_t *src = table.source.data() + row;
+        const uint16_t *frac = table.fraction.data() + row;
+        uint8_t *out = dest + static_cast<size_t>(v) * dest_stride;
+        for (int u = 0; u < table.width; u++, out += channels)
+        {
+            const uint32_t tap = src[u];
+            if (tap == kRemapOutside)
+            {
+                std::memset(out, 0, channels);
+                continue;
+            }
+            const uint8_t *p0 = source + (tap >> 16) * source_stride + (tap & 0xffff) * channels;
+            const uint8_t *p1 = p0 + source_stride;
+#if defined(__SSE2__)
+            if (simd && (channels == 4 || tap != last_tap))
+            {
+                remap_pixel_sse2<channels>(p0, p1, frac[u], out);
+                continue;
+            }
+#endif
+            remap_pixel_scalar<channels>(p0, p1, frac[u], out);
+        }
+    }
+}
+
+void remap_image(const RemapTable &table,
+                 const uint8_t *source,
+                 size_t source_stride,
+                 int channels,
+                 uint8_t *dest,
+                 size_t dest_stride,
+                 unsigned threads)
+{
+    auto rows = channels == 1 ? remap_rows<1> : channels == 3 ? remap_rows<3> : remap_rows<4>;
+    threads = std::max(1u, std::min(threads, static_cast<unsigned>(table.height)));
+    if (threads == 1)
+    {
+        rows(table, source, source_stride, dest, dest_stride, 0, table.height);
+        return;
+    }
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++)
+    {
+        const int begin = static_cast<int>(static_cast<int64_t>(table.height) * i / threads);
+        const int end = static_cast<int>(static_cast<int64_t>(table.height) * (i + 1) / threads);
+        pool.emplace_back(rows, std::cref(table), source, source_stride, dest, dest_stride, begin, end);
+    }
+    for (auto &t : pool)
+        t.join();
+}
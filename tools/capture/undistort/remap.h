@@ -0,0 +1,84 @@
+#ifndef REMAP_H
+#define REMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../calibrate/camera_model.h"
+
+// Undistortion as a lookup table: for every output pixel, the top-left source
+// pixel and a 5-bit fixed-point bilinear fraction, like OpenCV's
+// initUndistortRectifyMap() + remap(INTER_LINEAR). The table is built once per
+// camera and output geometry and cached on disk; applying it is one gather and
+// four integer multiplies per channel, split over threads by output rows.
+//
+// The output is a pinhole image with the source camera matrix, optionally
+// cropped to a region of the full-resolution undistorted image and scaled.
+// Cropping and scaling cost nothing extra since they are folded into the
+// table. Scaling is bilinear, so below 0.5 it aliases.
+
+struct RemapOptions
+{
+    double scale = 1.0; // output pixels per undistorted full-resolution pixel
+    // region of the undistorted full-resolution image to keep; 0 width/height
+    // keeps the whole image
+    int roi_x = 0, roi_y = 0, roi_width = 0, roi_height = 0;
+};
+
+static const int kRemapFractionBits = 5;
+static const int kRemapFractionOne = 1 << kRemapFractionBits;
+static const uint32_t kRemapOutside = 0xffffffff;
+
+struct RemapTable
+{
+    int source_width = 0, source_height = 0;
+    int width = 0, height = 0; // output
+    // pinhole camera matrix of the output image, row-major
+    double camera_matrix[9] = { 0 };
+    // per output pixel, row-major: the top-left source tap, x in the low 16
+    // bits and y in the high 16 bits; kRemapOutside where the ray misses the
+    // source image
+    std::vector<uint32_t> source;
+    // per output pixel: x fraction in the low byte, y fraction in the high
+    // byte, each 0..kRemapFractionOne
+    std::vector<uint16_t> fraction;
+    uint64_t key = 0; // remap_table_key() it was built for
+};
+
+// Identifies a camera model and options; two tables with the same key are
+// identical.
+uint64_t remap_table_key(const CameraModel &model, const RemapOptions &options);
+
+// False and fills error if the model has no size or the ROI is empty.
+bool build_remap_table(const CameraModel &model, const RemapOptions &options, RemapTable *table, std::string *error);
+
+// Cache file for a table: <dir>/remap_<name>_<key>.bin
+std::string remap_cache_path(const std::string &dir, const std::string &name, uint64_t key);
+bool write_remap_table(const std::string &path, const RemapTable &table, std::string *error);
+// False (without an error) if the file is missing; false and fills error if
+// it is unreadable or not for this key.
+bool load_remap_table(const std::string &path, uint64_t key, RemapTable *table, std::string *error);
+
+// Loads the cached table, or builds and caches it. An empty cache_dir skips the
+// cache. A cache that cannot be written is not an error.
+bool get_remap_table(const CameraModel &model,
+                     const RemapOptions &options,
+                     const std::string &cache_dir,
+                     const std::string &name,
+                     RemapTable *table,
+                     std::string *error);
+
+// Applies the table to an 8-bit image with 1, 3 or 4 interleaved channels.
+// Strides are in bytes. Pixels whose ray misses the source are set to 0.
+// threads > 1 splits the output rows into bands.
+void remap_image(const RemapTable &table,
+                 const uint8_t *source,
+                 size_t source_stride,
+                 int channels,
+                 uint8_t *dest,
+                 size_t dest_stride,
+                 unsigned threads = 1);
+
+#endif
@@ -0,0 +1,225 @@
+// Re-verifies recordings against the chunk checksums in a session manifest.
+//
+//   htkverify [--threads N] [--root DIR] session_manifest.json
+//
+// Chunks of every segment are hashed in parallel, so a copy on a NAS or a
+// training server is checked at disk speed. Segment paths are resolved
+// against --root, by default the manifest's directory. A mismatch is
+// reported as the byte range of the chunk that differs.
+// Exit status: 0 all good, 1 bad arguments or manifest, 2 missing or corrupt data.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "../chunk_hash.h"
+#include "../cli.h"
+#include "../json_reader.h"
+
+using namespace std::chrono;
+
+struct Segment
+{
+    std::string file; // as listed in the manifest
+    std::string path; // resolved
+    uint64_t bytes = 0;
+    size_t chunk_size = 0;
+    std::vector<std::string> chunks; // expected hex
+    int fd = -1;
+    std::vector<size_t> bad_chunks;
+    bool failed = false; // missing, wrong size or unreadable
+    std::string problem;
+};
+
+struct Job
+{
+    size_t segment;
+    size_t chunk;
+};
+
+static std::string dirname_of(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos)
+        return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argv[argc - 1][0] == '-')
+        die("Usage: htkverify [--threads N] [--root DIR] session_manifest.json");
+    const std::string manifest_path = argv[argc - 1];
+
+    std::string tmp;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    if (parse_arg_value(argc, argv, "--threads", tmp))
+        threads = static_cast<unsigned>(std::max(1, std::stoi(tmp)));
+    std::string root = dirname_of(manifest_path);
+    parse_arg_value(argc, argv, "--root", root);
+
+    JsonValue manifest;
+    std::string error;
+    if (!load_json_file(manifest_path, &manifest, &error))
+        die(error);
+    const JsonValue *devices = manifest.get("devices");
+    if (devices == nullptr || devices->type != JsonValue::Array)
+        die(manifest_path + " is not a session manifest.");
+
+    std::vector<Segment> segments;
+    size_t unchecked = 0;
+    for (auto &d : devices->items)
+    {
+        const JsonValue *list = d.get("segments");
+        if (list == nullptr)
+            continue;
+        for (auto &s : list->items)
+        {
+            Segment seg;
+            seg.file = s.get("file") ? s.get("file")->str() : "";
+            seg.path = seg.file.empty() || seg.file[0] == '/' ? seg.file : root + "/" + seg.file;
+            seg.bytes = s.get("bytes") ? s.get("bytes")->uint64() : 0;
+
+            std::string checksum = s.get("checksum") ? s.get("checksum")->str() : "";
+            if (checksum.empty())
+            {
+                std::cout << "UNCHECKED " << seg.file << " (no checksum in manifest)" << std::endl;
+                unchecked++;
+                continue;
+            }
+            std::string algo = checksum.substr(0, checksum.find(':'));
+            if (algo != chunk_hash_name())
+                die(seg.file + " uses " + algo + " checksums but this build computes " + chunk_hash_name() + ".");
+
+            seg.chunk_size = s.get("chunk_size") ? static_cast<size_t>(s.get("chunk_size")->uint64()) : 0;
+            std::vector<uint64_t> expected;
+            if (const JsonValue *chunks = s.get("chunks"))
+            {
+                for (auto &c : chunks->items)
+                {
+                    seg.chunks.push_back(c.str());
+                    expected.push_back(std::strtoull(c.str().c_str(), nullptr, 16));
+                }
+            }
+            if (seg.chunk_size == 0 || file_checksum(expected) != checksum ||
+                seg.chunks.size() != (seg.bytes + seg.chunk_size - 1) / seg.chunk_size)
+                die("Manifest entry for " + seg.file + " is inconsistent; refusing to trust it.");
+            segments.push_back(std::move(seg));
+        }
+    }
+
+    // cheap checks first so a missing file does not wait behind terabytes of hashing
+    std::vector<Job> jobs;
+    uint64_t total_bytes = 0;
+    for (size_t i = 0; i < segments.size(); i++)
+    {
+        Segment &seg = segments[i];
+        struct stat st;
+        if (stat(seg.path.c_str(), &st) != 0)
+        {
+            seg.failed = true;
+            seg.problem = "missing";
+            continue;
+        }
+        if (static_cast<uint64_t>(st.st_size) != seg.bytes)
+        {
+            seg.failed = true;
+            seg.problem = "size " + std::to_string(st.st_size) + ", expected " + std::to_string(seg.bytes);
+            continue;
+        }
+        seg.fd = open(seg.path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (seg.fd < 0)
+        {
+            seg.failed = true;
+            seg.problem = "cannot open";
+            continue;
+        }
+        for (size_t c = 0; c < seg.chunks.size(); c++)
+            jobs.push_back({ i, c });
+        total_bytes += seg.bytes;
+    }
+
+    std::atomic<size_t> next{ 0 };
+    std::mutex result_mutex;
+    auto worker = [&]() {
+        std::vector<uint8_t> buf;
+        size_t j;
+        while ((j = next.fetch_add(1)) < jobs.size())
+        {
+            Segment &seg = segments[jobs[j].segment];
+            const size_t chunk = jobs[j].chunk;
+            const uint64_t offset = static_cast<uint64_t>(chunk) * seg.chunk_size;
+            const size_t len = static_cast<size_t>(std::min<uint64_t>(seg.chunk_size, seg.bytes - offset));
+            buf.resize(len);
+
+            size_t done = 0;
+            while (done < len)
+            {
+                ssize_t n = pread(seg.fd, buf.data() + done, len - done, static_cast<off_t>(offset + done));
+                if (n <= 0)
+                    break;
+                done += static_cast<size_t>(n);
+            }
+            // verified data is not going to be read again soon
+            posix_fadvise(seg.fd, static_cast<off_t>(offset), static_cast<off_t>(len), POSIX_FADV_DONTNEED);
+
+            if (done != len || chunk_hash_hex(chunk_hash(buf.data(), len)) != seg.chunks[chunk])
+            {
+                std::lock_guard<std::mutex> lock(result_mutex);
+                seg.bad_chunks.push_back(chunk);
+            }
+        }
+    };
+
+    const auto t0 = steady_clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+    for (auto &t : pool)
+        t.join();
+    const double secs = duration<double>(steady_clock::now() - t0).count();
+
+    size_t bad = 0;
+    for (auto &seg : segments)
+    {
+        if (seg.fd >= 0)
+            close(seg.fd);
+
+        if (seg.failed)
+        {
+            std::cout << "FAILED " << seg.file << ": " << seg.problem << std::endl;
+            bad++;
+            continue;
+        }
+        if (seg.bad_chunks.empty())
+        {
+            std::cout << "OK " << seg.file << std::endl;
+            continue;
+        }
+        bad++;
+        std::sort(seg.bad_chunks.begin(), seg.bad_chunks.end());
+        std::cout << "CORRUPT " << seg.file << ":";
+        for (size_t c : seg.bad_chunks)
+        {
+            uint64_t start = static_cast<uint64_t>(c) * seg.chunk_size;
+            uint64_t end = std::min<uint64_t>(start + seg.chunk_size, seg.bytes);
+            std::cout << " [" << start << ", " << end << ")";
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout << segments.size() << " segment(s), " << bad << " bad, " << unchecked << " without checksum; "
+              << std::fixed << std::setprecision(1) << total_bytes / 1e6 << " MB in " << secs << " s ("
+              << (secs > 0 ? total_bytes / 1e6 / secs : 0) << " MB/s, " << threads << " threads)" << std::endl;
+    return bad ? 2 : 0;
+}
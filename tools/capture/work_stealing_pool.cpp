@@ -0,0 +1,120 @@
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+
+// which pool and worker the calling thread belongs to, if any
+static thread_local WorkStealingPool *t_pool = nullptr;
+static thread_local unsigned t_worker = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+{
+    threads = std::max(1u, threads);
+    for (unsigned i = 0; i < threads; i++)
+        m_workers.emplace_back(new Worker);
+    for (unsigned i = 0; i < threads; i++)
+        m_workers[i]->thread = std::thread(&WorkStealingPool::run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(m_sleep_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto &w : m_workers)
+        w->thread.join();
+}
+
+void WorkStealingPool::submit(std::function<void()> task)
+{
+    const unsigned target =
+        t_pool == this ? t_worker : m_next.fetch_add(1) % static_cast<unsigned>(m_workers.size());
+    m_pending++;
+    {
+        std::lock_guard<std::mutex> lock(m_workers[target]->mutex);
+        m_workers[target]->tasks.push_back(std::move(task));
+        m_queued++;
+    }
+    // under the lock, so a worker between its check and its wait still hears it
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    m_wake.notify_one();
+}
+
+void WorkStealingPool::wait()
+{
+    std::unique_lock<std::mutex> lock(m_done_mutex);
+    m_done.wait(lock, [this] { return m_pending == 0; });
+}
+
+bool WorkStealingPool::take(unsigned self, std::function<void()> *task)
+{
+    {
+        Worker &own = *m_workers[self];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            *task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            m_queued--;
+            return true;
+        }
+    }
+    const unsigned n = static_cast<unsigned>(m_workers.size());
+    for (unsigned k = 1; k < n; k++)
+    {
+        Worker &victim = *m_workers[(self + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            *task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            m_queued--;
+            m_steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::run(unsigned self)
+{
+    t_pool = this;
+    t_worker = self;
+    std::function<void()> task;
+    for (;;)
+    {
+        if (take(self, &task))
+        {
+            task();
+            task = nullptr;
+            if (--m_pending == 0)
+            {
+                std::lock_guard<std::mutex> lock(m_done_mutex);
+                m_done.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_sleep_mutex);
+        m_wake.wait(lock, [this] { return m_stop || m_queued > 0; });
+        if (m_stop && m_queued == 0)
+            return;
+    }
+}
+
+void IoSlots::acquire()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return m_free > 0; });
+    m_free--;
+}
+
+void IoSlots::release()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free++;
+    }
+    m_cv.notify_one();
+}
@@ -0,0 +1,107 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread pool for batch jobs whose tasks spawn more tasks, e.g. indexing a
+// recording and then extracting it range by range. Each worker keeps its own
+// deque: tasks submitted from a worker go to the back of its deque and it
+// runs them newest first, which keeps a recording's follow-up work on the
+// thread whose cache already holds it. An idle worker steals the oldest task
+// from another worker's front, so a few large files still spread over every
+// thread. Tasks are coarse (milliseconds or more), so the deques use a mutex
+// each rather than a lock-free scheme.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(unsigned threads);
+    // waits for all work, then stops the workers
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    // From a worker: onto that worker's deque. From anywhere else: spread
+    // round-robin.
+    void submit(std::function<void()> task);
+    // Until every task, including those submitted by tasks, has run.
+    void wait();
+
+    unsigned threads() const
+    {
+        return static_cast<unsigned>(m_workers.size());
+    }
+    uint64_t steals() const
+    {
+        return m_steals;
+    }
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+    };
+
+    void run(unsigned self);
+    bool take(unsigned self, std::function<void()> *task);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<size_t> m_queued{ 0 };  // in a deque
+    std::atomic<size_t> m_pending{ 0 }; // submitted and not finished
+    std::atomic<uint64_t> m_steals{ 0 };
+    std::atomic<unsigned> m_next{ 0 };
+    bool m_stop = false;
+    std::mutex m_sleep_mutex;
+    std::condition_variable m_wake;
+    std::mutex m_done_mutex;
+    std::condition_variable m_done;
+};
+
+// Caps how many tasks touch the disk at once, independent of the thread
+// count: past a few streams a disk array only seeks more, while decoding and
+// hashing want every core.
+class IoSlots
+{
+public:
+    explicit IoSlots(unsigned slots) : m_free(slots)
+    {
+    }
+
+    void acquire();
+    void release();
+
+    struct Guard
+    {
+        explicit Guard(IoSlots &slots) : m_slots(slots)
+        {
+            m_slots.acquire();
+        }
+        ~Guard()
+        {
+            m_slots.release();
+        }
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+    private:
+        IoSlots &m_slots;
+    };
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    unsigned m_free;
+};
+
+#endif
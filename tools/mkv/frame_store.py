@@ -0,0 +1,129 @@
+"""
+Reader for frame stores written by htkstore pack (see
+tools/capture/frame_store.h): the JPEG frames of many takes packed into a few
+shard files, with an index keyed by take, camera serial and frame number or
+device timestamp.
+
+    from tools.mkv.frame_store import FrameStore
+    store = FrameStore("/data/store")
+    jpg = store.frame("take_001", "000123412312", 42)     # memoryview of the JPEG
+    img = cv2.imdecode(np.frombuffer(jpg, np.uint8), cv2.IMREAD_COLOR)
+
+Files are mapped on first use, so a FrameStore can be built before a
+DataLoader forks its workers; each worker maps its own copy.
+"""
+import os
+import sys
+
+import numpy as np
+
+MAGIC = b"HTKSTORE"
+SHARD_MAGIC = b"HTKSHARD"
+VERSION = 1
+INDEX = "index.bin"
+
+HEADER_DTYPE = np.dtype([
+    ("magic", "S8"), ("version", "<u4"), ("header_bytes", "<u4"),
+    ("stream_bytes", "<u4"), ("entry_bytes", "<u4"), ("shard_count", "<u4"),
+    ("reserved0", "<u4"), ("stream_count", "<u8"), ("entry_count", "<u8"),
+    ("streams_offset", "<u8"), ("entries_offset", "<u8"),
+])
+STREAM_DTYPE = np.dtype([
+    ("take", "S64"), ("serial", "S32"), ("device_index", "<i4"),
+    ("reserved0", "<u4"), ("first_entry", "<u8"), ("entry_count", "<u8"),
+    ("bytes", "<u8"),
+])
+ENTRY_DTYPE = np.dtype([
+    ("device_timestamp_usec", "<u8"), ("offset", "<u8"), ("size", "<u4"),
+    ("shard", "<u4"), ("flags", "<u4"), ("reserved", "<u4"),
+])
+assert HEADER_DTYPE.itemsize == 64 and STREAM_DTYPE.itemsize == 128 and ENTRY_DTYPE.itemsize == 32
+
+FRAME_CORRUPT = 1  # FrameMetadataFlags, tools/capture/frame_metadata.h
+FRAME_FILLED = 2
+
+
+def shard_path(root, shard):
+    return os.path.join(root, f"shard_{shard:05d}.bin")
+
+
+class FrameStore:
+    def __init__(self, root):
+        self.root = str(root)
+        self._pid = None
+        self._index = None
+        self._shards = {}
+        # the stream table is small: keep it across forks
+        header, streams, _ = self._load_index()
+        self.shard_count = int(header["shard_count"])
+        self.streams = np.array(streams)
+        self._lookup = {(s["take"].decode(), s["serial"].decode()): i for i, s in enumerate(self.streams)}
+
+    def _load_index(self):
+        path = os.path.join(self.root, INDEX)
+        data = np.memmap(path, dtype=np.uint8, mode="r")
+        if data.size < HEADER_DTYPE.itemsize:
+            raise ValueError(f"{path}: too short for a frame store index")
+        header = data[:HEADER_DTYPE.itemsize].view(HEADER_DTYPE)[0]
+        if header["magic"] != MAGIC:
+            raise ValueError(f"{path}: not a frame store index")
+        if header["version"] > VERSION or header["stream_bytes"] != STREAM_DTYPE.itemsize \
+                or header["entry_bytes"] != ENTRY_DTYPE.itemsize:
+            raise ValueError(f"{path}: frame store version {header['version']} is not supported")
+        s0, e0 = int(header["streams_offset"]), int(header["entries_offset"])
+        s1 = s0 + STREAM_DTYPE.itemsize * int(header["stream_count"])
+        e1 = e0 + ENTRY_DTYPE.itemsize * int(header["entry_count"])
+        if s1 > data.size or e1 > data.size:
+            raise ValueError(f"{path}: frame store index is truncated")
+        return header, data[s0:s1].view(STREAM_DTYPE), data[e0:e1].view(ENTRY_DTYPE)
+
+    def _entries(self):
+        if self._pid != os.getpid():
+            self._index = self._load_index()[2]
+            self._shards = {}
+            self._pid = os.getpid()
+        return self._index
+
+    def _shard(self, shard):
+        self._entries()
+        data = self._shards.get(shard)
+        if data is None:
+            data = np.memmap(shard_path(self.root, shard), dtype=np.uint8, mode="r")
+            if bytes(data[:8]) != SHARD_MAGIC:
+                raise ValueError(f"{shard_path(self.root, shard)}: not a frame store shard")
+            self._shards[shard] = data
+        return data
+
+    def find(self, take, serial):
+        """Stream number of one camera of one take; KeyError if it is not in the store."""
+        return self._lookup[(take, serial)]
+
+    def entries(self, stream):
+        """Structured array of the stream's frames (ENTRY_DTYPE), frame 0 first."""
+        s = self.streams[stream]
+        first = int(s["first_entry"])
+        return self._entries()[first:first + int(s["entry_count"])]
+
+    def payload(self, entry):
+        """memoryview of one frame's JPEG, valid while the store is alive."""
+        start = int(entry["offset"])
+        return memoryview(self._shard(int(entry["shard"]))[start:start + int(entry["size"])])
+
+    def frame(self, take, serial, index):
+        return self.payload(self.entries(self.find(take, serial))[index])
+
+    def frame_at(self, take, serial, device_timestamp_usec):
+        """(frame number, JPEG) of the first frame at or after the timestamp; None past the end."""
+        entries = self.entries(self.find(take, serial))
+        i = int(np.searchsorted(entries["device_timestamp_usec"], device_timestamp_usec))
+        return None if i >= len(entries) else (i, self.payload(entries[i]))
+
+
+if __name__ == "__main__":
+    store = FrameStore(sys.argv[1])
+    print(f"{len(store.streams)} stream(s) in {store.shard_count} shard(s)")
+    for i, s in enumerate(store.streams):
+        ts = store.entries(i)["device_timestamp_usec"]
+        seconds = (int(ts[-1]) - int(ts[0])) / 1e6 if len(ts) > 1 else 0
+        print(f"  {s['take'].decode()} {s['serial'].decode()}: {s['entry_count']} frame(s), "
+              f"{s['bytes'] / 1e6:.1f} MB, {seconds:.1f} s")
@@ -0,0 +1,234 @@
+"""
+Zero-copy frame access to k4a recordings (see tools/capture/mapped_recording.h).
+
+    from tools.mkv.mkv_frames import MkvFrames
+    rec = MkvFrames("k4a_0_000123412312.mkv")
+    jpg = rec[42]                                   # read-only memoryview into the mapping
+    img = cv2.imdecode(np.frombuffer(jpg, np.uint8), cv2.IMREAD_COLOR)
+
+The file is mapped, not read: a frame is a view of its block payload in the
+page cache, with no copy through pyk4a or an ffmpeg pipe. The frame index comes
+from <recording>.frames when it is current (written by htkcapture's
+MappedRecording or by this module), else from a walk of the Matroska block
+headers, which is then saved for next time. Views stay valid while the
+MkvFrames object lives.
+"""
+import mmap
+import os
+import struct
+import sys
+
+import numpy as np
+
+MAGIC = b"HTKMKVIX"
+VERSION = 1
+
+HEADER_DTYPE = np.dtype([
+    ("magic", "S8"), ("version", "<u4"), ("header_bytes", "<u4"),
+    ("entry_bytes", "<u4"), ("track", "<u4"), ("entry_count", "<u8"),
+    ("file_bytes", "<u8"), ("file_mtime_ns", "<u8"),
+    ("start_offset_ns", "<i8"), ("track_name", "S32"), ("reserved", "<u8"),
+])
+ENTRY_DTYPE = np.dtype([
+    ("device_timestamp_usec", "<u8"), ("offset", "<u8"), ("size", "<u4"), ("reserved", "<u4"),
+])
+assert HEADER_DTYPE.itemsize == 96 and ENTRY_DTYPE.itemsize == 24
+
+EBML, SEGMENT, CLUSTER, INFO, TRACKS, TAGS = 0x1A45DFA3, 0x18538067, 0x1F43B675, 0x1549A966, 0x1654AE6B, 0x1254C367
+TOP_LEVEL = {CLUSTER, INFO, TRACKS, TAGS, 0x114D9B74, 0x1C53BB6B, 0x1941A469, 0x1043A770}
+
+
+def _vint(buf, pos, keep_marker):
+    first = buf[pos]
+    n = 1
+    while n <= 8 and not first & (0x80 >> (n - 1)):
+        n += 1
+    if n > 8:
+        raise ValueError(f"bad EBML length at {pos}")
+    v = first if keep_marker else first & (0xFF >> n)
+    for b in buf[pos + 1:pos + n]:
+        v = (v << 8) | b
+    return v, n
+
+
+def _header(buf, pos, limit):
+    """(id, data offset, size or None when unknown), or None if it does not fit."""
+    if pos + 2 > limit:
+        return None
+    eid, n = _vint(buf, pos, True)
+    if pos + n >= limit:
+        return None
+    size, m = _vint(buf, pos + n, False)
+    return eid, pos + n + m, None if size == (1 << (7 * m)) - 1 else size
+
+
+def _children(buf, start, end):
+    pos = start
+    while pos < end:
+        h = _header(buf, pos, end)
+        if h is None or h[2] is None or h[1] + h[2] > end:
+            return
+        yield h
+        pos = h[1] + h[2]
+
+
+def _uint(buf, start, size):
+    return int.from_bytes(buf[start:start + size], "big")
+
+
+def _text(buf, start, size):
+    return bytes(buf[start:start + size]).split(b"\0")[0].decode("utf-8", "replace")
+
+
+def walk_index(buf, track_name="COLOR"):
+    """
+    Builds the index from the block headers, as MappedRecording does: returns
+    (track number, start offset ns, entries as an ENTRY_DTYPE array).
+    """
+    eid, pos, size = _header(buf, 0, len(buf))
+    if eid != EBML:
+        raise ValueError("not a Matroska file")
+    pos += size
+    eid, pos, size = _header(buf, pos, len(buf))
+    if eid != SEGMENT:
+        raise ValueError("no Matroska segment")
+    end = len(buf) if size is None else min(len(buf), pos + size)
+
+    scale, track, start_offset = 1000000, None, 0
+    ts, offsets, sizes = [], [], []
+    while pos < end:
+        h = _header(buf, pos, end)
+        if h is None:
+            break
+        eid, data, size = h
+        if eid == CLUSTER:
+            cend = end if size is None else min(end, data + size)
+            cluster_tc, p = 0, data
+            while p < cend:
+                h = _header(buf, p, cend)
+                if h is None or (size is None and h[0] in TOP_LEVEL) or h[2] is None or h[1] + h[2] > cend:
+                    break
+                cid, cdata, csize = h
+                if cid == 0xE7:
+                    cluster_tc = _uint(buf, cdata, csize)
+                blocks = [(cdata, csize)] if cid == 0xA3 else \
+                    [(d, s) for i, d, s in _children(buf, cdata, cdata + csize) if i == 0xA1] if cid == 0xA0 else []
+                for bdata, bsize in blocks:
+                    number, n = _vint(buf, bdata, False)
+                    if number != track:
+                        continue
+                    rel, flags = struct.unpack_from(">hB", buf, bdata + n)
+                    hdr = n + 3 + (1 if flags & 0x06 else 0)
+                    ts.append((cluster_tc + rel) * scale)
+                    offsets.append(bdata + hdr)
+                    sizes.append(bsize - hdr)
+                p = cdata + csize
+            if size is not None and p < cend:
+                break  # cut off: the rest is not trustworthy
+            pos = p
+            continue
+        if size is None or data + size > end:
+            break
+        if eid == INFO:
+            for i, d, s in _children(buf, data, data + size):
+                if i == 0x2AD7B1:
+                    scale = _uint(buf, d, s)
+        elif eid == TRACKS:
+            for i, d, s in _children(buf, data, data + size):
+                fields = {fi: (fd, fs) for fi, fd, fs in _children(buf, d, d + s)} if i == 0xAE else {}
+                if 0x536E in fields and _text(buf, *fields[0x536E]) == track_name and 0xD7 in fields:
+                    track = _uint(buf, *fields[0xD7])
+        elif eid == TAGS:
+            for _, d, s in _children(buf, data, data + size):
+                for i, sd, ss in _children(buf, d, d + s):
+                    fields = {fi: (fd, fs) for fi, fd, fs in _children(buf, sd, sd + ss)} if i == 0x67C8 else {}
+                    if 0x45A3 in fields and _text(buf, *fields[0x45A3]) == "K4A_START_OFFSET_NS":
+                        start_offset = int(_text(buf, *fields[0x4487]))
+        pos = data + size
+    if track is None:
+        raise ValueError(f"no {track_name} track")
+
+    entries = np.zeros(len(ts), dtype=ENTRY_DTYPE)
+    entries["device_timestamp_usec"] = (np.array(ts, dtype=np.int64) + start_offset) // 1000
+    entries["offset"] = offsets
+    entries["size"] = sizes
+    return track, start_offset, entries
+
+
+class MkvFrames:
+    def __init__(self, path, track="COLOR", use_index_file=True):
+        self.path = str(path)
+        self.track_name = track
+        with open(self.path, "rb") as f:
+            st = os.fstat(f.fileno())
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self._view = memoryview(self._map)
+        index_path = self.path + ".frames"
+        loaded = use_index_file and self._load_index(index_path, st)
+        if not loaded:
+            self.track, self.start_offset_ns, self.entries = walk_index(self._view, track)
+            if use_index_file:
+                self._write_index(index_path, st)
+        self.timestamps = self.entries["device_timestamp_usec"]
+
+    def _load_index(self, index_path, st):
+        try:
+            data = np.fromfile(index_path, dtype=np.uint8)
+        except OSError:
+            return False
+        if data.size < HEADER_DTYPE.itemsize:
+            return False
+        h = data[:HEADER_DTYPE.itemsize].view(HEADER_DTYPE)[0]
+        if h["magic"] != MAGIC or h["version"] != VERSION or h["header_bytes"] != HEADER_DTYPE.itemsize \
+                or h["entry_bytes"] != ENTRY_DTYPE.itemsize or h["file_bytes"] != st.st_size \
+                or h["file_mtime_ns"] != st.st_mtime_ns or h["track_name"].decode() != self.track_name:
+            return False
+        end = HEADER_DTYPE.itemsize + ENTRY_DTYPE.itemsize * int(h["entry_count"])
+        if end > data.size:
+            return False
+        self.entries = data[HEADER_DTYPE.itemsize:end].view(ENTRY_DTYPE)
+        if len(self.entries) and int((self.entries["offset"] + self.entries["size"]).max()) > st.st_size:
+            return False
+        self.track, self.start_offset_ns = int(h["track"]), int(h["start_offset_ns"])
+        return True
+
+    def _write_index(self, index_path, st):
+        h = np.zeros(1, dtype=HEADER_DTYPE)
+        h[0] = (MAGIC, VERSION, HEADER_DTYPE.itemsize, ENTRY_DTYPE.itemsize, self.track, len(self.entries),
+                st.st_size, st.st_mtime_ns, self.start_offset_ns, self.track_name.encode(), 0)
+        tmp = index_path + ".tmp"
+        try:
+            with open(tmp, "wb") as f:
+                f.write(h.tobytes())
+                f.write(self.entries.tobytes())
+            os.replace(tmp, index_path)
+        except OSError:
+            pass  # a read-only directory: walk again next time
+
+    def __len__(self):
+        return len(self.entries)
+
+    def __getitem__(self, i):
+        """Read-only memoryview of frame i's payload."""
+        e = self.entries[i]
+        start = int(e["offset"])
+        return self._view[start:start + int(e["size"])].toreadonly()
+
+    def find(self, device_timestamp_usec):
+        """First frame at or after the timestamp; len(self) if none."""
+        return int(np.searchsorted(self.timestamps, device_timestamp_usec))
+
+    def prefetch(self, first, count):
+        """Starts reading frames [first, first + count) (MADV_WILLNEED)."""
+        if first >= len(self) or count <= 0 or not hasattr(self._map, "madvise"):
+            return
+        last = self.entries[min(first + count, len(self)) - 1]
+        start = int(self.entries[first]["offset"]) // mmap.PAGESIZE * mmap.PAGESIZE
+        self._map.madvise(mmap.MADV_WILLNEED, start, int(last["offset"]) + int(last["size"]) - start)
+
+
+if __name__ == "__main__":
+    rec = MkvFrames(sys.argv[1])
+    ts = rec.timestamps
+    print(f"{len(rec)} {rec.track_name} frame(s) on track {rec.track}, "
+          f"{int(rec.entries['size'].sum()) / 1e6:.1f} MB, device {ts[0] if len(ts) else 0}..{ts[-1] if len(ts) else 0} us")
@@ -0,0 +1,156 @@
+"""
+Reader for rig files written by htkrecorder --rig-file (see
+tools/capture/rig_container.h): every camera's frames of a take in one file,
+grouped into frame sets in timestamp order.
+
+    from tools.mkv.rig_file import RigFile, COLOR
+    rig = RigFile("/data/take_001/rig.htkrig")
+    for frames in rig:                              # one frame set at a time, front to back
+        views = {rig.serials[f.camera]: f.data for f in frames if f.image == COLOR}
+        img = cv2.imdecode(np.frombuffer(views["000123412312"], np.uint8), cv2.IMREAD_COLOR)
+
+The file is mapped, and frame data are read-only memoryviews into the
+mapping. A file without its index (the recorder was killed) is read by
+walking the set headers, up to the first incomplete set.
+"""
+import mmap
+import sys
+from collections import namedtuple
+
+import numpy as np
+
+MAGIC = b"HTKRIGFS"
+INDEX_MAGIC = b"HTKRIGIX"
+VERSION = 1
+SET_MARKER = 0x54455352
+
+HEADER_DTYPE = np.dtype([
+    ("magic", "S8"), ("version", "<u4"), ("header_bytes", "<u4"),
+    ("camera_bytes", "<u4"), ("set_bytes", "<u4"), ("frame_bytes", "<u4"),
+    ("entry_bytes", "<u4"), ("camera_count", "<u4"), ("master_camera", "<i4"),
+    ("period_usec", "<u4"), ("reserved", "<u4", 5),
+])
+CAMERA_DTYPE = np.dtype([
+    ("serial", "S32"), ("device_index", "<i4"), ("color_format", "<u4"),
+    ("color_width", "<u4"), ("color_height", "<u4"), ("color_x", "<i4"), ("color_y", "<i4"),
+    ("reserved", "<u8"),
+])
+SET_DTYPE = np.dtype([
+    ("marker", "<u4"), ("frame_count", "<u2"), ("reserved0", "<u2"),
+    ("set", "<u8"), ("timestamp_ns", "<i8"), ("bytes", "<u4"),
+    ("camera_mask", "<u4"),
+])
+FRAME_DTYPE = np.dtype([
+    ("camera", "<u2"), ("image", "u1"), ("reserved0", "u1"), ("format", "<u4"),
+    ("width", "<u4"), ("height", "<u4"), ("stride", "<u4"),
+    ("device_timestamp_usec", "<u8"), ("system_timestamp_ns", "<u8"),
+    ("flags", "<u4"), ("size", "<u4"), ("reserved", "<u4"),
+])
+ENTRY_DTYPE = np.dtype([
+    ("timestamp_ns", "<i8"), ("offset", "<u8"), ("bytes", "<u4"), ("camera_mask", "<u4"),
+])
+FOOTER_DTYPE = np.dtype([
+    ("magic", "S8"), ("index_offset", "<u8"), ("set_count", "<u8"), ("frame_count", "<u8"),
+])
+assert HEADER_DTYPE.itemsize == 64 and CAMERA_DTYPE.itemsize == 64 and SET_DTYPE.itemsize == 32
+assert FRAME_DTYPE.itemsize == 48 and ENTRY_DTYPE.itemsize == 24 and FOOTER_DTYPE.itemsize == 32
+
+COLOR, DEPTH, IR = 0, 1, 2  # RigImageKind
+
+Frame = namedtuple("Frame", "camera image format width height stride device_timestamp_usec "
+                            "system_timestamp_ns flags data")
+
+
+class RigFile:
+    def __init__(self, path):
+        self.path = str(path)
+        with open(self.path, "rb") as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self._buf = np.frombuffer(self._map, dtype=np.uint8)
+        self._view = memoryview(self._map)
+        if len(self._buf) < HEADER_DTYPE.itemsize:
+            raise ValueError(f"{self.path}: too short for a rig file")
+        self.header = self._buf[:HEADER_DTYPE.itemsize].view(HEADER_DTYPE)[0]
+        h = self.header
+        if h["magic"] != MAGIC:
+            raise ValueError(f"{self.path}: not a rig file")
+        if h["version"] > VERSION or h["camera_bytes"] != CAMERA_DTYPE.itemsize \
+                or h["set_bytes"] != SET_DTYPE.itemsize or h["frame_bytes"] != FRAME_DTYPE.itemsize \
+                or h["entry_bytes"] != ENTRY_DTYPE.itemsize:
+            raise ValueError(f"{self.path}: rig file version {h['version']} is not supported")
+        c0 = HEADER_DTYPE.itemsize
+        self._sets_start = c0 + CAMERA_DTYPE.itemsize * int(h["camera_count"])
+        self.cameras = self._buf[c0:self._sets_start].view(CAMERA_DTYPE)
+        self.serials = [c["serial"].decode() for c in self.cameras]
+        self.period_usec = int(h["period_usec"])
+        self.sets = self._load_index()
+        self.recovered = self.sets is None
+        if self.recovered:
+            self.sets = self._walk()
+        self.timestamps = self.sets["timestamp_ns"]
+
+    def _load_index(self):
+        size = len(self._buf)
+        if size < self._sets_start + FOOTER_DTYPE.itemsize:
+            return None
+        footer = self._buf[size - FOOTER_DTYPE.itemsize:].view(FOOTER_DTYPE)[0]
+        start, count = int(footer["index_offset"]), int(footer["set_count"])
+        if footer["magic"] != INDEX_MAGIC or start + count * ENTRY_DTYPE.itemsize + FOOTER_DTYPE.itemsize != size:
+            return None
+        return self._buf[start:start + count * ENTRY_DTYPE.itemsize].view(ENTRY_DTYPE)
+
+    def _walk(self):
+        entries, pos, size = [], self._sets_start, len(self._buf)
+        while pos + SET_DTYPE.itemsize <= size:
+            s = self._buf[pos:pos + SET_DTYPE.itemsize].view(SET_DTYPE)[0]
+            end = pos + int(s["bytes"])
+            if s["marker"] != SET_MARKER or s["set"] != len(entries) or end > size or end < pos + SET_DTYPE.itemsize:
+                break
+            inner = pos + SET_DTYPE.itemsize
+            for _ in range(int(s["frame_count"])):
+                if inner + FRAME_DTYPE.itemsize > end:
+                    break
+                f = self._buf[inner:inner + FRAME_DTYPE.itemsize].view(FRAME_DTYPE)[0]
+                inner += FRAME_DTYPE.itemsize + int(f["size"])
+            if inner != end:
+                break
+            entries.append((s["timestamp_ns"], pos, s["bytes"], s["camera_mask"]))
+            pos = end
+        return np.array(entries, dtype=ENTRY_DTYPE)
+
+    def __len__(self):
+        return len(self.sets)
+
+    def __getitem__(self, i):
+        """The frames of set i, each with its payload as a read-only memoryview."""
+        e = self.sets[i]
+        pos = int(e["offset"])
+        s = self._buf[pos:pos + SET_DTYPE.itemsize].view(SET_DTYPE)[0]
+        pos += SET_DTYPE.itemsize
+        frames = []
+        for _ in range(int(s["frame_count"])):
+            f = self._buf[pos:pos + FRAME_DTYPE.itemsize].view(FRAME_DTYPE)[0]
+            pos += FRAME_DTYPE.itemsize
+            size = int(f["size"])
+            frames.append(Frame(int(f["camera"]), int(f["image"]), int(f["format"]), int(f["width"]),
+                                int(f["height"]), int(f["stride"]), int(f["device_timestamp_usec"]),
+                                int(f["system_timestamp_ns"]), int(f["flags"]),
+                                self._view[pos:pos + size].toreadonly()))
+            pos += size
+        return frames
+
+    def __iter__(self):
+        for i in range(len(self)):
+            yield self[i]
+
+    def find(self, timestamp_ns):
+        """First set at or after the host timestamp; len(self) if none."""
+        return int(np.searchsorted(self.timestamps, timestamp_ns))
+
+
+if __name__ == "__main__":
+    rig = RigFile(sys.argv[1])
+    full = int(np.count_nonzero(rig.sets["camera_mask"] == (1 << len(rig.serials)) - 1))
+    span = (int(rig.timestamps[-1]) - int(rig.timestamps[0])) / 1e9 if len(rig) else 0.0
+    print(f"{len(rig)} frame set(s) over {span:.1f} s from {len(rig.serials)} camera(s), {full} complete"
+          + (", index rebuilt (unfinished file)" if rig.recovered else ""))